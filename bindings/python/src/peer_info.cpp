@@ -124,6 +124,7 @@ void bind_peer_info()
 #ifndef TORRENT_DISABLE_ENCRYPTION
     pi.attr("rc4_encrypted") = peer_info::rc4_encrypted;
     pi.attr("plaintext_encrypted") = peer_info::plaintext_encrypted;
+    pi.attr("chacha20_encrypted") = peer_info::chacha20_encrypted;
 #endif
 
     // connection_type
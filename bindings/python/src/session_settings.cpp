@@ -58,6 +58,7 @@ void bind_session_settings()
         .value("pe_rc4", settings_pack::pe_rc4)
         .value("pe_plaintext", settings_pack::pe_plaintext)
         .value("pe_both", settings_pack::pe_both)
+        .value("pe_chacha20", settings_pack::pe_chacha20)
 #ifndef TORRENT_NO_DEPRECATE
         .value("rc4", settings_pack::pe_rc4)
         .value("plaintext", settings_pack::pe_plaintext)
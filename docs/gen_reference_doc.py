@@ -71,6 +71,7 @@ category_mapping = {
 	'ed25519.hpp': 'ed25519',
 	'session.hpp': 'Core',
 	'add_torrent_params.hpp': 'Core',
+	'file_snapshot.hpp': 'Core',
 	'session_status.hpp': 'Core',
 	'error_code.hpp': 'Error Codes',
 	'storage.hpp': 'Custom Storage',
@@ -367,7 +367,7 @@ int print_peer_info(std::string& out
 			, color("S", (i->flags & peer_info::snubbed)?col_white:col_blue).c_str()
 			, color("U", (i->flags & peer_info::upload_only)?col_white:col_blue).c_str()
 			, color("e", (i->flags & peer_info::endgame_mode)?col_white:col_blue).c_str()
-			, color("E", (i->flags & peer_info::rc4_encrypted)?col_white:(i->flags & peer_info::plaintext_encrypted)?col_cyan:col_blue).c_str()
+			, color("E", (i->flags & (peer_info::rc4_encrypted | peer_info::chacha20_encrypted))?col_white:(i->flags & peer_info::plaintext_encrypted)?col_cyan:col_blue).c_str()
 			, color("h", (i->flags & peer_info::holepunched)?col_white:col_blue).c_str()
 
 			, color("d", (i->read_state & peer_info::bw_disk)?col_white:col_blue).c_str()
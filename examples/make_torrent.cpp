@@ -42,6 +42,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <cstdio>
 #include <sstream>
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 
 #ifdef TORRENT_WINDOWS
 #include <direct.h> // for _getcwd
@@ -112,9 +115,28 @@ bool file_filter(std::string const& f)
 	return true;
 }
 
-void print_progress(piece_index_t i, int num)
+namespace {
+
+// set by the SIGINT handler, to cancel hashing
+std::atomic<bool> quit(false);
+
+void sighandler(int) { quit = true; }
+
+}
+
+bool print_progress(piece_index_t const i, int const num, std::int64_t const piece_size
+	, std::chrono::steady_clock::time_point const start)
 {
-	std::fprintf(stderr, "\r%d/%d", static_cast<int>(i)+1, num);
+	// don't print every piece, large torrents have a lot of them
+	int const p = static_cast<int>(i) + 1;
+	if ((p & 0x3f) == 0 || p == num)
+	{
+		double const seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		std::fprintf(stderr, "\r%d/%d (%.1f MB/s)", p, num
+			, seconds > 0 ? double(p) * double(piece_size) / seconds / 1000000.0 : 0.0);
+	}
+	return !quit;
 }
 
 void print_usage()
@@ -139,6 +161,8 @@ void print_usage()
 		"              than bytes will be piece-aligned\n"
 		"-s bytes      specifies a piece size for the torrent\n"
 		"              This has to be a multiple of 16 kiB\n"
+		"-T threads    the number of threads to hash pieces with. Defaults\n"
+		"              to one per hardware thread\n"
 		"-l            Don't follow symlinks, instead encode them as\n"
 		"              links in the torrent file\n"
 		"-o file       specifies the output filename of the torrent file\n"
@@ -182,6 +206,7 @@ int main(int argc, char* argv[])
 		std::vector<sha1_hash> similar;
 		int pad_file_limit = -1;
 		int piece_size = 0;
+		int num_threads = 0;
 		create_flags_t flags = {};
 		std::string root_cert;
 
@@ -224,6 +249,10 @@ int main(int argc, char* argv[])
 					++i;
 					piece_size = atoi(argv[i]);
 					break;
+				case 'T':
+					++i;
+					num_threads = atoi(argv[i]);
+					break;
 				case 'm':
 					++i;
 					merklefile = argv[i];
@@ -329,9 +358,13 @@ int main(int argc, char* argv[])
 			, end(similar.end()); i != end; ++i)
 			t.add_similar_torrent(*i);
 
+		// Ctrl-C cancels hashing
+		std::signal(SIGINT, &sighandler);
+
 		error_code ec;
-		set_piece_hashes(t, branch_path(full_path)
-			, std::bind(&print_progress, _1, t.num_pieces()), ec);
+		set_piece_hashes(t, branch_path(full_path), num_threads
+			, std::bind(&print_progress, _1, t.num_pieces(), t.piece_length()
+				, std::chrono::steady_clock::now()), ec);
 		if (ec)
 		{
 			std::fprintf(stderr, "%s\n", ec.message().c_str());
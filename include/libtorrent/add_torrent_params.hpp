@@ -48,6 +48,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/units.hpp"
 #include "libtorrent/torrent_flags.hpp"
 #include "libtorrent/download_priority.hpp"
+#include "libtorrent/file_snapshot.hpp"
 #include "libtorrent/aux_/noexcept_movable.hpp"
 
 namespace libtorrent {
@@ -332,6 +333,19 @@ namespace libtorrent {
 		// applied before the torrent is added.
 		aux::noexcept_movable<std::map<file_index_t, std::string>> renamed_files;
 
+		// one entry per file, recording the state of the files when the resume
+		// data was saved. This is only saved when
+		// settings_pack::resume_file_snapshots is enabled, and only for files
+		// whose pieces have all been downloaded and written. When adding a
+		// torrent with this set (and that setting enabled), the files are not
+		// stat()ed up-front. Instead, each file is compared against its entry
+		// the first time it's opened. If it has changed, the operation fails
+		// with mismatching_file_size or mismatching_file_timestamp (posting a
+		// file_error_alert) and the pieces overlapping the file are checked
+		// again. Entries with a size of -1 are checked up-front, like when
+		// there is no snapshot.
+		aux::noexcept_movable<std::vector<file_snapshot>> file_snapshots;
+
 #ifndef TORRENT_NO_DEPRECATE
 		// deprecated in 1.2
 
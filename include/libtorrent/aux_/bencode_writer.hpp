@@ -0,0 +1,278 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_BENCODE_WRITER_HPP_INCLUDED
+#define TORRENT_BENCODE_WRITER_HPP_INCLUDED
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#include "libtorrent/assert.hpp"
+#include "libtorrent/string_view.hpp"
+#include "libtorrent/span.hpp"
+#include "libtorrent/entry.hpp" // for integer_to_str
+#include "libtorrent/bencode.hpp"
+
+#if TORRENT_USE_ASSERTS
+#include <string>
+#endif
+
+namespace libtorrent { namespace aux {
+
+	// compile-time bytewise comparison of two dictionary keys. Returns true
+	// if ``a`` sorts strictly before ``b``, which is the order bencoded
+	// dictionaries require
+	constexpr bool key_less(char const* a, char const* b)
+	{
+		return *b == '\0' ? false
+			: *a == '\0' ? true
+			: *a != *b ? static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b)
+			: key_less(a + 1, b + 1);
+	}
+
+	constexpr bool keys_sorted(char const*) { return true; }
+
+	// returns true if the keys are listed in strictly increasing order. This
+	// is meant for static_asserts next to code that writes a fixed set of
+	// keys with bencode_writer, e.g.:
+	//
+	//	static_assert(aux::keys_sorted("a", "b", "c"), "dictionary keys out of order");
+	template <typename... Keys>
+	constexpr bool keys_sorted(char const* a, char const* b, Keys... rest)
+	{
+		return key_less(a, b) && keys_sorted(b, rest...);
+	}
+
+	// a fixed capacity buffer, for bencoding small messages on the stack. It
+	// provides the subset of std::vector<char>'s interface that
+	// basic_bencode_writer uses. Writing past its capacity is a programming
+	// error
+	template <std::size_t Capacity>
+	struct fixed_buffer
+	{
+		using value_type = char;
+
+		char* data() { return m_buf; }
+		char const* data() const { return m_buf; }
+		std::size_t size() const { return m_size; }
+		char* end() { return m_buf + m_size; }
+
+		void push_back(char const c)
+		{
+			TORRENT_ASSERT(m_size < Capacity);
+			m_buf[m_size++] = c;
+		}
+
+		void insert(char* pos, char const* first, char const* last)
+		{
+			TORRENT_ASSERT(pos == end());
+			TORRENT_UNUSED(pos);
+			std::size_t const len = std::size_t(last - first);
+			TORRENT_ASSERT(m_size + len <= Capacity);
+			std::memcpy(m_buf + m_size, first, len);
+			m_size += len;
+		}
+
+		void resize(std::size_t const size)
+		{
+			TORRENT_ASSERT(size <= Capacity);
+			m_size = size;
+		}
+
+	private:
+		char m_buf[Capacity];
+		std::size_t m_size = 0;
+	};
+
+	// writes bencoded data directly into a caller supplied buffer, without
+	// building an entry tree first. Structures are opened and closed
+	// explicitly, and dictionary keys must be written in sorted order (this
+	// is asserted in debug builds). The buffer is appended to, so reusing the
+	// same buffer across messages avoids touching the heap once it has grown
+	// large enough.
+	template <typename Buffer>
+	struct basic_bencode_writer
+	{
+		explicit basic_bencode_writer(Buffer& buf) : m_buf(buf) {}
+		basic_bencode_writer(basic_bencode_writer const&) = delete;
+		basic_bencode_writer& operator=(basic_bencode_writer const&) = delete;
+
+		void open_dict()
+		{
+			m_buf.push_back('d');
+#if TORRENT_USE_ASSERTS
+			m_keys.push_back({true, false, std::string()});
+#endif
+		}
+
+		void open_list()
+		{
+			m_buf.push_back('l');
+#if TORRENT_USE_ASSERTS
+			m_keys.push_back({false, false, std::string()});
+#endif
+		}
+
+		// closes the innermost dictionary or list
+		void close()
+		{
+#if TORRENT_USE_ASSERTS
+			TORRENT_ASSERT(!m_keys.empty());
+			TORRENT_ASSERT(!m_keys.back().is_dict || !m_keys.back().expect_value);
+			m_keys.pop_back();
+			value_written();
+#endif
+			m_buf.push_back('e');
+		}
+
+		// writes a dictionary key. It must be followed by exactly one value
+		void key(string_view k)
+		{
+#if TORRENT_USE_ASSERTS
+			TORRENT_ASSERT(!m_keys.empty() && m_keys.back().is_dict);
+			TORRENT_ASSERT(!m_keys.back().expect_value);
+			TORRENT_ASSERT(m_keys.back().last_key.empty() || m_keys.back().last_key < k);
+			m_keys.back().last_key.assign(k.data(), k.size());
+			m_keys.back().expect_value = true;
+#endif
+			write_string_header(k.size());
+			append(k.data(), k.size());
+		}
+
+		void string(string_view s)
+		{
+			write_string_header(s.size());
+			append(s.data(), s.size());
+#if TORRENT_USE_ASSERTS
+			value_written();
+#endif
+		}
+
+		void integer(std::int64_t const val)
+		{
+			char buf[21];
+			char const* str = detail::integer_to_str(buf, 21, val);
+			m_buf.push_back('i');
+			append(str, std::strlen(str));
+			m_buf.push_back('e');
+#if TORRENT_USE_ASSERTS
+			value_written();
+#endif
+		}
+
+		// writes the header of a string of ``len`` bytes and returns a pointer
+		// to where the string's bytes go. The caller is expected to fill in all
+		// of them before writing anything else, since the pointer is
+		// invalidated by subsequent writes. This is useful to write compact
+		// structures (like node and peer lists) in-place.
+		char* string_buffer(std::size_t const len)
+		{
+			write_string_header(len);
+			std::size_t const offset = m_buf.size();
+			m_buf.resize(offset + len);
+#if TORRENT_USE_ASSERTS
+			value_written();
+#endif
+			return m_buf.data() + offset;
+		}
+
+		// appends the bencoding of an entry. This is meant for the (rare)
+		// parts of a message that are produced as an entry by some other
+		// interface
+		void value(entry const& e)
+		{
+			bencode(std::back_inserter(m_buf), e);
+#if TORRENT_USE_ASSERTS
+			value_written();
+#endif
+		}
+
+		// appends an already bencoded value
+		void raw(span<char const> v)
+		{
+			append(v.data(), std::size_t(v.size()));
+#if TORRENT_USE_ASSERTS
+			value_written();
+#endif
+		}
+
+		Buffer& buffer() { return m_buf; }
+
+#if TORRENT_USE_ASSERTS
+		// returns true if all dictionaries and lists have been closed
+		bool done() const { return m_keys.empty(); }
+#endif
+
+	private:
+
+		void write_string_header(std::size_t const len)
+		{
+			char buf[21];
+			char const* str = detail::integer_to_str(buf, 21, std::int64_t(len));
+			append(str, std::strlen(str));
+			m_buf.push_back(':');
+		}
+
+		void append(char const* p, std::size_t const len)
+		{
+			m_buf.insert(m_buf.end(), p, p + len);
+		}
+
+#if TORRENT_USE_ASSERTS
+		void value_written()
+		{
+			if (!m_keys.empty() && m_keys.back().is_dict)
+			{
+				TORRENT_ASSERT(m_keys.back().expect_value);
+				m_keys.back().expect_value = false;
+			}
+		}
+
+		struct level
+		{
+			bool is_dict;
+			// true if we've written a key and are expecting its value
+			bool expect_value;
+			std::string last_key;
+		};
+		std::vector<level> m_keys;
+#endif
+
+		Buffer& m_buf;
+	};
+
+	using bencode_writer = basic_bencode_writer<std::vector<char>>;
+}}
+
+#endif
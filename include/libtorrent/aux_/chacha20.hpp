@@ -0,0 +1,88 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_CHACHA20_HPP_INCLUDED
+#define TORRENT_CHACHA20_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/span.hpp"
+
+#include <cstdint>
+#include <array>
+
+namespace libtorrent { namespace aux {
+
+	// the ChaCha20 stream cipher, with a 64 bit nonce and a 64 bit block
+	// counter (the original variant, rather than the one in RFC 7539, to not
+	// limit the length of the stream). The key stream is generated four
+	// blocks at a time, using SSE2 where available.
+	struct TORRENT_EXTRA_EXPORT chacha20
+	{
+		static constexpr int key_size = 32;
+		static constexpr int nonce_size = 8;
+
+		chacha20();
+
+		// ``key`` must be 32 bytes and ``nonce`` 8 bytes. This restarts the key
+		// stream at block ``counter``
+		void set_key(span<char const> key, span<char const> nonce
+			, std::uint64_t counter = 0);
+
+		// XORs the key stream onto ``buf``, continuing where the previous call
+		// left off
+		void crypt(span<char> buf);
+
+		static constexpr int block_size = 64;
+		static constexpr int batch_size = 4 * block_size;
+
+	private:
+
+		// fills in m_stream with the next batch_size bytes of key stream
+		void next_batch();
+
+		std::array<std::uint32_t, 16> m_state;
+		alignas(16) std::array<std::uint8_t, batch_size> m_stream;
+
+		// the offset into m_stream of the first unused byte
+		int m_pos;
+	};
+
+	// generates ``batch_size`` bytes of key stream for the block counter in
+	// ``state`` and advances the counter. These are exposed to allow the
+	// implementations to be tested against each other
+	TORRENT_EXTRA_EXPORT void chacha20_blocks_sw(std::array<std::uint32_t, 16>& state
+		, std::uint8_t* out);
+	TORRENT_EXTRA_EXPORT bool chacha20_blocks_hw(std::array<std::uint32_t, 16>& state
+		, std::uint8_t* out);
+}}
+
+#endif
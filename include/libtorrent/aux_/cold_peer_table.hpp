@@ -0,0 +1,262 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_COLD_PEER_TABLE_HPP_INCLUDED
+#define TORRENT_COLD_PEER_TABLE_HPP_INCLUDED
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "libtorrent/assert.hpp"
+#include "libtorrent/address.hpp"
+
+namespace libtorrent { namespace aux {
+
+	// the state of a torrent_peer, minus the parts that only matter while
+	// we're connected to it or about to connect to it. The peer_list keeps
+	// peers that are neither connected nor connect candidates (peers that
+	// have failed too many times, seeds once we're a seed ourself, banned
+	// peers and incoming peers we don't know the listen port of) in this
+	// form. In large peer lists, that's typically most of them.
+	template <typename Addr>
+	struct cold_peer
+	{
+		Addr addr;
+		std::uint16_t port;
+		std::uint16_t last_connected;
+		std::uint16_t last_optimistically_unchoked;
+		std::uint8_t hashfails;
+
+		// these have the same meaning as the fields with the same names in
+		// torrent_peer
+		std::uint32_t failcount:5;
+		bool connectable:1;
+		bool seed:1;
+		bool banned:1;
+		bool pe_support:1;
+		bool on_parole:1;
+		bool supports_utp:1;
+		bool confirmed_supports_utp:1;
+		bool supports_holepunch:1;
+		std::uint32_t fast_reconnects:4;
+		signed trust_points:4;
+		std::uint32_t source:6;
+
+		// set on slots in the cold_peer_table that hold a peer
+		bool used:1;
+	};
+
+	using cold_peer4 = cold_peer<std::uint32_t>;
+#if TORRENT_USE_IPV6
+	using cold_peer6 = cold_peer<address_v6::bytes_type>;
+#endif
+
+	inline std::uint32_t cold_peer_hash(std::uint32_t h)
+	{
+		// the murmur3 finalizer. IPv4 addresses in a peer list tend to share
+		// prefixes, so all bits need to affect the bucket
+		h ^= h >> 16;
+		h *= 0x85ebca6bU;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35U;
+		h ^= h >> 16;
+		return h;
+	}
+
+#if TORRENT_USE_IPV6
+	inline std::uint32_t cold_peer_hash(address_v6::bytes_type const& a)
+	{
+		std::uint64_t w[2];
+		std::memcpy(w, a.data(), sizeof(w));
+		std::uint64_t const h = (w[0] ^ (w[1] * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+		return cold_peer_hash(std::uint32_t(h >> 32) ^ std::uint32_t(h));
+	}
+#endif
+
+	// an open addressing hash table (with linear probing) of cold_peer
+	// records, keyed by address. Peers with the same address but different
+	// ports all end up in the same probe sequence. Inserting or erasing
+	// peers invalidates pointers to all other peers in the table. The number
+	// of slots is a power of two, and kept between 4/3 and 4 times the
+	// number of peers (except for tiny tables).
+	template <typename Addr>
+	struct cold_peer_table
+	{
+		using value_type = cold_peer<Addr>;
+
+		int size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+
+		// the number of bytes of heap memory used by the table
+		std::size_t memory_usage() const
+		{ return m_slots.capacity() * sizeof(value_type); }
+
+		// returns the first peer with address ``a`` (and ``port``, unless it's
+		// -1), or nullptr if there is none
+		value_type* find(Addr const& a, int const port = -1)
+		{
+			if (m_slots.empty()) return nullptr;
+			std::size_t const mask = m_slots.size() - 1;
+			for (std::size_t i = cold_peer_hash(a) & mask;; i = (i + 1) & mask)
+			{
+				value_type& s = m_slots[i];
+				if (!s.used) return nullptr;
+				if (s.addr == a && (port == -1 || s.port == port)) return &s;
+			}
+		}
+
+		// adds a peer with address ``a`` and every other field zeroed, and
+		// returns it
+		value_type& insert(Addr const& a)
+		{
+			if ((std::size_t(m_size) + 1) * 4 > m_slots.size() * 3)
+				rehash(m_slots.empty() ? min_slots : m_slots.size() * 2);
+
+			value_type& s = m_slots[free_slot(a)];
+			std::memset(&s, 0, sizeof(s));
+			s.addr = a;
+			s.used = true;
+			++m_size;
+			return s;
+		}
+
+		void erase(value_type* p)
+		{
+			TORRENT_ASSERT(p >= m_slots.data() && p < m_slots.data() + m_slots.size());
+			TORRENT_ASSERT(p->used);
+			erase_slot(std::size_t(p - m_slots.data()));
+			maybe_shrink();
+		}
+
+		// calls ``f`` with every peer in the table, erasing the ones it
+		// returns true for. ``f`` may see a peer more than once
+		template <typename Fun>
+		void erase_if(Fun f)
+		{
+			for (std::size_t i = 0; i < m_slots.size();)
+			{
+				// erasing slot i moves a later peer into it, so it needs to be
+				// looked at again
+				if (m_slots[i].used && f(m_slots[i])) erase_slot(i);
+				else ++i;
+			}
+			maybe_shrink();
+		}
+
+		template <typename Fun>
+		void for_each(Fun f)
+		{
+			for (auto& s : m_slots) if (s.used) f(s);
+		}
+
+		template <typename Fun>
+		void for_each(Fun f) const
+		{
+			for (auto const& s : m_slots) if (s.used) f(s);
+		}
+
+		// the raw slots, including unused ones. This is meant for sampling
+		// peers at random
+		std::vector<value_type>& slots() { return m_slots; }
+
+		void clear()
+		{
+			m_slots.clear();
+			m_slots.shrink_to_fit();
+			m_size = 0;
+		}
+
+	private:
+
+		static constexpr std::size_t min_slots = 16;
+
+		std::size_t free_slot(Addr const& a) const
+		{
+			std::size_t const mask = m_slots.size() - 1;
+			std::size_t i = cold_peer_hash(a) & mask;
+			while (m_slots[i].used) i = (i + 1) & mask;
+			return i;
+		}
+
+		// backward shift deletion. This keeps every peer reachable from its
+		// home slot without leaving tombstones behind
+		void erase_slot(std::size_t hole)
+		{
+			std::size_t const mask = m_slots.size() - 1;
+			m_slots[hole].used = false;
+			--m_size;
+			for (std::size_t i = (hole + 1) & mask; m_slots[i].used; i = (i + 1) & mask)
+			{
+				std::size_t const home = cold_peer_hash(m_slots[i].addr) & mask;
+				// the peer in slot i can be moved into the hole, unless its
+				// home slot lies cyclically in (hole, i]
+				bool const stays = hole <= i
+					? (home > hole && home <= i)
+					: (home > hole || home <= i);
+				if (stays) continue;
+				m_slots[hole] = m_slots[i];
+				m_slots[i].used = false;
+				hole = i;
+			}
+		}
+
+		void maybe_shrink()
+		{
+			if (m_slots.size() > min_slots && std::size_t(m_size) * 4 < m_slots.size())
+				rehash(m_slots.size() / 2);
+		}
+
+		void rehash(std::size_t const num_slots)
+		{
+			TORRENT_ASSERT((num_slots & (num_slots - 1)) == 0);
+			TORRENT_ASSERT(std::size_t(m_size) < num_slots);
+			// value initialization zeroes the slots, marking them unused
+			std::vector<value_type> old(num_slots);
+			old.swap(m_slots);
+			for (auto const& s : old)
+			{
+				if (!s.used) continue;
+				m_slots[free_slot(s.addr)] = s;
+			}
+		}
+
+		std::vector<value_type> m_slots;
+		int m_size = 0;
+	};
+
+	template <typename Addr>
+	constexpr std::size_t cold_peer_table<Addr>::min_slots;
+}}
+
+#endif
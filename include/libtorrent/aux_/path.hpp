@@ -92,6 +92,9 @@ namespace libtorrent {
 		std::uint64_t atime = 0;
 		std::uint64_t mtime = 0;
 		std::uint64_t ctime = 0;
+		// identifies the file within its filesystem. On windows this is the
+		// file index
+		std::uint64_t inode = 0;
 		enum {
 #if defined TORRENT_WINDOWS
 			fifo = 0x1000, // named pipe (fifo)
@@ -0,0 +1,147 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_RESUME_DATA_BINARY_HPP_INCLUDED
+#define TORRENT_RESUME_DATA_BINARY_HPP_INCLUDED
+
+#include <vector>
+#include <cstdint>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/span.hpp"
+#include "libtorrent/error_code.hpp"
+
+namespace libtorrent {
+
+	struct add_torrent_params;
+
+namespace aux {
+
+	// The binary resume data format is a sequence of records. The first one
+	// is a checkpoint, holding the full state of the torrent. Any number of
+	// delta records may follow it, each one only carrying the fields that
+	// changed compared to the state described by the records before it.
+	//
+	// every record starts with a 14 byte header:
+	//
+	//	magic    4 bytes  "LTRB"
+	//	version  1 byte   binary_resume_version
+	//	kind     1 byte   record_kind
+	//	length   4 bytes  big endian size of the payload
+	//	crc      4 bytes  big endian crc32c of the payload
+	//
+	// The payload is a sequence of fields, each encoded as a varint tag, a
+	// varint length and the field's bytes. Fields with unknown tags are
+	// skipped. Integers inside fields are LEB128 varints, signed ones are
+	// zig-zag encoded first.
+
+	constexpr std::uint8_t binary_resume_version = 1;
+	constexpr int binary_resume_header_size = 14;
+
+	enum class record_kind : std::uint8_t
+	{
+		checkpoint = 0,
+		delta = 1
+	};
+
+	enum class resume_field : std::uint8_t
+	{
+		info_hash = 1,
+		name,
+		save_path,
+		storage_mode,
+		flags,
+		info,
+		merkle_tree,
+
+		total_uploaded,
+		total_downloaded,
+		active_time,
+		finished_time,
+		seeding_time,
+		last_seen_complete,
+		added_time,
+		completed_time,
+		num_complete,
+		num_incomplete,
+		num_downloaded,
+		upload_limit,
+		download_limit,
+		max_connections,
+		max_uploads,
+
+		// bitfields, replacing the current ones
+		have_pieces,
+		verified_pieces,
+		// a list of (piece, have | verified << 1) pairs, updating the current
+		// bitfields
+		piece_changes,
+		unfinished_pieces,
+
+		trackers,
+		url_seeds,
+		http_seeds,
+		peers,
+		banned_peers,
+		renamed_files,
+
+		// one byte per file/piece, replacing the current priorities
+		file_priorities,
+		piece_priorities,
+		// a list of (index, priority) pairs, updating the current ones
+		file_priority_changes,
+		piece_priority_changes,
+
+		// (size, mtime, inode) per file
+		file_snapshots
+	};
+
+	// returns true if the buffer starts with a binary resume record
+	TORRENT_EXTRA_EXPORT bool is_binary_resume_data(span<char const> buf);
+
+	// writes a checkpoint record with the full state in ``atp``
+	TORRENT_EXTRA_EXPORT std::vector<char> write_binary_resume_data(
+		add_torrent_params const& atp);
+
+	// writes a delta record with the fields that differ between ``prev`` and
+	// ``atp``
+	TORRENT_EXTRA_EXPORT std::vector<char> write_binary_resume_delta(
+		add_torrent_params const& prev, add_torrent_params const& atp);
+
+	// parses a checkpoint record and applies any delta records following it.
+	// A truncated or corrupt record terminates the log, the state up to the
+	// last good record is returned
+	TORRENT_EXTRA_EXPORT add_torrent_params read_binary_resume_data(
+		span<char const> buf, error_code& ec);
+}}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_RING_BUFFER_HPP_INCLUDED
+#define TORRENT_RING_BUFFER_HPP_INCLUDED
+
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent { namespace aux {
+
+	// a FIFO queue backed by a power-of-two sized circular buffer. The
+	// storage is doubled when it fills up, but it never shrinks. This means
+	// that once a queue has reached its steady-state depth, pushing and
+	// popping elements doesn't touch the heap anymore. Popped slots are
+	// assigned a default constructed T, to release any resources they own.
+	template <typename T>
+	struct ring_buffer
+	{
+		ring_buffer() = default;
+		ring_buffer(ring_buffer&&) noexcept = default;
+		ring_buffer& operator=(ring_buffer&&) noexcept = default;
+		ring_buffer(ring_buffer const&) = delete;
+		ring_buffer& operator=(ring_buffer const&) = delete;
+
+		bool empty() const { return m_size == 0; }
+		int size() const { return int(m_size); }
+		int capacity() const { return int(m_capacity); }
+
+		T& front()
+		{
+			TORRENT_ASSERT(m_size > 0);
+			return m_storage[m_first];
+		}
+
+		T& operator[](int const idx)
+		{
+			TORRENT_ASSERT(idx >= 0);
+			TORRENT_ASSERT(std::uint32_t(idx) < m_size);
+			return m_storage[(m_first + std::uint32_t(idx)) & (m_capacity - 1)];
+		}
+
+		T const& operator[](int const idx) const
+		{
+			TORRENT_ASSERT(idx >= 0);
+			TORRENT_ASSERT(std::uint32_t(idx) < m_size);
+			return m_storage[(m_first + std::uint32_t(idx)) & (m_capacity - 1)];
+		}
+
+		void push_back(T v)
+		{
+			if (m_size == m_capacity) reserve(int(m_size) + 1);
+			m_storage[(m_first + m_size) & (m_capacity - 1)] = std::move(v);
+			++m_size;
+		}
+
+		// removes the first ``n`` elements
+		void pop_front(int n = 1)
+		{
+			TORRENT_ASSERT(n >= 0);
+			TORRENT_ASSERT(std::uint32_t(n) <= m_size);
+			for (; n > 0; --n)
+			{
+				m_storage[m_first] = T();
+				m_first = (m_first + 1) & (m_capacity - 1);
+				--m_size;
+			}
+		}
+
+		void clear() { pop_front(int(m_size)); }
+
+		// make sure there's room for at least ``n`` elements without
+		// re-allocating the storage
+		void reserve(int const n)
+		{
+			TORRENT_ASSERT(n >= 0);
+			if (std::uint32_t(n) <= m_capacity) return;
+			std::uint32_t new_capacity = m_capacity == 0 ? 16 : m_capacity;
+			while (new_capacity < std::uint32_t(n)) new_capacity <<= 1;
+
+			std::unique_ptr<T[]> new_storage(new T[new_capacity]);
+			for (std::uint32_t i = 0; i < m_size; ++i)
+				new_storage[i] = std::move(m_storage[(m_first + i) & (m_capacity - 1)]);
+
+			m_storage = std::move(new_storage);
+			m_capacity = new_capacity;
+			m_first = 0;
+		}
+
+	private:
+
+		std::unique_ptr<T[]> m_storage;
+
+		// the number of slots in m_storage. Always 0 or a power of 2
+		std::uint32_t m_capacity = 0;
+
+		// the slot of the first element in the queue
+		std::uint32_t m_first = 0;
+
+		// the number of elements in the queue
+		std::uint32_t m_size = 0;
+	};
+
+	// a FIFO queue of at most ``Size`` elements, stored inline. Unlike
+	// ring_buffer, this never allocates. push_back() returns false when the
+	// queue is full.
+	template <typename T, std::size_t Size>
+	struct static_ring
+	{
+		static_assert(Size > 0 && (Size & (Size - 1)) == 0
+			, "static_ring size must be a power of 2");
+
+		bool empty() const { return m_size == 0; }
+		bool full() const { return m_size == Size; }
+		int size() const { return int(m_size); }
+		static constexpr int capacity() { return int(Size); }
+
+		T& front()
+		{
+			TORRENT_ASSERT(m_size > 0);
+			return m_storage[m_first];
+		}
+
+		T& operator[](int const idx)
+		{
+			TORRENT_ASSERT(idx >= 0);
+			TORRENT_ASSERT(std::uint32_t(idx) < m_size);
+			return m_storage[(m_first + std::uint32_t(idx)) & (Size - 1)];
+		}
+
+		T const& operator[](int const idx) const
+		{
+			TORRENT_ASSERT(idx >= 0);
+			TORRENT_ASSERT(std::uint32_t(idx) < m_size);
+			return m_storage[(m_first + std::uint32_t(idx)) & (Size - 1)];
+		}
+
+		bool push_back(T const& v)
+		{
+			if (m_size == Size) return false;
+			m_storage[(m_first + m_size) & (Size - 1)] = v;
+			++m_size;
+			return true;
+		}
+
+		void pop_front(int n = 1)
+		{
+			TORRENT_ASSERT(n >= 0);
+			TORRENT_ASSERT(std::uint32_t(n) <= m_size);
+			m_first = (m_first + std::uint32_t(n)) & (Size - 1);
+			m_size -= std::uint32_t(n);
+		}
+
+		void clear()
+		{
+			m_first = 0;
+			m_size = 0;
+		}
+
+	private:
+
+		std::array<T, Size> m_storage;
+		std::uint32_t m_first = 0;
+		std::uint32_t m_size = 0;
+	};
+
+}}
+
+#endif
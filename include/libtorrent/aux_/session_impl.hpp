@@ -675,6 +675,7 @@ namespace aux {
 
 			bool on_dht_request(string_view query
 				, dht::msg const& request, entry& response) override;
+			bool has_dht_request_handlers() const override;
 
 			void set_external_address(address const& ip
 				, ip_source_t source_type, address const& source) override;
@@ -1280,6 +1281,12 @@ namespace aux {
 			// no longer needs to execute the auto-management.
 			bool m_need_auto_manage = false;
 
+			// set when ban_ip() has added rules to m_ip_filter since it was
+			// last compiled. Bans can be triggered by remote peers, so rather
+			// than recompiling the filter for each one, it's recompiled once a
+			// second. Until then, lookups use the (slower) uncompiled rules
+			bool m_ip_filter_dirty = false;
+
 			// set to true when the session object
 			// is being destructed and the thread
 			// should exit
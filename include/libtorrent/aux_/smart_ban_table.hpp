@@ -0,0 +1,135 @@
+/*
+
+Copyright (c) 2007-2016, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_SMART_BAN_TABLE_HPP_INCLUDED
+#define TORRENT_SMART_BAN_TABLE_HPP_INCLUDED
+
+#include <vector>
+#include <cstdint>
+
+#include "libtorrent/export.hpp"
+#include "libtorrent/units.hpp"
+#include "libtorrent/span.hpp"
+
+namespace libtorrent {
+
+struct torrent_peer;
+struct counters;
+
+namespace aux {
+
+	// the fingerprint of a block is the first 8 bytes of the SHA-1 digest of
+	// the block and a secret salt
+	using block_fingerprint = std::uint64_t;
+
+	// ties the fingerprint of a block to the peer that sent it. An entry
+	// whose peer is nullptr is empty
+	struct smart_ban_block
+	{
+		torrent_peer* peer;
+		block_fingerprint fingerprint;
+	};
+
+	// a block that was sent twice by the same peer, with different contents
+	struct smart_ban_mismatch
+	{
+		int block;
+		// the fingerprint of the block the first time it was sent
+		block_fingerprint recorded;
+	};
+
+	// the blocks of the pieces that failed the hash check, and the peers that
+	// sent them. This is the bookkeeping of the smart ban plugin, which reads
+	// the blocks back and bans the peers that sent bad data once the piece
+	// passes. The peers are never dereferenced. The memory used by the table
+	// is reported to the smart_ban_memory counter
+	struct TORRENT_EXTRA_EXPORT smart_ban_table
+	{
+		explicit smart_ban_table(counters& c) : m_counters(c) {}
+		~smart_ban_table();
+
+		smart_ban_table(smart_ban_table const&) = delete;
+		smart_ban_table& operator=(smart_ban_table const&) = delete;
+
+		// records the blocks of a failed piece, ``blocks[i]`` being block i.
+		// Empty entries are ignored, and only the first peer to send a block is
+		// recorded. If that peer sent the block before with a different
+		// fingerprint, it sent bad data at least once and the block is
+		// appended to ``mismatches``. Then the pieces that failed the longest
+		// time ago are forgotten, until the table uses no more than
+		// ``memory_limit`` bytes (the piece just recorded is forgotten last)
+		void record_failed(piece_index_t piece, span<smart_ban_block const> blocks
+			, std::int64_t memory_limit, std::vector<smart_ban_mismatch>& mismatches);
+
+		// removes the blocks recorded for a piece that passed the hash check,
+		// and returns them to be compared against the good data. If nothing
+		// was recorded for the piece, the returned vector is empty
+		std::vector<smart_ban_block> piece_passed(piece_index_t piece);
+
+		// forgets all pieces, and releases the memory
+		void clear();
+
+		int num_pieces() const { return int(m_pieces.size()); }
+
+		// the number of bytes used by the table
+		std::int64_t memory() const { return m_memory; }
+
+	private:
+
+		struct piece_entry
+		{
+			piece_index_t piece;
+			// the order pieces were added in, to evict the oldest one first
+			std::uint32_t seq;
+			std::vector<smart_ban_block> blocks;
+		};
+
+		std::vector<piece_entry>::iterator find_piece(piece_index_t p);
+		// removes the piece and returns its blocks
+		std::vector<smart_ban_block> erase_piece(std::vector<piece_entry>::iterator i);
+		static std::int64_t piece_entry_size(piece_entry const& e);
+
+		counters& m_counters;
+
+		// sorted by piece index
+		std::vector<piece_entry> m_pieces;
+
+		// the number of bytes used by m_pieces
+		std::int64_t m_memory = 0;
+
+		// the sequence number of the next piece added to m_pieces
+		std::uint32_t m_seq = 0;
+	};
+}
+}
+
+#endif
@@ -35,6 +35,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <memory>
 #include <vector>
+#include <deque>
+#include <array>
+#include <unordered_map>
+#include <cstdint>
 
 #include "libtorrent/invariant_check.hpp"
 #include "libtorrent/assert.hpp"
@@ -74,11 +78,92 @@ struct TORRENT_EXTRA_EXPORT bandwidth_manager
 
 private:
 
+	// requests are grouped by the set of bandwidth channels they draw from.
+	// Each such group is a leaf under the channels (peer classes) it belongs
+	// to. Every round, each leaf is given its share of the quota of its
+	// channels, in proportion to the sum of the priorities queued in it
+	// (weighted by the channel's total). Within a leaf the share is handed out
+	// by deficit round-robin, each visit granting a request a slice in
+	// proportion to its priority. A leaf only visits as many requests as its
+	// share reaches, and picks up where it left off in the next round. That
+	// makes queuing and dequeuing a request constant time, and lets low rates
+	// be handed out in meaningful slices, rather than spread thin over every
+	// request in every round
+	using channel_set = std::array<bandwidth_channel*, bw_request::max_bandwidth_channels>;
+
+	struct channel_set_hash
+	{
+		std::size_t operator()(channel_set const& s) const;
+	};
+
+	struct leaf
+	{
+		// the sum of the priorities of all requests queued in this leaf
+		std::int64_t weight = 0;
+
+		// the number of requests queued in this leaf
+		int num_requests = 0;
+
+		// the requests (indices into m_slots) in the order they are visited.
+		// Requests that have been cancelled are left in here, and removed as
+		// they come up
+		std::deque<int> queue;
+	};
+
+	struct slot
+	{
+		slot(bw_request const& r, int const d, leaf* l)
+			: request(r), deadline(d), owner(l) {}
+		bw_request request;
+
+		// the round at which the request is handed whatever has been assigned
+		// to it so far, even if it isn't satisfied
+		int deadline;
+
+		// the leaf the request is queued in, or nullptr once it has been
+		// removed (and the slot is waiting for the leaf to get to it)
+		leaf* owner;
+	};
+
+	// hands out this round's share of the leaf's channels' quota to its
+	// requests. Requests that are done are moved to ``done``
+	void serve_leaf(leaf& l, channel_set const& channels
+		, std::vector<bw_request>& done);
+
+	// removes the request in slot ``idx`` from the accounting of its leaf and
+	// its channels, and moves it to ``done``. The slot is freed once the
+	// leaf's queue gets to it
+	void remove_request(int idx, std::vector<bw_request>& done);
+
+	// removes the request of a disconnecting peer, returning the quota
+	// assigned to it so far to its channels
+	void cancel_request(int idx, std::vector<bw_request>& done);
+
+	// checks a few queued requests for disconnecting peers, and removes the
+	// ones that are, into ``done``. Every request is looked at within a few
+	// rounds, without looking at all of them every round
+	void sweep_disconnecting(std::vector<bw_request>& done);
+
 	// these are the consumers that want bandwidth
-	std::vector<bw_request> m_queue;
+	std::unordered_map<channel_set, leaf, channel_set_hash> m_leaves;
+
+	// the storage of the queued requests. The leaves refer to slots by index,
+	// and freed slots are recycled through m_free_slots
+	std::vector<slot> m_slots;
+	std::vector<int> m_free_slots;
+
+	// the number of queued requests
+	int m_queue_size;
+
 	// the number of bytes all the requests in queue are for
 	std::int64_t m_queued_bytes;
 
+	// incremented every call to update_quotas(). Used for request deadlines
+	int m_round;
+
+	// the next slot to check for a disconnecting peer
+	int m_sweep_cursor;
+
 	// this is the channel within the consumers
 	// that bandwidth is assigned to (upload or download)
 	int m_channel;
@@ -59,10 +59,6 @@ struct TORRENT_EXTRA_EXPORT bw_request
 	// time to satisfy
 	int ttl;
 
-	// loops over the bandwidth channels and assigns bandwidth
-	// from the most limiting one
-	int assign_bandwidth();
-
 	constexpr static int max_bandwidth_channels = 10;
 	// we don't actually support more than 10 channels per peer
 	bandwidth_channel* channel[max_bandwidth_channels];
@@ -47,6 +47,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/string_view.hpp"
 #include "libtorrent/aux_/noexcept_movable.hpp"
 
+#include <memory>
+
 /*
 
 This is an efficient bdecoder. It decodes into a flat memory buffer of tokens.
@@ -332,6 +334,14 @@ struct TORRENT_EXPORT bdecode_node
 		, std::int64_t default_val = 0) const;
 	int dict_size() const;
 
+	// builds a hash table of the keys of this dictionary, making subsequent
+	// ``dict_find*()`` calls through this ``bdecode_node`` object constant
+	// time. This is worth it for dictionaries with many keys, that many of
+	// them are looked up in. Copies of the node do not share the index. This
+	// function is only valid if ``type()`` == ``dict_t``, and must not be
+	// called while other threads are using the node.
+	void dict_build_index();
+
 	// this function is only valid if ``type()`` == ``int_t``. It returns the
 	// value of the integer.
 	std::int64_t int_value() const;
@@ -370,6 +380,8 @@ private:
 	bdecode_node(detail::bdecode_token const* tokens, char const* buf
 		, int len, int idx);
 
+	bdecode_node dict_find_linear(string_view key) const;
+
 	// if this is the root node, that owns all the tokens, they live in this
 	// vector. If this is a sub-node, this field is not used, instead the
 	// m_root_tokens pointer points to the root node's token.
@@ -396,6 +408,13 @@ private:
 	// the number of elements in this list or dict (computed on the first
 	// call to dict_size() or list_size())
 	mutable int m_size;
+
+	// the hash table of the keys of this dictionary, built by
+	// dict_build_index(). Each slot holds the index of a key token, relative
+	// to m_token_idx, or 0 if the slot is empty. The index is not copied
+	// along with the node.
+	std::unique_ptr<std::uint32_t[]> m_key_index;
+	std::uint32_t m_key_index_mask = 0;
 };
 
 // print the bencoded structure in a human-readable format to a string
@@ -322,6 +322,14 @@ namespace libtorrent {
 
 		// helper to cut down on boilerplate
 		void rc4_decrypt(span<char> buf);
+
+		// computes the keys of the ciphers that may be negotiated, from the DH
+		// shared secret and the info-hash
+		void init_stream_ciphers(key_t const& secret, sha1_hash const& stream_key);
+
+		// the cipher the stream is encrypted with once the handshake is done,
+		// or nullptr if it's plaintext
+		std::shared_ptr<crypto_plugin> stream_crypto() const;
 #endif
 
 	public:
@@ -405,6 +413,9 @@ namespace libtorrent {
 		// true if rc4, false if plaintext
 		bool m_rc4_encrypted:1;
 
+		// true if chacha20 was negotiated
+		bool m_chacha20_encrypted:1;
+
 // this is a legitimate use of a shadow field
 #ifdef __clang__
 #pragma clang diagnostic push
@@ -457,6 +468,10 @@ namespace libtorrent {
 		// otherwise it is destroyed when the handshake completes
 		std::shared_ptr<rc4_handler> m_rc4;
 
+		// set up alongside m_rc4, if chacha20 is allowed. It's used if
+		// chacha20 is negotiated and destroyed when the handshake completes
+		std::shared_ptr<chacha20_handler> m_chacha20;
+
 		// if encryption is negotiated, this is used for
 		// encryption/decryption during the entire session.
 		encryption_handler m_enc_handler;
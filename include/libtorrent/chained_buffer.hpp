@@ -39,83 +39,79 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 #include "libtorrent/buffer.hpp"
 
-#include <deque>
 #include <vector>
+#include <array>
+#include <memory>
+#include <type_traits>
+#include <limits>
 
 #include "libtorrent/aux_/disable_warnings_push.hpp"
 #include <boost/asio/buffer.hpp>
 #include "libtorrent/aux_/disable_warnings_pop.hpp"
 
-#ifdef _MSC_VER
-// visual studio requires the value in a deque to be copyable. C++11
-// has looser requirements depending on which functions are actually used.
-#define TORRENT_CPP98_DEQUE 1
-#else
-#define TORRENT_CPP98_DEQUE 0
-#endif
-
 namespace libtorrent {
 
 	// TODO: 2 this type should probably be renamed to send_buffer
 	struct TORRENT_EXTRA_EXPORT chained_buffer : private single_threaded
 	{
-		chained_buffer(): m_bytes(0), m_capacity(0)
+		chained_buffer()
+			: m_ring_size(inline_segments)
+			, m_first(0)
+			, m_num(0)
+			, m_bytes(0)
+			, m_capacity(0)
+			, m_num_iovec(0)
 		{
+			// m_inline is left uninitialized, taking its address in the
+			// initializer list trips -Wuninitialized
+			m_ring = m_inline.data();
 			thread_started();
 #if TORRENT_USE_ASSERTS
 			m_destructed = false;
 #endif
 		}
 
+		chained_buffer(chained_buffer const&) = delete;
+		chained_buffer& operator=(chained_buffer const&) = delete;
+
+		// the max number of buffers passed to a single write. This is the
+		// number of buffers asio passes to the system call, at most
+		static constexpr int max_iovec = 32;
+
+		// the buffers of a write, as an asio ConstBufferSequence. It refers to
+		// storage in the chained_buffer, and is valid until the next call to
+		// build_iovec()
+		struct iovec_t
+		{
+			using value_type = boost::asio::const_buffer;
+			using const_iterator = value_type const*;
+			const_iterator begin() const { return m_begin; }
+			const_iterator end() const { return m_end; }
+			std::size_t size() const { return std::size_t(m_end - m_begin); }
+			iovec_t(const_iterator b, const_iterator e) : m_begin(b), m_end(e) {}
+		private:
+			const_iterator m_begin;
+			const_iterator m_end;
+		};
+
 	private:
 
 		// destructs/frees the holder object
 		using destruct_holder_fun = void (*)(void*);
 		using move_construct_holder_fun = void (*)(void*, void*);
 
+		// a slot in the ring of buffers. The holder is constructed in-place in
+		// ``holder`` and only moved when the ring grows. Holders that are
+		// trivially copyable and destructible (such as spans) leave the
+		// function pointers null, and are just copied
 		struct buffer_t
 		{
-			buffer_t() {}
-#if TORRENT_CPP98_DEQUE
-			buffer_t(buffer_t&& rhs) noexcept
-			{
-				destruct_holder = rhs.destruct_holder;
-				move_holder = rhs.move_holder;
-				buf = rhs.buf;
-				size = rhs.size;
-				used_size = rhs.used_size;
-				move_holder(&holder, &rhs.holder);
-			}
-			buffer_t& operator=(buffer_t&& rhs) noexcept
-			{
-				destruct_holder(&holder);
-				destruct_holder = rhs.destruct_holder;
-				move_holder = rhs.move_holder;
-				buf = rhs.buf;
-				size = rhs.size;
-				used_size = rhs.used_size;
-				move_holder(&holder, &rhs.holder);
-				return *this;
-			}
-			buffer_t(buffer_t const& rhs) noexcept
-				: buffer_t(std::move(const_cast<buffer_t&>(rhs))) {}
-			buffer_t& operator=(buffer_t const& rhs) noexcept
-			{ return this->operator=(std::move(const_cast<buffer_t&>(rhs))); }
-#else
-			buffer_t(buffer_t&&) = delete;
-			buffer_t& operator=(buffer_t&&) = delete;
-			buffer_t(buffer_t const&) = delete;
-			buffer_t& operator=(buffer_t const&) = delete;
-#endif
-
 			destruct_holder_fun destruct_holder;
-#if TORRENT_CPP98_DEQUE
 			move_construct_holder_fun move_holder;
-#endif
 			aux::aligned_storage<32>::type holder;
-			char* buf = nullptr; // the first byte of the buffer
-			int size = 0; // the total size of the buffer
-			int used_size = 0; // this is the number of bytes to send/receive
+			char* buf; // the first byte of the buffer
+			int size; // the total size of the buffer
+			int used_size; // this is the number of bytes to send/receive
 		};
 
 	public:
@@ -131,8 +127,9 @@ namespace libtorrent {
 		{
 			TORRENT_ASSERT(is_single_thread());
 			TORRENT_ASSERT(int(buffer.size()) >= used_size);
-			m_vec.emplace_back();
-			buffer_t& b = m_vec.back();
+			if (m_num == m_ring_size) grow();
+			buffer_t& b = m_ring[(m_first + m_num) & (m_ring_size - 1)];
+			++m_num;
 			init_buffer_entry<Holder>(b, std::move(buffer), used_size);
 		}
 
@@ -141,9 +138,10 @@ namespace libtorrent {
 		{
 			TORRENT_ASSERT(is_single_thread());
 			TORRENT_ASSERT(int(buffer.size()) >= used_size);
-			m_vec.emplace_front();
-			buffer_t& b = m_vec.front();
-			init_buffer_entry<Holder>(b, std::move(buffer), used_size);
+			if (m_num == m_ring_size) grow();
+			m_first = (m_first - 1) & (m_ring_size - 1);
+			++m_num;
+			init_buffer_entry<Holder>(m_ring[m_first], std::move(buffer), used_size);
 		}
 
 		// returns the number of bytes available at the
@@ -160,11 +158,16 @@ namespace libtorrent {
 		// enough room, returns 0
 		char* allocate_appendix(int s);
 
-		std::vector<boost::asio::const_buffer> const& build_iovec(int to_send);
+		// returns the buffers of (up to) the first ``to_send`` bytes. At most
+		// max_iovec buffers are returned, which may be fewer bytes than asked
+		// for
+		iovec_t build_iovec(int to_send);
 
 		void clear();
 
-		void build_mutable_iovec(int bytes, std::vector<span<char>>& vec);
+		// fills in ``vec`` with the buffers of (up to) the first ``bytes``
+		// bytes and returns the part of it that was used
+		span<span<char>> build_mutable_iovec(int bytes, span<span<char>> vec);
 
 		~chained_buffer();
 
@@ -184,13 +187,20 @@ namespace libtorrent {
 #pragma warning(push, 1)
 #pragma warning(disable : 4100)
 #endif
-			b.destruct_holder = [](void* holder)
-			{ reinterpret_cast<Holder*>(holder)->~Holder(); };
+			if (std::is_trivially_destructible<Holder>::value
+				&& std::is_trivially_copyable<Holder>::value)
+			{
+				b.destruct_holder = nullptr;
+				b.move_holder = nullptr;
+			}
+			else
+			{
+				b.destruct_holder = [](void* holder)
+				{ reinterpret_cast<Holder*>(holder)->~Holder(); };
 
-#if TORRENT_CPP98_DEQUE
-			b.move_holder = [](void* dst, void* src)
-			{ new (dst) Holder(std::move(*reinterpret_cast<Holder*>(src))); };
-#endif
+				b.move_holder = [](void* dst, void* src)
+				{ new (dst) Holder(std::move(*reinterpret_cast<Holder*>(src))); };
+			}
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -204,12 +214,37 @@ namespace libtorrent {
 			TORRENT_ASSERT(m_bytes <= m_capacity);
 		}
 
+		buffer_t& front() { return m_ring[m_first]; }
+		buffer_t& back() { return m_ring[(m_first + m_num - 1) & (m_ring_size - 1)]; }
+		buffer_t& at(int const i)
+		{ return m_ring[(m_first + i) & (m_ring_size - 1)]; }
+
+		// doubles the size of the ring, moving the buffers over to a new one
+		// on the heap. Once the ring is large enough for the connection, it's
+		// kept, so sending doesn't allocate in the steady state
+		void grow();
+
+		static void destruct(buffer_t& b)
+		{
+			if (b.destruct_holder) b.destruct_holder(static_cast<void*>(&b.holder));
+		}
+
 		template <typename Buffer>
-		void build_vec(int bytes, std::vector<Buffer>& vec);
+		int build_vec(int bytes, span<Buffer> vec);
+
+		static constexpr int inline_segments = 8;
+
+		// the ring of all the buffers we want to send. It starts out as the
+		// inline storage, and is moved to the heap if there are more buffers
+		// than fit in it. The size of the ring is always a power of 2
+		std::array<buffer_t, inline_segments> m_inline;
+		std::unique_ptr<buffer_t[]> m_heap;
+		buffer_t* m_ring;
+		int m_ring_size;
 
-		// this is the list of all the buffers we want to
-		// send
-		std::deque<buffer_t> m_vec;
+		// the index of the first buffer in the ring, and the number of buffers
+		int m_first;
+		int m_num;
 
 		// this is the number of bytes in the send buf.
 		// this will always be equal to the sum of the
@@ -220,9 +255,9 @@ namespace libtorrent {
 		// including unused space
 		int m_capacity;
 
-		// this is the vector of buffers used when
-		// invoking the async write call
-		std::vector<boost::asio::const_buffer> m_tmp_vec;
+		// the buffers used when invoking the async write call
+		std::array<boost::asio::const_buffer, max_iovec> m_tmp_vec;
+		int m_num_iovec;
 
 #if TORRENT_USE_ASSERTS
 		bool m_destructed;
@@ -33,10 +33,75 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/config.hpp"
 #include "libtorrent/time.hpp" // for time_duration
 #include <vector>
+#include <cstdint>
+#include <algorithm>
 
 namespace libtorrent {
 
-	namespace aux { struct session_settings; }
+	namespace aux {
+
+	struct session_settings;
+
+	// what the choker ranks a peer by, captured once per unchoke round. This
+	// way sorting the peers doesn't need to call into peer_connection (and
+	// lock its torrent) for every comparison. Ranks are compared by prio,
+	// primary, secondary and tertiary, where higher is better, and last by
+	// last_unchoke, where earlier is better. What the fields hold depends on
+	// the choking algorithm
+	struct unchoke_rank
+	{
+		std::int64_t primary;
+		std::int64_t secondary;
+		std::int64_t tertiary;
+		time_point last_unchoke;
+		int prio;
+
+		// the index of the peer this is the rank of, in the caller's list
+		int peer;
+	};
+
+	struct better_rank
+	{
+		bool operator()(unchoke_rank const& lhs, unchoke_rank const& rhs) const
+		{
+			if (lhs.prio != rhs.prio) return lhs.prio > rhs.prio;
+			if (lhs.primary != rhs.primary) return lhs.primary > rhs.primary;
+			if (lhs.secondary != rhs.secondary) return lhs.secondary > rhs.secondary;
+			if (lhs.tertiary != rhs.tertiary) return lhs.tertiary > rhs.tertiary;
+			return lhs.last_unchoke < rhs.last_unchoke;
+		}
+	};
+
+	// moves the best ranks in [first, ranks.size()) into [first, last), in
+	// order. The ranks after last are left in unspecified order. This is
+	// linear in the number of ranks, plus the cost of sorting the range
+	TORRENT_EXTRA_EXPORT void rank_range(std::vector<unchoke_rank>& ranks
+		, std::size_t first, std::size_t last);
+
+	// calls ``f`` with every rank, best first, until it returns false. The
+	// ranks are sorted in growing chunks, just ahead of ``f``, so stopping
+	// early saves most of the sorting. Returns the number of ranks ``f``
+	// returned true for. When returning, ranks is ordered at least that far
+	template <typename Fun>
+	int for_each_rank(std::vector<unchoke_rank>& ranks, Fun f)
+	{
+		std::size_t sorted = 0;
+		std::size_t chunk = 16;
+		for (std::size_t i = 0; i < ranks.size(); ++i)
+		{
+			if (i == sorted)
+			{
+				sorted = std::min(ranks.size(), sorted + chunk);
+				rank_range(ranks, i, sorted);
+				chunk *= 2;
+			}
+			if (!f(ranks[i])) return int(i);
+		}
+		return int(ranks.size());
+	}
+
+	}
+
 	class peer_connection;
 
 	// sorts the vector of peers in-place. When returning, the top unchoke slots
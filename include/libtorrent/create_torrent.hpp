@@ -403,6 +403,20 @@ namespace detail {
 	// file error, the other overloads sets the error code to reflect the error, if any.
 	TORRENT_EXPORT void set_piece_hashes(create_torrent& t, std::string const& p
 		, std::function<void(piece_index_t)> const& f, error_code& ec);
+
+	// This overload of set_piece_hashes() lets you control the number of
+	// hashing threads, and cancel the operation. The files are read
+	// sequentially, in large chunks, by the calling thread, and the pieces are
+	// hashed by a pool of ``num_threads`` threads. If ``num_threads`` is 0, one
+	// thread per hardware thread is used. The other overloads use the default.
+	//
+	// ``f`` is called from the calling thread, once per piece and in order,
+	// after the piece's hash has been set. Returning false from ``f`` cancels
+	// hashing, in which case ``ec`` is set to
+	// ``boost::asio::error::operation_aborted``.
+	TORRENT_EXPORT void set_piece_hashes(create_torrent& t, std::string const& p
+		, int num_threads, std::function<bool(piece_index_t)> const& f
+		, error_code& ec);
 	inline void set_piece_hashes(create_torrent& t, std::string const& p, error_code& ec)
 	{
 		set_piece_hashes(t, p, detail::nop, ec);
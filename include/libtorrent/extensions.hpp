@@ -377,7 +377,10 @@ namespace libtorrent {
 		virtual string_view type() const { return {}; }
 
 		// can add entries to the extension handshake
-		// this is not called for web seeds
+		// this is not called for web seeds. The entry passed in only holds
+		// what plugins have added, the built-in keys are merged in when the
+		// handshake is written. If a plugin sets one of the built-in keys, its
+		// value takes precedence. Built-in keys cannot be removed by plugins
 		virtual void add_handshake(entry&) {}
 
 		// called when the peer is being disconnected.
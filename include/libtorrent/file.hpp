@@ -180,6 +180,8 @@ namespace libtorrent {
 		constexpr open_mode_t attribute_mask = attribute_hidden | attribute_executable;
 	}
 
+	struct file_status;
+
 	struct TORRENT_EXTRA_EXPORT file : boost::noncopyable
 	{
 		file();
@@ -200,6 +202,10 @@ namespace libtorrent {
 
 		std::int64_t get_size(error_code& ec) const;
 
+		// fills in the size, modification time and inode of the open file.
+		// The other fields of ``s`` are left untouched
+		void stat(file_status* s, error_code& ec) const;
+
 		// return the offset of the first byte that
 		// belongs to a data-region
 		std::int64_t sparse_end(std::int64_t start) const;
@@ -33,9 +33,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_FILE_POOL_HPP
 #define TORRENT_FILE_POOL_HPP
 
-#include <map>
 #include <mutex>
 #include <vector>
+#include <array>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
 
 #include "libtorrent/file.hpp"
 #include "libtorrent/aux_/time.hpp"
@@ -53,6 +59,12 @@ namespace libtorrent {
 	// not opening more file handles than specified. Given multiple threads,
 	// each with the ability to lock a file handle (via smart pointer), there
 	// may be windows where more file handles are open.
+	//
+	// The handles are spread over a number of shards, each with its own mutex,
+	// hash table and LRU list, to keep disk threads opening different files
+	// from contending on a single lock. Files evicted to make room for new
+	// ones are closed on a background thread, since closing a file can take
+	// a long time on some systems.
 	struct TORRENT_EXPORT file_pool : boost::noncopyable
 	{
 		// ``size`` specifies the number of allowed files handles
@@ -66,6 +78,15 @@ namespace libtorrent {
 		file_handle open_file(storage_index_t st, std::string const& p
 			, file_index_t file_index, file_storage const& fs, open_mode_t m
 			, error_code& ec);
+
+		// opens the file at ``file_index`` on the file pool's background
+		// thread, unless it's already open, in anticipation of it being asked
+		// for with open_file() shortly. Failures are ignored, they will be
+		// reported by open_file(). If the file is released before it's done
+		// opening, it's not added to the pool.
+		void prefetch_file(storage_index_t st, std::string const& p
+			, file_index_t file_index, file_storage const& fs, open_mode_t m);
+
 		// release all files belonging to the specified storage_interface (``st``)
 		// the overload that takes ``file_index`` releases only the file with
 		// that index in storage ``st``.
@@ -101,10 +122,16 @@ namespace libtorrent {
 
 	private:
 
-		file_handle remove_oldest(std::unique_lock<std::mutex>&);
+		using file_key = std::pair<storage_index_t, file_index_t>;
 
-		int m_size;
-		bool m_low_prio_io = false;
+		struct file_key_hash
+		{
+			std::size_t operator()(file_key const& k) const
+			{
+				return std::size_t(static_cast<std::uint32_t>(k.first)) * 0x9e3779b1u
+					^ std::size_t(static_cast<std::uint32_t>(k.second));
+			}
+		};
 
 		struct lru_file_entry
 		{
@@ -112,15 +139,117 @@ namespace libtorrent {
 			time_point const opened{aux::time_now()};
 			time_point last_use{opened};
 			open_mode_t mode{};
+
+			// the value of the pool's use counter when this file was last used.
+			// Unlike last_use this is unique, which makes the least recently
+			// used file well defined across shards
+			std::uint64_t use_seq = 0;
+
+			// the shard's LRU list. ``prev`` is towards the least recently used
+			lru_file_entry* prev = nullptr;
+			lru_file_entry* next = nullptr;
+			file_key key;
+		};
+
+		struct shard
+		{
+			mutable std::mutex mutex;
+			std::unordered_map<file_key, lru_file_entry, file_key_hash> files;
+
+			// the least and most recently used entries
+			lru_file_entry* oldest = nullptr;
+			lru_file_entry* newest = nullptr;
+
+			// incremented whenever files are released from this shard. A
+			// prefetched file is only added if this hasn't changed since it was
+			// requested
+			std::uint32_t generation = 0;
+
+			void unlink(lru_file_entry& e);
+			void push_newest(lru_file_entry& e, std::uint64_t seq);
+			void erase(lru_file_entry& e);
+		};
+
+		static constexpr int num_shards = 16;
+
+		shard& shard_for(file_key const& k)
+		{ return m_shards[file_key_hash()(k) % num_shards]; }
+		shard const& shard_for(file_key const& k) const
+		{ return m_shards[file_key_hash()(k) % num_shards]; }
+
+		file_handle open_new_file(std::string const& full_path, open_mode_t m
+			, error_code& ec) const;
+
+		// adds an open file to the shard, which must be locked
+		file_handle add_file(shard& s, file_key const& k, file_handle f
+			, open_mode_t m);
+
+		// closes least recently used files until there are no more than
+		// ``limit`` open. The handles are destructed on the background thread
+		void evict_files(int limit);
+
+		// removes the least recently used file, across all shards. None of the
+		// shards may be locked by the caller
+		file_handle remove_oldest();
+
+		// hands files over to the background thread to be closed
+		void close_async(std::vector<file_handle> files);
+
+		// closes files that are waiting to be closed by the background thread,
+		// in the calling thread. This is used when files are released, to make
+		// sure they really are closed when release() returns
+		void flush_closing();
+
+		// drops the queued prefetch requests ``pred`` returns true for, and
+		// waits for the background thread in case it's in the middle of
+		// opening a file. This is used when files are released, after the
+		// generation of their shards has been incremented, to make sure no
+		// file is (re)opened by a prefetch once release() returns
+		template <typename Pred>
+		void cancel_prefetch(Pred pred);
+
+		void start_thread(std::unique_lock<std::mutex>& l);
+		void thread_fun();
+
+		std::atomic<int> m_size;
+		bool m_low_prio_io = false;
+
+		std::array<shard, num_shards> m_shards;
+
+		// the number of files open, across all shards
+		std::atomic<int> m_num_files{0};
+
+		// incremented every time a file is used
+		std::atomic<std::uint64_t> m_use_counter{0};
+
+		struct prefetch_request
+		{
+			file_key key;
+			std::string path;
+			open_mode_t mode;
+			std::uint32_t generation;
 		};
 
-		// maps storage pointer, file index pairs to the
-		// LRU entry for the file
-		std::map<std::pair<storage_index_t, file_index_t>, lru_file_entry> m_files;
+		// protects the queues of the background thread
+		std::mutex m_thread_mutex;
+		std::condition_variable m_thread_cond;
+		std::vector<file_handle> m_to_close;
+		std::vector<prefetch_request> m_to_open;
+		bool m_abort = false;
+		std::thread m_thread;
+
+		// held by the background thread while it's closing files, for
+		// flush_closing() to wait for it
+		std::mutex m_closing_mutex;
+
+		// held by the background thread while it's opening a prefetched
+		// file, for cancel_prefetch() to wait for it
+		std::mutex m_opening_mutex;
+
 #if TORRENT_USE_ASSERTS
 		std::vector<std::pair<std::string, void const*>> m_deleted_storages;
+		mutable std::mutex m_deleted_mutex;
 #endif
-		mutable std::mutex m_mutex;
 	};
 }
 
@@ -0,0 +1,62 @@
+/*
+
+Copyright (c) 2017, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef TORRENT_FILE_SNAPSHOT_HPP_INCLUDED
+#define TORRENT_FILE_SNAPSHOT_HPP_INCLUDED
+
+#include <cstdint>
+
+#include "libtorrent/config.hpp"
+
+namespace libtorrent {
+
+	// the size, modification time and inode of a file, as observed by the
+	// storage. See add_torrent_params::file_snapshots.
+	struct TORRENT_EXPORT file_snapshot
+	{
+		// the size of the file in bytes, or -1 if the file's state is not
+		// known
+		std::int64_t size = -1;
+
+		// the modification time of the file, in seconds since epoch
+		std::int64_t mtime = 0;
+
+		// the inode of the file (the file index on windows)
+		std::uint64_t inode = 0;
+
+		bool operator==(file_snapshot const& rhs) const
+		{ return size == rhs.size && mtime == rhs.mtime && inode == rhs.inode; }
+		bool operator!=(file_snapshot const& rhs) const
+		{ return !(*this == rhs); }
+	};
+}
+
+#endif
@@ -413,6 +413,8 @@ namespace libtorrent {
 			swap(ti.m_symlinks, m_symlinks);
 			swap(ti.m_mtime, m_mtime);
 			swap(ti.m_paths, m_paths);
+			swap(ti.m_path_index, m_path_index);
+			swap(ti.m_offset_index, m_offset_index);
 			swap(ti.m_name, m_name);
 			swap(ti.m_total_size, m_total_size);
 			swap(ti.m_num_pieces, m_num_pieces);
@@ -542,6 +544,11 @@ namespace libtorrent {
 	private:
 
 		int get_or_add_path(string_view path);
+		void rebuild_path_index(std::size_t size);
+		void rebuild_offset_index();
+
+		// returns the index of the last file whose offset is <= offset
+		file_index_t file_at_offset_impl(std::int64_t offset) const;
 
 		void add_pad_file(int size
 			, std::vector<internal_file_entry>::iterator& i
@@ -591,6 +598,19 @@ namespace libtorrent {
 		// entry appended, to form full file paths
 		aux::vector<std::string> m_paths;
 
+		// open addressing hash table of indices into m_paths, used by
+		// get_or_add_path() to avoid a linear scan for every file added. Empty
+		// slots are -1. The number of slots is a power of two and at least twice
+		// the number of paths
+		aux::vector<std::int32_t> m_path_index;
+
+		// the offset of every offset_index_stride:th file. This is a compact
+		// index used by file_index_at_offset() and map_block() to narrow down
+		// the binary search to a small range of m_files, rather than searching
+		// the (much larger) internal_file_entry objects directly
+		aux::vector<std::int64_t> m_offset_index;
+		static constexpr int offset_index_stride = 64;
+
 		// name of torrent. For multi-file torrents
 		// this is always the root directory
 		aux::noexcept_movable<std::string> m_name;
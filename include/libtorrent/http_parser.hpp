@@ -33,7 +33,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_HTTP_PARSER_HPP_INCLUDED
 #define TORRENT_HTTP_PARSER_HPP_INCLUDED
 
-#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -63,13 +62,21 @@ namespace libtorrent {
 		enum flags_t { dont_parse_chunks = 1 };
 		explicit http_parser(int flags = 0);
 		~http_parser();
-		std::string const& header(string_view key) const;
+
+		// all strings returned by the parser refer to its internal header
+		// buffer, not the receive buffer passed to incoming(). Both incoming()
+		// and parse_chunk_header() may append to (and reallocate) that buffer,
+		// so the strings are only valid until the next call to either of them,
+		// or until the parser is reset or destructed. Header names are
+		// lower-case. If a header appears more than once, header() returns
+		// the first one. If it's missing, an empty string is returned
+		string_view header(string_view key) const;
 		boost::optional<seconds32> header_duration(string_view key) const;
-		std::string const& protocol() const { return m_protocol; }
+		string_view protocol() const { return view(m_protocol); }
 		int status_code() const { return m_status_code; }
-		std::string const& method() const { return m_method; }
-		std::string const& path() const { return m_path; }
-		std::string const& message() const { return m_server_message; }
+		string_view method() const { return view(m_method); }
+		string_view path() const { return view(m_path); }
+		string_view message() const { return view(m_server_message); }
 		span<char const> get_body() const;
 		bool header_finished() const { return m_state == read_body; }
 		bool finished() const { return m_finished; }
@@ -114,21 +121,56 @@ namespace libtorrent {
 
 		bool connection_close() const { return m_connection_close; }
 
-		std::multimap<std::string, std::string> const& headers() const { return m_header; }
+		// returns all headers (name, value) in the order they were received
+		std::vector<std::pair<string_view, string_view>> headers() const;
 		std::vector<std::pair<std::int64_t, std::int64_t>> const& chunks() const { return m_chunked_ranges; }
 
 	private:
+
+		// a string in m_header_buf
+		struct text_range
+		{
+			int start;
+			int length;
+		};
+
+		struct header_entry
+		{
+			text_range name;
+			text_range value;
+		};
+
+		string_view view(text_range r) const
+		{ return {m_header_buf.data() + r.start, std::size_t(r.length)}; }
+
+		// copies [begin, end) to the end of m_header_buf, followed by a null
+		// terminator (which isn't part of the returned range)
+		text_range store(char const* begin, char const* end);
+
+		// parses a "name: value" line into m_header_buf. Returns false if the
+		// line doesn't have a colon, i.e. it's the blank line ending the
+		// headers
+		bool parse_header_line(char const* line, char const* line_end
+			, header_entry& e);
+
 		std::int64_t m_recv_pos = 0;
-		std::string m_method;
-		std::string m_path;
-		std::string m_protocol;
-		std::string m_server_message;
+		text_range m_method{0, 0};
+		text_range m_path{0, 0};
+		text_range m_protocol{0, 0};
+		text_range m_server_message{0, 0};
 
 		std::int64_t m_content_length = -1;
 		std::int64_t m_range_start = -1;
 		std::int64_t m_range_end = -1;
 
-		std::multimap<std::string, std::string> m_header;
+		// the status line and header lines are copied here as they are parsed,
+		// so that they stay valid when the caller cuts or reallocates its
+		// receive buffer. The names and values stored in here are null
+		// terminated. This buffer keeps its capacity across reset(), so
+		// parsing a stream of responses (like from a web seed) doesn't touch
+		// the heap once it has grown large enough
+		std::vector<char> m_header_buf;
+		std::vector<header_entry> m_headers;
 		span<char const> m_recv_buffer;
 		// contains offsets of the first and one-past-end of
 		// each chunked range in the response
@@ -41,9 +41,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <tuple>
 #include <iterator> // for next
 #include <limits>
+#include <memory>
 
 #include "libtorrent/address.hpp"
 #include "libtorrent/assert.hpp"
+#include "libtorrent/span.hpp"
 
 namespace libtorrent {
 
@@ -232,6 +234,16 @@ namespace detail {
 			return ret;
 		}
 
+		// calls ``f(start, access)`` for every range, in address order. The
+		// end of each range is implied by the start of the next one
+		template <typename Fun>
+		void for_each_range(Fun f) const
+		{
+			for (auto const& r : m_access_list) f(r.start, r.access);
+		}
+
+		std::size_t num_ranges() const { return m_access_list.size(); }
+
 	private:
 
 		struct range
@@ -250,6 +262,8 @@ namespace detail {
 
 }
 
+namespace aux { struct ip_filter_lookup; }
+
 // The ``ip_filter`` class is a set of rules that uniquely categorizes all
 // ip addresses as allowed or disallowed. The default constructor creates
 // a single rule that allows all addresses (0.0.0.0 - 255.255.255.255 for
@@ -285,9 +299,23 @@ struct TORRENT_EXPORT ip_filter
 	// Returns the access permissions for the given address (``addr``). The permission
 	// can currently be 0 or ``ip_filter::blocked``. The complexity of this operation
 	// is O(``log`` n), where n is the minimum number of non-overlapping ranges to describe
-	// the current filter.
+	// the current filter. Once compile() has been called, the constant factor
+	// is a lot smaller.
 	std::uint32_t access(address const& addr) const;
 
+	// Looks up the access permissions for every address in ``addrs`` and
+	// stores them in the corresponding element of ``flags``. Both spans must
+	// have the same size.
+	void access(span<address const> addrs, span<std::uint32_t> flags) const;
+
+	// Builds a compact, immutable lookup table from the current set of rules,
+	// which makes access() a lot cheaper for large filters (e.g. blocklists of
+	// hundreds of thousands of ranges). Adding a rule discards the table, and
+	// compile() needs to be called again. The table is shared (not copied)
+	// when the filter is copied. session_handle::set_ip_filter() compiles the
+	// filter it's given, before it's handed over to the session.
+	void compile();
+
 #if TORRENT_USE_IPV6
 	using filter_tuple_t = std::tuple<std::vector<ip_range<address_v4>>
 		, std::vector<ip_range<address_v6>>>;
@@ -312,6 +340,11 @@ private:
 #if TORRENT_USE_IPV6
 	detail::filter_impl<address_v6::bytes_type> m_filter6;
 #endif
+
+	// the lookup table built by compile(), or nullptr if the filter has
+	// changed since (or was never compiled). Since it's immutable it can be
+	// shared by copies of this filter
+	std::shared_ptr<aux::ip_filter_lookup const> m_lookup;
 };
 
 // the port filter maps non-overlapping port ranges to flags. This
@@ -85,6 +85,11 @@ namespace dht {
 		virtual bool on_dht_request(string_view query
 			, dht::msg const& request, entry& response) = 0;
 
+		// returns true if there is anything that may handle requests via
+		// on_dht_request(). If not, responses can be written without
+		// building an entry first
+		virtual bool has_dht_request_handlers() const = 0;
+
 	protected:
 		~dht_observer() = default;
 	};
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/address.hpp>
 #include <libtorrent/span.hpp>
 #include <libtorrent/string_view.hpp>
+#include <libtorrent/time.hpp>
 
 namespace libtorrent {
 
@@ -51,6 +52,18 @@ namespace libtorrent {
 namespace libtorrent { namespace dht {
 	struct dht_settings;
 
+	// limits shared by the built-in storage implementations
+
+	// peers that haven't announced for one and a half times this interval
+	// are removed
+	// TODO: 2 make this configurable in dht_settings
+	constexpr time_duration announce_interval = minutes(30);
+
+	// the bounds of the interval and the number of samples returned in
+	// responses to sample_infohashes (BEP 51)
+	constexpr int sample_infohashes_interval_max = 21600;
+	constexpr int infohashes_sample_count_max = 20;
+
 	// This structure hold the relevant counters for the storage
 	struct TORRENT_EXPORT dht_storage_counters
 	{
@@ -70,11 +83,13 @@ namespace libtorrent { namespace dht {
 	// the peers, mutable and immutable items and it's designed to
 	// provide a fast and fully compliant behavior of the BEPs.
 	//
-	// libtorrent comes with one built-in storage implementation:
+	// libtorrent comes with two built-in storage implementations:
 	// ``dht_default_storage`` (private non-accessible class). Its
 	// constructor function is called dht_default_storage_constructor().
 	// You should know that if this storage becomes full of DHT items,
 	// the current implementation could degrade in performance.
+	// The other one is constructed by dht_compact_storage_constructor(),
+	// and is meant for nodes storing a large number of torrents and items.
 	//
 	struct TORRENT_EXPORT dht_storage_interface
 	{
@@ -239,6 +254,19 @@ namespace libtorrent { namespace dht {
 	TORRENT_EXPORT std::unique_ptr<dht_storage_interface>
 		dht_default_storage_constructor(dht_settings const& settings);
 
+	// constructs a storage intended for nodes that track a large number of
+	// torrents and items, such as bootstrap nodes. Torrents and items are
+	// kept in dense arrays indexed by open-addressing hash tables, and peers
+	// are stored as fixed size 12 (IPv4) or 24 (IPv6) byte records. Picking
+	// peers for get_peers replies and info-hashes for samples takes time
+	// proportional to the number of entries returned. When the item tables
+	// are full, the item to evict is picked among a small random sample of
+	// items (an approximation of the least important item, evicting the
+	// least recently seen on ties). The behavior is otherwise the same as
+	// the default storage.
+	TORRENT_EXPORT std::unique_ptr<dht_storage_interface>
+		dht_compact_storage_constructor(dht_settings const& settings);
+
 } } // namespace libtorrent::dht
 
 #endif //TORRENT_DHT_STORAGE_HPP
@@ -174,6 +174,8 @@ namespace libtorrent { namespace dht {
 		// implements socket_manager
 		bool has_quota() override;
 		bool send_packet(aux::listen_socket_handle const& s, entry& e, udp::endpoint const& addr) override;
+		bool send_packet(aux::listen_socket_handle const& s, span<char const> buf
+			, udp::endpoint const& addr) override;
 
 		// this is the bdecode_node DHT messages are parsed into. It's a member
 		// in order to avoid having to deallocate and re-allocate it for every
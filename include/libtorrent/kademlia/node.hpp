@@ -64,6 +64,7 @@ struct dht_observer;
 struct msg;
 
 TORRENT_EXTRA_EXPORT entry write_nodes_entry(std::vector<node_entry> const& nodes);
+TORRENT_EXTRA_EXPORT entry write_nodes_entry(span<node_entry const* const> nodes);
 
 class announce_observer : public observer
 {
@@ -80,6 +81,12 @@ struct socket_manager
 {
 	virtual bool has_quota() = 0;
 	virtual bool send_packet(aux::listen_socket_handle const& s, entry& e, udp::endpoint const& addr) = 0;
+
+	// sends a message that has already been bencoded, including the "v" key.
+	// The default implementation decodes it and forwards it to the entry
+	// overload
+	virtual bool send_packet(aux::listen_socket_handle const& s
+		, span<char const> buf, udp::endpoint const& addr);
 protected:
 	~socket_manager() = default;
 };
@@ -233,6 +240,12 @@ private:
 
 	void incoming_request(msg const& h, entry& e);
 
+	// writes the response to get_peers, find_node and announce_peer requests
+	// directly into ``buf``, without building an entry. Returns false if the
+	// request is of another kind or is invalid, in which case nothing has
+	// been done and it must be handled by incoming_request()
+	bool write_response(msg const& m, std::vector<char>& buf);
+
 	void write_nodes_entries(sha1_hash const& info_hash
 		, bdecode_node const& want, entry& r);
 
@@ -275,6 +288,10 @@ private:
 
 	dht_storage_interface& m_storage;
 
+	// the buffer responses are serialized into by write_response(). It's a
+	// member to avoid allocating a new one for every message
+	std::vector<char> m_response_buf;
+
 #ifndef TORRENT_DISABLE_LOGGING
 	std::uint32_t m_search_id = 0;
 #endif
@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <cstdint>
 #include <memory>
+#include <algorithm>
 
 #include <libtorrent/time.hpp>
 #include <libtorrent/address.hpp>
@@ -101,6 +102,13 @@ struct TORRENT_EXTRA_EXPORT observer
 	void set_id(node_id const& id);
 	node_id const& id() const { return m_id; }
 
+	// the round-trip time (in milliseconds) we expect from this node, or
+	// 0xffff if unknown. It's seeded from the routing table and updated
+	// once the node responds
+	int rtt() const { return m_rtt; }
+	void set_rtt(int rtt)
+	{ m_rtt = std::uint16_t(std::min(rtt, 0xffff)); }
+
 	static constexpr observer_flags_t flag_queried = 0_bit;
 	static constexpr observer_flags_t flag_initial = 1_bit;
 	static constexpr observer_flags_t flag_no_id = 2_bit;
@@ -134,6 +142,7 @@ private:
 	} m_addr;
 
 	std::uint16_t m_port = 0;
+	std::uint16_t m_rtt = 0xffff;
 
 public:
 	observer_flags_t flags{};
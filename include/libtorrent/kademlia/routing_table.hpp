@@ -35,7 +35,6 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <set>
-#include <unordered_set>
 #include <cstdint>
 #include <tuple>
 #include <array>
@@ -45,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/assert.hpp>
 #include <libtorrent/time.hpp>
 #include <libtorrent/aux_/vector.hpp>
+#include <libtorrent/span.hpp>
 
 namespace libtorrent {
 
@@ -67,29 +67,48 @@ struct routing_table_node
 	bucket_t live_nodes;
 };
 
-struct ipv4_hash
+// a compact, open addressing hash table of IP addresses. Each address has a
+// reference count, since there can be multiple routing table entries for a
+// single IP when restrict_routing_ips is set to false
+template <typename Bytes>
+struct ip_hash_table
 {
-	using argument_type = address_v4::bytes_type;
-	using result_type = std::size_t;
-	result_type operator()(argument_type const& ip) const
+	void insert(Bytes const& ip);
+	bool exists(Bytes const& ip) const;
+	void erase(Bytes const& ip);
+
+	void clear()
 	{
-		return std::hash<std::uint32_t>()(*reinterpret_cast<std::uint32_t const*>(&ip[0]));
+		m_slots.clear();
+		m_size = 0;
 	}
-};
 
-#if TORRENT_USE_IPV6
-struct ipv6_hash
-{
-	using argument_type = address_v6::bytes_type;
-	using result_type = std::size_t;
-	result_type operator()(argument_type const& ip) const
+	int size() const { return m_size; }
+
+	bool operator==(ip_hash_table const& rh) const;
+
+private:
+
+	struct slot
 	{
-		return std::hash<std::uint64_t>()(*reinterpret_cast<std::uint64_t const*>(&ip[0]));
-	}
+		Bytes ip;
+		// zero means this slot is empty
+		std::uint32_t count;
+	};
+
+	// returns the slot the IP is in, or the empty slot where it would be
+	// inserted
+	std::size_t find_slot(Bytes const& ip) const;
+	void grow();
+
+	// the number of slots is always 0 or a power of two
+	std::vector<slot> m_slots;
+
+	// the number of unique IPs in the table
+	int m_size = 0;
 };
-#endif
 
-struct ip_set
+struct TORRENT_EXTRA_EXPORT ip_set
 {
 	void insert(address const& addr);
 	bool exists(address const& addr) const;
@@ -103,20 +122,11 @@ struct ip_set
 #endif
 	}
 
-	bool operator==(ip_set const& rh)
-	{
-#if TORRENT_USE_IPV6
-		return m_ip4s == rh.m_ip4s && m_ip6s == rh.m_ip6s;
-#else
-		return m_ip4s == rh.m_ip4s;
-#endif
-	}
+	bool operator==(ip_set const& rh) const;
 
-	// these must be multisets because there can be multiple routing table
-	// entries for a single IP when restrict_routing_ips is set to false
-	std::unordered_multiset<address_v4::bytes_type, ipv4_hash> m_ip4s;
+	ip_hash_table<address_v4::bytes_type> m_ip4s;
 #if TORRENT_USE_IPV6
-	std::unordered_multiset<address_v6::bytes_type, ipv6_hash> m_ip6s;
+	ip_hash_table<address_v6::bytes_type> m_ip6s;
 #endif
 };
 
@@ -211,6 +221,13 @@ public:
 	// are nearest to the given id.
 	void find_node(node_id const& id, std::vector<node_entry>& l
 		, int options, int count = 0);
+
+	// fills in ``nodes`` with pointers to the (at most) nodes.size() entries
+	// nearest to the given id, and returns the number of entries filled in.
+	// This neither allocates nor sorts the candidates. The pointers are
+	// invalidated by any modification of the routing table
+	int find_node(node_id const& id, span<node_entry const*> nodes
+		, int options) const;
 	void remove_node(node_entry* n
 		, table_t::iterator bucket) ;
 
@@ -277,6 +294,10 @@ private:
 #endif
 
 	table_t::iterator find_bucket(node_id const& id);
+
+	// returns the index of the bucket the given node ID belongs in, or -1 if
+	// we don't have any buckets yet
+	int bucket_index(node_id const& id) const;
 	void remove_node_internal(node_entry* n, bucket_t& b);
 
 	void split_bucket();
@@ -287,6 +308,12 @@ private:
 	node_entry* find_node(udp::endpoint const& ep
 		, routing_table::table_t::iterator* bucket);
 
+	// like find_node(), but first looks in the bucket ``id`` belongs in. If
+	// the endpoint belongs to a node with that ID, this avoids scanning the
+	// whole table
+	node_entry* find_node(udp::endpoint const& ep, node_id const& id
+		, routing_table::table_t::iterator* bucket);
+
 	// if the bucket is not full, try to fill it with nodes from the
 	// replacement list
 	void fill_from_replacements(table_t::iterator bucket);
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <libtorrent/socket.hpp>
 #include <libtorrent/time.hpp>
+#include <libtorrent/sliding_average.hpp>
 #include <libtorrent/kademlia/node_id.hpp>
 #include <libtorrent/kademlia/observer.hpp>
 #include <libtorrent/aux_/listen_socket_handle.hpp>
@@ -84,6 +85,11 @@ public:
 	bool incoming(msg const&, node_id* id);
 	time_duration tick();
 
+	// the time we wait for a response before we consider it late and open
+	// up another slot in the traversal it belongs to. This adapts to the
+	// round-trip times we observe, and is never more than one second
+	time_duration short_timeout() const;
+
 	bool invoke(entry& e, udp::endpoint const& target
 		, observer_ptr o);
 
@@ -131,6 +137,11 @@ private:
 	dht_settings const& m_settings;
 	routing_table& m_table;
 	node_id m_our_id;
+
+	// the moving average (and deviation) of the round-trip times of
+	// responses to our requests, in milliseconds
+	sliding_average<32> m_rtt;
+
 	std::uint32_t m_allocated_observers:31;
 	std::uint32_t m_destructing:1;
 };
@@ -76,7 +76,11 @@ struct TORRENT_EXTRA_EXPORT traversal_algorithm
 	node_id const& target() const { return m_target; }
 
 	void resort_result(observer*);
-	void add_entry(node_id const& id, udp::endpoint const& addr, observer_flags_t flags);
+	// rtt is the round-trip time (in milliseconds) we expect from this node,
+	// or 0xffff if unknown. It's used to prefer fast nodes among the ones
+	// equally close to the target
+	void add_entry(node_id const& id, udp::endpoint const& addr
+		, observer_flags_t flags, int rtt = 0xffff);
 
 	traversal_algorithm(node& dht_node, node_id const& target);
 	traversal_algorithm(traversal_algorithm const&) = delete;
@@ -101,6 +105,17 @@ protected:
 	void add_router_entries();
 	void init();
 
+	// returns the unqueried candidate in [i, end) to invoke next. This is
+	// normally i itself, but among candidates at the same distance from the
+	// target, the one with the lowest known round-trip time is preferred
+	std::vector<observer_ptr>::iterator pick_candidate(
+		std::vector<observer_ptr>::iterator i
+		, std::vector<observer_ptr>::iterator end) const;
+
+	// check whether the set of the k closest nodes that have responded
+	// changed as a result of the last response
+	void update_stable_count();
+
 	virtual void done();
 	// should construct an algorithm dependent
 	// observer in ptr.
@@ -134,6 +149,17 @@ private:
 	std::int16_t m_responses = 0;
 	std::int16_t m_timeouts = 0;
 
+	// the number of consecutive responses that did not change the set of
+	// the k closest live nodes. Once this reaches the branch factor, the
+	// lookup is considered converged and is allowed to complete without
+	// waiting for the remaining outstanding requests
+	std::int8_t m_stable_responses = 0;
+
+	// the node ID of the k:th closest live node, the last time we checked.
+	// Since the set is kept sorted, any change to the k closest live nodes
+	// also changes this node
+	node_id m_kth_closest;
+
 #ifndef TORRENT_DISABLE_LOGGING
 	// this is a unique ID for this specific traversal_algorithm instance,
 	// just used for logging
@@ -35,14 +35,15 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/config.hpp"
 
-#include "libtorrent/aux_/throw.hpp"
 #include "libtorrent/aux_/vector.hpp"
 #include "libtorrent/aux_/numeric_cast.hpp"
 #include "libtorrent/time.hpp"
 #include "libtorrent/assert.hpp"
 #include "libtorrent/debug.hpp" // for single_threaded
 
-#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <cstddef>
 
 namespace libtorrent {
 
@@ -103,7 +104,7 @@ namespace libtorrent {
 		{
 			TORRENT_ASSERT(p != nullptr);
 			p->~packet();
-			std::free(p);
+			::operator delete(p);
 		}
 	};
 
@@ -111,8 +112,8 @@ namespace libtorrent {
 
 	inline packet_ptr create_packet(int const size)
 	{
-		packet* p = static_cast<packet*>(std::malloc(sizeof(packet) + aux::numeric_cast<std::uint16_t>(size)));
-		if (p == nullptr) aux::throw_ex<std::bad_alloc>();
+		packet* p = static_cast<packet*>(::operator new(sizeof(packet)
+			+ aux::numeric_cast<std::uint16_t>(size)));
 		new (p) packet();
 		p->allocated = aux::numeric_cast<std::uint16_t>(size);
 		return packet_ptr(p);
@@ -145,10 +146,13 @@ namespace libtorrent {
 			return ret;
 		}
 
+		// frees a sixteenth of the cached packets (and at least one), to not
+		// hold on to a large cache for long after a burst
 		void decay()
 		{
 			if (m_storage.empty()) return;
-			m_storage.erase(m_storage.end() - 1);
+			std::size_t const n = std::max(std::size_t(1), m_storage.size() / 16);
+			m_storage.erase(m_storage.end() - std::ptrdiff_t(n), m_storage.end());
 		}
 
 	private:
@@ -202,9 +206,17 @@ namespace libtorrent {
 		}
 		static int const mtu_floor_size = TORRENT_INET_MIN_MTU - TORRENT_IPV4_HEADER - TORRENT_UDP_HEADER;
 		static int const mtu_ceiling_size = TORRENT_ETHERNET_MTU - TORRENT_IPV4_HEADER - TORRENT_UDP_HEADER;
+		// full sized packets are the ones that sockets with a deep send
+		// queue keep in flight. Cache enough of them to cover a full window
+		// (which is bounded by the 1 MiB receive buffer uTP sockets
+		// advertise), to avoid hitting the heap every time a window worth of
+		// packets is ACKed and then sent again. The cache decays over time
+		// when idle
+		static std::size_t const mtu_ceiling_limit
+			= (1024 * 1024 + mtu_ceiling_size - 1) / mtu_ceiling_size;
 		packet_slab m_syn_slab{ TORRENT_UTP_HEADER };
 		packet_slab m_mtu_floor_slab{ mtu_floor_size };
-		packet_slab m_mtu_ceiling_slab{ mtu_ceiling_size };
+		packet_slab m_mtu_ceiling_slab{ mtu_ceiling_size, mtu_ceiling_limit };
 	};
 }
 
@@ -36,13 +36,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <vector>
 #include <mutex>
-#include <unordered_map>
+#include <set>
 #include <cstdint>
 
 #include "libtorrent/config.hpp"
 #include "libtorrent/file.hpp"
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/units.hpp"
+#include "libtorrent/aux_/vector.hpp"
 
 namespace libtorrent {
 
@@ -82,20 +83,52 @@ namespace libtorrent {
 		std::string m_path;
 		std::string m_name;
 
-		// allocate a slot and return the slot index
+		// allocate a slot and return the slot index. The slot following the
+		// one of the previous piece (or preceding the one of the next piece) is
+		// preferred, to keep runs of pieces contiguous in the file
 		slot_index_t allocate_slot(piece_index_t piece);
 
+		// removes the piece from the slot map. The slot is returned to the free
+		// list once there is no more outstanding I/O against it
+		void unmap_piece(piece_index_t piece);
+
+		// drops one reference to a slot taken for the duration of an I/O
+		// operation
+		void unpin_slot(slot_index_t slot);
+
+		// flags the header page holding the slot entry of ``piece`` as needing
+		// to be written
+		void mark_dirty(piece_index_t piece);
+
+		std::int64_t slot_offset(slot_index_t const slot) const
+		{
+			return std::int64_t(m_header_size)
+				+ std::int64_t(static_cast<int>(slot)) * m_piece_size;
+		}
+
 		// this mutex must be held while accessing the data
 		// structure. Not while reading or writing from the file though!
 		// it's important to support multithreading
 		std::mutex m_mutex;
 
-		// this is a list of unallocated slots in the part file
-		// within the m_num_allocated range
-		std::vector<slot_index_t> m_free_slots;
+		struct slot_entry
+		{
+			// the piece stored in this slot, or -1 if it's free (or waiting to
+			// be freed)
+			piece_index_t piece{-1};
 
-		// this is the number of slots allocated
-		slot_index_t m_num_allocated{0};
+			// the number of read and write operations currently in progress
+			// against this slot. A slot whose piece has been freed is not
+			// reused until this drops to zero
+			int refs = 0;
+		};
+
+		// one entry per slot allocated in the file
+		aux::vector<slot_entry, slot_index_t> m_slots;
+
+		// this is a list of unallocated slots in the part file
+		// within the allocated range
+		std::set<slot_index_t> m_free_slots;
 
 		// the max number of pieces in the torrent this part file is
 		// backing
@@ -109,13 +142,20 @@ namespace libtorrent {
 		// payload data from
 		int m_header_size;
 
+		// the number of pieces currently stored in the part file
+		int m_num_pieces = 0;
+
 		// if this is true, the metadata in memory has changed since
 		// we last saved or read it from disk. It means that we
 		// need to flush the metadata before closing the file
 		bool m_dirty_metadata = false;
 
-		// maps a piece index to the part-file slot it is stored in
-		std::unordered_map<piece_index_t, slot_index_t> m_piece_map;
+		// one entry per kilobyte of the header. Only the pages that have
+		// changed since the last flush are written back
+		std::vector<bool> m_dirty_pages;
+
+		// maps a piece index to the part-file slot it is stored in, or -1
+		aux::vector<slot_index_t, piece_index_t> m_piece_map;
 
 		// this is the file handle to the part file
 		file m_file;
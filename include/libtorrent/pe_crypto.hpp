@@ -48,6 +48,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/span.hpp"
 #include "libtorrent/buffer.hpp"
 #include "libtorrent/aux_/array.hpp"
+#include "libtorrent/aux_/chacha20.hpp"
 
 #include <list>
 #include <array>
@@ -155,6 +156,33 @@ namespace libtorrent {
 		bool m_decrypt;
 	};
 
+	// encrypts the stream with ChaCha20. This is negotiated in the MSE
+	// handshake like RC4, but is only understood by libtorrent peers
+	struct TORRENT_EXTRA_EXPORT chacha20_handler : crypto_plugin
+	{
+		// the number of bytes of key material expected by set_incoming_key()
+		// and set_outgoing_key(): the 32 byte key followed by the 8 byte nonce
+		static constexpr int key_size = aux::chacha20::key_size
+			+ aux::chacha20::nonce_size;
+
+		chacha20_handler();
+
+		void set_incoming_key(span<char const> key) override;
+		void set_outgoing_key(span<char const> key) override;
+
+		std::tuple<int, span<span<char const>>>
+		encrypt(span<span<char>> buf) override;
+
+		std::tuple<int, int, int> decrypt(span<span<char>> buf) override;
+
+	private:
+		aux::chacha20 m_incoming;
+		aux::chacha20 m_outgoing;
+
+		bool m_encrypt;
+		bool m_decrypt;
+	};
+
 } // namespace libtorrent
 
 #endif // TORRENT_PE_CRYPTO_HPP_INCLUDED
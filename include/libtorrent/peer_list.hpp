@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_POLICY_HPP_INCLUDED
 
 #include <algorithm>
+#include <functional>
 #include "libtorrent/string_util.hpp" // for allocate_string_copy
 #include "libtorrent/request_blocks.hpp" // for source_rank
 
@@ -47,6 +48,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 #include "libtorrent/peer_connection_interface.hpp"
 #include "libtorrent/aux_/deque.hpp"
+#include "libtorrent/aux_/cold_peer_table.hpp"
 #include "libtorrent/peer_info.hpp" // for peer_source_flags_t
 #include "libtorrent/string_view.hpp"
 
@@ -76,7 +78,12 @@ namespace libtorrent {
 		// the number of iterations over the peer list for this operation
 		int loop_counter = 0;
 
-		// these are used only by find_connect_candidates in order
+		// the number of iterations over the peer list a scan for connect
+		// candidates would have needed, that were saved by picking the
+		// candidate from the candidate heap instead
+		int loops_saved = 0;
+
+		// these are used only by connect_one_peer in order
 		// to implement peer ranking. See:
 		// http://blog.libtorrent.org/2012/12/swarm-connectivity/
 		external_ip ip;
@@ -159,8 +166,41 @@ namespace libtorrent {
 		void check_invariant() const;
 #endif
 
-		int num_peers() const { return int(m_peers.size()); }
+		// the total number of peers in the list, including the ones kept in
+		// compact form (see num_cold_peers())
+		int num_peers() const { return int(m_peers.size()) + num_cold_peers(); }
+
+		// the number of peers that are neither connected nor connect
+		// candidates, and are kept in a compact form rather than as
+		// torrent_peer objects. These are turned back into torrent_peer
+		// objects as soon as they're needed again, for instance when they are
+		// added again, connect to us or become connect candidates. Since
+		// that's when they get new torrent_peer objects, these peers are
+		// reported as erased (in torrent_state::erased) when they are compacted
+		int num_cold_peers() const
+		{
+#if TORRENT_USE_IPV6
+			return m_cold4.size() + m_cold6.size();
+#else
+			return m_cold4.size();
+#endif
+		}
+
+		// calls ``f`` for every peer in the list. Cold peers are passed as
+		// temporary torrent_peer objects, which ``f`` must not hold on to
+		void for_each_peer(std::function<void(torrent_peer const&)> const& f) const;
 
+		// resets last_connected of every peer, to allow reconnecting to them
+		// immediately
+		void clear_last_connected();
+
+		// moves all session time stamps (last_connected and
+		// last_optimistically_unchoked) back by ``seconds``, clamping them at 0.
+		// This is called when the session time epoch is stepped forward
+		void step_session_time(int seconds);
+
+		// iterating over the peer list, and find_peers(), only covers the
+		// peers held as torrent_peer objects, not the cold ones
 		using peers_t = aux::deque<torrent_peer*>;
 		using iterator = peers_t::iterator;
 		using const_iterator = peers_t::const_iterator;
@@ -190,7 +230,8 @@ namespace libtorrent {
 		bool has_peer(torrent_peer const* p) const;
 
 		int num_seeds() const { return int(m_num_seeds); }
-		int num_connect_candidates() const { return m_num_connect_candidates; }
+		int num_connect_candidates() const
+		{ return int(m_candidates.size() + m_waiting.size()); }
 
 		void erase_peer(torrent_peer* p, torrent_state* state);
 		void erase_peer(iterator i, torrent_state* state);
@@ -201,7 +242,17 @@ namespace libtorrent {
 
 		void recalculate_connect_candidates(torrent_state* state);
 
-		void update_connect_candidates(int delta);
+		// the session time at which p may be connected to again
+		int reconnect_time(torrent_peer const& p) const;
+
+		// these keep the connect candidate heaps in sync with
+		// is_connect_candidate(). update_candidate() must be called whenever
+		// anything that affects whether p is a candidate, or how good of a
+		// candidate it is, has changed
+		void update_candidate(torrent_peer* p);
+		void add_candidate(torrent_peer* p, int time);
+		void remove_candidate(torrent_peer* p);
+		void rebuild_candidates();
 
 		void update_peer(torrent_peer* p, peer_source_flags_t src, int flags
 		, tcp::endpoint const& remote);
@@ -211,8 +262,10 @@ namespace libtorrent {
 		bool compare_peer(torrent_peer const* lhs, torrent_peer const* rhs
 			, external_ip const& external, int source_port) const;
 
-		void find_connect_candidates(std::vector<torrent_peer*>& peers
-			, int session_time, torrent_state* state);
+		// visits a few peers (starting at m_round_robin) to demote the ones
+		// that aren't candidates anymore, and to erase peers if the list is
+		// getting full. Returns the number of peers visited
+		int weed_peers(torrent_state* state);
 
 		bool is_connect_candidate(torrent_peer const& p) const;
 		bool is_erase_candidate(torrent_peer const& p) const;
@@ -221,9 +274,39 @@ namespace libtorrent {
 
 		enum flags_t { force_erase = 1 };
 		void erase_peers(torrent_state* state, int flags = 0);
+		bool erase_cold_peer(int flags);
+
+		// removes the peer at i from m_peers and frees it, reporting it in
+		// state->erased. This is the part erasing and demoting peers have
+		// in common
+		void remove_peer_entry(iterator i, torrent_state* state);
+
+		// returns true if p can be turned into a cold peer without losing
+		// any of its state
+		bool can_demote(torrent_peer const& p) const;
+		void demote_peer(iterator i, torrent_state* state);
+
+		// turns the cold peer with address ``a`` (and ``port``, unless it's -1)
+		// back into a torrent_peer in m_peers. Returns an iterator to it, or
+		// m_peers.end() if there was no such peer
+		iterator promote_peer(address const& a, int port);
+		void promote_cold_candidates();
+
+		// allocates a torrent_peer for the cold peer ``c`` and inserts it into
+		// m_peers (but leaves ``c`` in its table)
+		template <typename Addr>
+		iterator materialize_peer(aux::cold_peer<Addr> const& c);
 
 		peers_t m_peers;
 
+		// the peers that are neither connected nor connect candidates, in
+		// compact form. A peer is either in m_peers or in one of these tables,
+		// never both
+		aux::cold_peer_table<std::uint32_t> m_cold4;
+#if TORRENT_USE_IPV6
+		aux::cold_peer_table<address_v6::bytes_type> m_cold6;
+#endif
+
 		// this should be nullptr for the most part. It's set
 		// to point to a valid torrent_peer object if that
 		// object needs to be kept alive. If we ever feel
@@ -253,16 +336,37 @@ namespace libtorrent {
 		// to scan all of it, start at this index
 		int m_round_robin = 0;
 
-		// a list of good connect candidates
-		std::vector<torrent_peer*> m_candidate_cache;
+		// The peers in our torrent_peer list that are connect candidates.
+		// i.e. they're not already connected and they have not yet reached
+		// their max try count and they have the connectable state (we have a
+		// listen port for them). Every candidate is in exactly one of these
+		// heaps, and knows its position in it (torrent_peer::heap_index).
+		// m_candidates holds the ones we may connect to right away, the best
+		// one (according to compare_peer()) first. m_waiting holds the ones
+		// whose reconnect time hasn't passed yet, the earliest first. New
+		// candidates start out in m_waiting, and are moved over to
+		// m_candidates by connect_one_peer()
+		std::vector<torrent_peer*> m_candidates;
+		struct waiting_peer
+		{
+			int time;
+			torrent_peer* peer;
+		};
+		std::vector<waiting_peer> m_waiting;
+
+		// the external address and port last passed in via torrent_state.
+		// They are used to rank peers in m_candidates
+		external_ip m_external;
+		int m_external_port = 0;
+
+		// set when the ranks of peers have been reset (see clear_peer_prio())
+		// or their last_connected changed, which requires m_candidates to be
+		// re-ordered before it's used next
+		bool m_candidates_dirty = false;
 
-		// The number of peers in our torrent_peer list
-		// that are connect candidates. i.e. they're
-		// not already connected and they have not
-		// yet reached their max try count and they
-		// have the connectable state (we have a listen
-		// port for them).
-		int m_num_connect_candidates = 0;
+		// torrent_state::min_reconnect_time, as of the last call to
+		// connect_one_peer()
+		int m_min_reconnect_time = 60;
 
 		// if a peer has failed this many times or more, we don't consider
 		// it a connect candidate anymore.
@@ -116,6 +116,10 @@ namespace libtorrent {
 			// the number of iterations over the peer list when finding
 			// a connect candidate
 			connection_attempt_loops,
+			// the number of iterations over the peer list a scan for connect
+			// candidates would have taken, that were saved by keeping the
+			// candidates in a heap
+			connection_attempt_loops_saved,
 			// successful incoming connections (not rejected for any reason)
 			incoming_connections,
 
@@ -181,6 +185,13 @@ namespace libtorrent {
 			num_piece_passed,
 			num_piece_failed,
 
+			// the number of blocks of failed pieces the smart ban plugin hashed,
+			// the time it spent hashing them (in microseconds) and the number of
+			// pieces it forgot about to stay within smart_ban_memory_limit
+			smart_ban_hashed_blocks,
+			smart_ban_hash_time,
+			smart_ban_evicted_pieces,
+
 			num_have_pieces,
 			num_total_pieces_added,
 
@@ -438,6 +449,10 @@ namespace libtorrent {
 
 			has_incoming_connections,
 
+			// the number of bytes used by the smart ban plugin to remember the
+			// blocks of failed pieces
+			smart_ban_memory,
+
 			limiter_up_queue,
 			limiter_down_queue,
 			limiter_up_bytes,
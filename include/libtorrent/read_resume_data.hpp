@@ -50,6 +50,10 @@ namespace libtorrent {
 	// If the client wants to override any field that was loaded from the resume
 	// data, e.g. save_path, those fields must be changed after loading resume
 	// data but before adding the torrent.
+	//
+	// The buffer overload accepts both bencoded and binary resume data (see
+	// resume_data_format), including binary resume data with delta records
+	// appended to it.
 	TORRENT_EXPORT add_torrent_params read_resume_data(bdecode_node const& rd
 		, error_code& ec);
 	TORRENT_EXPORT add_torrent_params read_resume_data(span<char const> buffer
@@ -692,7 +692,9 @@ namespace libtorrent {
 			enable_dht,
 
 			// if the allowed encryption level is both, setting this to true will
-			// prefer rc4 if both methods are offered, plaintext otherwise
+			// prefer rc4 if both methods are offered, plaintext otherwise. More
+			// generally, the strongest of the offered and allowed methods is
+			// selected, rather than the weakest
 			prefer_rc4,
 
 			// if true, hostname lookups are done via the configured proxy (if
@@ -726,6 +728,15 @@ namespace libtorrent {
 			// changes are taken in consideration.
 			enable_ip_notifier,
 
+			// when enabled, resume data includes a snapshot of the size,
+			// modification time and inode of every file the storage has
+			// seen (see add_torrent_params::file_snapshots). Torrents added
+			// with such resume data trust the snapshot instead of stat()ing
+			// all their files before starting, and check each file against it
+			// the first time it's opened. This lets torrents with many files,
+			// or files on slow network storage, start seeding right away.
+			resume_file_snapshots,
+
 			max_bool_setting_internal
 		};
 
@@ -1650,8 +1661,11 @@ namespace libtorrent {
 			// systems.
 			close_file_interval,
 
-			// the max number of web seeds to have connected per torrent at any
-			// given time.
+			// the max number of connections to web seeds to have open per
+			// torrent at any given time. Every web seed is given one connection
+			// first. Any left over are handed to web seeds where opening another
+			// connection has been found to increase the download rate, so a
+			// single fast server may end up with several of them.
 			max_web_seed_connections,
 
 			// the number of seconds before the internal host name resolver
@@ -1659,6 +1673,13 @@ namespace libtorrent {
 			// as zero.
 			resolver_cache_timeout,
 
+			// the max number of bytes the smart ban plugin may use, per torrent,
+			// to remember the blocks of failed pieces and who sent them. When
+			// the limit is reached, the pieces that failed the longest time ago
+			// are forgotten. The peers that sent bad data in those pieces won't
+			// be banned if the piece later passes. Each block takes 16 bytes.
+			smart_ban_memory_limit,
+
 			max_int_setting_internal
 		};
 
@@ -1734,7 +1755,13 @@ namespace libtorrent {
 			// use only rc4 encryption
 			pe_rc4 = 2,
 			// allow both
-			pe_both = 3
+			pe_both = 3,
+			// use ChaCha20 encryption. This is not part of the MSE
+			// specification, only libtorrent peers support it. It's a lot
+			// cheaper than RC4 (and not broken) so when it's combined with
+			// pe_rc4 and prefer_rc4 is set, it's selected whenever the other
+			// end offers it
+			pe_chacha20 = 4
 		};
 
 		enum proxy_type_t
@@ -36,15 +36,20 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <mutex>
 
 #include "libtorrent/config.hpp"
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/file_storage.hpp"
 #include "libtorrent/units.hpp"
+#include "libtorrent/bitfield.hpp"
+#include "libtorrent/file_snapshot.hpp"
 #include "libtorrent/aux_/vector.hpp"
 
 namespace libtorrent {
 
+	struct file_status;
+
 	struct TORRENT_EXTRA_EXPORT stat_cache
 	{
 		stat_cache();
@@ -61,6 +66,27 @@ namespace libtorrent {
 
 		void clear();
 
+		// populates the cache with a snapshot saved with the resume data. These
+		// entries are trusted by get_filesize() without touching the
+		// filesystem, until the file is opened and the entry is checked by
+		// check_snapshot()
+		void load_snapshot(std::vector<file_snapshot> const& s);
+
+		// returns one entry per file, with a size of -1 for files whose state
+		// isn't known. If nothing is known, the returned vector is empty
+		std::vector<file_snapshot> snapshot(int num_files) const;
+
+		// returns true if the entry for file ``i`` was loaded from a snapshot
+		// and hasn't been compared against the file yet
+		bool needs_check(file_index_t i) const;
+
+		// compares the state of file ``i``, as reported by the filesystem, with
+		// the snapshot entry loaded for it, and sets ``ec`` to
+		// mismatching_file_size or mismatching_file_timestamp if they differ.
+		// Either way, the cache is updated with ``st``, and the file won't be
+		// checked again
+		void check_snapshot(file_index_t i, file_status const& st, error_code& ec);
+
 		// internal
 		enum
 		{
@@ -70,10 +96,15 @@ namespace libtorrent {
 
 		// internal
 		void set_cache(file_index_t i, std::int64_t size);
+		void set_cache(file_index_t i, file_status const& st);
 		void set_error(file_index_t i, error_code const& ec);
 
 	private:
 
+		void set_cache_impl(file_index_t i, std::int64_t size
+			, std::int64_t mtime, std::uint64_t inode);
+		void set_error_impl(file_index_t i, error_code const& ec);
+
 		// returns the index to the specified error. Either an existing one or a
 		// newly added entry
 		int add_error(error_code const& ec);
@@ -88,11 +119,25 @@ namespace libtorrent {
 			// occurred while stat()ing the file. The positive value is an index
 			// into m_errors, that recorded the actual error.
 			std::int64_t file_size;
+
+			// the modification time and inode of the file. Only valid when
+			// file_size is
+			std::int64_t mtime = 0;
+			std::uint64_t inode = 0;
 		};
 
+		// the cache is used by the disk threads, and read from the network
+		// thread when saving resume data. The filesystem is never accessed
+		// while holding this mutex
+		mutable std::mutex m_mutex;
+
 		// one entry per file
 		aux::vector<stat_cache_t, file_index_t> m_stat_cache;
 
+		// one bit per file. Set for entries loaded from a snapshot that
+		// haven't been checked against the filesystem yet
+		typed_bitfield<file_index_t> m_unchecked;
+
 		// These are the errors that have happened when stating files. Each entry
 		// that had an error, refers to an index into this vector.
 		std::vector<error_code> m_errors;
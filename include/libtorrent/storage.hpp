@@ -46,6 +46,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/allocator.hpp"
 #include "libtorrent/part_file.hpp"
 #include "libtorrent/stat_cache.hpp"
+#include "libtorrent/file_snapshot.hpp"
 #include "libtorrent/bitfield.hpp"
 #include "libtorrent/span.hpp"
 #include "libtorrent/aux_/vector.hpp"
@@ -298,12 +299,28 @@ namespace libtorrent {
 		//		};
 		virtual void delete_files(remove_flags_t options, storage_error& ec) = 0;
 
+		// This function is called from the network thread when saving resume
+		// data. It may return the size, modification time and inode of the
+		// files, as they're known by the storage, to be saved as
+		// add_torrent_params::file_snapshots. The default implementation
+		// doesn't return any.
+		virtual std::vector<file_snapshot> file_snapshots() const { return {}; }
+
 		// called periodically (useful for deferred flushing). When returning
 		// false, it means no more ticks are necessary. Any disk job submitted
 		// will re-enable ticking. The default will always turn ticking back
 		// off again.
 		virtual bool tick() { return false; }
 
+		// called from a disk thread while it's performing a job on this
+		// storage, for read jobs queued up behind it. It's a hint that the
+		// range ``offset`` bytes into ``piece``, ``size`` bytes long, is about
+		// to be read with the open mode ``flags``. A storage may use this to
+		// prepare, for instance by opening the files it maps to ahead of time.
+		// The default does nothing.
+		virtual void hint_read(piece_index_t, int /* offset */, int /* size */
+			, open_mode_t /* flags */) {}
+
 		file_storage const& files() const { return m_files; }
 
 		bool set_need_tick()
@@ -389,6 +406,7 @@ namespace libtorrent {
 			, storage_error& ec) override;
 		void release_files(storage_error& ec) override;
 		void delete_files(remove_flags_t options, storage_error& ec) override;
+		std::vector<file_snapshot> file_snapshots() const override;
 		void initialize(storage_error& ec) override;
 		status_t move_storage(std::string const& save_path
 			, move_flags_t flags, storage_error& ec) override;
@@ -396,6 +414,8 @@ namespace libtorrent {
 			, aux::vector<std::string, file_index_t> const& links
 			, storage_error& error) override;
 		bool tick() override;
+		void hint_read(piece_index_t piece, int offset, int size
+			, open_mode_t flags) override;
 
 		int readv(span<iovec_t const> bufs
 			, piece_index_t piece, int offset, open_mode_t flags, storage_error& ec) override;
@@ -427,6 +447,9 @@ namespace libtorrent {
 		file_handle open_file(file_index_t file, open_mode_t mode, storage_error& ec) const;
 		file_handle open_file_impl(file_index_t file, open_mode_t mode, error_code& ec) const;
 
+		// the mode ``file`` is opened in, given the mode a job asks for
+		open_mode_t open_mode_for(file_index_t file, open_mode_t mode) const;
+
 		aux::vector<download_priority_t, file_index_t> m_file_priority;
 		std::string m_save_path;
 		std::string m_part_file_name;
@@ -141,7 +141,7 @@ namespace libtorrent {
 	};
 
 	// this is the internal representation of web seeds
-	struct web_seed_t : web_seed_entry
+	struct TORRENT_EXTRA_EXPORT web_seed_t : web_seed_entry
 	{
 		explicit web_seed_t(web_seed_entry const& wse);
 		web_seed_t(std::string const& url_, web_seed_entry::type_t type_
@@ -155,11 +155,47 @@ namespace libtorrent {
 		// these are its IP addresses
 		std::vector<tcp::endpoint> endpoints;
 
-		// this is the peer_info field used for the
-		// connection, just to count hash failures
-		// it's also used to hold the peer_connection
-		// pointer, when the web seed is connected
-		ipv4_peer peer_info{tcp::endpoint(), true, {}};
+		// these are the peer_info fields used for the connections, just to
+		// count hash failures. They're also used to hold the peer_connection
+		// pointers, when the web seed is connected. There is one entry per
+		// connection we've had open to this web seed at the same time (it
+		// never shrinks). A deque is used since the piece picker and the
+		// connections hold on to pointers to these entries
+		std::deque<ipv4_peer> peers;
+
+		// returns the number of open connections to this web seed
+		int num_connections() const;
+
+		// returns a peer_info entry that's not used by any connection, adding
+		// a new one if all of them are in use
+		ipv4_peer* free_peer();
+
+		// returns the peer_info entry whose connection is ``c``, or nullptr
+		ipv4_peer* find_peer(peer_connection_interface const* c);
+
+		// returns true if any of the connections to this web seed has been
+		// banned
+		bool banned() const;
+
+		// adjusts target_connections based on the combined payload download
+		// rate of the ``num_connections`` connections open to this web seed.
+		// This is expected to be called at regular intervals. As long as each
+		// new connection makes the combined rate grow by more than 10%, one
+		// more connection is allowed, up to ``max_connections``. If the rate
+		// drops by more than 25%, one connection is given back.
+		void update_target_connections(int num_connections, int download_rate
+			, int max_connections);
+
+		// the number of connections we want open to this web seed. Starts at
+		// one and is adapted by update_target_connections()
+		int target_connections = 1;
+
+		// the combined download rate of all connections to this web seed the
+		// last time update_target_connections() was called
+		int last_download_rate = 0;
+
+		// the next time the download rate of this web seed should be sampled
+		time_point32 next_rate_sample = aux::time_now32();
 
 		// this is initialized to true, but if we discover the
 		// server not to support it, it's set to false, and we
@@ -205,7 +241,10 @@ namespace libtorrent {
 			web_seed_entry::operator=(std::move(rhs));
 			retry = std::move(rhs.retry);
 			endpoints = std::move(rhs.endpoints);
-			peer_info = std::move(rhs.peer_info);
+			peers = std::move(rhs.peers);
+			target_connections = std::move(rhs.target_connections);
+			last_download_rate = std::move(rhs.last_download_rate);
+			next_rate_sample = std::move(rhs.next_rate_sample);
 			supports_keepalive = std::move(rhs.supports_keepalive);
 			resolving = std::move(rhs.resolving);
 			removed = std::move(rhs.removed);
@@ -480,6 +519,10 @@ namespace libtorrent {
 		// connect to them
 		void maybe_connect_web_seeds();
 
+		// samples the download rate of the connections to each web seed and
+		// adapts the number of connections we open to it
+		void update_web_seed_connections();
+
 		std::string name() const;
 
 		stat statistics() const { return m_stat; }
@@ -505,6 +548,11 @@ namespace libtorrent {
 		void handle_disk_error(string_view job_name
 			, storage_error const& error, peer_connection* c = nullptr
 			, disk_class rw = disk_class::none);
+
+		// if ``error`` means a file has changed since its snapshot was saved
+		// in the resume data, the pieces overlapping it are checked again and
+		// true is returned. Any other error returns false
+		bool handle_file_changed(storage_error const& error);
 		void clear_error();
 
 		void set_error(error_code const& ec, file_index_t file);
@@ -203,6 +203,16 @@ namespace libtorrent {
 		// so, any torrent_peer with the web_seed bit set, is
 		// never considered a connect candidate
 		bool web_seed:1;
+
+		// the position of this torrent_peer in one of peer_list's connect
+		// candidate heaps, or not_in_heap if it's not a connect candidate.
+		// candidate_waiting is set if it's in the heap of candidates waiting
+		// for their reconnect time to pass
+		std::uint32_t heap_index:31;
+		bool candidate_waiting:1;
+
+		static constexpr std::uint32_t not_in_heap = 0x7fffffff;
+
 #if TORRENT_USE_ASSERTS
 		bool in_use = true;
 #endif
@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <functional>
 #include <memory>
 #include <unordered_map>
+#include <map>
 
 #ifdef TORRENT_USE_OPENSSL
 // there is no forward declaration header for asio
@@ -415,6 +416,13 @@ namespace libtorrent {
 
 		std::vector<std::shared_ptr<http_tracker_connection>> m_http_conns;
 
+		// the most recent UDP scrape connection for each tracker URL and
+		// listen socket. As long as it hasn't sent its request yet, scrapes of
+		// other torrents on the same tracker are added to it, to be sent as a
+		// single multi info-hash scrape
+		std::map<std::pair<std::string, aux::listen_socket_handle>
+			, std::weak_ptr<udp_tracker_connection>> m_udp_scrapes;
+
 		send_fun_t m_send_fun;
 		send_fun_hostname_t m_send_fun_hostname;
 		resolver_interface& m_host_resolver;
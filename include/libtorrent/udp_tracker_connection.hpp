@@ -58,12 +58,26 @@ namespace libtorrent {
 			, tracker_manager& man
 			, tracker_request const& req
 			, std::weak_ptr<request_callback> c);
+		~udp_tracker_connection() override;
 
 		void start() override;
 		void close() override;
 
 		std::uint32_t transaction_id() const { return m_transaction_id; }
 
+		// the max number of info-hashes to put in a single scrape request. BEP
+		// 15 says about 74, this is a bit lower to keep the request within a
+		// single 1500 byte MTU packet
+		static constexpr int max_scrape_hashes = 72;
+
+		// adds the scrape of another torrent, on the same tracker, to this
+		// connection's scrape. All of them are sent in a single request once the
+		// connection ID has been established. This is only possible until the
+		// request has been sent, and for at most max_scrape_hashes torrents.
+		// Returns false if the request could not be added.
+		bool add_scrape(tracker_request const& req
+			, std::weak_ptr<request_callback> c);
+
 	private:
 
 		enum class action_t : std::uint8_t
@@ -100,6 +114,10 @@ namespace libtorrent {
 			, seconds32 min_interval = seconds32(30));
 
 		void send_udp_connect();
+		void release_pending_connect();
+		void on_connect_released(address const& target);
+		void fail_scrape_batch(error_code const& ec, int code
+			, char const* msg, seconds32 interval);
 		void send_udp_announce();
 		void send_udp_scrape();
 
@@ -117,8 +135,25 @@ namespace libtorrent {
 		};
 
 		static std::map<address, connection_cache_entry> m_connection_cache;
+
+		// while a connect handshake with a tracker is in progress, other
+		// connections to the same tracker wait for its connection ID rather
+		// than sending connect requests of their own. Once the handshake
+		// completes (or fails), the waiters are restarted.
+		struct pending_connect
+		{
+			udp_tracker_connection const* connector = nullptr;
+			std::vector<std::weak_ptr<udp_tracker_connection>> waiters;
+		};
+		static std::map<address, pending_connect> m_pending_connects;
+
+		// protects m_connection_cache and m_pending_connects
 		static std::mutex m_cache_mutex;
 
+		// the scrapes of other torrents that are sent along with this
+		// connection's own, in a single request. See add_scrape()
+		std::vector<std::pair<tracker_request, std::weak_ptr<request_callback>>> m_scrape_batch;
+
 		udp::endpoint m_target;
 
 		std::uint32_t m_transaction_id;
@@ -127,6 +162,15 @@ namespace libtorrent {
 		action_t m_state;
 
 		bool m_abort;
+
+		// true if this connection is the one performing the connect handshake
+		// for m_target, with other connections waiting for it in
+		// m_pending_connects
+		bool m_connecting = false;
+
+		// true if we're waiting for another connection's connect handshake
+		// with m_target to complete
+		bool m_waiting_for_connect = false;
 	};
 
 }
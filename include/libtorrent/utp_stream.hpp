@@ -40,14 +40,18 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/time.hpp"
 #include "libtorrent/close_reason.hpp"
+#include "libtorrent/aux_/aligned_storage.hpp"
 
 #include <functional>
+#include <new>
+#include <type_traits>
 
-#ifndef BOOST_NO_EXCEPTIONS
 #include "libtorrent/aux_/disable_warnings_push.hpp"
+#include <boost/asio/detail/bind_handler.hpp>
+#ifndef BOOST_NO_EXCEPTIONS
 #include <boost/system/system_error.hpp>
-#include "libtorrent/aux_/disable_warnings_pop.hpp"
 #endif
+#include "libtorrent/aux_/disable_warnings_pop.hpp"
 
 namespace libtorrent {
 
@@ -171,6 +175,97 @@ void utp_send_ack(utp_socket_impl* s);
 void utp_socket_drained(utp_socket_impl* s);
 void utp_writable(utp_socket_impl* s);
 
+namespace aux {
+
+	// holds the completion handler of an outstanding read or write operation
+	// on a utp_stream, in inline storage. When the operation completes, the
+	// handler is posted bound to its result. This is done with asio's own
+	// binder, which forwards the handler allocation hooks, so the posted
+	// operation is allocated the same way it would be by a TCP socket (e.g.
+	// in a peer_connection's handler storage), rather than wrapped in a
+	// std::function, which would allocate for every operation
+	template <std::size_t Size>
+	struct utp_handler
+	{
+		utp_handler() = default;
+		~utp_handler() { clear(); }
+
+		utp_handler(utp_handler const&) = delete;
+		utp_handler& operator=(utp_handler const&) = delete;
+
+		// a stream can only be moved when it doesn't have outstanding
+		// operations
+		utp_handler(utp_handler&& rhs) noexcept { TORRENT_ASSERT(!rhs); }
+		utp_handler& operator=(utp_handler&& rhs) noexcept
+		{
+			TORRENT_ASSERT(!rhs);
+			clear();
+			return *this;
+		}
+
+		explicit operator bool() const { return m_op != nullptr; }
+
+		template <typename Handler>
+		void set(Handler const& h)
+		{
+			TORRENT_ASSERT(m_op == nullptr);
+			using op_t = op<typename std::decay<Handler>::type>;
+			if (sizeof(op_t) <= sizeof(m_storage)
+				&& alignof(op_t) <= alignof(decltype(m_storage)))
+				m_op = new (&m_storage) op_t(h);
+			else
+				m_op = new op_t(h);
+		}
+
+		// posts the handler to ``ios``, to be called with ``ec`` and
+		// ``bytes``, and clears it
+		void post(io_service& ios, error_code const& ec, std::size_t const bytes)
+		{
+			TORRENT_ASSERT(m_op != nullptr);
+			base* o = m_op;
+			m_op = nullptr;
+			o->post(ios, ec, bytes);
+			destroy(o);
+		}
+
+		void clear()
+		{
+			if (m_op == nullptr) return;
+			base* o = m_op;
+			m_op = nullptr;
+			destroy(o);
+		}
+
+	private:
+
+		struct base
+		{
+			virtual void post(io_service& ios, error_code const& ec, std::size_t bytes) = 0;
+			virtual ~base() = default;
+		};
+
+		template <typename Handler>
+		struct op final : base
+		{
+			explicit op(Handler const& h) : handler(h) {}
+			void post(io_service& ios, error_code const& ec, std::size_t const bytes) override
+			{
+				ios.post(boost::asio::detail::bind_handler(std::move(handler), ec, bytes));
+			}
+			Handler handler;
+		};
+
+		void destroy(base* o)
+		{
+			if (static_cast<void*>(o) == static_cast<void*>(&m_storage)) o->~base();
+			else delete o;
+		}
+
+		base* m_op = nullptr;
+		typename aux::aligned_storage<Size>::type m_storage;
+	};
+}
+
 // this is the user-level stream interface to utp sockets.
 // the reason why it's split up in a utp_stream class and
 // an implementation class is because the socket state has
@@ -253,9 +348,12 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 	static void on_connect(void* self, error_code const& ec, bool kill);
 	static void on_close_reason(void* self, close_reason_t reason);
 
-	void add_read_buffer(void* buf, std::size_t len);
+	// these return false if the buffer could not be added because the
+	// operation already refers to as many buffers as it can hold. Any
+	// remaining buffers are left untouched by the operation
+	bool add_read_buffer(void* buf, std::size_t len);
 	void issue_read();
-	void add_write_buffer(void const* buf, std::size_t len);
+	bool add_write_buffer(void const* buf, std::size_t len);
 	void issue_write();
 	std::size_t read_some(bool clear_buffers);
 
@@ -326,7 +424,7 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 			if (buffer_size(*i) == 0) continue;
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
-			add_read_buffer(buffer_cast<void*>(*i), buffer_size(*i));
+			if (!add_read_buffer(buffer_cast<void*>(*i), buffer_size(*i))) break;
 			bytes_added += buffer_size(*i);
 		}
 		if (bytes_added == 0)
@@ -337,7 +435,7 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 			return;
 		}
 
-		m_read_handler = handler;
+		m_read_handler.set(handler);
 		issue_read();
 	}
 
@@ -357,7 +455,7 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 			m_io_service.post(std::bind<void>(handler, boost::asio::error::operation_not_supported, 0));
 			return;
 		}
-		m_read_handler = handler;
+		m_read_handler.set(handler);
 		issue_read();
 	}
 
@@ -396,7 +494,7 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 		{
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
-			add_read_buffer(buffer_cast<void*>(*i), buffer_size(*i));
+			if (!add_read_buffer(buffer_cast<void*>(*i), buffer_size(*i))) break;
 #if TORRENT_USE_ASSERTS
 			buf_size += buffer_size(*i);
 #endif
@@ -462,7 +560,7 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 			if (buffer_size(*i) == 0) continue;
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
-			add_write_buffer(buffer_cast<void const*>(*i), buffer_size(*i));
+			if (!add_write_buffer(buffer_cast<void const*>(*i), buffer_size(*i))) break;
 			bytes_added += buffer_size(*i);
 		}
 		if (bytes_added == 0)
@@ -472,7 +570,7 @@ struct TORRENT_EXTRA_EXPORT utp_stream
 			m_io_service.post(std::bind<void>(handler, error_code(), 0));
 			return;
 		}
-		m_write_handler = handler;
+		m_write_handler.set(handler);
 		issue_write();
 	}
 
@@ -481,8 +579,10 @@ private:
 	void cancel_handlers(error_code const&);
 
 	std::function<void(error_code const&)> m_connect_handler;
-	std::function<void(error_code const&, std::size_t)> m_read_handler;
-	std::function<void(error_code const&, std::size_t)> m_write_handler;
+	// large enough for the handlers of peer connections, including when
+	// wrapped by the SSL stream
+	aux::utp_handler<160> m_read_handler;
+	aux::utp_handler<160> m_write_handler;
 
 	io_service& m_io_service;
 	utp_socket_impl* m_impl;
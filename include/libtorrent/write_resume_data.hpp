@@ -33,6 +33,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_WRITE_RESUME_DATA_HPP_INCLUDE
 #define TORRENT_WRITE_RESUME_DATA_HPP_INCLUDE
 
+#include <cstdint>
+#include <vector>
+
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/export.hpp"
 #include "libtorrent/bencode.hpp"
@@ -42,10 +45,43 @@ namespace libtorrent {
 	struct add_torrent_params;
 	class entry;
 
+	// the formats resume data can be saved in. Both are understood by
+	// read_resume_data().
+	enum class resume_data_format : std::uint8_t
+	{
+		// a bencoded dictionary. This is what write_resume_data() returns and
+		// what write_resume_data_buf() produces by default
+		bencode,
+
+		// a compact, versioned binary format. Piece bitfields are stored with
+		// one bit per piece, and it supports appending delta records (see
+		// write_resume_data_delta())
+		binary
+	};
+
 	// this function turns the resume data in an ``add_torrent_params`` object
 	// into a bencoded structure
 	TORRENT_EXPORT entry write_resume_data(add_torrent_params const& atp);
 	TORRENT_EXPORT std::vector<char> write_resume_data_buf(add_torrent_params const& atp);
+	TORRENT_EXPORT std::vector<char> write_resume_data_buf(add_torrent_params const& atp
+		, resume_data_format fmt);
+
+	// returns a binary delta record holding only what changed in ``atp``
+	// compared to ``prev``. Stats, flags, piece state and priorities are
+	// stored as individual changes, the other fields are stored in full when
+	// they differ.
+	//
+	// The record is meant to be appended to resume data previously written
+	// with resume_data_format::binary, where ``prev`` is the state that data
+	// describes (i.e. the add_torrent_params last written to it). When such
+	// a log is passed to read_resume_data(), the records are applied in
+	// order. A record that's truncated or fails its checksum ends the log,
+	// so a partially written append is discarded.
+	//
+	// To compact a log, read it with read_resume_data() and write it back
+	// with write_resume_data_buf() in the binary format.
+	TORRENT_EXPORT std::vector<char> write_resume_data_delta(add_torrent_params const& prev
+		, add_torrent_params const& atp);
 }
 
 #endif
@@ -48,6 +48,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/kademlia/ed25519.hpp"
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/kademlia/item.hpp"
+#include "libtorrent/random.hpp"
+#include <algorithm>
 
 
 #ifndef TORRENT_DISABLE_DHT
@@ -218,6 +220,91 @@ TORRENT_TEST(dht_dual_stack_get_peers)
 #endif // TORRENT_DISABLE_DHT
 }
 
+// measures the time from starting a get_peers lookup until the first peers
+// are returned, in a network where some of the nodes in the routing tables
+// are dead. Slow or dead nodes should not stall the lookups
+TORRENT_TEST(dht_lookup_latency)
+{
+#ifndef TORRENT_DISABLE_DHT
+	sim::default_config cfg;
+	sim::simulation sim{ cfg };
+
+	dht_network dht(sim, 500, dht_network::add_dead_nodes);
+
+	int const num_lookups = 20;
+	std::vector<lt::sha1_hash> info_hashes;
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		lt::sha1_hash ih;
+		lt::aux::random_bytes(ih);
+		info_hashes.push_back(ih);
+	}
+
+	std::vector<lt::time_point> started(num_lookups);
+	std::vector<lt::time_duration> latency(num_lookups, lt::seconds(0));
+	int num_done = 0;
+
+	setup_swarm(1, swarm_test::download, sim
+		// add session
+		, [](lt::settings_pack&) {
+		}
+		// add torrent
+		, [](lt::add_torrent_params&) {}
+		// on alert
+		, [&](lt::alert const* a, lt::session&)
+		{
+			if (lt::dht_get_peers_reply_alert const* p = lt::alert_cast<lt::dht_get_peers_reply_alert>(a))
+			{
+				auto const it = std::find(info_hashes.begin(), info_hashes.end(), p->info_hash);
+				if (it == info_hashes.end()) return;
+				int const idx = int(it - info_hashes.begin());
+				if (started[idx] == lt::time_point() || latency[idx] > lt::seconds(0)) return;
+				if (p->num_peers() == 0) return;
+				latency[idx] = p->timestamp() - started[idx];
+				++num_done;
+			}
+		}
+		// terminate?
+		, [&](int ticks, lt::session& ses) -> bool
+		{
+			if (ticks == 0)
+			{
+				bootstrap_session({&dht}, ses);
+			}
+			if (ticks == 2)
+			{
+				for (auto const& ih : info_hashes)
+					ses.dht_announce(ih, 6881);
+			}
+			// issue one lookup per tick, to not have them compete with each
+			// other
+			int const idx = ticks - 6;
+			if (idx >= 0 && idx < num_lookups)
+			{
+				started[idx] = lt::clock_type::now();
+				ses.dht_get_peers(info_hashes[idx]);
+			}
+			if (idx == num_lookups + 15)
+			{
+				TEST_EQUAL(num_done, num_lookups);
+
+				std::sort(latency.begin(), latency.end());
+				std::int64_t sum = 0;
+				for (auto const& l : latency) sum += lt::total_milliseconds(l);
+				std::printf("lookup latency (ms) mean: %d median: %d max: %d\n"
+					, int(sum / num_lookups)
+					, int(lt::total_milliseconds(latency[num_lookups / 2]))
+					, int(lt::total_milliseconds(latency.back())));
+				return true;
+			}
+			return false;
+		});
+
+	sim.run();
+
+#endif // TORRENT_DISABLE_DHT
+}
+
 TORRENT_TEST(dht_dual_stack_immutable_item)
 {
 #ifndef TORRENT_DISABLE_DHT
@@ -68,6 +68,7 @@ struct obs : dht::dht_observer
 	bool on_dht_request(string_view /* query */
 		, dht::msg const& /* request */, entry& /* response */) override
 	{ return false; }
+	bool has_dht_request_handlers() const override { return false; }
 
 #ifndef TORRENT_DISABLE_LOGGING
 	bool should_log(module_t) const override { return true; }
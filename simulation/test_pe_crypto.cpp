@@ -35,6 +35,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/pe_crypto.hpp"
 #include "libtorrent/session.hpp"
+#include "libtorrent/torrent_handle.hpp"
+#include "libtorrent/peer_info.hpp"
 
 #include "setup_transfer.hpp"
 #include "test.hpp"
@@ -62,11 +64,17 @@ void display_pe_settings(lt::settings_pack const& s)
 	std::printf("enc_level - %s\t\tprefer_rc4 - %s\n"
 		, s.get_int(settings_pack::allowed_enc_level) == settings_pack::pe_plaintext ? "plaintext"
 		: s.get_int(settings_pack::allowed_enc_level) == settings_pack::pe_rc4 ? "rc4"
-		: s.get_int(settings_pack::allowed_enc_level) == settings_pack::pe_both ? "both" : "unknown"
+		: s.get_int(settings_pack::allowed_enc_level) == settings_pack::pe_both ? "both"
+		: s.get_int(settings_pack::allowed_enc_level) & settings_pack::pe_chacha20 ? "chacha20" : "unknown"
 		, s.get_bool(settings_pack::prefer_rc4) ? "true": "false");
 }
 
-void test_transfer(int enc_policy, int level, bool prefer_rc4)
+// the other session allows plaintext and rc4, unless ``remote_level`` says
+// otherwise. ``expect`` is the flag the connection is expected to end up
+// with, if any
+void test_transfer(int enc_policy, int level, bool prefer_rc4
+	, int const remote_level = settings_pack::pe_both
+	, peer_flags_t const expect = peer_flags_t{})
 {
 	lt::settings_pack default_settings = settings();
 	default_settings.set_bool(settings_pack::prefer_rc4, prefer_rc4);
@@ -83,10 +91,10 @@ void test_transfer(int enc_policy, int level, bool prefer_rc4)
 	default_add_torrent.flags &= ~lt::torrent_flags::auto_managed;
 	setup_swarm(2, swarm_test::download, sim, default_settings, default_add_torrent
 		// add session
-		, [](lt::settings_pack& pack) {
+		, [=](lt::settings_pack& pack) {
 			pack.set_int(settings_pack::out_enc_policy, settings_pack::pe_enabled);
 			pack.set_int(settings_pack::in_enc_policy, settings_pack::pe_enabled);
-			pack.set_int(settings_pack::allowed_enc_level, settings_pack::pe_both);
+			pack.set_int(settings_pack::allowed_enc_level, remote_level);
 			pack.set_bool(settings_pack::prefer_rc4, false);
 		}
 		// add torrent
@@ -94,13 +102,23 @@ void test_transfer(int enc_policy, int level, bool prefer_rc4)
 		// on alert
 		, [](lt::alert const* a, lt::session& ses) {}
 		// terminate
-		, [](int ticks, lt::session& ses) -> bool
+		, [=](int ticks, lt::session& ses) -> bool
 		{
 			if (ticks > 20)
 			{
 				TEST_ERROR("timeout");
 				return true;
 			}
+			if (expect)
+			{
+				std::vector<peer_info> peers;
+				ses.get_torrents()[0].get_peer_info(peers);
+				for (auto const& p : peers)
+				{
+					if (p.flags & (peer_info::handshake | peer_info::connecting)) continue;
+					TEST_CHECK(p.flags & expect);
+				}
+			}
 			return is_seed(ses);
 		});
 }
@@ -150,6 +168,30 @@ TORRENT_TEST(enabled_both_prefer_rc4)
 	test_transfer(settings_pack::pe_enabled, settings_pack::pe_both, true);
 }
 
+TORRENT_TEST(forced_chacha20)
+{
+	test_transfer(settings_pack::pe_forced, settings_pack::pe_chacha20, true
+		, settings_pack::pe_both | settings_pack::pe_chacha20
+		, peer_info::chacha20_encrypted);
+}
+
+TORRENT_TEST(enabled_chacha20_prefer_rc4)
+{
+	// when both ends allow chacha20, it's selected over rc4
+	test_transfer(settings_pack::pe_enabled
+		, settings_pack::pe_both | settings_pack::pe_chacha20, true
+		, settings_pack::pe_both | settings_pack::pe_chacha20
+		, peer_info::chacha20_encrypted);
+}
+
+TORRENT_TEST(chacha20_fallback_rc4)
+{
+	// the other end doesn't support chacha20, rc4 is used instead
+	test_transfer(settings_pack::pe_forced
+		, settings_pack::pe_rc4 | settings_pack::pe_chacha20, true
+		, settings_pack::pe_both, peer_info::rc4_encrypted);
+}
+
 // make sure that a peer with encryption disabled cannot talk to a peer with
 // encryption forced
 TORRENT_TEST(disabled_failing)
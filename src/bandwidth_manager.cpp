@@ -32,14 +32,34 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/bandwidth_manager.hpp"
 
-#if TORRENT_USE_ASSERTS
+#include <algorithm>
 #include <climits>
-#endif
 
 namespace libtorrent {
 
+namespace {
+
+	// the smallest slice (on average) a request is granted when a leaf's
+	// share of a round is too small to give every request a slice. This keeps
+	// low rates from being spread thin over many requests, each of which would
+	// otherwise reach its deadline with just a few bytes assigned
+	constexpr std::int64_t min_slice = 1024;
+}
+
+	std::size_t bandwidth_manager::channel_set_hash::operator()(
+		channel_set const& s) const
+	{
+		std::size_t ret = 0;
+		for (auto const c : s)
+			ret = ret * 31 + (reinterpret_cast<std::uintptr_t>(c) >> 4);
+		return ret;
+	}
+
 	bandwidth_manager::bandwidth_manager(int channel)
-		: m_queued_bytes(0)
+		: m_queue_size(0)
+		, m_queued_bytes(0)
+		, m_round(0)
+		, m_sweep_cursor(0)
 		, m_channel(channel)
 		, m_abort(false)
 	{
@@ -50,7 +70,14 @@ namespace libtorrent {
 		m_abort = true;
 
 		std::vector<bw_request> queue;
-		queue.swap(m_queue);
+		for (int i = 0; i < int(m_slots.size()); ++i)
+		{
+			if (m_slots[std::size_t(i)].owner == nullptr) continue;
+			remove_request(i, queue);
+		}
+		m_leaves.clear();
+		m_slots.clear();
+		m_free_slots.clear();
 		m_queued_bytes = 0;
 
 		while (!queue.empty())
@@ -64,9 +91,9 @@ namespace libtorrent {
 #if TORRENT_USE_ASSERTS
 	bool bandwidth_manager::is_queued(bandwidth_socket const* peer) const
 	{
-		for (auto const& r : m_queue)
+		for (auto const& s : m_slots)
 		{
-			if (r.peer.get() == peer) return true;
+			if (s.owner != nullptr && s.request.peer.get() == peer) return true;
 		}
 		return false;
 	}
@@ -74,7 +101,7 @@ namespace libtorrent {
 
 	int bandwidth_manager::queue_size() const
 	{
-		return int(m_queue.size());
+		return m_queue_size;
 	}
 
 	std::int64_t bandwidth_manager::queued_bytes() const
@@ -117,8 +144,33 @@ namespace libtorrent {
 
 		if (k == 0) return blk;
 
+		// the channels are sorted in the key, to have requests with the same
+		// channels end up in the same leaf regardless of the order they were
+		// passed in
+		channel_set key;
+		std::copy(std::begin(bwr.channel), std::end(bwr.channel), key.begin());
+		std::sort(key.begin(), key.begin() + k);
+		leaf& l = m_leaves[key];
+
+		l.weight += priority;
+		++l.num_requests;
+
+		int idx;
+		if (!m_free_slots.empty())
+		{
+			idx = m_free_slots.back();
+			m_free_slots.pop_back();
+			m_slots[std::size_t(idx)] = slot(bwr, m_round + bwr.ttl, &l);
+		}
+		else
+		{
+			idx = int(m_slots.size());
+			m_slots.emplace_back(bwr, m_round + bwr.ttl, &l);
+		}
+		l.queue.push_back(idx);
+
+		++m_queue_size;
 		m_queued_bytes += blk;
-		m_queue.push_back(bwr);
 		return 0;
 	}
 
@@ -126,89 +178,230 @@ namespace libtorrent {
 	void bandwidth_manager::check_invariant() const
 	{
 		std::int64_t queued = 0;
-		for (auto const& r : m_queue)
+		int num_queued = 0;
+		for (auto const& s : m_slots)
 		{
-			queued += r.request_size - r.assigned;
+			if (s.owner == nullptr) continue;
+			queued += s.request.request_size - s.request.assigned;
+			++num_queued;
 		}
 		TORRENT_ASSERT(queued == m_queued_bytes);
+		TORRENT_ASSERT(num_queued == m_queue_size);
+
+		int num_in_leaves = 0;
+		for (auto const& e : m_leaves)
+		{
+			leaf const& l = e.second;
+			std::int64_t weight = 0;
+			int num_requests = 0;
+			for (int const idx : l.queue)
+			{
+				slot const& s = m_slots[std::size_t(idx)];
+				if (s.owner == nullptr) continue;
+				TORRENT_ASSERT(s.owner == &l);
+				weight += s.request.priority;
+				++num_requests;
+			}
+			TORRENT_ASSERT(weight == l.weight);
+			TORRENT_ASSERT(num_requests == l.num_requests);
+			num_in_leaves += num_requests;
+		}
+		TORRENT_ASSERT(num_in_leaves == m_queue_size);
 	}
 #endif
 
-	void bandwidth_manager::update_quotas(time_duration const& dt)
+	void bandwidth_manager::remove_request(int const idx, std::vector<bw_request>& done)
 	{
-		if (m_abort) return;
-		if (m_queue.empty()) return;
+		slot& s = m_slots[std::size_t(idx)];
+		TORRENT_ASSERT(s.owner != nullptr);
+		bw_request& r = s.request;
 
-		INVARIANT_CHECK;
+		leaf& l = *s.owner;
+		l.weight -= r.priority;
+		--l.num_requests;
 
-		std::int64_t dt_milliseconds = total_milliseconds(dt);
-		if (dt_milliseconds > 3000) dt_milliseconds = 3000;
+		m_queued_bytes -= r.request_size - r.assigned;
+		--m_queue_size;
+		s.owner = nullptr;
 
-		// for each bandwidth channel, call update_quota(dt)
+		done.push_back(r);
+		// don't hold on to the peer while the slot waits to be freed
+		r.peer.reset();
+	}
 
-		std::vector<bandwidth_channel*> channels;
+	void bandwidth_manager::cancel_request(int const idx, std::vector<bw_request>& done)
+	{
+		bw_request& r = m_slots[std::size_t(idx)].request;
 
-		std::vector<bw_request> queue;
+		// return all assigned quota to all the
+		// bandwidth channels this peer belongs to
+		for (int j = 0; j < bw_request::max_bandwidth_channels && r.channel[j]; ++j)
+			r.channel[j]->return_quota(r.assigned);
+
+		m_queued_bytes += r.assigned;
+		r.assigned = 0;
+		remove_request(idx, done);
+	}
+
+	void bandwidth_manager::sweep_disconnecting(std::vector<bw_request>& done)
+	{
+		int const num_slots = int(m_slots.size());
+		int const n = std::min(num_slots, std::max(16, num_slots / 8));
+		for (int i = 0; i < n; ++i)
+		{
+			if (m_sweep_cursor >= num_slots) m_sweep_cursor = 0;
+			int const idx = m_sweep_cursor++;
+			slot const& s = m_slots[std::size_t(idx)];
+			if (s.owner == nullptr) continue;
+			if (!s.request.peer->is_disconnecting()) continue;
+			cancel_request(idx, done);
+		}
+	}
+
+	void bandwidth_manager::serve_leaf(leaf& l, channel_set const& channels
+		, std::vector<bw_request>& done)
+	{
+		// the leaf's share of this round. Unthrottled channels don't limit it,
+		// and if none of the channels are throttled, every request is satisfied
+		std::int64_t budget = std::numeric_limits<std::int64_t>::max();
+		bool limited = false;
+		if (l.num_requests > 0)
+		{
+			for (auto const ch : channels)
+			{
+				if (ch == nullptr || ch->throttle() == 0) continue;
+				TORRENT_ASSERT(ch->tmp >= l.weight);
+				budget = std::min(budget
+					, std::int64_t(ch->distribute_quota) * l.weight / ch->tmp);
+				limited = true;
+			}
+		}
+
+		// the total handed out over one pass through the queue. A request's
+		// slice is its part of this, by priority
+		std::int64_t const pass = std::max(budget, min_slice * l.num_requests);
+		std::int64_t used = 0;
 
-		for (auto i = m_queue.begin(); i != m_queue.end();)
+		while (!l.queue.empty())
 		{
-			if (i->peer->is_disconnecting())
+			int const idx = l.queue.front();
+			slot& s = m_slots[std::size_t(idx)];
+			if (s.owner == nullptr)
 			{
-				m_queued_bytes -= i->request_size - i->assigned;
-
-				// return all assigned quota to all the
-				// bandwidth channels this peer belongs to
-				for (int j = 0; j < bw_request::max_bandwidth_channels && i->channel[j]; ++j)
-				{
-					bandwidth_channel* bwc = i->channel[j];
-					bwc->return_quota(i->assigned);
-				}
-
-				i->assigned = 0;
-				queue.push_back(*i);
-				i = m_queue.erase(i);
+				// this request was removed while it was queued
+				l.queue.pop_front();
+				m_free_slots.push_back(idx);
 				continue;
 			}
-			for (int j = 0; j < bw_request::max_bandwidth_channels && i->channel[j]; ++j)
+
+			if (budget <= 0) break;
+
+			bw_request& r = s.request;
+			if (r.peer->is_disconnecting())
 			{
-				bandwidth_channel* bwc = i->channel[j];
-				bwc->tmp = 0;
+				cancel_request(idx, done);
+				l.queue.pop_front();
+				m_free_slots.push_back(idx);
+				continue;
 			}
-			++i;
-		}
 
-		for (auto const& r : m_queue)
-		{
-			for (int j = 0; j < bw_request::max_bandwidth_channels && r.channel[j]; ++j)
+			std::int64_t slice = r.request_size - r.assigned;
+			if (limited)
+			{
+				slice = std::min(slice, std::max(std::int64_t(1)
+					, pass * r.priority / l.weight));
+				slice = std::min(slice, budget);
+			}
+			TORRENT_ASSERT(slice > 0);
+
+			r.assigned += int(slice);
+			m_queued_bytes -= slice;
+			budget -= slice;
+			used += slice;
+
+			if (r.assigned == r.request_size || m_round >= s.deadline)
+			{
+				TORRENT_ASSERT(r.assigned <= r.request_size);
+				remove_request(idx, done);
+				l.queue.pop_front();
+				m_free_slots.push_back(idx);
+			}
+			else if (budget > 0)
 			{
-				bandwidth_channel* bwc = r.channel[j];
-				if (bwc->tmp == 0) channels.push_back(bwc);
-				TORRENT_ASSERT(INT_MAX - bwc->tmp > r.priority);
-				bwc->tmp += r.priority;
+				// this request has had its slice for this pass, move on to
+				// the next one
+				l.queue.pop_front();
+				l.queue.push_back(idx);
 			}
+			// otherwise the budget ran out part way through this request's
+			// slice. It stays at the front, to be continued next round
 		}
 
-		for (auto const& ch : channels)
+		if (!limited) return;
+		TORRENT_ASSERT(used <= INT_MAX);
+		for (auto const ch : channels)
 		{
-			ch->update_quota(int(dt_milliseconds));
+			if (ch == nullptr) continue;
+			ch->use_quota(int(used));
 		}
+	}
+
+	void bandwidth_manager::update_quotas(time_duration const& dt)
+	{
+		if (m_abort) return;
+		if (m_leaves.empty()) return;
+
+		INVARIANT_CHECK;
 
-		for (auto i = m_queue.begin(); i != m_queue.end();)
+		++m_round;
+
+		std::int64_t dt_milliseconds = total_milliseconds(dt);
+		if (dt_milliseconds > 3000) dt_milliseconds = 3000;
+
+		std::vector<bw_request> queue;
+
+		sweep_disconnecting(queue);
+
+		// sum up the weights of the leaves under each bandwidth channel. The
+		// leaves' weights are kept up to date as requests come and go, so this
+		// doesn't need to look at individual requests
+		std::vector<bandwidth_channel*> channels;
+		for (auto const& e : m_leaves)
 		{
-			int a = i->assign_bandwidth();
-			if (i->assigned == i->request_size
-				|| (i->ttl <= 0 && i->assigned > 0))
+			for (auto const ch : e.first)
+				if (ch != nullptr) ch->tmp = 0;
+		}
+		for (auto const& e : m_leaves)
+		{
+			if (e.second.num_requests == 0) continue;
+			for (auto const ch : e.first)
 			{
-				a += i->request_size - i->assigned;
-				TORRENT_ASSERT(i->assigned <= i->request_size);
-				queue.push_back(*i);
-				i = m_queue.erase(i);
+				if (ch == nullptr) continue;
+				if (ch->tmp == 0) channels.push_back(ch);
+				TORRENT_ASSERT(INT_MAX - ch->tmp > e.second.weight);
+				ch->tmp += int(e.second.weight);
 			}
+		}
+
+		// for each bandwidth channel, call update_quota(dt)
+		for (auto const ch : channels)
+			ch->update_quota(int(dt_milliseconds));
+
+		for (auto i = m_leaves.begin(); i != m_leaves.end();)
+		{
+			serve_leaf(i->second, i->first, queue);
+			if (i->second.queue.empty())
+				i = m_leaves.erase(i);
 			else
-			{
 				++i;
-			}
-			m_queued_bytes -= a;
+		}
+
+		if (m_leaves.empty())
+		{
+			TORRENT_ASSERT(m_queue_size == 0);
+			m_slots.clear();
+			m_free_slots.clear();
+			m_sweep_cursor = 0;
 		}
 
 		while (!queue.empty())
@@ -30,9 +30,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 */
 
-#include <cstdint>
 #include <cstring>
-#include <algorithm>
 
 #include "libtorrent/bandwidth_queue_entry.hpp"
 
@@ -49,27 +47,5 @@ namespace libtorrent {
 		TORRENT_ASSERT(priority > 0);
 		std::memset(channel, 0, sizeof(channel));
 	}
-
-	int bw_request::assign_bandwidth()
-	{
-		TORRENT_ASSERT(assigned < request_size);
-		int quota = request_size - assigned;
-		TORRENT_ASSERT(quota >= 0);
-		--ttl;
-		if (quota == 0) return quota;
-
-		for (int j = 0; j < 5 && channel[j]; ++j)
-		{
-			if (channel[j]->throttle() == 0) continue;
-			if (channel[j]->tmp == 0) continue;
-			quota = (std::min)(int(std::int64_t(channel[j]->distribute_quota)
-				* priority / channel[j]->tmp), quota);
-		}
-		assigned += quota;
-		for (int j = 0; j < 5 && channel[j]; ++j)
-			channel[j]->use_quota(quota);
-		TORRENT_ASSERT(assigned <= request_size);
-		return quota;
-	}
 }
 
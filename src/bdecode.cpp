@@ -33,7 +33,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bdecode.hpp"
 #include "libtorrent/aux_/alloca.hpp"
 #include "libtorrent/aux_/numeric_cast.hpp"
+#include "libtorrent/config.hpp" // for TORRENT_HAS_BUILTIN_CTZ
 #include <limits>
+#include <algorithm> // for min
 #include <cstring> // for memset
 #include <cstdio> // for snprintf
 #include <cinttypes> // for PRId64 et.al.
@@ -50,6 +52,37 @@ namespace {
 
 	bool numeric(char c) { return c >= '0' && c <= '9'; }
 
+	// returns the number of leading ASCII digits in the 8 bytes starting at
+	// ptr. All 8 bytes are classified at once (as SIMD within a register),
+	// which makes skipping long runs of digits cheaper than testing one
+	// character at a time.
+	int count_digits8(char const* ptr)
+	{
+		// load the bytes with the first one in the least significant position,
+		// regardless of the endianness of the machine
+		std::uint64_t v = 0;
+		for (int i = 7; i >= 0; --i)
+			v = (v << 8) | std::uint8_t(ptr[i]);
+
+		// a byte is a digit if its high nibble is 3 and it stays 3 when adding
+		// 6 to the byte (i.e. the low nibble is at most 9). Every byte that's
+		// not a digit ends up non-zero. Adding 6 to a byte can only carry into
+		// the next byte if it's not a digit, in which case all subsequent
+		// bytes are irrelevant anyway
+		std::uint64_t const high_nibble = 0xf0f0f0f0f0f0f0f0ULL;
+		std::uint64_t const threes = 0x3030303030303030ULL;
+		std::uint64_t const not_digit = ((v & high_nibble) ^ threes)
+			| (((v + 0x0606060606060606ULL) & high_nibble) ^ threes);
+		if (not_digit == 0) return 8;
+#if TORRENT_HAS_BUILTIN_CTZ
+		return __builtin_ctzll(not_digit) / 8;
+#else
+		int ret = 0;
+		while ((not_digit & (0xffULL << (ret * 8))) == 0) ++ret;
+		return ret;
+#endif
+	}
+
 	// finds the end of an integer and verifies that it looks valid this does
 	// not detect all overflows, just the ones that are an order of magnitude
 	// beyond. Exact overflow checking is done when the integer value is queried
@@ -74,8 +107,24 @@ namespace {
 		}
 
 		int digits = 0;
-		do
+
+		// skip whole words of digits at a time, as long as there's room
+		while (end - start >= 8)
+		{
+			int const n = count_digits8(start);
+			start += n;
+			digits += n;
+			if (n < 8) break;
+		}
+
+		for (;;)
 		{
+			if (start == end)
+			{
+				e = bdecode_errors::unexpected_eof;
+				break;
+			}
+			if (*start == 'e' && digits > 0) break;
 			if (!numeric(*start))
 			{
 				e = bdecode_errors::expected_digit;
@@ -83,14 +132,7 @@ namespace {
 			}
 			++start;
 			++digits;
-
-			if (start == end)
-			{
-				e = bdecode_errors::unexpected_eof;
-				break;
-			}
 		}
-		while (*start != 'e');
 
 		if (digits > 20)
 		{
@@ -100,15 +142,43 @@ namespace {
 		return start;
 	}
 
+	// parses the length prefix of a string, starting at start, which is
+	// known to be a digit. Returns a pointer to the colon (or wherever parsing
+	// stopped).
+	char const* parse_string_length(char const* start, char const* end
+		, std::int64_t& len, bdecode_errors::error_code_enum& e)
+	{
+		len = *start - '0';
+		++start;
+		if (start >= end)
+		{
+			e = bdecode_errors::unexpected_eof;
+			return start;
+		}
+
+		// the vast majority of strings have a length prefix of one or two
+		// digits. Those can't overflow, so there's no need for parse_int()
+		if (*start == ':') return start;
+		if (end - start >= 2 && numeric(*start) && start[1] == ':')
+		{
+			len = len * 10 + (*start - '0');
+			return start + 1;
+		}
+		return parse_int(start, end, ':', len, e);
+	}
+
 	struct stack_frame
 	{
-		stack_frame() : token(0), state(0) {}
-		explicit stack_frame(int const t): token(std::uint32_t(t)), state(0) {}
+		stack_frame() : token(0), state(0), dict(0) {}
+		stack_frame(int const t, bool const d)
+			: token(std::uint32_t(t)), state(0), dict(d) {}
 		// this is an index into m_tokens
-		std::uint32_t token:31;
+		std::uint32_t token:30;
 		// this is used for dictionaries to indicate whether we're
 		// reading a key or a vale. 0 means key 1 is value
 		std::uint32_t state:1;
+		// this is set for dictionaries, to avoid having to look up the token
+		std::uint32_t dict:1;
 	};
 
 	// diff between current and next item offset
@@ -236,6 +306,8 @@ namespace {
 		m_last_index = n.m_last_index;
 		m_last_token = n.m_last_token;
 		m_size = n.m_size;
+		m_key_index.reset();
+		m_key_index_mask = 0;
 		if (!m_tokens.empty())
 		{
 			// if this is a root, make the token pointer
@@ -280,6 +352,8 @@ namespace {
 		m_size = -1;
 		m_last_index = -1;
 		m_last_token = -1;
+		m_key_index.reset();
+		m_key_index_mask = 0;
 	}
 
 	void bdecode_node::switch_underlying_buffer(char const* buf) noexcept
@@ -567,10 +641,55 @@ namespace {
 		return ret;
 	}
 
+	namespace {
+
+	// dictionaries smaller than this are not worth indexing
+	constexpr int key_index_min_size = 8;
+
+	std::uint32_t hash_key(char const* key, std::size_t const len)
+	{
+		// FNV-1a
+		std::uint32_t h = 2166136261U;
+		for (std::size_t i = 0; i < len; ++i)
+		{
+			h ^= std::uint8_t(key[i]);
+			h *= 16777619U;
+		}
+		return h;
+	}
+
+	} // anonymous namespace
+
 	bdecode_node bdecode_node::dict_find(string_view key) const
 	{
 		TORRENT_ASSERT(type() == dict_t);
 
+		if (!m_key_index) return dict_find_linear(key);
+
+		bdecode_token const* const tokens = m_root_tokens;
+		std::uint32_t slot = hash_key(key.data(), key.size()) & m_key_index_mask;
+		for (;;)
+		{
+			std::uint32_t const rel = m_key_index[slot];
+			if (rel == 0) return bdecode_node();
+
+			int const token = m_token_idx + int(rel);
+			bdecode_token const& t = tokens[token];
+			TORRENT_ASSERT(t.type == bdecode_token::string);
+			int const size = token_source_span(t) - t.start_offset();
+			if (int(key.size()) == size
+				&& std::equal(key.data(), key.data() + size, m_buffer
+					+ t.offset + t.start_offset()))
+			{
+				return bdecode_node(tokens, m_buffer, m_buffer_size
+					, token + int(t.next_item));
+			}
+			slot = (slot + 1) & m_key_index_mask;
+		}
+	}
+
+	bdecode_node bdecode_node::dict_find_linear(string_view key) const
+	{
 		bdecode_token const* const tokens = m_root_tokens;
 
 		// this is the first item
@@ -603,6 +722,57 @@ namespace {
 		return bdecode_node();
 	}
 
+	void bdecode_node::dict_build_index()
+	{
+		TORRENT_ASSERT(type() == dict_t);
+		if (m_key_index) return;
+
+		int const num_keys = dict_size();
+		if (num_keys < key_index_min_size) return;
+
+		bdecode_token const* const tokens = m_root_tokens;
+
+		// keep the table at most half full
+		std::uint32_t num_slots = 16;
+		while (num_slots < std::uint32_t(num_keys) * 2) num_slots *= 2;
+
+		m_key_index.reset(new std::uint32_t[num_slots]());
+		m_key_index_mask = num_slots - 1;
+
+		int token = m_token_idx + 1;
+		while (tokens[token].type != bdecode_token::end)
+		{
+			bdecode_token const& t = tokens[token];
+			TORRENT_ASSERT(t.type == bdecode_token::string);
+			char const* const key = m_buffer + t.offset + t.start_offset();
+			int const size = token_source_span(t) - t.start_offset();
+
+			std::uint32_t slot = hash_key(key, std::size_t(size)) & m_key_index_mask;
+			for (;;)
+			{
+				std::uint32_t const rel = m_key_index[slot];
+				if (rel == 0)
+				{
+					m_key_index[slot] = std::uint32_t(token - m_token_idx);
+					break;
+				}
+
+				// in case of duplicate keys, the first one is the one we find
+				bdecode_token const& other = tokens[m_token_idx + int(rel)];
+				int const other_size = token_source_span(other) - other.start_offset();
+				if (other_size == size && std::equal(key, key + size
+					, m_buffer + other.offset + other.start_offset()))
+					break;
+
+				slot = (slot + 1) & m_key_index_mask;
+			}
+
+			// skip key and value
+			token += t.next_item;
+			token += tokens[token].next_item;
+		}
+	}
+
 	bdecode_node bdecode_node::dict_find_list(string_view key) const
 	{
 		bdecode_node ret = dict_find(key);
@@ -731,6 +901,8 @@ namespace {
 		std::swap(m_last_index, n.m_last_index);
 		std::swap(m_last_token, n.m_last_token);
 		std::swap(m_size, n.m_size);
+		std::swap(m_key_index, n.m_key_index);
+		std::swap(m_key_index_mask, n.m_key_index_mask);
 	}
 
 #define TORRENT_FAIL_BDECODE(code) do { \
@@ -769,6 +941,13 @@ namespace {
 		char const* end = start + buffer.size();
 		char const* const orig_start = start;
 
+		// a token takes up about as much space as 8 bytes of bencoded data.
+		// Reserving that up-front saves growing the token vector one
+		// reallocation at a time while parsing small messages. Large buffers
+		// tend to be dominated by long strings (like the piece hashes), so
+		// don't reserve too much for those.
+		ret.m_tokens.reserve(std::min(buffer.size() / 8 + 4, std::size_t(2048)));
+
 		if (start == end)
 			TORRENT_FAIL_BDECODE(bdecode_errors::unexpected_eof);
 
@@ -790,8 +969,7 @@ namespace {
 
 			// if we're currently parsing a dictionary, assert that
 			// every other node is a string.
-			if (current_frame > 0
-				&& ret.m_tokens[stack[current_frame - 1].token].type == bdecode_token::dict)
+			if (current_frame > 0 && stack[current_frame - 1].dict)
 			{
 				if (stack[current_frame - 1].state == 0)
 				{
@@ -805,7 +983,7 @@ namespace {
 			switch (t)
 			{
 				case 'd':
-					stack[sp++] = stack_frame(int(ret.m_tokens.size()));
+					stack[sp++] = stack_frame(int(ret.m_tokens.size()), true);
 					// we push it into the stack so that we know where to fill
 					// in the next_node field once we pop this node off the stack.
 					// i.e. get to the node following the dictionary in the buffer
@@ -813,7 +991,7 @@ namespace {
 					++start;
 					break;
 				case 'l':
-					stack[sp++] = stack_frame(int(ret.m_tokens.size()));
+					stack[sp++] = stack_frame(int(ret.m_tokens.size()), false);
 					// we push it into the stack so that we know where to fill
 					// in the next_node field once we pop this node off the stack.
 					// i.e. get to the node following the list in the buffer
@@ -850,7 +1028,7 @@ namespace {
 						TORRENT_FAIL_BDECODE(bdecode_errors::unexpected_eof);
 
 					if (sp > 0
-						&& ret.m_tokens[stack[sp - 1].token].type == bdecode_token::dict
+						&& stack[sp - 1].dict
 						&& stack[sp - 1].state == 1)
 					{
 						// this means we're parsing a dictionary and about to parse a
@@ -884,12 +1062,10 @@ namespace {
 					if (!numeric(t))
 						TORRENT_FAIL_BDECODE(bdecode_errors::expected_value);
 
-					std::int64_t len = t - '0';
+					std::int64_t len = 0;
 					char const* const str_start = start;
-					++start;
-					if (start >= end) TORRENT_FAIL_BDECODE(bdecode_errors::unexpected_eof);
 					bdecode_errors::error_code_enum e = bdecode_errors::no_error;
-					start = parse_int(start, end, ':', len, e);
+					start = parse_string_length(start, end, len, e);
 					if (e)
 						TORRENT_FAIL_BDECODE(e);
 					if (start == end)
@@ -920,8 +1096,7 @@ namespace {
 				}
 			}
 
-			if (current_frame > 0
-				&& ret.m_tokens[stack[current_frame - 1].token].type == bdecode_token::dict)
+			if (current_frame > 0 && stack[current_frame - 1].dict)
 			{
 				// the next item we parse is the opposite
 				stack[current_frame - 1].state = ~stack[current_frame - 1].state;
@@ -942,8 +1117,7 @@ done:
 
 			// we may need to insert a dummy token to properly terminate the tree,
 			// in case we just parsed a key to a dict and failed in the value
-			if (ret.m_tokens[stack[sp].token].type == bdecode_token::dict
-				&& stack[sp].state == 1)
+			if (stack[sp].dict && stack[sp].state == 1)
 			{
 				// insert an empty dictionary as the value
 				ret.m_tokens.push_back({start - orig_start, 2, bdecode_token::dict});
@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <memory> // unique_ptr
 #include <vector>
 #include <functional>
+#include <set>
 
 #include "libtorrent/aux_/disable_warnings_push.hpp"
 
@@ -53,6 +54,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/identify_client.hpp"
 #include "libtorrent/entry.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/aux_/bencode_writer.hpp"
 #include "libtorrent/alert_types.hpp"
 #include "libtorrent/invariant_check.hpp"
 #include "libtorrent/io.hpp"
@@ -123,6 +126,40 @@ namespace {
 		return ret;
 	}
 
+	// the chacha20 key and nonce for one direction:
+	// hash(label,'1',S,SKEY) + hash(label,'2',S,SKEY), where the label is
+	// 'keyA' or 'keyB', the same as for the rc4 keys
+	std::array<char, chacha20_handler::key_size> pe_chacha20_key(char const* label
+		, std::array<char, dh_key_len> const& secret, sha1_hash const& stream_key)
+	{
+		std::array<char, 2 * 20> material;
+		for (int i = 0; i < 2; ++i)
+		{
+			char const n = char('1' + i);
+			hasher h(span<char const>(label, 4));
+			h.update({&n, 1});
+			h.update(secret);
+			h.update(stream_key);
+			sha1_hash const digest = h.final();
+			std::memcpy(material.data() + i * 20, digest.data(), 20);
+		}
+		std::array<char, chacha20_handler::key_size> ret;
+		std::memcpy(ret.data(), material.data(), ret.size());
+		return ret;
+	}
+
+	std::shared_ptr<chacha20_handler> init_pe_chacha20_handler(key_t const& secret
+		, sha1_hash const& stream_key, bool const outgoing)
+	{
+		std::array<char, dh_key_len> const secret_buf = export_key(secret);
+		auto ret = std::make_shared<chacha20_handler>();
+		ret->set_outgoing_key(pe_chacha20_key(outgoing ? "keyA" : "keyB"
+			, secret_buf, stream_key));
+		ret->set_incoming_key(pe_chacha20_key(outgoing ? "keyB" : "keyA"
+			, secret_buf, stream_key));
+		return ret;
+	}
+
 } // anonymous namespace
 #endif
 
@@ -160,6 +197,7 @@ namespace {
 #if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
 		, m_encrypted(false)
 		, m_rc4_encrypted(false)
+		, m_chacha20_encrypted(false)
 		, m_recv_buffer(peer_connection::m_recv_buffer)
 #endif
 		, m_our_peer_id(pid)
@@ -459,6 +497,8 @@ namespace {
 		{
 			p.flags |= m_rc4_encrypted
 				? peer_info::rc4_encrypted
+				: m_chacha20_encrypted
+				? peer_info::chacha20_encrypted
 				: peer_info::plaintext_encrypted;
 		}
 #endif
@@ -580,25 +620,25 @@ namespace {
 		ptr += 20;
 
 		// Discard DH key exchange data, setup RC4 keys
-		m_rc4 = init_pe_rc4_handler(secret_key, info_hash, is_outgoing());
-#ifndef TORRENT_DISABLE_LOGGING
-		peer_log(peer_log_alert::info, "ENCRYPTION", "computed RC4 keys");
-#endif
+		init_stream_ciphers(secret_key, info_hash);
 		m_dh_key_exchange.reset(); // secret should be invalid at this point
 
 		// write the verification constant and crypto field
 		std::size_t const encrypt_size = sizeof(msg) - 512 + pad_size - 40;
 
 		// this is an invalid setting, but let's just make the best of the situation
-		int const enc_level = m_settings.get_int(settings_pack::allowed_enc_level);
-		std::uint8_t const crypto_provide = ((enc_level & settings_pack::pe_both) == 0)
+		int enc_level = m_settings.get_int(settings_pack::allowed_enc_level)
+			& (settings_pack::pe_both | settings_pack::pe_chacha20);
+		if (!m_chacha20) enc_level &= ~settings_pack::pe_chacha20;
+		std::uint8_t const crypto_provide = (enc_level == 0)
 			? std::uint8_t(settings_pack::pe_both)
 			: std::uint8_t(enc_level);
 
 #ifndef TORRENT_DISABLE_LOGGING
-		static char const* level[] = {"plaintext", "rc4", "plaintext rc4"};
-		peer_log(peer_log_alert::info, "ENCRYPTION"
-			, "%s", level[crypto_provide - 1]);
+		peer_log(peer_log_alert::info, "ENCRYPTION", "%s%s%s"
+			, (crypto_provide & settings_pack::pe_plaintext) ? " plaintext" : ""
+			, (crypto_provide & settings_pack::pe_rc4) ? " rc4" : ""
+			, (crypto_provide & settings_pack::pe_chacha20) ? " chacha20" : "");
 #endif
 
 		write_pe_vc_cryptofield({ptr, encrypt_size}, crypto_provide, pad_size);
@@ -614,7 +654,8 @@ namespace {
 		TORRENT_ASSERT(!is_outgoing());
 		TORRENT_ASSERT(!m_encrypted);
 		TORRENT_ASSERT(!m_rc4_encrypted);
-		TORRENT_ASSERT(crypto_select == 0x02 || crypto_select == 0x01);
+		TORRENT_ASSERT(crypto_select == 0x04 || crypto_select == 0x02 || crypto_select == 0x01);
+		TORRENT_ASSERT(crypto_select != 0x04 || m_chacha20);
 		TORRENT_ASSERT(!m_sent_handshake);
 
 		std::size_t const pad_size = random(512);
@@ -628,14 +669,13 @@ namespace {
 		send_buffer(vec);
 
 		// encryption method has been negotiated
-		if (crypto_select == 0x02)
-			m_rc4_encrypted = true;
-		else // 0x01
-			m_rc4_encrypted = false;
+		m_rc4_encrypted = (crypto_select == 0x02);
+		m_chacha20_encrypted = (crypto_select == 0x04);
 
 #ifndef TORRENT_DISABLE_LOGGING
 		peer_log(peer_log_alert::info, "ENCRYPTION", " crypto select: %s"
-			, (crypto_select == 0x01) ? "plaintext" : "rc4");
+			, (crypto_select == 0x01) ? "plaintext"
+			: (crypto_select == 0x02) ? "rc4" : "chacha20");
 #endif
 	}
 
@@ -646,7 +686,7 @@ namespace {
 	{
 		INVARIANT_CHECK;
 
-		TORRENT_ASSERT(crypto_field <= 0x03 && crypto_field > 0);
+		TORRENT_ASSERT(crypto_field <= 0x07 && crypto_field > 0);
 		// vc,crypto_field,len(pad),pad, (len(ia))
 		TORRENT_ASSERT((write_buf.size() >= 8+4+2+pad_size+2
 				&& is_outgoing())
@@ -676,6 +716,25 @@ namespace {
 		m_rc4->decrypt(buf);
 	}
 
+	void bt_peer_connection::init_stream_ciphers(key_t const& secret
+		, sha1_hash const& stream_key)
+	{
+		m_rc4 = init_pe_rc4_handler(secret, stream_key, is_outgoing());
+		if (m_settings.get_int(settings_pack::allowed_enc_level) & settings_pack::pe_chacha20)
+			m_chacha20 = init_pe_chacha20_handler(secret, stream_key, is_outgoing());
+#ifndef TORRENT_DISABLE_LOGGING
+		peer_log(peer_log_alert::info, "ENCRYPTION", "computed RC4%s keys"
+			, m_chacha20 ? " and chacha20" : "");
+#endif
+	}
+
+	std::shared_ptr<crypto_plugin> bt_peer_connection::stream_crypto() const
+	{
+		if (m_rc4_encrypted) return m_rc4;
+		if (m_chacha20_encrypted) return m_chacha20;
+		return std::shared_ptr<crypto_plugin>();
+	}
+
 #endif // #if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
 
 	void bt_peer_connection::write_handshake()
@@ -2102,6 +2161,70 @@ namespace {
 	}
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
+namespace {
+
+	// merges the dictionary filled in by peer plugins (in their add_handshake()
+	// hooks) with the keys we write ourselves, keeping everything in sorted
+	// order. If a plugin set a key we also write, the plugin's value wins
+	struct handshake_merger
+	{
+		handshake_merger(aux::bencode_writer& w, entry const& e)
+			: m_w(w)
+		{
+			static entry::dictionary_type const empty_dict;
+			entry::dictionary_type const& d = e.type() == entry::dictionary_t
+				? e.dict() : empty_dict;
+			m_it = d.begin();
+			m_end = d.end();
+		}
+
+		// writes key ``k``. Returns true if the caller is expected to write
+		// its value, false if it was provided by a plugin
+		bool key(string_view const k)
+		{
+			flush(k);
+			m_w.key(k);
+			if (m_it == m_end || m_it->first != k) return true;
+			m_w.value(m_it->second);
+			++m_it;
+			return false;
+		}
+
+		// if a plugin added a dictionary under ``k``, it's returned (and the
+		// caller is expected to merge it). Otherwise nullptr
+		entry const* sub_dict(string_view const k)
+		{
+			flush(k);
+			if (m_it == m_end || m_it->first != k
+				|| m_it->second.type() != entry::dictionary_t)
+				return nullptr;
+			return &(m_it++)->second;
+		}
+
+		// writes any remaining keys added by plugins
+		void finish() { while (m_it != m_end) write_plugin_key(); }
+
+	private:
+
+		void flush(string_view const k)
+		{
+			while (m_it != m_end && string_view(m_it->first) < k)
+				write_plugin_key();
+		}
+
+		void write_plugin_key()
+		{
+			m_w.key(m_it->first);
+			m_w.value(m_it->second);
+			++m_it;
+		}
+
+		aux::bencode_writer& m_w;
+		entry::dictionary_type::const_iterator m_it;
+		entry::dictionary_type::const_iterator m_end;
+	};
+}
+
 	void bt_peer_connection::write_extensions()
 	{
 		INVARIANT_CHECK;
@@ -2109,44 +2232,76 @@ namespace {
 		TORRENT_ASSERT(m_supports_extensions);
 		TORRENT_ASSERT(m_sent_handshake);
 
-		entry handshake;
-		entry::dictionary_type& m = handshake["m"].dict();
-
-		// if we're using a proxy, our listen port won't be useful
-		// anyway.
-		if (!m_settings.get_bool(settings_pack::force_proxy) && is_outgoing())
-			handshake["p"] = m_ses.listen_port();
+		std::shared_ptr<torrent> t = associated_torrent().lock();
+		TORRENT_ASSERT(t);
 
-		// only send the port in case we bade the connection
-		// on incoming connections the other end already knows
-		// our listen port
-		if (!m_settings.get_bool(settings_pack::anonymous_mode))
+		// plugins fill in their own keys into an entry, which is then merged
+		// with the keys written here
+		entry plugin_keys;
+		for (auto const& e : m_extensions)
 		{
-			handshake["v"] = m_settings.get_str(settings_pack::handshake_client_version).empty()
-				? m_settings.get_str(settings_pack::user_agent)
-				: m_settings.get_str(settings_pack::handshake_client_version);
+			e->add_handshake(plugin_keys);
 		}
 
-		std::string remote_address;
-		std::back_insert_iterator<std::string> out(remote_address);
-		detail::write_address(remote().address(), out);
-#if TORRENT_USE_I2P
-		if (!is_i2p(*get_socket()))
-#endif
-			handshake["yourip"] = remote_address;
-		handshake["reqq"] = m_settings.get_int(settings_pack::max_allowed_in_request_queue);
-		std::shared_ptr<torrent> t = associated_torrent().lock();
-		TORRENT_ASSERT(t);
+		static_assert(aux::keys_sorted("complete_ago", "m", "p", "reqq"
+			, "share_mode", "upload_only", "v", "yourip")
+			, "extension handshake keys out of order");
+		static_assert(aux::keys_sorted("lt_donthave", "share_mode"
+			, "upload_only", "ut_holepunch")
+			, "extension message keys out of order");
 
-		m["upload_only"] = upload_only_msg;
-		m["ut_holepunch"] = holepunch_msg;
-		if (m_settings.get_bool(settings_pack::support_share_mode))
-			m["share_mode"] = share_mode_msg;
-		m["lt_donthave"] = dont_have_msg;
+		bool const share_mode_support = m_settings.get_bool(settings_pack::support_share_mode);
+
+		std::vector<char> dict_msg;
+		dict_msg.reserve(200);
+		aux::bencode_writer w(dict_msg);
+		w.open_dict();
+		handshake_merger hs(w, plugin_keys);
 
 		int complete_ago = -1;
 		if (t->last_seen_complete() > 0) complete_ago = t->time_since_complete();
-		handshake["complete_ago"] = complete_ago;
+		if (hs.key("complete_ago")) w.integer(complete_ago);
+
+		entry const* plugin_messages = hs.sub_dict("m");
+		if (plugin_messages != nullptr)
+		{
+			w.key("m");
+			w.open_dict();
+			handshake_merger m(w, *plugin_messages);
+			if (m.key("lt_donthave")) w.integer(dont_have_msg);
+			if (share_mode_support && m.key("share_mode")) w.integer(share_mode_msg);
+			if (m.key("upload_only")) w.integer(upload_only_msg);
+			if (m.key("ut_holepunch")) w.integer(holepunch_msg);
+			m.finish();
+			w.close();
+		}
+		else if (hs.key("m"))
+		{
+			w.open_dict();
+			w.key("lt_donthave"); w.integer(dont_have_msg);
+			if (share_mode_support)
+			{
+				w.key("share_mode"); w.integer(share_mode_msg);
+			}
+			w.key("upload_only"); w.integer(upload_only_msg);
+			w.key("ut_holepunch"); w.integer(holepunch_msg);
+			w.close();
+		}
+
+		// if we're using a proxy, our listen port won't be useful
+		// anyway.
+		if (!m_settings.get_bool(settings_pack::force_proxy) && is_outgoing())
+		{
+			if (hs.key("p")) w.integer(m_ses.listen_port());
+		}
+
+		if (hs.key("reqq"))
+			w.integer(m_settings.get_int(settings_pack::max_allowed_in_request_queue));
+
+		if (share_mode_support && t->share_mode())
+		{
+			if (hs.key("share_mode")) w.integer(1);
+		}
 
 		// if we're super seeding, don't say we're upload only, since it might
 		// make peers disconnect. don't tell anyone we're upload only when in
@@ -2162,36 +2317,54 @@ namespace {
 			&& t->valid_metadata()
 			&& !t->super_seeding())
 		{
-			handshake["upload_only"] = 1;
+			if (hs.key("upload_only")) w.integer(1);
 		}
 
-		if (m_settings.get_bool(settings_pack::support_share_mode)
-			&& t->share_mode())
-			handshake["share_mode"] = 1;
+		// only send the port in case we bade the connection
+		// on incoming connections the other end already knows
+		// our listen port
+		if (!m_settings.get_bool(settings_pack::anonymous_mode))
+		{
+			if (hs.key("v"))
+			{
+				w.string(m_settings.get_str(settings_pack::handshake_client_version).empty()
+					? m_settings.get_str(settings_pack::user_agent)
+					: m_settings.get_str(settings_pack::handshake_client_version));
+			}
+		}
 
-		// loop backwards, to make the first extension be the last
-		// to fill in the handshake (i.e. give the first extensions priority)
-		for (auto const& e : m_extensions)
+#if TORRENT_USE_I2P
+		if (!is_i2p(*get_socket()))
+#endif
 		{
-			e->add_handshake(handshake);
+			if (hs.key("yourip"))
+			{
+				address const& a = remote().address();
+				char* ptr = w.string_buffer(a.is_v4() ? 4 : 16);
+				detail::write_address(a, ptr);
+			}
 		}
 
-#ifndef NDEBUG
+		hs.finish();
+		w.close();
+		TORRENT_ASSERT(w.done());
+
+#if TORRENT_USE_ASSERTS
 		// make sure there are not conflicting extensions
-		std::set<int> ext;
-		for (entry::dictionary_type::const_iterator i = m.begin()
-			, end(m.end()); i != end; ++i)
+		error_code ec;
+		bdecode_node const handshake = bdecode(dict_msg, ec);
+		TORRENT_ASSERT(!ec);
+		std::set<std::int64_t> ext;
+		bdecode_node const m = handshake.dict_find_dict("m");
+		for (int i = 0; i < m.dict_size(); ++i)
 		{
-			if (i->second.type() != entry::int_t) continue;
-			int val = int(i->second.integer());
-			TORRENT_ASSERT(ext.find(val) == ext.end());
-			ext.insert(val);
+			bdecode_node const val = m.dict_at(i).second;
+			if (val.type() != bdecode_node::int_t) continue;
+			TORRENT_ASSERT(ext.find(val.int_value()) == ext.end());
+			ext.insert(val.int_value());
 		}
 #endif
 
-		std::vector<char> dict_msg;
-		bencode(std::back_inserter(dict_msg), handshake);
-
 		char msg[6];
 		char* ptr = msg;
 
@@ -2208,8 +2381,9 @@ namespace {
 #ifndef TORRENT_DISABLE_LOGGING
 		if (should_log(peer_log_alert::outgoing_message))
 		{
+			error_code err;
 			peer_log(peer_log_alert::outgoing_message, "EXTENDED_HANDSHAKE"
-				, "%s", handshake.to_string().c_str());
+				, "%s", print_entry(bdecode(dict_msg, err), true).c_str());
 		}
 #endif
 	}
@@ -2630,10 +2804,8 @@ namespace {
 					TORRENT_ASSERT(t);
 				}
 
-				m_rc4 = init_pe_rc4_handler(m_dh_key_exchange->get_secret()
-					, ti->info_hash(), is_outgoing());
+				init_stream_ciphers(m_dh_key_exchange->get_secret(), ti->info_hash());
 #ifndef TORRENT_DISABLE_LOGGING
-				peer_log(peer_log_alert::info, "ENCRYPTION", "computed RC4 keys");
 				peer_log(peer_log_alert::info, "ENCRYPTION", "stream key found, torrent located");
 #endif
 			}
@@ -2758,16 +2930,18 @@ namespace {
 			std::uint32_t crypto_field = aux::read_uint32(recv_buffer);
 
 #ifndef TORRENT_DISABLE_LOGGING
-			peer_log(peer_log_alert::info, "ENCRYPTION", "crypto %s : [%s%s ]"
+			peer_log(peer_log_alert::info, "ENCRYPTION", "crypto %s : [%s%s%s ]"
 				, is_outgoing() ? "select" : "provide"
 				, (crypto_field & 1) ? " plaintext" : ""
-				, (crypto_field & 2) ? " rc4" : "");
+				, (crypto_field & 2) ? " rc4" : ""
+				, (crypto_field & 4) ? " chacha20" : "");
 #endif
 
 			if (!is_outgoing())
 			{
 				// select a crypto method
 				int allowed_encryption = m_settings.get_int(settings_pack::allowed_enc_level);
+				if (!m_chacha20) allowed_encryption &= ~settings_pack::pe_chacha20;
 				std::uint32_t crypto_select = crypto_field & std::uint32_t(allowed_encryption);
 
 				// when prefer_rc4 is set, keep the most significant bit
@@ -2804,6 +2978,7 @@ namespace {
 			{
 				// check if crypto select is valid
 				int allowed_encryption = m_settings.get_int(settings_pack::allowed_enc_level);
+				if (!m_chacha20) allowed_encryption &= ~settings_pack::pe_chacha20;
 
 				crypto_field &= std::uint32_t(allowed_encryption);
 				if (crypto_field == 0)
@@ -2817,6 +2992,8 @@ namespace {
 					m_rc4_encrypted = false;
 				else if (crypto_field == settings_pack::pe_rc4)
 					m_rc4_encrypted = true;
+				else if (crypto_field == settings_pack::pe_chacha20)
+					m_chacha20_encrypted = true;
 			}
 
 			int len_pad = aux::read_int16(recv_buffer);
@@ -2834,10 +3011,10 @@ namespace {
 				if (len_pad == 0)
 				{
 					m_encrypted = true;
-					if (m_rc4_encrypted)
+					if (auto const crypto = stream_crypto())
 					{
-						switch_send_crypto(m_rc4);
-						switch_recv_crypto(m_rc4);
+						switch_send_crypto(crypto);
+						switch_recv_crypto(crypto);
 					}
 					m_state = state_t::init_bt_handshake;
 				}
@@ -2878,10 +3055,10 @@ namespace {
 				{
 					// everything after this is Encrypt2
 					m_encrypted = true;
-					if (m_rc4_encrypted)
+					if (auto const crypto = stream_crypto())
 					{
-						switch_send_crypto(m_rc4);
-						switch_recv_crypto(m_rc4);
+						switch_send_crypto(crypto);
+						switch_recv_crypto(crypto);
 					}
 					m_state = state_t::init_bt_handshake;
 				}
@@ -2895,10 +3072,10 @@ namespace {
 			{
 				// everything that arrives after this is Encrypt2
 				m_encrypted = true;
-				if (m_rc4_encrypted)
+				if (auto const crypto = stream_crypto())
 				{
-					switch_send_crypto(m_rc4);
-					switch_recv_crypto(m_rc4);
+					switch_send_crypto(crypto);
+					switch_recv_crypto(crypto);
 				}
 				m_state = state_t::init_bt_handshake;
 			}
@@ -2923,12 +3100,13 @@ namespace {
 
 			// everything that arrives after this is encrypted
 			m_encrypted = true;
-			if (m_rc4_encrypted)
+			if (auto const crypto = stream_crypto())
 			{
-				switch_send_crypto(m_rc4);
-				switch_recv_crypto(m_rc4);
+				switch_send_crypto(crypto);
+				switch_recv_crypto(crypto);
 			}
 			m_rc4.reset();
+			m_chacha20.reset();
 
 			m_state = state_t::read_protocol_identifier;
 			m_recv_buffer.cut(0, 20);
@@ -2941,11 +3119,11 @@ namespace {
 			TORRENT_ASSERT(m_encrypted);
 
 			// decrypt remaining received bytes
-			if (m_rc4_encrypted)
+			if (auto const crypto = stream_crypto())
 			{
-				span<char> const remaining = m_recv_buffer.mutable_buffer()
+				span<char> remaining = m_recv_buffer.mutable_buffer()
 					.subspan(aux::numeric_cast<std::size_t>(m_recv_buffer.packet_size()));
-				rc4_decrypt(remaining);
+				crypto->decrypt(remaining);
 
 #ifndef TORRENT_DISABLE_LOGGING
 				peer_log(peer_log_alert::info, "ENCRYPTION"
@@ -2953,6 +3131,7 @@ namespace {
 #endif
 			}
 			m_rc4.reset();
+			m_chacha20.reset();
 
 			// payload stream, start with 20 handshake bytes
 			m_state = state_t::read_protocol_identifier;
@@ -3470,6 +3649,9 @@ namespace {
 
 		TORRENT_ASSERT(!m_rc4_encrypted || (!m_encrypted && m_rc4)
 			|| (m_encrypted && !m_enc_handler.is_send_plaintext()));
+		TORRENT_ASSERT(!m_chacha20_encrypted || (!m_encrypted && m_chacha20)
+			|| (m_encrypted && !m_enc_handler.is_send_plaintext()));
+		TORRENT_ASSERT(!(m_rc4_encrypted && m_chacha20_encrypted));
 #endif
 		if (!in_handshake())
 		{
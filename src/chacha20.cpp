@@ -0,0 +1,265 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/aux_/chacha20.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+// SSE2 is part of the x86-64 baseline, on 32 bit x86 it has to be enabled
+// explicitly
+#if TORRENT_HAS_SSE && (defined __SSE2__ || defined _M_X64 || defined _M_AMD64 \
+	|| (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define TORRENT_CHACHA20_SSE2 1
+#else
+#define TORRENT_CHACHA20_SSE2 0
+#endif
+
+#if TORRENT_CHACHA20_SSE2
+#include "libtorrent/aux_/disable_warnings_push.hpp"
+#include <emmintrin.h>
+#include "libtorrent/aux_/disable_warnings_pop.hpp"
+#endif
+
+namespace libtorrent { namespace aux {
+
+	constexpr int chacha20::key_size;
+	constexpr int chacha20::nonce_size;
+	constexpr int chacha20::block_size;
+	constexpr int chacha20::batch_size;
+
+	namespace {
+
+	std::uint32_t load_le32(char const* p)
+	{
+		std::uint8_t const* b = reinterpret_cast<std::uint8_t const*>(p);
+		return std::uint32_t(b[0]) | (std::uint32_t(b[1]) << 8)
+			| (std::uint32_t(b[2]) << 16) | (std::uint32_t(b[3]) << 24);
+	}
+
+	std::uint32_t rotl(std::uint32_t const v, int const n)
+	{
+		return (v << n) | (v >> (32 - n));
+	}
+
+	void quarter_round(std::uint32_t& a, std::uint32_t& b
+		, std::uint32_t& c, std::uint32_t& d)
+	{
+		a += b; d ^= a; d = rotl(d, 16);
+		c += d; b ^= c; b = rotl(b, 12);
+		a += b; d ^= a; d = rotl(d, 8);
+		c += d; b ^= c; b = rotl(b, 7);
+	}
+
+	void increment_counter(std::array<std::uint32_t, 16>& state, std::uint32_t const n)
+	{
+		std::uint64_t const counter = (std::uint64_t(state[13]) << 32) + state[12] + n;
+		state[12] = std::uint32_t(counter);
+		state[13] = std::uint32_t(counter >> 32);
+	}
+
+#if TORRENT_CHACHA20_SSE2
+	template <int N>
+	__m128i rotl(__m128i const v)
+	{
+		return _mm_or_si128(_mm_slli_epi32(v, N), _mm_srli_epi32(v, 32 - N));
+	}
+
+	// rotating by 16 is swapping the 16 bit halves of each word, which can be
+	// done with shuffles instead of two shifts and an or
+	template <>
+	__m128i rotl<16>(__m128i const v)
+	{
+		return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+	}
+
+	void quarter_round(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+	{
+		a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = rotl<16>(d);
+		c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = rotl<12>(b);
+		a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = rotl<8>(d);
+		c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = rotl<7>(b);
+	}
+#endif
+
+	} // anonymous namespace
+
+	void chacha20_blocks_sw(std::array<std::uint32_t, 16>& state, std::uint8_t* out)
+	{
+		for (int block = 0; block < chacha20::batch_size / chacha20::block_size; ++block)
+		{
+			std::array<std::uint32_t, 16> x = state;
+			for (int i = 0; i < 10; ++i)
+			{
+				quarter_round(x[0], x[4], x[8], x[12]);
+				quarter_round(x[1], x[5], x[9], x[13]);
+				quarter_round(x[2], x[6], x[10], x[14]);
+				quarter_round(x[3], x[7], x[11], x[15]);
+				quarter_round(x[0], x[5], x[10], x[15]);
+				quarter_round(x[1], x[6], x[11], x[12]);
+				quarter_round(x[2], x[7], x[8], x[13]);
+				quarter_round(x[3], x[4], x[9], x[14]);
+			}
+			for (int i = 0; i < 16; ++i)
+			{
+				std::uint32_t const v = x[std::size_t(i)] + state[std::size_t(i)];
+				out[0] = std::uint8_t(v);
+				out[1] = std::uint8_t(v >> 8);
+				out[2] = std::uint8_t(v >> 16);
+				out[3] = std::uint8_t(v >> 24);
+				out += 4;
+			}
+			increment_counter(state, 1);
+		}
+	}
+
+	bool chacha20_blocks_hw(std::array<std::uint32_t, 16>& state, std::uint8_t* out)
+	{
+#if TORRENT_CHACHA20_SSE2
+		// each vector holds the same word of the state for four consecutive
+		// blocks. The only words that differ between them are the counter
+		std::uint64_t const counter = (std::uint64_t(state[13]) << 32) | state[12];
+		__m128i in[16];
+		for (int i = 0; i < 16; ++i)
+			in[i] = _mm_set1_epi32(int(state[std::size_t(i)]));
+		in[12] = _mm_setr_epi32(int(std::uint32_t(counter))
+			, int(std::uint32_t(counter + 1))
+			, int(std::uint32_t(counter + 2))
+			, int(std::uint32_t(counter + 3)));
+		in[13] = _mm_setr_epi32(int(std::uint32_t(counter >> 32))
+			, int(std::uint32_t((counter + 1) >> 32))
+			, int(std::uint32_t((counter + 2) >> 32))
+			, int(std::uint32_t((counter + 3) >> 32)));
+
+		__m128i x[16];
+		std::copy(in, in + 16, x);
+		for (int i = 0; i < 10; ++i)
+		{
+			quarter_round(x[0], x[4], x[8], x[12]);
+			quarter_round(x[1], x[5], x[9], x[13]);
+			quarter_round(x[2], x[6], x[10], x[14]);
+			quarter_round(x[3], x[7], x[11], x[15]);
+			quarter_round(x[0], x[5], x[10], x[15]);
+			quarter_round(x[1], x[6], x[11], x[12]);
+			quarter_round(x[2], x[7], x[8], x[13]);
+			quarter_round(x[3], x[4], x[9], x[14]);
+		}
+		for (int i = 0; i < 16; ++i)
+			x[i] = _mm_add_epi32(x[i], in[i]);
+
+		// transpose each group of four words, to get them in block order
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128i const t0 = _mm_unpacklo_epi32(x[i], x[i + 1]);
+			__m128i const t1 = _mm_unpacklo_epi32(x[i + 2], x[i + 3]);
+			__m128i const t2 = _mm_unpackhi_epi32(x[i], x[i + 1]);
+			__m128i const t3 = _mm_unpackhi_epi32(x[i + 2], x[i + 3]);
+			std::uint8_t* const dst = out + i * 4;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst)
+				, _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + chacha20::block_size)
+				, _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * chacha20::block_size)
+				, _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * chacha20::block_size)
+				, _mm_unpackhi_epi64(t2, t3));
+		}
+		increment_counter(state, 4);
+		return true;
+#else
+		TORRENT_UNUSED(state);
+		TORRENT_UNUSED(out);
+		return false;
+#endif
+	}
+
+	chacha20::chacha20()
+		: m_pos(batch_size)
+	{
+		m_state.fill(0);
+	}
+
+	void chacha20::set_key(span<char const> const key, span<char const> const nonce
+		, std::uint64_t const counter)
+	{
+		TORRENT_ASSERT(key.size() == key_size);
+		TORRENT_ASSERT(nonce.size() == nonce_size);
+
+		// "expand 32-byte k"
+		m_state[0] = 0x61707865;
+		m_state[1] = 0x3320646e;
+		m_state[2] = 0x79622d32;
+		m_state[3] = 0x6b206574;
+		for (int i = 0; i < 8; ++i)
+			m_state[std::size_t(4 + i)] = load_le32(key.data() + i * 4);
+		m_state[12] = std::uint32_t(counter);
+		m_state[13] = std::uint32_t(counter >> 32);
+		m_state[14] = load_le32(nonce.data());
+		m_state[15] = load_le32(nonce.data() + 4);
+		m_pos = batch_size;
+	}
+
+	void chacha20::next_batch()
+	{
+		if (!chacha20_blocks_hw(m_state, m_stream.data()))
+			chacha20_blocks_sw(m_state, m_stream.data());
+		m_pos = 0;
+	}
+
+	void chacha20::crypt(span<char> buf)
+	{
+		char* ptr = buf.data();
+		std::size_t left = std::size_t(buf.size());
+		while (left > 0)
+		{
+			if (m_pos == batch_size) next_batch();
+			std::size_t const n = std::min(left, std::size_t(batch_size - m_pos));
+			std::uint8_t const* ks = m_stream.data() + m_pos;
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				std::uint64_t a, b;
+				std::memcpy(&a, ptr + i, 8);
+				std::memcpy(&b, ks + i, 8);
+				a ^= b;
+				std::memcpy(ptr + i, &a, 8);
+			}
+			for (; i < n; ++i)
+				ptr[i] = char(ptr[i] ^ ks[i]);
+			ptr += n;
+			left -= n;
+			m_pos += int(n);
+		}
+	}
+}}
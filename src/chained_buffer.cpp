@@ -34,17 +34,21 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/assert.hpp"
 
 #include <cstring> // for memcpy
+#include <algorithm> // for min
 
 namespace libtorrent {
 
+	constexpr int chained_buffer::max_iovec;
+	constexpr int chained_buffer::inline_segments;
+
 	void chained_buffer::pop_front(int bytes_to_pop)
 	{
 		TORRENT_ASSERT(is_single_thread());
 		TORRENT_ASSERT(!m_destructed);
 		TORRENT_ASSERT(bytes_to_pop <= m_bytes);
-		while (bytes_to_pop > 0 && !m_vec.empty())
+		while (bytes_to_pop > 0 && m_num > 0)
 		{
-			buffer_t& b = m_vec.front();
+			buffer_t& b = front();
 			if (b.used_size > bytes_to_pop)
 			{
 				b.buf += bytes_to_pop;
@@ -58,15 +62,19 @@ namespace libtorrent {
 				break;
 			}
 
-			b.destruct_holder(static_cast<void*>(&b.holder));
+			destruct(b);
 			m_bytes -= b.used_size;
 			m_capacity -= b.size;
 			bytes_to_pop -= b.used_size;
 			TORRENT_ASSERT(m_bytes >= 0);
 			TORRENT_ASSERT(m_capacity >= 0);
 			TORRENT_ASSERT(m_bytes <= m_capacity);
-			m_vec.pop_front();
+			m_first = (m_first + 1) & (m_ring_size - 1);
+			--m_num;
 		}
+		// when the ring is empty, start over from the beginning to keep the
+		// buffers we send contiguous in memory
+		if (m_num == 0) m_first = 0;
 	}
 
 	// returns the number of bytes available at the
@@ -75,8 +83,8 @@ namespace libtorrent {
 	{
 		TORRENT_ASSERT(is_single_thread());
 		TORRENT_ASSERT(!m_destructed);
-		if (m_vec.empty()) return 0;
-		buffer_t& b = m_vec.back();
+		if (m_num == 0) return 0;
+		buffer_t& b = back();
 		TORRENT_ASSERT(b.buf != nullptr);
 		return b.size - b.used_size;
 	}
@@ -101,8 +109,8 @@ namespace libtorrent {
 	{
 		TORRENT_ASSERT(is_single_thread());
 		TORRENT_ASSERT(!m_destructed);
-		if (m_vec.empty()) return nullptr;
-		buffer_t& b = m_vec.back();
+		if (m_num == 0) return nullptr;
+		buffer_t& b = back();
 		TORRENT_ASSERT(b.buf != nullptr);
 		char* const insert = b.buf + b.used_size;
 		if (insert + s > b.buf + b.size) return nullptr;
@@ -112,48 +120,81 @@ namespace libtorrent {
 		return insert;
 	}
 
-	std::vector<boost::asio::const_buffer> const& chained_buffer::build_iovec(int const to_send)
+	chained_buffer::iovec_t chained_buffer::build_iovec(int const to_send)
 	{
 		TORRENT_ASSERT(is_single_thread());
 		TORRENT_ASSERT(!m_destructed);
-		m_tmp_vec.clear();
-		build_vec(to_send, m_tmp_vec);
-		return m_tmp_vec;
+		m_num_iovec = build_vec(to_send, span<boost::asio::const_buffer>(m_tmp_vec));
+		return iovec_t(m_tmp_vec.data(), m_tmp_vec.data() + m_num_iovec);
 	}
 
-	void chained_buffer::build_mutable_iovec(int bytes, std::vector<span<char>> &vec)
+	span<span<char>> chained_buffer::build_mutable_iovec(int const bytes
+		, span<span<char>> vec)
 	{
 		TORRENT_ASSERT(!m_destructed);
-		build_vec(bytes, vec);
+		return vec.first(std::size_t(build_vec(bytes, vec)));
 	}
 
 	template <typename Buffer>
-	void chained_buffer::build_vec(int bytes, std::vector<Buffer>& vec)
+	int chained_buffer::build_vec(int bytes, span<Buffer> vec)
 	{
 		TORRENT_ASSERT(!m_destructed);
-		for (auto i = m_vec.begin(), end(m_vec.end()); bytes > 0 && i != end; ++i)
+		int const limit = std::min(m_num, int(vec.size()));
+		int i = 0;
+		for (; bytes > 0 && i < limit; ++i)
 		{
-			TORRENT_ASSERT(i->buf != nullptr);
-			if (i->used_size > bytes)
+			buffer_t const& b = at(i);
+			TORRENT_ASSERT(b.buf != nullptr);
+			if (b.used_size > bytes)
 			{
 				TORRENT_ASSERT(bytes > 0);
-				vec.push_back(Buffer(i->buf, std::size_t(bytes)));
-				break;
+				vec[std::size_t(i)] = Buffer(b.buf, std::size_t(bytes));
+				return i + 1;
+			}
+			TORRENT_ASSERT(b.used_size > 0);
+			vec[std::size_t(i)] = Buffer(b.buf, std::size_t(b.used_size));
+			bytes -= b.used_size;
+		}
+		return i;
+	}
+
+	void chained_buffer::grow()
+	{
+		int const new_size = m_ring_size * 2;
+		std::unique_ptr<buffer_t[]> ring(new buffer_t[std::size_t(new_size)]);
+		for (int i = 0; i < m_num; ++i)
+		{
+			buffer_t& src = at(i);
+			buffer_t& dst = ring[std::size_t(i)];
+			if (src.move_holder == nullptr)
+			{
+				dst = src;
+				continue;
 			}
-			TORRENT_ASSERT(i->used_size > 0);
-			vec.push_back(Buffer(i->buf, std::size_t(i->used_size)));
-			bytes -= i->used_size;
+			dst.destruct_holder = src.destruct_holder;
+			dst.move_holder = src.move_holder;
+			dst.buf = src.buf;
+			dst.size = src.size;
+			dst.used_size = src.used_size;
+			src.move_holder(static_cast<void*>(&dst.holder)
+				, static_cast<void*>(&src.holder));
+			destruct(src);
 		}
+		m_heap = std::move(ring);
+		m_ring = m_heap.get();
+		m_ring_size = new_size;
+		m_first = 0;
 	}
 
 	void chained_buffer::clear()
 	{
 		TORRENT_ASSERT(!m_destructed);
-		for (auto& b : m_vec)
-			b.destruct_holder(static_cast<void*>(&b.holder));
+		for (int i = 0; i < m_num; ++i)
+			destruct(at(i));
 		m_bytes = 0;
 		m_capacity = 0;
-		m_vec.clear();
+		m_first = 0;
+		m_num = 0;
 	}
 
 	chained_buffer::~chained_buffer()
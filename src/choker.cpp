@@ -36,41 +36,39 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/time.hpp"
 #include "libtorrent/torrent.hpp"
 
-#include <functional>
-
-using namespace std::placeholders;
+#include <algorithm>
+#include <limits>
 
 namespace libtorrent {
 
 	namespace {
 
-	// return true if 'lhs' peer should be preferred to be unchoke over 'rhs'
-	bool unchoke_compare_rr(peer_connection const* lhs
-		, peer_connection const* rhs, int pieces)
-	{
-		// if one peer belongs to a higher priority torrent than the other one
-		// that one should be unchoked.
-		std::shared_ptr<torrent> t1 = lhs->associated_torrent().lock();
-		TORRENT_ASSERT(t1);
-		std::shared_ptr<torrent> t2 = rhs->associated_torrent().lock();
-		TORRENT_ASSERT(t2);
-
-		int const prio1 = lhs->get_priority(peer_connection::upload_channel);
-		int const prio2 = rhs->get_priority(peer_connection::upload_channel);
-
-		if (prio1 != prio2) return prio1 > prio2;
+	// the rank snapshots mirror what the comparison functions used to look at
+	// when sorting peer_connection pointers directly. Each peer is visited
+	// once per unchoke round (locking its torrent once) rather than once per
+	// comparison
 
-		// compare how many bytes they've sent us
-		std::int64_t const d1 = lhs->downloaded_in_last_round();
-		std::int64_t const d2 = rhs->downloaded_in_last_round();
-
-		if (d1 != d2) return d1 > d2;
-
-		// when seeding, rotate which peer is unchoked in a round-robin fasion
+	aux::unchoke_rank make_rank(peer_connection const* p, int const index
+		, std::int64_t const primary, std::int64_t const secondary = 0
+		, std::int64_t const tertiary = 0, int const prio = 0)
+	{
+		aux::unchoke_rank r;
+		r.primary = primary;
+		r.secondary = secondary;
+		r.tertiary = tertiary;
+		r.last_unchoke = p->time_of_last_unchoke();
+		r.prio = prio;
+		r.peer = index;
+		return r;
+	}
 
-		// the amount uploaded since unchoked (not just in the last round)
-		std::int64_t const u1 = lhs->uploaded_since_unchoked();
-		std::int64_t const u2 = rhs->uploaded_since_unchoked();
+	// prefer peers of higher priority torrents, then the ones that sent us the
+	// most. When seeding, rotate which peer is unchoked in a round-robin fasion
+	aux::unchoke_rank rank_rr(peer_connection const* p, int const index
+		, int const pieces, time_point const now)
+	{
+		std::shared_ptr<torrent> t = p->associated_torrent().lock();
+		TORRENT_ASSERT(t);
 
 		// the way the round-robin unchoker works is that it,
 		// by default, prioritizes any peer that is already unchoked.
@@ -81,99 +79,38 @@ namespace libtorrent {
 		// if a peer is already unchoked, the number of bytes sent since it was unchoked
 		// is greater than the send quanta, and it has been unchoked for at least one minute
 		// then it's done with its upload slot, and we can de-prioritize it
-		bool const c1_quota_complete = !lhs->is_choked()
-			&& u1 > t1->torrent_file().piece_length() * pieces
-			&& aux::time_now() - lhs->time_of_last_unchoke() > minutes(1);
-		bool const c2_quota_complete = !rhs->is_choked()
-			&& u2 > t2->torrent_file().piece_length() * pieces
-			&& aux::time_now() - rhs->time_of_last_unchoke() > minutes(1);
-
-		// if c2 has completed a quanta, it should be de-prioritized
-		// and vice versa
-		if (c1_quota_complete != c2_quota_complete)
-			return int(c1_quota_complete) < int(c2_quota_complete);
-
-		// when seeding, prefer the peer we're uploading the fastest to
+		bool const quota_complete = !p->is_choked()
+			&& p->uploaded_since_unchoked() > t->torrent_file().piece_length() * pieces
+			&& now - p->time_of_last_unchoke() > minutes(1);
 
 		// force the upload rate to zero for choked peers because
 		// if the peers just got choked the previous round
 		// there may have been a residual transfer which was already
 		// in-flight at the time and we don't want that to cause the peer
 		// to be ranked at the top of the choked peers
-		std::int64_t const c1 = lhs->is_choked() ? 0 : lhs->uploaded_in_last_round();
-		std::int64_t const c2 = rhs->is_choked() ? 0 : rhs->uploaded_in_last_round();
-
-		if (c1 != c2) return c1 > c2;
+		std::int64_t const upload = p->is_choked() ? 0 : p->uploaded_in_last_round();
 
 		// if the peers are still identical (say, they're both waiting to be unchoked)
 		// prioritize the one that has waited the longest to be unchoked
 		// the round-robin unchoker relies on this logic. Don't change it
 		// without moving this into that unchoker logic
-		return lhs->time_of_last_unchoke() < rhs->time_of_last_unchoke();
+		return make_rank(p, index, p->downloaded_in_last_round()
+			, quota_complete ? 0 : 1, upload
+			, p->get_priority(peer_connection::upload_channel));
 	}
 
-	// return true if 'lhs' peer should be preferred to be unchoke over 'rhs'
-	bool unchoke_compare_fastest_upload(peer_connection const* lhs
-		, peer_connection const* rhs)
+	aux::unchoke_rank rank_fastest_upload(peer_connection const* p, int const index)
 	{
-		// if one peer belongs to a higher priority torrent than the other one
-		// that one should be unchoked.
-		std::shared_ptr<torrent> t1 = lhs->associated_torrent().lock();
-		TORRENT_ASSERT(t1);
-		std::shared_ptr<torrent> t2 = rhs->associated_torrent().lock();
-		TORRENT_ASSERT(t2);
-
-		int prio1 = lhs->get_priority(peer_connection::upload_channel);
-		int prio2 = rhs->get_priority(peer_connection::upload_channel);
-
-		if (prio1 != prio2)
-			return prio1 > prio2;
-
-		// compare how many bytes they've sent us
-		std::int64_t c1;
-		std::int64_t c2;
-		c1 = lhs->downloaded_in_last_round();
-		c2 = rhs->downloaded_in_last_round();
-
-		if (c1 != c2) return c1 > c2;
-
 		// when seeding, prefer the peer we're uploading the fastest to
-		c1 = lhs->uploaded_in_last_round();
-		c2 = rhs->uploaded_in_last_round();
-
-		if (c1 > c2) return true;
-		if (c2 > c1) return false;
-
-		// prioritize the one that has waited the longest to be unchoked
-		// the round-robin unchoker relies on this logic. Don't change it
-		// without moving this into that unchoker logic
-		return lhs->time_of_last_unchoke() < rhs->time_of_last_unchoke();
+		return make_rank(p, index, p->downloaded_in_last_round()
+			, p->uploaded_in_last_round(), 0
+			, p->get_priority(peer_connection::upload_channel));
 	}
 
-	// return true if 'lhs' peer should be preferred to be unchoke over 'rhs'
-	bool unchoke_compare_anti_leech(peer_connection const* lhs
-		, peer_connection const* rhs)
+	aux::unchoke_rank rank_anti_leech(peer_connection const* p, int const index)
 	{
-		// if one peer belongs to a higher priority torrent than the other one
-		// that one should be unchoked.
-		std::shared_ptr<torrent> t1 = lhs->associated_torrent().lock();
-		TORRENT_ASSERT(t1);
-		std::shared_ptr<torrent> t2 = rhs->associated_torrent().lock();
-		TORRENT_ASSERT(t2);
-
-		int prio1 = lhs->get_priority(peer_connection::upload_channel);
-		int prio2 = rhs->get_priority(peer_connection::upload_channel);
-
-		if (prio1 != prio2)
-			return prio1 > prio2;
-
-		// compare how many bytes they've sent us
-		std::int64_t c1;
-		std::int64_t c2;
-		c1 = lhs->downloaded_in_last_round();
-		c2 = rhs->downloaded_in_last_round();
-
-		if (c1 != c2) return c1 > c2;
+		std::shared_ptr<torrent> t = p->associated_torrent().lock();
+		TORRENT_ASSERT(t);
 
 		// the anti-leech seeding algorithm is based on the paper "Improving
 		// BitTorrent: A Simple Approach" from Chow et. al. and ranks peers based
@@ -195,64 +132,74 @@ namespace libtorrent {
 		//   |             V             |
 		//   +---------------------------+
 		//   0%    num have pieces     100%
-		int t1_total = t1->torrent_file().num_pieces();
-		int t2_total = t2->torrent_file().num_pieces();
-		int score1 = (lhs->num_have_pieces() < t1_total / 2
-			? t1_total - lhs->num_have_pieces() : lhs->num_have_pieces()) * 1000 / t1_total;
-		int score2 = (rhs->num_have_pieces() < t2_total / 2
-			? t2_total - rhs->num_have_pieces() : rhs->num_have_pieces()) * 1000 / t2_total;
-		if (score1 > score2) return true;
-		if (score2 > score1) return false;
+		int const total = std::max(1, t->torrent_file().num_pieces());
+		int const have = p->num_have_pieces();
+		int const score = (have < total / 2 ? total - have : have) * 1000 / total;
 
-		// prioritize the one that has waited the longest to be unchoked
-		// the round-robin unchoker relies on this logic. Don't change it
-		// without moving this into that unchoker logic
-		return lhs->time_of_last_unchoke() < rhs->time_of_last_unchoke();
+		return make_rank(p, index, p->downloaded_in_last_round(), score, 0
+			, p->get_priority(peer_connection::upload_channel));
 	}
 
-	bool upload_rate_compare(peer_connection const* lhs
-		, peer_connection const* rhs)
+	aux::unchoke_rank rank_upload_rate(peer_connection const* p, int const index)
 	{
-		std::int64_t c1;
-		std::int64_t c2;
-
-		c1 = lhs->uploaded_in_last_round();
-		c2 = rhs->uploaded_in_last_round();
-
 		// take torrent priority into account
-		c1 *= lhs->get_priority(peer_connection::upload_channel);
-		c2 *= rhs->get_priority(peer_connection::upload_channel);
+		return make_rank(p, index, p->uploaded_in_last_round()
+			* p->get_priority(peer_connection::upload_channel));
+	}
+
+	aux::unchoke_rank rank_bittyrant(peer_connection const* p, int const index)
+	{
+		// first compare how many bytes they've sent us, taking torrent
+		// priority into account, divided by the number of bytes we've sent them
+		std::int64_t const d = p->downloaded_in_last_round()
+			* p->get_priority(peer_connection::upload_channel);
+		std::int64_t const u = p->uploaded_in_last_round();
 
-		return c1 > c2;
+		return make_rank(p, index, d * 1000 / std::max(std::int64_t(1), u));
 	}
 
-	bool bittyrant_unchoke_compare(peer_connection const* lhs
-		, peer_connection const* rhs)
+	template <typename Fun>
+	void build_ranks(std::vector<aux::unchoke_rank>& ranks
+		, std::vector<peer_connection*> const& peers, Fun f)
 	{
-		std::int64_t d1, d2, u1, u2;
+		ranks.clear();
+		ranks.reserve(peers.size());
+		for (int i = 0; i < int(peers.size()); ++i)
+			ranks.push_back(f(peers[std::size_t(i)], i));
+	}
 
-		// first compare how many bytes they've sent us
-		d1 = lhs->downloaded_in_last_round();
-		d2 = rhs->downloaded_in_last_round();
-		// divided by the number of bytes we've sent them
-		u1 = lhs->uploaded_in_last_round();
-		u2 = rhs->uploaded_in_last_round();
+	// reorders peers to match the order of the ranks
+	void apply_ranks(std::vector<aux::unchoke_rank> const& ranks
+		, std::vector<peer_connection*>& peers)
+	{
+		TORRENT_ASSERT(ranks.size() == peers.size());
+		std::vector<peer_connection*> const orig(peers);
+		for (std::size_t i = 0; i < ranks.size(); ++i)
+			peers[i] = orig[std::size_t(ranks[i].peer)];
+	}
 
-		// take torrent priority into account
-		d1 *= lhs->get_priority(peer_connection::upload_channel);
-		d2 *= rhs->get_priority(peer_connection::upload_channel);
+	} // anonymous namespace
 
-		d1 = d1 * 1000 / (std::max)(std::int64_t(1), u1);
-		d2 = d2 * 1000 / (std::max)(std::int64_t(1), u2);
-		if (d1 > d2) return true;
-		if (d1 < d2) return false;
+	namespace aux {
 
-		// if both peers are still in their send quota or not in their send quota
-		// prioritize the one that has waited the longest to be unchoked
-		return lhs->time_of_last_unchoke() < rhs->time_of_last_unchoke();
+	void rank_range(std::vector<unchoke_rank>& ranks
+		, std::size_t const first, std::size_t const last)
+	{
+		TORRENT_ASSERT(first <= last);
+		TORRENT_ASSERT(last <= ranks.size());
+		if (first == last) return;
+
+		auto const begin = ranks.begin() + std::ptrdiff_t(first);
+		auto const mid = ranks.begin() + std::ptrdiff_t(last);
+
+		// nth_element is linear. Only the range we're asked for needs to be
+		// in order, the rest just needs to rank lower
+		if (mid != ranks.end())
+			std::nth_element(begin, mid, ranks.end(), better_rank());
+		std::sort(begin, mid, better_rank());
 	}
 
-	} // anonymous namespace
+	}
 
 	int unchoke_sort(std::vector<peer_connection*>& peers
 		, int max_upload_rate
@@ -271,6 +218,8 @@ namespace libtorrent {
 		if (upload_slots < 0)
 			upload_slots = (std::numeric_limits<int>::max)();
 
+		std::vector<aux::unchoke_rank> ranks;
+
 		// ==== BitTyrant ====
 		//
 		// if we're using the bittyrant unchoker, go through all peers that
@@ -300,28 +249,26 @@ namespace libtorrent {
 				}
 			}
 
-			// if we're using the bittyrant choker, sort peers by their return
+			// if we're using the bittyrant choker, rank peers by their return
 			// on investment. i.e. download rate / upload rate
-			std::sort(peers.begin(), peers.end()
-				, std::bind(&bittyrant_unchoke_compare, _1, _2));
+			build_ranks(ranks, peers, &rank_bittyrant);
 
 			int upload_capacity_left = max_upload_rate;
 
 			// now, figure out how many peers should be unchoked. We deduct the
 			// estimated reciprocation rate from our upload_capacity estimate
-			// until there none left
-			upload_slots = 0;
-
-			for (auto const p : peers)
+			// until there none left. Only the peers we get to need to be sorted
+			upload_slots = aux::for_each_rank(ranks, [&](aux::unchoke_rank const& r)
 			{
+				peer_connection const* p = peers[std::size_t(r.peer)];
 				TORRENT_ASSERT(p != nullptr);
 
-				if (p->est_reciprocation_rate() > upload_capacity_left) break;
-
-				++upload_slots;
+				if (p->est_reciprocation_rate() > upload_capacity_left) return false;
 				upload_capacity_left -= p->est_reciprocation_rate();
-			}
+				return true;
+			});
 
+			apply_ranks(ranks, peers);
 			return upload_slots;
 		}
 
@@ -338,77 +285,60 @@ namespace libtorrent {
 		if (sett.get_int(settings_pack::choking_algorithm)
 			== settings_pack::rate_based_choker)
 		{
-			// first reset the number of unchoke slots, because we'll calculate
-			// it purely based on the current state of our peers.
-			upload_slots = 0;
+			build_ranks(ranks, peers, &rank_upload_rate);
 
-			// TODO: optimize this using partial_sort or something. We don't need
-			// to sort the entire list
-
-			// TODO: make the comparison function a free function and move it
-			// into this cpp file
-			std::sort(peers.begin(), peers.end()
-				, std::bind(&upload_rate_compare, _1, _2));
+			std::int64_t const interval_ms = std::max(std::int64_t(1)
+				, std::int64_t(total_milliseconds(unchoke_interval)));
 
 			// TODO: make configurable
 			int rate_threshold = 1024;
 
-			for (auto const p : peers)
+			// the number of unchoke slots is calculated purely based on the
+			// current state of our peers. The walk stops at the first peer below
+			// the threshold, so only that far into the ranking needs sorting
+			upload_slots = aux::for_each_rank(ranks, [&](aux::unchoke_rank const& r)
 			{
-				int const rate = int(p->uploaded_in_last_round()
-					* 1000 / total_milliseconds(unchoke_interval));
-
-				if (rate < rate_threshold) break;
+				int const rate = int(peers[std::size_t(r.peer)]->uploaded_in_last_round()
+					* 1000 / interval_ms);
 
-				++upload_slots;
+				if (rate < rate_threshold) return false;
 
 				// TODO: make configurable
 				rate_threshold += 1024;
-			}
+				return true;
+			});
 			++upload_slots;
 		}
 
-		// sorts the peers that are eligible for unchoke by download rate and
+		// ranks the peers that are eligible for unchoke by download rate and
 		// secondary by total upload. The reason for this is, if all torrents are
 		// being seeded, the download rate will be 0, and the peers we have sent
 		// the least to should be unchoked
 
-		// we use partial sort here, because we only care about the top
-		// upload_slots peers.
+		// only the top upload_slots peers are put in order, the remaining ones
+		// are just known to rank lower
 
-		if (sett.get_int(settings_pack::seed_choking_algorithm)
-			== settings_pack::round_robin)
+		int const seed_choker = sett.get_int(settings_pack::seed_choking_algorithm);
+		if (seed_choker == settings_pack::fastest_upload)
 		{
-			int const pieces = sett.get_int(settings_pack::seeding_piece_quota);
-
-			std::partial_sort(peers.begin(), peers.begin()
-				+ (std::min)(upload_slots, int(peers.size())), peers.end()
-				, std::bind(&unchoke_compare_rr, _1, _2, pieces));
+			build_ranks(ranks, peers, &rank_fastest_upload);
 		}
-		else if (sett.get_int(settings_pack::seed_choking_algorithm)
-			== settings_pack::fastest_upload)
+		else if (seed_choker == settings_pack::anti_leech)
 		{
-			std::partial_sort(peers.begin(), peers.begin()
-				+ (std::min)(upload_slots, int(peers.size())), peers.end()
-				, std::bind(&unchoke_compare_fastest_upload, _1, _2));
-		}
-		else if (sett.get_int(settings_pack::seed_choking_algorithm)
-			== settings_pack::anti_leech)
-		{
-			std::partial_sort(peers.begin(), peers.begin()
-				+ (std::min)(upload_slots, int(peers.size())), peers.end()
-				, std::bind(&unchoke_compare_anti_leech, _1, _2));
+			build_ranks(ranks, peers, &rank_anti_leech);
 		}
 		else
 		{
+			TORRENT_ASSERT(seed_choker == settings_pack::round_robin);
 			int const pieces = sett.get_int(settings_pack::seeding_piece_quota);
-			std::partial_sort(peers.begin(), peers.begin()
-				+ (std::min)(upload_slots, int(peers.size())), peers.end()
-				, std::bind(&unchoke_compare_rr, _1, _2, pieces));
-
-			TORRENT_ASSERT_FAIL();
+			time_point const now = aux::time_now();
+			build_ranks(ranks, peers, [=](peer_connection const* p, int const index)
+				{ return rank_rr(p, index, pieces, now); });
 		}
 
+		aux::rank_range(ranks, 0, std::min(std::size_t(upload_slots), ranks.size()));
+		apply_ranks(ranks, peers);
+
 		return upload_slots;
 	}
 
@@ -33,12 +33,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/create_torrent.hpp"
 #include "libtorrent/utf8.hpp"
 #include "libtorrent/aux_/escape_string.hpp" // for convert_to_wstring
-#include "libtorrent/disk_io_thread.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/hasher.hpp"
 #include "libtorrent/aux_/merkle.hpp" // for merkle_*()
 #include "libtorrent/torrent_info.hpp"
 #include "libtorrent/announce_entry.hpp"
-#include "libtorrent/performance_counters.hpp" // for counters
-#include "libtorrent/alert_manager.hpp"
 #include "libtorrent/aux_/path.hpp"
 
 #include <sys/types.h>
@@ -46,6 +45,15 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <functional>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstring> // for memset
+
+#ifndef TORRENT_WINDOWS
+#include <fcntl.h> // for posix_fadvise
+#endif
 
 using namespace std::placeholders;
 
@@ -162,43 +170,162 @@ namespace {
 		}
 	}
 
-	struct hash_state
+	// a range of consecutive pieces, read from disk by the calling thread and
+	// hashed by one of the hashing threads
+	struct hash_chunk
 	{
-		create_torrent& ct;
-		storage_holder storage;
-		disk_io_thread& iothread;
-		piece_index_t piece_counter;
-		piece_index_t completed_piece;
-		std::function<void(piece_index_t)> const& f;
-		error_code& ec;
+		std::vector<char> buffer;
+		piece_index_t first_piece;
+		int num_pieces;
+		int size;
+		int index;
 	};
 
-	void on_hash(piece_index_t const piece, sha1_hash const& piece_hash
-		, storage_error const& error, hash_state* st)
+	// the state shared between the thread reading the files and the threads
+	// hashing the chunks. Chunks go from ``free_chunks`` (filled by the
+	// reader) to ``queue`` and back to ``free_chunks`` once hashed. The number
+	// of chunks bounds both the read-ahead and the memory used
+	struct hash_pipeline
 	{
-		if (error)
+		hash_pipeline(file_storage const& fs, int const pieces_per_chunk)
+			: files(fs)
+			, hashes(std::size_t(fs.num_pieces()))
+			, chunk_done(std::size_t((fs.num_pieces() + pieces_per_chunk - 1)
+				/ pieces_per_chunk), false)
+		{}
+
+		void hash_thread()
 		{
-			// on error
-			st->ec = error.ec;
-			st->iothread.abort(true);
-			return;
+			std::unique_lock<std::mutex> l(mutex);
+			for (;;)
+			{
+				while (queue.empty() && !done_reading && !abort)
+					work_cond.wait(l);
+				if (abort || queue.empty()) return;
+
+				hash_chunk* c = queue.front();
+				queue.pop_front();
+				l.unlock();
+
+				char const* buf = c->buffer.data();
+				int left = c->size;
+				for (int i = 0; i < c->num_pieces; ++i)
+				{
+					piece_index_t const piece(static_cast<int>(c->first_piece) + i);
+					int const piece_size = std::min(files.piece_size(piece), left);
+					hashes[std::size_t(static_cast<int>(piece))]
+						= hasher(buf, piece_size).final();
+					buf += piece_size;
+					left -= piece_size;
+				}
+
+				l.lock();
+				chunk_done[std::size_t(c->index)] = true;
+				free_chunks.push_back(c);
+				done_cond.notify_one();
+			}
 		}
-		st->ct.set_hash(piece, piece_hash);
-		st->f(st->completed_piece);
-		++st->completed_piece;
-		if (st->piece_counter < st->ct.files().end_piece())
+
+		// returns the number of leading chunks that have been hashed. Must be
+		// called with the mutex held
+		int num_done(int completed) const
 		{
-			st->iothread.async_hash(st->storage, st->piece_counter
-				, disk_interface::sequential_access
-				, std::bind(&on_hash, _1, _2, _3, st));
-			++st->piece_counter;
+			int const num_chunks = int(chunk_done.size());
+			while (completed < num_chunks && chunk_done[std::size_t(completed)])
+				++completed;
+			return completed;
 		}
-		else
+
+		file_storage const& files;
+
+		// the hash of every piece, written by the hashing threads. A hash may
+		// only be read after its chunk is marked in chunk_done
+		std::vector<sha1_hash> hashes;
+
+		std::mutex mutex;
+
+		// signalled when a chunk is queued, or when the reader is done or
+		// aborted
+		std::condition_variable work_cond;
+
+		// signalled when a chunk has been hashed
+		std::condition_variable done_cond;
+
+		std::deque<hash_chunk*> queue;
+		std::vector<hash_chunk*> free_chunks;
+		std::vector<bool> chunk_done;
+		bool done_reading = false;
+		bool abort = false;
+	};
+
+	// reads the files of the torrent sequentially. It keeps the current file
+	// open, since we're only ever moving forward
+	struct sequential_reader
+	{
+		sequential_reader(file_storage const& fs, std::string const& path)
+			: m_files(fs), m_path(path) {}
+
+		// fills ``buf`` with the bytes of the torrent starting at ``offset``.
+		// Reads must be issued in order, each one starting where the previous
+		// one ended
+		void read(std::int64_t offset, span<char> buf, error_code& ec)
 		{
-			st->iothread.abort(true);
+			while (!buf.empty())
+			{
+				// skip empty files and the ones we're done with
+				while (m_files.file_offset(m_cursor) + m_files.file_size(m_cursor) <= offset)
+					++m_cursor;
+
+				file_index_t const idx = m_cursor;
+				std::int64_t const file_offset = offset - m_files.file_offset(idx);
+				int const len = int(std::min(std::int64_t(buf.size())
+					, m_files.file_size(idx) - file_offset));
+				TORRENT_ASSERT(len > 0);
+
+				if (m_files.pad_file_at(idx))
+				{
+					std::memset(buf.data(), 0, std::size_t(len));
+				}
+				else
+				{
+					if (idx != m_file_index)
+					{
+						m_file.reset(new file(m_files.file_path(idx, m_path)
+							, open_mode::read_only | open_mode::no_atime, ec));
+						if (ec) return;
+						m_file_index = idx;
+#ifdef POSIX_FADV_SEQUENTIAL
+						// ask for aggressive read-ahead
+						posix_fadvise(m_file->native_handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+					}
+
+					int read = 0;
+					while (read < len)
+					{
+						iovec_t vec(buf.data() + read, std::size_t(len - read));
+						std::int64_t const ret = m_file->readv(file_offset + read, vec, ec);
+						if (ec) return;
+						if (ret == 0)
+						{
+							ec = errors::file_too_short;
+							return;
+						}
+						read += int(ret);
+					}
+				}
+				buf = buf.subspan(std::size_t(len));
+				offset += len;
+			}
 		}
-		st->iothread.submit_jobs();
-	}
+
+	private:
+		file_storage const& m_files;
+		std::string const& m_path;
+		std::unique_ptr<file> m_file;
+		file_index_t m_file_index{-1};
+		file_index_t m_cursor{0};
+	};
 
 } // anonymous namespace
 
@@ -250,61 +377,132 @@ namespace {
 	void set_piece_hashes(create_torrent& t, std::string const& p
 		, std::function<void(piece_index_t)> const& f, error_code& ec)
 	{
-		// optimized path
-		io_service ios;
+		set_piece_hashes(t, p, 0, [&f](piece_index_t const i) { f(i); return true; }, ec);
+	}
 
+	void set_piece_hashes(create_torrent& t, std::string const& p
+		, int num_threads, std::function<bool(piece_index_t)> const& f
+		, error_code& ec)
+	{
 #if TORRENT_USE_UNC_PATHS
 		std::string const path = canonicalize_path(p);
 #else
 		std::string const& path = p;
 #endif
 
-		if (t.files().num_files() == 0)
+		file_storage const& fs = t.files();
+		if (fs.num_files() == 0)
 		{
 			ec = errors::no_files_in_torrent;
 			return;
 		}
 
-		if (t.files().total_size() == 0)
+		if (fs.total_size() == 0)
 		{
 			ec = errors::torrent_invalid_length;
 			return;
 		}
 
-		counters cnt;
-		disk_io_thread disk_thread(ios, cnt);
-
-		aux::vector<download_priority_t, file_index_t> priorities;
-		sha1_hash info_hash;
-		storage_params params{
-			t.files(),
-			nullptr,
-			path,
-			storage_mode_t::storage_mode_sparse,
-			priorities,
-			info_hash
-		};
+		if (num_threads <= 0)
+			num_threads = std::max(1, int(std::thread::hardware_concurrency()));
 
-		storage_holder storage = disk_thread.new_torrent(default_storage_constructor, std::move(params), std::shared_ptr<void>());
+		// read at least 4 MiB at a time, to let the disk stream. Every thread
+		// can hash one chunk while the reader fills two more
+		int const pieces_per_chunk = std::max(1, 4 * 1024 * 1024 / t.piece_length());
+		int const chunk_size = pieces_per_chunk * t.piece_length();
+		std::vector<hash_chunk> chunks(std::size_t(num_threads + 2));
 
-		settings_pack sett;
-		sett.set_int(settings_pack::cache_size, 0);
-		sett.set_int(settings_pack::aio_threads, 1);
+		hash_pipeline st(fs, pieces_per_chunk);
+		for (auto& c : chunks) st.free_chunks.push_back(&c);
 
-		disk_thread.set_settings(&sett);
+		std::vector<std::thread> threads;
+		threads.reserve(std::size_t(num_threads));
+		for (int i = 0; i < num_threads; ++i)
+			threads.emplace_back(&hash_pipeline::hash_thread, &st);
 
-		int const piece_read_ahead = std::max(1, 15 * 1024 * 1024 / t.piece_length());
+		sequential_reader reader(fs, path);
+		int const num_chunks = int(st.chunk_done.size());
+		int reported_chunks = 0;
+		bool cancelled = false;
 
-		hash_state st = { t, std::move(storage), disk_thread, piece_index_t(0), piece_index_t(0), f, ec };
-		for (piece_index_t i(0); i < piece_index_t(piece_read_ahead); ++i)
+		// sets the hashes of, and reports, all pieces in the leading chunks
+		// that have been hashed. Must be called without holding the mutex
+		auto report = [&](int const completed)
 		{
-			disk_thread.async_hash(st.storage, i, disk_interface::sequential_access
-				, std::bind(&on_hash, _1, _2, _3, &st));
-			++st.piece_counter;
-			if (st.piece_counter >= t.files().end_piece()) break;
+			piece_index_t const end = std::min(fs.end_piece()
+				, piece_index_t(completed * pieces_per_chunk));
+			for (piece_index_t i(reported_chunks * pieces_per_chunk); i < end; ++i)
+			{
+				t.set_hash(i, st.hashes[std::size_t(static_cast<int>(i))]);
+				if (!f(i))
+				{
+					cancelled = true;
+					break;
+				}
+			}
+			reported_chunks = completed;
+		};
+
+		std::unique_lock<std::mutex> l(st.mutex);
+		for (int i = 0; i < num_chunks && !cancelled && !ec; ++i)
+		{
+			while (st.free_chunks.empty() || st.num_done(reported_chunks) > reported_chunks)
+			{
+				int const completed = st.num_done(reported_chunks);
+				if (completed > reported_chunks)
+				{
+					l.unlock();
+					report(completed);
+					l.lock();
+					if (cancelled) break;
+					continue;
+				}
+				st.done_cond.wait(l);
+			}
+			if (cancelled) break;
+
+			hash_chunk* c = st.free_chunks.back();
+			st.free_chunks.pop_back();
+			l.unlock();
+
+			c->index = i;
+			c->first_piece = piece_index_t(i * pieces_per_chunk);
+			c->num_pieces = std::min(pieces_per_chunk
+				, fs.num_pieces() - i * pieces_per_chunk);
+			std::int64_t const offset = std::int64_t(i) * chunk_size;
+			c->size = int(std::min(std::int64_t(chunk_size), fs.total_size() - offset));
+			c->buffer.resize(std::size_t(c->size));
+			reader.read(offset, c->buffer, ec);
+
+			l.lock();
+			if (ec) break;
+			st.queue.push_back(c);
+			st.work_cond.notify_one();
 		}
-		disk_thread.submit_jobs();
-		ios.run(ec);
+
+		if (cancelled || ec) st.abort = true;
+		st.done_reading = true;
+		st.work_cond.notify_all();
+
+		// wait for the remaining chunks to be hashed
+		while (!st.abort && reported_chunks < num_chunks)
+		{
+			int const completed = st.num_done(reported_chunks);
+			if (completed > reported_chunks)
+			{
+				l.unlock();
+				report(completed);
+				l.lock();
+				if (cancelled) st.abort = true;
+				continue;
+			}
+			st.done_cond.wait(l);
+		}
+		l.unlock();
+
+		for (auto& th : threads) th.join();
+
+		if (cancelled && !ec) ec = boost::asio::error::operation_aborted;
 	}
 
 	create_torrent::~create_torrent() = default;
@@ -54,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/array.hpp"
 
 #include <functional>
+#include <array>
 
 #include "libtorrent/aux_/disable_warnings_push.hpp"
 #include <boost/variant/get.hpp>
@@ -3052,8 +3053,42 @@ constexpr disk_job_flags_t disk_interface::cache_hit;
 			bool const should_exit = wait_for_job(queue, pool, l);
 			if (should_exit) break;
 			j = queue.m_queued_jobs.pop_front();
+
+			// look for read jobs queued up behind this one, against the same
+			// storage. Their files can be opened ahead of time, while this job
+			// is performed. As long as this job is outstanding the storage
+			// can't be fenced (to move or rename files), so it's safe to pass
+			// the hints on to it
+			struct read_hint
+			{
+				piece_index_t piece;
+				int offset;
+				int size;
+				open_mode_t flags;
+			};
+			std::array<read_hint, 4> hints;
+			int num_hints = 0;
+			if (j->action == job_action_t::read && j->storage)
+			{
+				bool const coalesce = m_settings.get_bool(settings_pack::coalesce_reads);
+				int scanned = 0;
+				for (auto i = queue.m_queued_jobs.iterate(); i.get()
+					&& scanned < 8 && num_hints < int(hints.size()); i.next(), ++scanned)
+				{
+					disk_io_job* k = i.get();
+					if (k->action != job_action_t::read || k->storage != j->storage) continue;
+					hints[std::size_t(num_hints++)] = {k->piece, k->d.io.offset
+						, k->d.io.buffer_size, file_flags_for_job(k, coalesce)};
+				}
+			}
 			l.unlock();
 
+			for (int i = 0; i < num_hints; ++i)
+			{
+				read_hint const& h = hints[std::size_t(i)];
+				j->storage->hint_read(h.piece, h.offset, h.size, h.flags);
+			}
+
 			TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
 
 			if (&pool == &m_generic_threads && thread_id == pool.first_thread_id())
@@ -1267,6 +1267,36 @@ namespace {
 #endif
 	}
 
+#ifdef TORRENT_WINDOWS
+	// defined in path.cpp
+	time_t file_time_to_posix(FILETIME f);
+#endif
+
+	void file::stat(file_status* s, error_code& ec) const
+	{
+#ifdef TORRENT_WINDOWS
+		BY_HANDLE_FILE_INFORMATION data;
+		if (!GetFileInformationByHandle(native_handle(), &data))
+		{
+			ec.assign(GetLastError(), system_category());
+			return;
+		}
+		s->file_size = std::int64_t((std::uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+		s->mtime = std::uint64_t(file_time_to_posix(data.ftLastWriteTime));
+		s->inode = (std::uint64_t(data.nFileIndexHigh) << 32) | data.nFileIndexLow;
+#else
+		struct stat st;
+		if (::fstat(native_handle(), &st) != 0)
+		{
+			ec.assign(errno, system_category());
+			return;
+		}
+		s->file_size = st.st_size;
+		s->mtime = std::uint64_t(st.st_mtime);
+		s->inode = std::uint64_t(st.st_ino);
+#endif
+	}
+
 	std::int64_t file::sparse_end(std::int64_t start) const
 	{
 #ifdef TORRENT_WINDOWS
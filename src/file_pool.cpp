@@ -44,11 +44,50 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include <limits>
+#include <algorithm>
 
 namespace libtorrent {
 
 	file_pool::file_pool(int size) : m_size(size) {}
-	file_pool::~file_pool() = default;
+
+	file_pool::~file_pool()
+	{
+		{
+			std::unique_lock<std::mutex> l(m_thread_mutex);
+			m_abort = true;
+		}
+		m_thread_cond.notify_all();
+		if (m_thread.joinable()) m_thread.join();
+	}
+
+	constexpr int file_pool::num_shards;
+
+	void file_pool::shard::unlink(lru_file_entry& e)
+	{
+		if (e.prev) e.prev->next = e.next;
+		else oldest = e.next;
+		if (e.next) e.next->prev = e.prev;
+		else newest = e.prev;
+		e.prev = nullptr;
+		e.next = nullptr;
+	}
+
+	void file_pool::shard::push_newest(lru_file_entry& e, std::uint64_t const seq)
+	{
+		TORRENT_ASSERT(e.prev == nullptr && e.next == nullptr);
+		e.use_seq = seq;
+		e.prev = newest;
+		if (newest) newest->next = &e;
+		else oldest = &e;
+		newest = &e;
+	}
+
+	void file_pool::shard::erase(lru_file_entry& e)
+	{
+		file_key const k = e.key;
+		unlink(e);
+		files.erase(k);
+	}
 
 #ifdef TORRENT_WINDOWS
 	void set_low_priority(file_handle const& f)
@@ -97,10 +136,78 @@ namespace libtorrent {
 	}
 #endif // TORRENT_WINDOWS
 
+	namespace {
+
+	// returns true if a file opened with mode ``have`` can be used for
+	// accesses that want mode ``want``
+	bool compatible_mode(open_mode_t const have, open_mode_t const want)
+	{
+		// if we asked for a file in write mode,
+		// and the cached file is is not opened in
+		// write mode, re-open it
+		if (((have & open_mode::rw_mask) != open_mode::read_write)
+			&& ((want & open_mode::rw_mask) == open_mode::read_write))
+			return false;
+		return (have & open_mode::random_access) == (want & open_mode::random_access);
+	}
+
+	// the max number of files waiting to be opened speculatively. Requests
+	// beyond this are dropped
+	constexpr std::size_t max_prefetch_queue = 64;
+	}
+
+	file_handle file_pool::open_new_file(std::string const& full_path
+		, open_mode_t const m, error_code& ec) const
+	{
+		file_handle f = std::make_shared<file>();
+		if (!f)
+		{
+			ec = error_code(boost::system::errc::not_enough_memory, generic_category());
+			return file_handle();
+		}
+		if (!f->open(full_path, m, ec))
+			return file_handle();
+#ifdef TORRENT_WINDOWS
+		if (m_low_prio_io)
+			set_low_priority(f);
+#endif
+		TORRENT_ASSERT(f->is_open());
+		return f;
+	}
+
+	file_handle file_pool::add_file(shard& s, file_key const& k, file_handle f
+		, open_mode_t const m)
+	{
+		auto const ret = s.files.emplace(k, lru_file_entry());
+		TORRENT_ASSERT(ret.second);
+		lru_file_entry& e = ret.first->second;
+		e.file_ptr = std::move(f);
+		e.mode = m;
+		e.key = k;
+		s.push_newest(e, ++m_use_counter);
+		++m_num_files;
+		return e.file_ptr;
+	}
+
 	file_handle file_pool::open_file(storage_index_t st, std::string const& p
 		, file_index_t const file_index, file_storage const& fs
 		, open_mode_t const m, error_code& ec)
 	{
+#if TORRENT_USE_ASSERTS
+		{
+			// we're not allowed to open a file
+			// from a deleted storage!
+			std::unique_lock<std::mutex> l(m_deleted_mutex);
+			TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
+				, std::make_pair(fs.name(), static_cast<void const*>(&fs)))
+				== m_deleted_storages.end());
+		}
+#endif
+
+		TORRENT_ASSERT(is_complete(p));
+		TORRENT_ASSERT((m & open_mode::rw_mask) == open_mode::read_only
+			|| (m & open_mode::rw_mask) == open_mode::read_write);
+
 		// potentially used to hold a reference to a file object that's
 		// about to be destructed. If we have such object we assign it to
 		// this member to be destructed after we release the std::mutex. On some
@@ -108,43 +215,41 @@ namespace libtorrent {
 		// time. We don't want to hold the std::mutex for that.
 		file_handle defer_destruction;
 
-		std::unique_lock<std::mutex> l(m_mutex);
+		file_key const k(st, file_index);
+		shard& s = shard_for(k);
+		std::unique_lock<std::mutex> l(s.mutex);
 
-#if TORRENT_USE_ASSERTS
-		// we're not allowed to open a file
-		// from a deleted storage!
-		TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-			, std::make_pair(fs.name(), static_cast<void const*>(&fs)))
-			== m_deleted_storages.end());
-#endif
-
-		TORRENT_ASSERT(is_complete(p));
-		TORRENT_ASSERT((m & open_mode::rw_mask) == open_mode::read_only
-			|| (m & open_mode::rw_mask) == open_mode::read_write);
-		auto const i = m_files.find(std::make_pair(st, file_index));
-		if (i != m_files.end())
+		auto i = s.files.find(k);
+		if (i != s.files.end() && compatible_mode(i->second.mode, m))
 		{
 			lru_file_entry& e = i->second;
 			e.last_use = aux::time_now();
+			s.unlink(e);
+			s.push_newest(e, ++m_use_counter);
+			return e.file_ptr;
+		}
 
-			// if we asked for a file in write mode,
-			// and the cached file is is not opened in
-			// write mode, re-open it
-			if ((((e.mode & open_mode::rw_mask) != open_mode::read_write)
-				&& ((m & open_mode::rw_mask) == open_mode::read_write))
-				|| (e.mode & open_mode::random_access) != (m & open_mode::random_access))
-			{
-				file_handle new_file = std::make_shared<file>();
-
-				std::string full_path = fs.file_path(file_index, p);
-				if (!new_file->open(full_path, m, ec))
-					return file_handle();
-#ifdef TORRENT_WINDOWS
-				if (m_low_prio_io)
-					set_low_priority(new_file);
-#endif
+		// opening a file may take a while, don't hold the shard's mutex
+		// while doing it
+		l.unlock();
+		file_handle new_file = open_new_file(fs.file_path(file_index, p), m, ec);
+		if (!new_file) return file_handle();
+		l.lock();
 
-				TORRENT_ASSERT(new_file->is_open());
+		// some other thread may have opened the file in the meantime
+		i = s.files.find(k);
+		if (i != s.files.end())
+		{
+			lru_file_entry& e = i->second;
+			e.last_use = aux::time_now();
+			s.unlink(e);
+			s.push_newest(e, ++m_use_counter);
+			if (compatible_mode(e.mode, m))
+			{
+				defer_destruction = std::move(new_file);
+			}
+			else
+			{
 				defer_destruction = std::move(e.file_ptr);
 				e.file_ptr = std::move(new_file);
 				e.mode = m;
@@ -152,32 +257,144 @@ namespace libtorrent {
 			return e.file_ptr;
 		}
 
-		lru_file_entry e;
-		e.file_ptr = std::make_shared<file>();
-		if (!e.file_ptr)
+		file_handle file_ptr = add_file(s, k, std::move(new_file), m);
+		l.unlock();
+
+		// if the file cache is at its maximum size, close
+		// the least recently used (lru) file from it
+		evict_files(m_size);
+		return file_ptr;
+	}
+
+	void file_pool::prefetch_file(storage_index_t const st, std::string const& p
+		, file_index_t const file_index, file_storage const& fs, open_mode_t const m)
+	{
+		file_key const k(st, file_index);
+		shard& s = shard_for(k);
+		std::uint32_t generation;
 		{
-			ec = error_code(boost::system::errc::not_enough_memory, generic_category());
-			return file_handle();
+			std::unique_lock<std::mutex> l(s.mutex);
+			if (s.files.count(k)) return;
+			generation = s.generation;
 		}
-		std::string full_path = fs.file_path(file_index, p);
-		if (!e.file_ptr->open(full_path, m, ec))
-			return file_handle();
-#ifdef TORRENT_WINDOWS
-		if (m_low_prio_io)
-			set_low_priority(e.file_ptr);
-#endif
-		e.mode = m;
-		file_handle file_ptr = e.file_ptr;
-		m_files.insert(std::make_pair(std::make_pair(st, file_index), e));
-		TORRENT_ASSERT(file_ptr->is_open());
 
-		if (int(m_files.size()) >= m_size)
+		std::unique_lock<std::mutex> l(m_thread_mutex);
+		if (m_abort) return;
+		if (m_to_open.size() >= max_prefetch_queue) return;
+		if (std::any_of(m_to_open.begin(), m_to_open.end()
+			, [&](prefetch_request const& r) { return r.key == k; }))
+			return;
+
+		m_to_open.push_back({k, fs.file_path(file_index, p), m, generation});
+		start_thread(l);
+		l.unlock();
+		m_thread_cond.notify_one();
+	}
+
+	void file_pool::start_thread(std::unique_lock<std::mutex>& l)
+	{
+		TORRENT_ASSERT(l.owns_lock());
+		TORRENT_UNUSED(l);
+		if (m_thread.joinable()) return;
+		m_thread = std::thread(&file_pool::thread_fun, this);
+	}
+
+	void file_pool::thread_fun()
+	{
+		std::unique_lock<std::mutex> l(m_thread_mutex);
+		for (;;)
+		{
+			m_thread_cond.wait(l, [this] {
+				return m_abort || !m_to_close.empty() || !m_to_open.empty(); });
+			if (m_abort) break;
+
+			std::vector<file_handle> closing;
+			closing.swap(m_to_close);
+			std::vector<prefetch_request> opening;
+			opening.swap(m_to_open);
+			l.unlock();
+
+			{
+				std::unique_lock<std::mutex> cl(m_closing_mutex);
+				closing.clear();
+			}
+
+			for (auto& r : opening)
+			{
+				std::unique_lock<std::mutex> ol(m_opening_mutex);
+				shard& s = shard_for(r.key);
+
+				// if the file was released since it was requested, don't open
+				// it. Opening it may create it, for instance after its torrent
+				// was deleted
+				{
+					std::unique_lock<std::mutex> sl(s.mutex);
+					if (s.generation != r.generation || s.files.count(r.key))
+						continue;
+				}
+
+				error_code ec;
+				file_handle f = open_new_file(r.path, r.mode, ec);
+				if (!f) continue;
+
+				std::unique_lock<std::mutex> sl(s.mutex);
+
+				// if the file was released while we were opening it, or if
+				// someone else opened it already, this handle isn't needed. It's
+				// closed before m_opening_mutex is released
+				if (s.generation != r.generation || s.files.count(r.key))
+				{
+					sl.unlock();
+					continue;
+				}
+				add_file(s, r.key, std::move(f), r.mode);
+				sl.unlock();
+				evict_files(m_size);
+			}
+
+			l.lock();
+		}
+	}
+
+	void file_pool::close_async(std::vector<file_handle> files)
+	{
+		std::unique_lock<std::mutex> l(m_thread_mutex);
+		// once we're shutting down, the files are closed by the caller
+		if (m_abort) return;
+		m_to_close.insert(m_to_close.end()
+			, std::make_move_iterator(files.begin())
+			, std::make_move_iterator(files.end()));
+		start_thread(l);
+		l.unlock();
+		m_thread_cond.notify_one();
+	}
+
+	void file_pool::flush_closing()
+	{
+		std::vector<file_handle> closing;
+		std::unique_lock<std::mutex> l(m_thread_mutex);
+		closing.swap(m_to_close);
+		l.unlock();
+
+		// wait for the background thread, in case it's in the middle of
+		// closing files
+		std::unique_lock<std::mutex> cl(m_closing_mutex);
+		closing.clear();
+	}
+
+	template <typename Pred>
+	void file_pool::cancel_prefetch(Pred pred)
+	{
 		{
-			// the file cache is at its maximum size, close
-			// the least recently used (lru) file from it
-			defer_destruction = remove_oldest(l);
+			std::unique_lock<std::mutex> l(m_thread_mutex);
+			m_to_open.erase(std::remove_if(m_to_open.begin(), m_to_open.end(), pred)
+				, m_to_open.end());
 		}
-		return file_ptr;
+
+		// wait for the background thread, in case it's in the middle of
+		// opening a file. Any request it picks up after this will see the new
+		// generation of its shard, and be dropped
+		std::unique_lock<std::mutex> ol(m_opening_mutex);
 	}
 
 	namespace {
@@ -206,83 +423,146 @@ namespace libtorrent {
 	std::vector<open_file_state> file_pool::get_status(storage_index_t const st) const
 	{
 		std::vector<open_file_state> ret;
+		for (auto const& s : m_shards)
 		{
-			std::unique_lock<std::mutex> l(m_mutex);
-
-			auto const start = m_files.lower_bound(std::make_pair(st, file_index_t(0)));
-			auto const end = m_files.upper_bound(std::make_pair(st
-				, std::numeric_limits<file_index_t>::max()));
-
-			for (auto i = start; i != end; ++i)
+			std::unique_lock<std::mutex> l(s.mutex);
+			for (auto const& f : s.files)
 			{
-				ret.push_back({i->first.second, to_file_open_mode(i->second.mode)
-					, i->second.last_use});
+				if (f.first.first != st) continue;
+				ret.push_back({f.first.second, to_file_open_mode(f.second.mode)
+					, f.second.last_use});
 			}
 		}
+		std::sort(ret.begin(), ret.end(), [](open_file_state const& lhs
+			, open_file_state const& rhs) { return lhs.file_index < rhs.file_index; });
 		return ret;
 	}
 
-	file_handle file_pool::remove_oldest(std::unique_lock<std::mutex>&)
+	file_handle file_pool::remove_oldest()
 	{
-		using value_type = decltype(m_files)::value_type;
-		auto const i = std::min_element(m_files.begin(), m_files.end()
-			, [] (value_type const& lhs, value_type const& rhs)
-				{ return lhs.second.last_use < rhs.second.last_use; });
-		if (i == m_files.end()) return file_handle();
+		// find the shard whose least recently used file is the oldest. The
+		// shards are only locked one at a time, so by the time we get back to
+		// it, it may have changed. That's fine, this is an approximation of
+		// the least recently used file either way
+		shard* victim = nullptr;
+		std::uint64_t oldest = 0;
+		for (auto& s : m_shards)
+		{
+			std::unique_lock<std::mutex> l(s.mutex);
+			if (s.oldest == nullptr) continue;
+			if (victim == nullptr || s.oldest->use_seq < oldest)
+			{
+				victim = &s;
+				oldest = s.oldest->use_seq;
+			}
+		}
+		if (victim == nullptr) return file_handle();
+
+		std::unique_lock<std::mutex> l(victim->mutex);
+		if (victim->oldest == nullptr) return file_handle();
 
-		file_handle file_ptr = i->second.file_ptr;
-		m_files.erase(i);
+		file_handle file_ptr = std::move(victim->oldest->file_ptr);
+		victim->erase(*victim->oldest);
+		--m_num_files;
 
 		// closing a file may be long running operation (mac os x)
 		// let the calling function destruct it after releasing the mutex
 		return file_ptr;
 	}
 
+	void file_pool::evict_files(int const limit)
+	{
+		std::vector<file_handle> closing;
+		while (m_num_files > std::max(limit, 0))
+		{
+			file_handle f = remove_oldest();
+			if (!f) break;
+			closing.push_back(std::move(f));
+		}
+		if (!closing.empty()) close_async(std::move(closing));
+	}
+
 	void file_pool::release(storage_index_t const st, file_index_t file_index)
 	{
-		std::unique_lock<std::mutex> l(m_mutex);
+		file_key const k(st, file_index);
+		shard& s = shard_for(k);
+		std::unique_lock<std::mutex> l(s.mutex);
+		++s.generation;
 
-		auto const i = m_files.find(std::make_pair(st, file_index));
-		if (i == m_files.end()) return;
+		auto const i = s.files.find(k);
+		if (i != s.files.end())
+		{
+			file_handle file_ptr = std::move(i->second.file_ptr);
+			s.erase(i->second);
+			--m_num_files;
+
+			// closing a file may take a long time (mac os x), so make sure
+			// we're not holding the mutex
+			l.unlock();
+			file_ptr.reset();
+		}
+		else
+		{
+			l.unlock();
+		}
 
-		file_handle file_ptr = i->second.file_ptr;
-		m_files.erase(i);
+		cancel_prefetch([&](prefetch_request const& r) { return r.key == k; });
 
-		// closing a file may take a long time (mac os x), so make sure
-		// we're not holding the mutex
-		l.unlock();
-		file_ptr.reset();
+		// the file may have been evicted, and still be waiting to be closed
+		flush_closing();
 	}
 
 	// closes files belonging to the specified
 	// storage, or all if none is specified.
 	void file_pool::release()
 	{
-		std::unique_lock<std::mutex> l(m_mutex);
-		m_files.clear();
-		l.unlock();
+		std::vector<file_handle> to_close;
+		for (auto& s : m_shards)
+		{
+			std::unique_lock<std::mutex> l(s.mutex);
+			++s.generation;
+			for (auto& f : s.files)
+				to_close.push_back(std::move(f.second.file_ptr));
+			m_num_files -= int(s.files.size());
+			s.files.clear();
+			s.oldest = nullptr;
+			s.newest = nullptr;
+		}
+		to_close.clear();
+		cancel_prefetch([](prefetch_request const&) { return true; });
+		flush_closing();
 	}
 
 	void file_pool::release(storage_index_t const st)
 	{
-		std::unique_lock<std::mutex> l(m_mutex);
-
-		auto const begin = m_files.lower_bound(std::make_pair(st, file_index_t(0)));
-		auto const end = m_files.upper_bound(std::make_pair(st
-				, std::numeric_limits<file_index_t>::max()));
-
 		std::vector<file_handle> to_close;
-		for (auto it = begin; it != end; ++it)
-			to_close.push_back(std::move(it->second.file_ptr));
-		if (!to_close.empty()) m_files.erase(begin, end);
-		l.unlock();
+		for (auto& s : m_shards)
+		{
+			std::unique_lock<std::mutex> l(s.mutex);
+			++s.generation;
+			for (auto i = s.files.begin(); i != s.files.end();)
+			{
+				if (i->first.first != st)
+				{
+					++i;
+					continue;
+				}
+				to_close.push_back(std::move(i->second.file_ptr));
+				s.unlink(i->second);
+				i = s.files.erase(i);
+				--m_num_files;
+			}
+		}
 		// the files are closed here while the lock is not held
+		to_close.clear();
+		cancel_prefetch([=](prefetch_request const& r) { return r.key.first == st; });
+		flush_closing();
 	}
 
 #if TORRENT_USE_ASSERTS
 	void file_pool::mark_deleted(file_storage const& fs)
 	{
-		std::unique_lock<std::mutex> l(m_mutex);
+		std::unique_lock<std::mutex> l(m_deleted_mutex);
 		m_deleted_storages.push_back(std::make_pair(fs.name()
 			, static_cast<void const*>(&fs)));
 		if(m_deleted_storages.size() > 100)
@@ -291,12 +571,14 @@ namespace libtorrent {
 
 	bool file_pool::assert_idle_files(storage_index_t const st) const
 	{
-		std::unique_lock<std::mutex> l(m_mutex);
-
-		for (auto const& i : m_files)
+		for (auto const& s : m_shards)
 		{
-			if (i.first.first == st && !i.second.file_ptr.unique())
-				return false;
+			std::unique_lock<std::mutex> l(s.mutex);
+			for (auto const& i : s.files)
+			{
+				if (i.first.first == st && !i.second.file_ptr.unique())
+					return false;
+			}
 		}
 		return true;
 	}
@@ -304,38 +586,44 @@ namespace libtorrent {
 
 	void file_pool::resize(int size)
 	{
-		// these are destructed _after_ the mutex is released
-		std::vector<file_handle> defer_destruction;
-
-		std::unique_lock<std::mutex> l(m_mutex);
-
 		TORRENT_ASSERT(size > 0);
 
 		if (size == m_size) return;
 		m_size = size;
-		if (int(m_files.size()) <= m_size) return;
 
 		// close the least recently used files
-		while (int(m_files.size()) > m_size)
-			defer_destruction.push_back(remove_oldest(l));
+		evict_files(size);
 	}
 
 	void file_pool::close_oldest()
 	{
-		std::unique_lock<std::mutex> l(m_mutex);
+		// find the file that was opened the longest ago
+		shard* victim = nullptr;
+		file_key key;
+		time_point oldest = max_time();
+		for (auto& s : m_shards)
+		{
+			std::unique_lock<std::mutex> l(s.mutex);
+			for (auto const& f : s.files)
+			{
+				if (victim != nullptr && f.second.opened >= oldest) continue;
+				victim = &s;
+				key = f.first;
+				oldest = f.second.opened;
+			}
+		}
+		if (victim == nullptr) return;
 
-		using value_type = decltype(m_files)::value_type;
-		auto const i = std::min_element(m_files.begin(), m_files.end()
-			, [] (value_type const& lhs, value_type const& rhs)
-				{ return lhs.second.opened < rhs.second.opened; });
-		if (i == m_files.end()) return;
+		std::unique_lock<std::mutex> l(victim->mutex);
+		auto const i = victim->files.find(key);
+		if (i == victim->files.end()) return;
 
-		file_handle file_ptr = i->second.file_ptr;
-		m_files.erase(i);
+		file_handle file_ptr = std::move(i->second.file_ptr);
+		victim->erase(i->second);
+		--m_num_files;
 
 		// closing a file may be long running operation (mac os x)
 		l.unlock();
 		file_ptr.reset();
-		l.lock();
 	}
 }
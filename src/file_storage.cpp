@@ -58,6 +58,7 @@ namespace libtorrent {
 	constexpr file_flags_t file_storage::flag_hidden;
 	constexpr file_flags_t file_storage::flag_executable;
 	constexpr file_flags_t file_storage::flag_symlink;
+	constexpr int file_storage::offset_index_stride;
 
 #ifndef TORRENT_NO_DEPRECATE
 	constexpr file_flags_t file_storage::pad_file;
@@ -86,6 +87,7 @@ namespace libtorrent {
 	void file_storage::reserve(int num_files)
 	{
 		m_files.reserve(num_files);
+		m_offset_index.reserve(num_files / offset_index_stride + 1);
 	}
 
 	int file_storage::piece_size(piece_index_t const index) const
@@ -173,24 +175,100 @@ namespace {
 		if (set_name) e.set_name(leaf);
 	}
 
-	int file_storage::get_or_add_path(string_view const path)
+namespace {
+
+	std::uint32_t path_hash(string_view const path)
 	{
-		// do we already have this path in the path list?
-		auto const p = std::find(m_paths.rbegin(), m_paths.rend(), path);
+		// FNV-1a
+		std::uint32_t ret = 2166136261u;
+		for (char const c : path)
+		{
+			ret ^= static_cast<std::uint8_t>(c);
+			ret *= 16777619u;
+		}
+		return ret;
+	}
+}
 
-		if (p == m_paths.rend())
+	void file_storage::rebuild_path_index(std::size_t const size)
+	{
+		TORRENT_ASSERT((size & (size - 1)) == 0);
+		m_path_index.assign(size, -1);
+		std::uint32_t const mask = std::uint32_t(size - 1);
+		for (int i = 0; i < int(m_paths.size()); ++i)
 		{
-			// no, we don't. add it
-			int const ret = int(m_paths.size());
-			TORRENT_ASSERT(path.size() == 0 || path[0] != '/');
-			m_paths.emplace_back(path.data(), path.size());
-			return ret;
+			std::uint32_t slot = path_hash(m_paths[i]) & mask;
+			while (m_path_index[int(slot)] != -1) slot = (slot + 1) & mask;
+			m_path_index[int(slot)] = i;
 		}
-		else
+	}
+
+	int file_storage::get_or_add_path(string_view const path)
+	{
+		// keep the load factor of the hash table at or below 50%. The table
+		// may also be out of date if this object was created by an older
+		// version, or had its paths cleared, so it's rebuilt from m_paths
+		if (m_path_index.size() < (m_paths.size() + 1) * 2)
 		{
+			std::size_t size = 16;
+			while (size < (m_paths.size() + 1) * 2) size *= 2;
+			rebuild_path_index(size);
+		}
+
+		// do we already have this path in the path list?
+		std::uint32_t const mask = std::uint32_t(m_path_index.size() - 1);
+		std::uint32_t slot = path_hash(path) & mask;
+		for (;;)
+		{
+			int const idx = m_path_index[int(slot)];
+			if (idx == -1) break;
 			// yes we do. use it
-			return int(p.base() - m_paths.begin() - 1);
+			if (m_paths[idx] == path) return idx;
+			slot = (slot + 1) & mask;
 		}
+
+		// no, we don't. add it
+		int const ret = int(m_paths.size());
+		TORRENT_ASSERT(path.size() == 0 || path[0] != '/');
+		m_paths.emplace_back(path.data(), path.size());
+		m_path_index[int(slot)] = ret;
+		return ret;
+	}
+
+	void file_storage::rebuild_offset_index()
+	{
+		m_offset_index.clear();
+		m_offset_index.reserve(m_files.size() / offset_index_stride + 1);
+		for (std::size_t i = 0; i < m_files.size(); i += offset_index_stride)
+			m_offset_index.push_back(std::int64_t(m_files[file_index_t(int(i))].offset));
+	}
+
+	file_index_t file_storage::file_at_offset_impl(std::int64_t const offset) const
+	{
+		TORRENT_ASSERT(m_offset_index.size() == (m_files.size() + offset_index_stride - 1) / offset_index_stride);
+		TORRENT_ASSERT(!m_offset_index.empty());
+
+		// first find the block of files the offset falls in, using the compact
+		// index. Files with offsets greater than the next sample can't be the
+		// one we're looking for
+		auto const block = std::upper_bound(m_offset_index.begin()
+			, m_offset_index.end(), offset);
+		TORRENT_ASSERT(block != m_offset_index.begin());
+		int const block_index = int(block - m_offset_index.begin()) - 1;
+
+		auto const begin = m_files.begin() + block_index * offset_index_stride;
+		auto const end = block == m_offset_index.end()
+			? m_files.end() : begin + offset_index_stride;
+
+		internal_file_entry target;
+		target.offset = aux::numeric_cast<std::uint64_t>(offset);
+		TORRENT_ASSERT(!compare_file_offset(target, *begin));
+
+		auto file_iter = std::upper_bound(begin, end, target, compare_file_offset);
+
+		TORRENT_ASSERT(file_iter != begin);
+		--file_iter;
+		return file_index_t(int(file_iter - m_files.begin()));
 	}
 
 #ifndef TORRENT_NO_DEPRECATE
@@ -426,17 +504,7 @@ namespace {
 	{
 		TORRENT_ASSERT_PRECOND(offset >= 0);
 		TORRENT_ASSERT_PRECOND(offset < m_total_size);
-		// find the file iterator and file offset
-		internal_file_entry target;
-		target.offset = aux::numeric_cast<std::uint64_t>(offset);
-		TORRENT_ASSERT(!compare_file_offset(target, m_files.front()));
-
-		auto file_iter = std::upper_bound(
-			m_files.begin(), m_files.end(), target, compare_file_offset);
-
-		TORRENT_ASSERT(file_iter != m_files.begin());
-		--file_iter;
-		return file_index_t(int(file_iter - m_files.begin()));
+		return file_at_offset_impl(offset);
 	}
 
 	char const* file_storage::file_name_ptr(file_index_t const index) const
@@ -462,22 +530,17 @@ namespace {
 		if (m_files.empty()) return ret;
 
 		// find the file iterator and file offset
-		internal_file_entry target;
-		target.offset = aux::numeric_cast<std::uint64_t>(static_cast<int>(piece) * std::int64_t(m_piece_length) + offset);
-		TORRENT_ASSERT_PRECOND(std::int64_t(target.offset) + size <= m_total_size);
-		TORRENT_ASSERT(!compare_file_offset(target, m_files.front()));
+		std::int64_t const target = static_cast<int>(piece) * std::int64_t(m_piece_length) + offset;
+		TORRENT_ASSERT_PRECOND(target + size <= m_total_size);
+		TORRENT_ASSERT(target >= 0);
 
 		// in case the size is past the end, fix it up
-		if (std::int64_t(target.offset) + size > m_total_size)
-			size = aux::numeric_cast<int>(m_total_size - std::int64_t(target.offset));
-
-		auto file_iter = std::upper_bound(
-			m_files.begin(), m_files.end(), target, compare_file_offset);
+		if (target + size > m_total_size)
+			size = aux::numeric_cast<int>(m_total_size - target);
 
-		TORRENT_ASSERT(file_iter != m_files.begin());
-		--file_iter;
+		auto file_iter = m_files.begin() + static_cast<int>(file_at_offset_impl(target));
 
-		std::int64_t file_offset = target.offset - file_iter->offset;
+		std::int64_t file_offset = target - std::int64_t(file_iter->offset);
 		for (; size > 0; file_offset -= file_iter->size, ++file_iter)
 		{
 			TORRENT_ASSERT(file_iter != m_files.end());
@@ -630,6 +693,9 @@ namespace {
 			m_mtime[last_file()] = std::time_t(mtime);
 		}
 
+		if ((m_files.size() - 1) % offset_index_stride == 0)
+			m_offset_index.push_back(m_total_size);
+
 		m_total_size += e.size;
 	}
 
@@ -1050,6 +1116,10 @@ namespace {
 			}
 		}
 		m_total_size = off;
+
+		// files were reordered and pad files inserted, all offsets may have
+		// changed
+		rebuild_offset_index();
 	}
 
 	void file_storage::add_pad_file(int const size
@@ -652,7 +652,7 @@ void http_connection::callback(error_code e, span<char> data)
 	{
 		data = m_parser.collapse_chunk_headers(data);
 
-		std::string const& encoding = m_parser.header("content-encoding");
+		string_view const encoding = m_parser.header("content-encoding");
 		if (encoding == "gzip" || encoding == "x-gzip")
 		{
 			error_code ec;
@@ -781,7 +781,7 @@ void http_connection::on_read(error_code const& e
 			if (is_redirect(code))
 			{
 				// attempt a redirect
-				std::string const& location = m_parser.header("location");
+				std::string const location = m_parser.header("location").to_string();
 				if (location.empty())
 				{
 					// missing location header
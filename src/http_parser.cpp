@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <algorithm>
 #include <cstdlib>
 #include <cinttypes>
+#include <limits>
 
 #include "libtorrent/config.hpp"
 #include "libtorrent/http_parser.hpp"
@@ -42,7 +43,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/assert.hpp"
 #include "libtorrent/parse_url.hpp" // for parse_url_components
 #include "libtorrent/string_util.hpp" // for ensure_trailing_slash, to_lower
-#include "libtorrent/aux_/escape_string.hpp" // for read_until
 #include "libtorrent/time.hpp" // for seconds32
 
 namespace libtorrent {
@@ -131,23 +131,91 @@ namespace libtorrent {
 		return url;
 	}
 
-	std::string const& http_parser::header(string_view const key) const
+	namespace {
+
+	// returns a pointer to the first ``c`` in [pos, end), or end if there is
+	// none. memchr() is vectorized by any reasonable C library, which makes
+	// this a lot faster than a byte-by-byte loop for finding line and header
+	// boundaries
+	char const* find_char(char const* pos, char const* end, char const c)
+	{
+		TORRENT_ASSERT(pos <= end);
+		if (pos == end) return end;
+		void const* ret = std::memchr(pos, c, std::size_t(end - pos));
+		return ret == nullptr ? end : static_cast<char const*>(ret);
+	}
+
+	// returns the offset and length of the string starting at ``pos`` up to
+	// the next ``delim``, and moves ``pos`` past it and any repeated
+	// delimiters. This is the in-place version of read_until()
+	std::pair<int, int> next_token(char const* buf, int& pos, int const end
+		, char const delim)
+	{
+		int const start = pos;
+		while (pos != end && buf[pos] != delim) ++pos;
+		std::pair<int, int> const ret(start, pos - start);
+		while (pos != end && buf[pos] == delim) ++pos;
+		return ret;
+	}
+
+	} // anonymous namespace
+
+	string_view http_parser::header(string_view const key) const
 	{
-		static std::string const empty;
-		// TODO: remove to_string() if we're in C++14
-		auto const i = m_header.find(key.to_string());
-		if (i == m_header.end()) return empty;
-		return i->second;
+		for (auto const& h : m_headers)
+			if (view(h.name) == key) return view(h.value);
+		return string_view();
 	}
 
 	boost::optional<seconds32> http_parser::header_duration(string_view const key) const
 	{
-		// TODO: remove to_string() if we're in C++14
-		auto const i = m_header.find(key.to_string());
-		if (i == m_header.end()) return boost::none;
-		auto const val = std::atol(i->second.c_str());
-		if (val <= 0) return boost::none;
-		return seconds32(val);
+		for (auto const& h : m_headers)
+		{
+			if (view(h.name) != key) continue;
+			// values are null terminated in m_header_buf
+			auto const val = std::atol(m_header_buf.data() + h.value.start);
+			if (val <= 0) return boost::none;
+			return seconds32(val);
+		}
+		return boost::none;
+	}
+
+	std::vector<std::pair<string_view, string_view>> http_parser::headers() const
+	{
+		std::vector<std::pair<string_view, string_view>> ret;
+		ret.reserve(m_headers.size());
+		for (auto const& h : m_headers)
+			ret.emplace_back(view(h.name), view(h.value));
+		return ret;
+	}
+
+	http_parser::text_range http_parser::store(char const* const begin
+		, char const* const end)
+	{
+		TORRENT_ASSERT(begin <= end);
+		TORRENT_ASSERT(m_header_buf.size() + std::size_t(end - begin) < std::size_t(std::numeric_limits<int>::max()));
+		text_range const ret{int(m_header_buf.size()), int(end - begin)};
+		m_header_buf.insert(m_header_buf.end(), begin, end);
+		m_header_buf.push_back('\0');
+		return ret;
+	}
+
+	bool http_parser::parse_header_line(char const* const line
+		, char const* const line_end, header_entry& e)
+	{
+		char const* const separator = find_char(line, line_end, ':');
+		if (separator == line_end) return false;
+
+		e.name = store(line, separator);
+		char* const name = m_header_buf.data() + e.name.start;
+		std::transform(name, name + e.name.length, name, &to_lower);
+
+		// skip whitespace
+		char const* value = separator + 1;
+		while (value != line_end && (*value == ' ' || *value == '\t'))
+			++value;
+		e.value = store(value, line_end);
+		return true;
 	}
 
 	http_parser::~http_parser() = default;
@@ -179,7 +247,7 @@ restart_response:
 		{
 			TORRENT_ASSERT(!m_finished);
 			TORRENT_ASSERT(pos <= recv_buffer.end());
-			char const* newline = std::find(pos, recv_buffer.end(), '\n');
+			char const* newline = find_char(pos, recv_buffer.end(), '\n');
 			// if we don't have a full line yet, wait.
 			if (newline == recv_buffer.end())
 			{
@@ -197,7 +265,7 @@ restart_response:
 			char const* line_end = newline;
 			if (pos != line_end && *(line_end - 1) == '\r') --line_end;
 
-			char const* line = pos;
+			text_range const line = store(pos, line_end);
 			++newline;
 			TORRENT_ASSERT(newline >= pos);
 			int incoming = int(newline - pos);
@@ -205,25 +273,32 @@ restart_response:
 			std::get<1>(ret) += int(newline - (m_recv_buffer.data() + start_pos));
 			pos = newline;
 
-			m_protocol = read_until(line, ' ', line_end);
-			if (m_protocol.substr(0, 5) == "HTTP/")
+			char* const buf = m_header_buf.data();
+			int cursor = line.start;
+			int const end = line.start + line.length;
+			std::tie(m_protocol.start, m_protocol.length) = next_token(buf, cursor, end, ' ');
+			if (protocol().substr(0, 5) == "HTTP/")
 			{
-				m_status_code = atoi(read_until(line, ' ', line_end).c_str());
-				m_server_message = read_until(line, '\r', line_end);
+				// the line is null terminated in m_header_buf, and the token
+				// ends with a space or the terminator
+				auto const status = next_token(buf, cursor, end, ' ');
+				m_status_code = int(std::strtol(buf + status.first, nullptr, 10));
+				std::tie(m_server_message.start, m_server_message.length)
+					= next_token(buf, cursor, end, '\r');
 
 				// HTTP 1.0 always closes the connection after
 				// each request
-				if (m_protocol == "HTTP/1.0") m_connection_close = true;
+				if (protocol() == "HTTP/1.0") m_connection_close = true;
 			}
 			else
 			{
 				m_method = m_protocol;
-				std::transform(m_method.begin(), m_method.end(), m_method.begin(), &to_lower);
+				std::transform(buf + m_method.start, buf + m_method.start + m_method.length
+					, buf + m_method.start, &to_lower);
 				// the content length is assumed to be 0 for requests
 				m_content_length = 0;
-				m_protocol.clear();
-				m_path = read_until(line, ' ', line_end);
-				m_protocol = read_until(line, ' ', line_end);
+				std::tie(m_path.start, m_path.length) = next_token(buf, cursor, end, ' ');
+				std::tie(m_protocol.start, m_protocol.length) = next_token(buf, cursor, end, ' ');
 				m_status_code = 0;
 			}
 			m_state = read_header;
@@ -234,22 +309,21 @@ restart_response:
 		{
 			TORRENT_ASSERT(!m_finished);
 			TORRENT_ASSERT(pos <= recv_buffer.end());
-			char const* newline = std::find(pos, recv_buffer.end(), '\n');
-			std::string line;
+			char const* newline = find_char(pos, recv_buffer.end(), '\n');
 
 			while (newline != recv_buffer.end() && m_state == read_header)
 			{
 				// if the LF character is preceded by a CR
-				// character, don't copy it into the line string.
+				// character, don't copy it into the header buffer
 				char const* line_end = newline;
 				if (pos != line_end && *(line_end - 1) == '\r') --line_end;
-				line.assign(pos, line_end);
+				char const* const line = pos;
 				++newline;
 				m_recv_pos += newline - pos;
 				pos = newline;
 
-				std::string::size_type separator = line.find(':');
-				if (separator == std::string::npos)
+				header_entry h;
+				if (!parse_header_line(line, line_end, h))
 				{
 					if (m_status_code == 100)
 					{
@@ -271,19 +345,14 @@ restart_response:
 					break;
 				}
 
-				std::string name = line.substr(0, separator);
-				std::transform(name.begin(), name.end(), name.begin(), &to_lower);
-				++separator;
-				// skip whitespace
-				while (separator < line.size()
-					&& (line[separator] == ' ' || line[separator] == '\t'))
-					++separator;
-				std::string value = line.substr(separator, std::string::npos);
-				m_header.insert(std::make_pair(name, value));
+				m_headers.push_back(h);
+				string_view const name = view(h.name);
+				// the value is null terminated in m_header_buf
+				char const* const value = m_header_buf.data() + h.value.start;
 
 				if (name == "content-length")
 				{
-					m_content_length = std::strtoll(value.c_str(), nullptr, 10);
+					m_content_length = std::strtoll(value, nullptr, 10);
 					if (m_content_length < 0)
 					{
 						m_state = error_state;
@@ -293,12 +362,12 @@ restart_response:
 				}
 				else if (name == "connection")
 				{
-					m_connection_close = string_begins_no_case("close", value.c_str());
+					m_connection_close = string_begins_no_case("close", value);
 				}
 				else if (name == "content-range")
 				{
 					bool success = true;
-					char const* ptr = value.c_str();
+					char const* ptr = value;
 
 					// apparently some web servers do not send the "bytes"
 					// in their content-range. Don't treat it as an error
@@ -339,12 +408,12 @@ restart_response:
 				}
 				else if (name == "transfer-encoding")
 				{
-					m_chunked_encoding = string_begins_no_case("chunked", value.c_str());
+					m_chunked_encoding = string_begins_no_case("chunked", value);
 				}
 
 				TORRENT_ASSERT(m_recv_pos <= int(recv_buffer.size()));
 				TORRENT_ASSERT(pos <= recv_buffer.end());
-				newline = std::find(pos, recv_buffer.end(), '\n');
+				newline = find_char(pos, recv_buffer.end(), '\n');
 			}
 			std::get<1>(ret) += int(newline - (m_recv_buffer.data() + start_pos));
 		}
@@ -465,7 +534,7 @@ restart_response:
 		if (pos == buf.end()) return false;
 
 		TORRENT_ASSERT(pos <= buf.end());
-		char const* newline = std::find(pos, buf.end(), '\n');
+		char const* newline = find_char(pos, buf.end(), '\n');
 		if (newline == buf.end()) return false;
 		++newline;
 
@@ -508,24 +577,26 @@ restart_response:
 			return true;
 		}
 
-		// this is the terminator of the stream. Also read headers
-		std::map<std::string, std::string> tail_headers;
+		// this is the terminator of the stream. Also read headers. They're
+		// stored in the header buffer as they're parsed, and rolled back if
+		// we don't have all of them yet
+		std::size_t const header_buf_size = m_header_buf.size();
+		std::size_t const num_headers = m_headers.size();
 		pos = newline;
-		newline = std::find(pos, buf.end(), '\n');
+		newline = find_char(pos, buf.end(), '\n');
 
-		std::string line;
 		while (newline != buf.end())
 		{
 			// if the LF character is preceded by a CR
-			// character, don't copy it into the line string.
+			// character, don't copy it into the header buffer
 			char const* line_end = newline;
 			if (pos != line_end && *(line_end - 1) == '\r') --line_end;
-			line.assign(pos, line_end);
+			char const* const line = pos;
 			++newline;
 			pos = newline;
 
-			std::string::size_type separator = line.find(':');
-			if (separator == std::string::npos)
+			header_entry h;
+			if (!parse_header_line(line, line_end, h))
 			{
 				// this means we got a blank line,
 				// the header is finished and the body
@@ -535,27 +606,17 @@ restart_response:
 				// the newline alone is two bytes
 				TORRENT_ASSERT(newline - buf.data() > 2);
 
-				// we were successful in parsing the headers.
-				// add them to the headers in the parser
-				for (auto const& p : tail_headers)
-					m_header.insert(p);
-
+				// we were successful in parsing the headers. They have already
+				// been added to the headers in the parser
 				return true;
 			}
+			m_headers.push_back(h);
 
-			std::string name = line.substr(0, separator);
-			std::transform(name.begin(), name.end(), name.begin(), &to_lower);
-			++separator;
-			// skip whitespace
-			while (separator < line.size()
-				&& (line[separator] == ' ' || line[separator] == '\t'))
-				++separator;
-			std::string value = line.substr(separator, std::string::npos);
-			tail_headers.insert(std::make_pair(name, value));
-//			std::fprintf(stderr, "tail_header: %s: %s\n", name.c_str(), value.c_str());
-
-			newline = std::find(pos, buf.end(), '\n');
+			newline = find_char(pos, buf.end(), '\n');
 		}
+
+		m_header_buf.resize(header_buf_size);
+		m_headers.resize(num_headers);
 		return false;
 	}
 
@@ -573,7 +634,10 @@ restart_response:
 
 	void http_parser::reset()
 	{
-		m_method.clear();
+		m_method = text_range{0, 0};
+		m_path = text_range{0, 0};
+		m_protocol = text_range{0, 0};
+		m_server_message = text_range{0, 0};
 		m_recv_pos = 0;
 		m_body_start_pos = 0;
 		m_status_code = -1;
@@ -583,7 +647,8 @@ restart_response:
 		m_finished = false;
 		m_state = read_status;
 		m_recv_buffer = span<char const>();
-		m_header.clear();
+		m_header_buf.clear();
+		m_headers.clear();
 		m_chunked_encoding = false;
 		m_chunked_ranges.clear();
 		m_cur_chunk_end = -1;
@@ -284,7 +284,7 @@ namespace libtorrent {
 					if (t->alerts().should_post<url_seed_alert>())
 					{
 						std::string const error_msg = to_string(m_parser.status_code()).data()
-							+ (" " + m_parser.message());
+							+ (" " + m_parser.message().to_string());
 						t->alerts().emplace_alert<url_seed_alert>(t->get_handle(), url()
 							, error_msg);
 					}
@@ -307,7 +307,7 @@ namespace libtorrent {
 				{
 					// this means we got a redirection request
 					// look for the location header
-					std::string location = m_parser.header("location");
+					std::string const location = m_parser.header("location").to_string();
 					received_bytes(0, int(bytes_transferred));
 
 					if (location.empty())
@@ -323,17 +323,17 @@ namespace libtorrent {
 					return;
 				}
 
-				std::string const& server_version = m_parser.header("server");
+				string_view const server_version = m_parser.header("server");
 				if (!server_version.empty())
 				{
 					m_server_string = "URL seed @ ";
 					m_server_string += m_host;
 					m_server_string += " (";
-					m_server_string += server_version;
+					m_server_string.append(server_version.data(), server_version.size());
 					m_server_string += ")";
 				}
 
-				m_response_left = atol(m_parser.header("content-length").c_str());
+				m_response_left = atol(m_parser.header("content-length").to_string().c_str());
 				if (m_response_left == -1)
 				{
 					received_bytes(0, int(bytes_transferred));
@@ -321,7 +321,7 @@ namespace libtorrent {
 		if (parser.status_code() != 200)
 		{
 			fail(error_code(parser.status_code(), http_category())
-				, parser.status_code(), parser.message().c_str());
+				, parser.status_code(), parser.message().to_string().c_str());
 			return;
 		}
 
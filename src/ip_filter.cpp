@@ -31,11 +31,125 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/ip_filter.hpp"
+#include "libtorrent/aux_/numeric_cast.hpp"
+
+#include <algorithm>
 
 namespace libtorrent {
 
+namespace aux {
+
+	// an IPv6 address as a pair of integers, to compare it cheaply
+	struct v6_key
+	{
+		std::uint64_t hi;
+		std::uint64_t lo;
+		bool operator<(v6_key const& k) const
+		{ return hi < k.hi || (hi == k.hi && lo < k.lo); }
+	};
+
+	inline std::uint32_t to_key(address_v4::bytes_type const& b)
+	{
+		return (std::uint32_t(b[0]) << 24) | (std::uint32_t(b[1]) << 16)
+			| (std::uint32_t(b[2]) << 8) | std::uint32_t(b[3]);
+	}
+
+	inline std::uint32_t top_bits(std::uint32_t const k) { return k >> 16; }
+
+#if TORRENT_USE_IPV6
+	inline v6_key to_key(address_v6::bytes_type const& b)
+	{
+		v6_key ret{0, 0};
+		for (int i = 0; i < 8; ++i)
+			ret.hi = (ret.hi << 8) | b[std::size_t(i)];
+		for (int i = 8; i < 16; ++i)
+			ret.lo = (ret.lo << 8) | b[std::size_t(i)];
+		return ret;
+	}
+
+	inline std::uint32_t top_bits(v6_key const& k) { return std::uint32_t(k.hi >> 48); }
+#endif
+
+	// a flat, sorted copy of the ranges of a filter_impl. The range start
+	// addresses are stored as integers in one array (to make the binary
+	// search touch as little memory as possible) and their flags in another.
+	// For large filters, a radix table indexed by the top 16 bits of the
+	// address narrows down the binary search to the ranges starting with the
+	// same prefix.
+	template <typename Key>
+	struct compiled_ranges
+	{
+		std::vector<Key> starts;
+		std::vector<std::uint32_t> flags;
+
+		// buckets[i] is the index of the first range whose start address has
+		// the top 16 bits >= i. This has 65537 entries, or none if the filter
+		// is small enough to not need it.
+		std::vector<std::uint32_t> buckets;
+
+		// filters with fewer ranges than this are just binary searched
+		static constexpr std::size_t min_bucket_ranges = 256;
+
+		template <typename Addr>
+		void build(detail::filter_impl<Addr> const& f)
+		{
+			starts.reserve(f.num_ranges());
+			flags.reserve(f.num_ranges());
+			f.for_each_range([this](Addr const& start, std::uint32_t const access)
+			{
+				starts.push_back(to_key(start));
+				flags.push_back(access);
+			});
+			TORRENT_ASSERT(!starts.empty());
+
+			if (starts.size() < min_bucket_ranges) return;
+
+			buckets.resize(65537);
+			std::size_t r = 0;
+			for (std::uint32_t b = 0; b < 65537; ++b)
+			{
+				while (r < starts.size() && top_bits(starts[r]) < b) ++r;
+				buckets[b] = aux::numeric_cast<std::uint32_t>(r);
+			}
+		}
+
+		std::uint32_t access(Key const& k) const
+		{
+			auto begin = starts.begin();
+			auto end = starts.end();
+			if (!buckets.empty())
+			{
+				std::uint32_t const b = top_bits(k);
+				// the range containing k is either one of the ranges starting
+				// in k's bucket, or the last one starting before it
+				begin = starts.begin() + buckets[b];
+				end = starts.begin() + buckets[b + 1];
+			}
+			auto const it = std::upper_bound(begin, end, k);
+			// the first range always starts at the lowest address, so there
+			// is always a range at or below k
+			TORRENT_ASSERT(it != starts.begin());
+			return flags[std::size_t(it - starts.begin()) - 1];
+		}
+	};
+
+	template <typename Key>
+	constexpr std::size_t compiled_ranges<Key>::min_bucket_ranges;
+
+	struct ip_filter_lookup
+	{
+		compiled_ranges<std::uint32_t> v4;
+#if TORRENT_USE_IPV6
+		compiled_ranges<v6_key> v6;
+#endif
+	};
+}
+
 	void ip_filter::add_rule(address first, address last, std::uint32_t flags)
 	{
+		// the compiled lookup table no longer reflects the rules
+		m_lookup.reset();
+
 		if (first.is_v4())
 		{
 			TORRENT_ASSERT(last.is_v4());
@@ -54,6 +168,18 @@ namespace libtorrent {
 
 	std::uint32_t ip_filter::access(address const& addr) const
 	{
+		if (m_lookup)
+		{
+			if (addr.is_v4())
+				return m_lookup->v4.access(aux::to_key(addr.to_v4().to_bytes()));
+#if TORRENT_USE_IPV6
+			TORRENT_ASSERT(addr.is_v6());
+			return m_lookup->v6.access(aux::to_key(addr.to_v6().to_bytes()));
+#else
+			return 0;
+#endif
+		}
+
 		if (addr.is_v4())
 			return m_filter4.access(addr.to_v4().to_bytes());
 #if TORRENT_USE_IPV6
@@ -64,6 +190,25 @@ namespace libtorrent {
 #endif
 	}
 
+	void ip_filter::access(span<address const> const addrs
+		, span<std::uint32_t> const flags) const
+	{
+		TORRENT_ASSERT_PRECOND(addrs.size() == flags.size());
+		for (std::size_t i = 0; i < std::size_t(addrs.size()); ++i)
+			flags[i] = access(addrs[i]);
+	}
+
+	void ip_filter::compile()
+	{
+		if (m_lookup) return;
+		auto l = std::make_shared<aux::ip_filter_lookup>();
+		l->v4.build(m_filter4);
+#if TORRENT_USE_IPV6
+		l->v6.build(m_filter6);
+#endif
+		m_lookup = std::move(l);
+	}
+
 	ip_filter::filter_tuple_t ip_filter::export_filter() const
 	{
 #if TORRENT_USE_IPV6
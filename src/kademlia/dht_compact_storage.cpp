@@ -0,0 +1,812 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg, Alden Torres
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/kademlia/dht_storage.hpp"
+#include "libtorrent/kademlia/dht_settings.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <string>
+#include <vector>
+#include <array>
+#include <cstring>
+
+#include <libtorrent/socket_io.hpp>
+#include <libtorrent/aux_/time.hpp>
+#include <libtorrent/config.hpp>
+#include <libtorrent/bloom_filter.hpp>
+#include <libtorrent/random.hpp>
+#include <libtorrent/aux_/vector.hpp>
+#include <libtorrent/aux_/numeric_cast.hpp>
+
+// The compact storage is an alternative to dht_default_storage, meant for
+// nodes that handle a lot of traffic (like bootstrap nodes). Instead of
+// std::map trees of heap allocated nodes, the torrents and items are kept in
+// dense arrays, indexed by open-addressing hash tables of 32 bit slots.
+// Peers are stored as fixed size records of 12 (IPv4) or 24 (IPv6) bytes,
+// sorted by address, in one contiguous array per torrent.
+//
+// Since the elements are dense, picking random torrents for
+// sample_infohashes and random peers for get_peers takes time proportional
+// to the number of elements picked, not the number of elements stored.
+// When the item tables are full, the item to evict is picked among a small
+// random sample of items, rather than by scanning the whole table.
+
+namespace libtorrent { namespace dht {
+namespace {
+
+	// the number of random items to consider when picking an item to evict
+	constexpr int eviction_sample_size = 8;
+
+	// timestamps are stored as the number of seconds since the storage was
+	// created, to fit in 32 bits
+	std::uint32_t now_seconds(time_point const epoch)
+	{
+		return std::uint32_t(total_seconds(aux::time_now() - epoch));
+	}
+
+	// a peer record. The records are ordered by address and port, which for
+	// the big-endian address bytes is the same order as the address type's
+	template <std::size_t Size>
+	struct compact_peer
+	{
+		std::uint32_t added;
+		std::array<std::uint8_t, Size> ip;
+		std::uint16_t port;
+		bool seed;
+	};
+
+	using compact_peer4 = compact_peer<4>;
+	using compact_peer6 = compact_peer<16>;
+
+	static_assert(sizeof(compact_peer4) == 12, "compact_peer4 is expected to be 12 bytes");
+	static_assert(sizeof(compact_peer6) == 24, "compact_peer6 is expected to be 24 bytes");
+
+	template <std::size_t Size>
+	bool operator<(compact_peer<Size> const& lhs, compact_peer<Size> const& rhs)
+	{
+		return lhs.ip == rhs.ip ? lhs.port < rhs.port : lhs.ip < rhs.ip;
+	}
+
+	compact_peer4 make_peer(address_v4 const& addr, std::uint16_t const port)
+	{
+		compact_peer4 ret{};
+		ret.ip = addr.to_bytes();
+		ret.port = port;
+		return ret;
+	}
+
+	compact_peer6 make_peer(address_v6 const& addr, std::uint16_t const port)
+	{
+		compact_peer6 ret{};
+		ret.ip = addr.to_bytes();
+		ret.port = port;
+		return ret;
+	}
+
+	address_v4 peer_address(compact_peer4 const& p) { return address_v4(p.ip); }
+	address_v6 peer_address(compact_peer6 const& p) { return address_v6(p.ip); }
+
+	// writes the peer in the compact endpoint format (address bytes
+	// followed by the port in network byte order)
+	template <std::size_t Size>
+	std::string compact_endpoint(compact_peer<Size> const& p)
+	{
+		std::string ret(Size + 2, '\0');
+		std::memcpy(&ret[0], p.ip.data(), Size);
+		ret[Size] = char(p.port >> 8);
+		ret[Size + 1] = char(p.port & 0xff);
+		return ret;
+	}
+
+	struct compact_torrent
+	{
+		sha1_hash key;
+		std::string name;
+		std::vector<compact_peer4> peers4;
+		std::vector<compact_peer6> peers6;
+		// the number of seeds in peers4 and peers6 respectively
+		std::int32_t seeds4 = 0;
+		std::int32_t seeds6 = 0;
+	};
+
+	struct compact_immutable_item
+	{
+		sha1_hash key;
+		// the actual value
+		std::unique_ptr<char[]> value;
+		// this counts the number of IPs we have seen
+		// announcing this item, this is used to determine
+		// popularity if we reach the limit of items to store
+		bloom_filter<128> ips;
+		// the last time we heard about this item, in seconds
+		// since the storage was created
+		std::uint32_t last_seen = 0;
+		// number of IPs in the bloom filter
+		int num_announcers = 0;
+		// size of malloced space pointed to by value
+		int size = 0;
+	};
+
+	struct compact_mutable_item : compact_immutable_item
+	{
+		signature sig;
+		sequence_number seq;
+		public_key pk;
+		std::string salt;
+	};
+
+	void set_value(compact_immutable_item& item, span<char const> buf)
+	{
+		int const size = int(buf.size());
+		if (item.size != size)
+		{
+			item.value.reset(new char[std::size_t(size)]);
+			item.size = size;
+		}
+		std::memcpy(item.value.get(), buf.data(), buf.size());
+	}
+
+	void touch_item(compact_immutable_item& f, address const& addr
+		, std::uint32_t const now)
+	{
+		f.last_seen = now;
+
+		// maybe increase num_announcers if we haven't seen this IP before
+		sha1_hash const iphash = hash_address(addr);
+		if (!f.ips.find(iphash))
+		{
+			f.ips.set(iphash);
+			++f.num_announcers;
+		}
+	}
+
+	std::uint32_t gcd(std::uint32_t a, std::uint32_t b)
+	{
+		while (b != 0)
+		{
+			std::uint32_t const t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	// calls f(i) on distinct indices in the range [0, n), in random order,
+	// until f returns false or all indices have been visited. The order is an
+	// arithmetic progression modulo n with a random start and a random step
+	// that's co-prime with n. This lets us pick random elements without
+	// visiting (or allocating memory for) the ones we don't pick.
+	template <typename Fun>
+	void visit_random_order(int const n, Fun f)
+	{
+		if (n <= 0) return;
+		std::uint32_t const size = std::uint32_t(n);
+		std::uint32_t const start = random(size - 1);
+		std::uint32_t step = size == 1 ? 1 : random(size - 2) + 1;
+		while (gcd(step, size) != 1) step = step == size - 1 ? 1 : step + 1;
+
+		std::uint32_t idx = start;
+		for (std::uint32_t i = 0; i < size; ++i)
+		{
+			if (!f(int(idx))) return;
+			idx = std::uint32_t((std::uint64_t(idx) + step) % size);
+		}
+	}
+
+	// a dense array of elements, indexed by an open-addressing hash table
+	// (with linear probing) of 32 bit slots. The slots hold the index into the
+	// dense array plus one, 0 means the slot is empty. T is expected to have a
+	// ``key`` member of type sha1_hash. Erasing an element moves the last
+	// element into its place, so indices are not stable across erase().
+	template <typename T>
+	struct hashed_array
+	{
+		explicit hashed_array(std::uint32_t const seed) : m_seed(seed) {}
+
+		int size() const { return int(m_elements.size()); }
+		bool empty() const { return m_elements.empty(); }
+
+		T& operator[](int const idx) { return m_elements[std::size_t(idx)]; }
+		T const& operator[](int const idx) const { return m_elements[std::size_t(idx)]; }
+
+		typename std::vector<T>::const_iterator begin() const { return m_elements.begin(); }
+		typename std::vector<T>::const_iterator end() const { return m_elements.end(); }
+
+		// returns the index of the element with the specified key, or -1
+		int find(sha1_hash const& key) const
+		{
+			if (m_slots.empty()) return -1;
+			std::uint32_t const mask = std::uint32_t(m_slots.size() - 1);
+			for (std::uint32_t s = hash(key) & mask;; s = (s + 1) & mask)
+			{
+				std::uint32_t const v = m_slots[s];
+				if (v == 0) return -1;
+				if (m_elements[v - 1].key == key) return int(v - 1);
+			}
+		}
+
+		// inserts a new, default constructed, element with the specified key.
+		// The key must not already be in the table
+		T& insert(sha1_hash const& key)
+		{
+			TORRENT_ASSERT(find(key) == -1);
+			if ((m_elements.size() + 1) * 2 > m_slots.size())
+				rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+
+			m_elements.emplace_back();
+			m_elements.back().key = key;
+			m_slots[free_slot(key)] = std::uint32_t(m_elements.size());
+			return m_elements.back();
+		}
+
+		void erase(int const idx)
+		{
+			TORRENT_ASSERT(idx >= 0 && idx < size());
+			std::uint32_t const mask = std::uint32_t(m_slots.size() - 1);
+
+			// remove the slot referring to idx. Then shift subsequent entries
+			// in the same probe sequence back, to fill the hole
+			std::uint32_t hole = slot_of(idx);
+			for (std::uint32_t s = (hole + 1) & mask; m_slots[s] != 0; s = (s + 1) & mask)
+			{
+				std::uint32_t const home = hash(m_elements[m_slots[s] - 1].key) & mask;
+				// can the entry at s be moved into the hole? Only if its home
+				// slot isn't in the (cyclic) range (hole, s]
+				if (((s - home) & mask) >= ((s - hole) & mask))
+				{
+					m_slots[hole] = m_slots[s];
+					hole = s;
+				}
+			}
+			m_slots[hole] = 0;
+
+			int const last = size() - 1;
+			if (idx != last)
+			{
+				m_slots[slot_of(last)] = std::uint32_t(idx + 1);
+				m_elements[std::size_t(idx)] = std::move(m_elements.back());
+			}
+			m_elements.pop_back();
+		}
+
+	private:
+
+		std::uint32_t hash(sha1_hash const& key) const
+		{
+			// the keys are mostly hashes already, but they are chosen by other
+			// nodes. Mix all bits with a per-table random seed, to make it hard
+			// to construct keys that collide
+			std::uint64_t h = m_seed;
+			for (int i = 0; i < 5; ++i)
+			{
+				std::uint32_t w;
+				std::memcpy(&w, key.data() + i * 4, 4);
+				h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+				h ^= h >> 29;
+			}
+			return std::uint32_t(h ^ (h >> 32));
+		}
+
+		std::uint32_t slot_of(int const idx) const
+		{
+			std::uint32_t const mask = std::uint32_t(m_slots.size() - 1);
+			for (std::uint32_t s = hash(m_elements[std::size_t(idx)].key) & mask;; s = (s + 1) & mask)
+			{
+				TORRENT_ASSERT(m_slots[s] != 0);
+				if (m_slots[s] == std::uint32_t(idx + 1)) return s;
+			}
+		}
+
+		std::uint32_t free_slot(sha1_hash const& key) const
+		{
+			std::uint32_t const mask = std::uint32_t(m_slots.size() - 1);
+			std::uint32_t s = hash(key) & mask;
+			while (m_slots[s] != 0) s = (s + 1) & mask;
+			return s;
+		}
+
+		void rehash(std::size_t const new_size)
+		{
+			m_slots.assign(new_size, 0);
+			for (std::size_t i = 0; i < m_elements.size(); ++i)
+				m_slots[free_slot(m_elements[i].key)] = std::uint32_t(i + 1);
+		}
+
+		std::uint32_t const m_seed;
+		std::vector<T> m_elements;
+		std::vector<std::uint32_t> m_slots;
+	};
+
+	// return true if the first argument is a better candidate for removal, i.e.
+	// less important to keep. This uses the same score as the default
+	// storage, and breaks ties by evicting the item we heard about least
+	// recently
+	struct compact_item_comparator
+	{
+		explicit compact_item_comparator(std::vector<node_id> const& node_ids) : m_node_ids(node_ids) {}
+
+		bool operator()(compact_immutable_item const& lhs
+			, compact_immutable_item const& rhs) const
+		{
+			int const l_score = lhs.num_announcers / 5 - min_distance_exp(lhs.key, m_node_ids);
+			int const r_score = rhs.num_announcers / 5 - min_distance_exp(rhs.key, m_node_ids);
+			if (l_score != r_score) return l_score < r_score;
+			return lhs.last_seen < rhs.last_seen;
+		}
+
+	private:
+		std::vector<node_id> const& m_node_ids;
+	};
+
+	// picks the item to evict among a random sample of eviction_sample_size
+	// items. With fewer items than that, all of them are considered
+	template <typename Item>
+	int pick_eviction_candidate(std::vector<node_id> const& node_ids
+		, hashed_array<Item> const& table)
+	{
+		compact_item_comparator const cmp(node_ids);
+		int ret = -1;
+		int samples = eviction_sample_size;
+		visit_random_order(table.size(), [&](int const idx)
+		{
+			if (ret == -1 || cmp(table[idx], table[ret])) ret = idx;
+			return --samples > 0;
+		});
+		return ret;
+	}
+
+	struct infohashes_sample
+	{
+		aux::vector<sha1_hash> samples;
+		time_point created = min_time();
+
+		int count() const { return int(samples.size()); }
+	};
+
+	class dht_compact_storage final : public dht_storage_interface
+	{
+	public:
+
+		explicit dht_compact_storage(dht_settings const& settings)
+			: m_settings(settings)
+			, m_epoch(aux::time_now())
+			, m_torrents(random(0xffffffff))
+			, m_immutable_table(random(0xffffffff))
+			, m_mutable_table(random(0xffffffff))
+		{
+			m_counters.reset();
+		}
+
+		~dht_compact_storage() override = default;
+
+		dht_compact_storage(dht_compact_storage const&) = delete;
+		dht_compact_storage& operator=(dht_compact_storage const&) = delete;
+
+#ifndef TORRENT_NO_DEPRECATE
+		size_t num_torrents() const override { return std::size_t(m_torrents.size()); }
+		size_t num_peers() const override
+		{
+			size_t ret = 0;
+			for (auto const& t : m_torrents)
+				ret += t.peers4.size() + t.peers6.size();
+			return ret;
+		}
+#endif
+		void update_node_ids(std::vector<node_id> const& ids) override
+		{
+			m_node_ids = ids;
+		}
+
+		bool get_peers(sha1_hash const& info_hash
+			, bool const noseed, bool const scrape, address const& requester
+			, entry& peers) const override
+		{
+			int const idx = m_torrents.find(info_hash);
+			if (idx < 0) return m_torrents.size() >= m_settings.max_torrents;
+
+			compact_torrent const& t = m_torrents[idx];
+			if (!t.name.empty()) peers["n"] = t.name;
+
+			if (requester.is_v4())
+				return get_peers_impl(t.peers4, t.seeds4, noseed, scrape
+					, make_peer(requester.to_v4(), 0), peers);
+			else
+				return get_peers_impl(t.peers6, t.seeds6, noseed, scrape
+					, make_peer(requester.to_v6(), 0), peers);
+		}
+
+		void announce_peer(sha1_hash const& info_hash
+			, tcp::endpoint const& endp
+			, string_view name, bool const seed) override
+		{
+			int idx = m_torrents.find(info_hash);
+			if (idx < 0)
+			{
+				if (m_torrents.size() >= m_settings.max_torrents)
+				{
+					// we're at capacity, drop the announce
+					return;
+				}
+
+				m_counters.torrents += 1;
+				m_torrents.insert(info_hash);
+				idx = m_torrents.size() - 1;
+			}
+
+			compact_torrent& t = m_torrents[idx];
+
+			// the peer announces a torrent name, and we don't have a name
+			// for this torrent. Store it.
+			if (!name.empty() && t.name.empty())
+			{
+				t.name = name.substr(0, 100).to_string();
+			}
+
+			std::uint32_t const now = now_seconds(m_epoch);
+			if (endp.protocol() == tcp::v4())
+				announce_impl(t.peers4, t.seeds4, make_peer(endp.address().to_v4(), endp.port()), seed, now);
+			else
+				announce_impl(t.peers6, t.seeds6, make_peer(endp.address().to_v6(), endp.port()), seed, now);
+		}
+
+		bool get_immutable_item(sha1_hash const& target
+			, entry& item) const override
+		{
+			int const idx = m_immutable_table.find(target);
+			if (idx < 0) return false;
+
+			compact_immutable_item const& f = m_immutable_table[idx];
+			item["v"] = bdecode(f.value.get(), f.value.get() + f.size);
+			return true;
+		}
+
+		void put_immutable_item(sha1_hash const& target
+			, span<char const> buf
+			, address const& addr) override
+		{
+			TORRENT_ASSERT(!m_node_ids.empty());
+			int idx = m_immutable_table.find(target);
+			if (idx < 0)
+			{
+				// make sure we don't add too many items
+				if (m_immutable_table.size() >= m_settings.max_dht_items)
+				{
+					int const j = pick_eviction_candidate(m_node_ids, m_immutable_table);
+					TORRENT_ASSERT(j >= 0);
+					m_immutable_table.erase(j);
+					m_counters.immutable_data -= 1;
+				}
+				set_value(m_immutable_table.insert(target), buf);
+				idx = m_immutable_table.size() - 1;
+				m_counters.immutable_data += 1;
+			}
+
+			touch_item(m_immutable_table[idx], addr, now_seconds(m_epoch));
+		}
+
+		bool get_mutable_item_seq(sha1_hash const& target
+			, sequence_number& seq) const override
+		{
+			int const idx = m_mutable_table.find(target);
+			if (idx < 0) return false;
+
+			seq = m_mutable_table[idx].seq;
+			return true;
+		}
+
+		bool get_mutable_item(sha1_hash const& target
+			, sequence_number const seq, bool const force_fill
+			, entry& item) const override
+		{
+			int const idx = m_mutable_table.find(target);
+			if (idx < 0) return false;
+
+			compact_mutable_item const& f = m_mutable_table[idx];
+			item["seq"] = f.seq.value;
+			if (force_fill || (sequence_number(0) <= seq && seq < f.seq))
+			{
+				item["v"] = bdecode(f.value.get(), f.value.get() + f.size);
+				item["sig"] = f.sig.bytes;
+				item["k"] = f.pk.bytes;
+			}
+			return true;
+		}
+
+		void put_mutable_item(sha1_hash const& target
+			, span<char const> buf
+			, signature const& sig
+			, sequence_number const seq
+			, public_key const& pk
+			, span<char const> salt
+			, address const& addr) override
+		{
+			TORRENT_ASSERT(!m_node_ids.empty());
+			int idx = m_mutable_table.find(target);
+			if (idx < 0)
+			{
+				// this is the case where we don't have an item in this slot
+				// make sure we don't add too many items
+				if (m_mutable_table.size() >= m_settings.max_dht_items)
+				{
+					int const j = pick_eviction_candidate(m_node_ids, m_mutable_table);
+					TORRENT_ASSERT(j >= 0);
+					m_mutable_table.erase(j);
+					m_counters.mutable_data -= 1;
+				}
+				compact_mutable_item& to_add = m_mutable_table.insert(target);
+				set_value(to_add, buf);
+				to_add.seq = seq;
+				to_add.salt = {salt.begin(), salt.end()};
+				to_add.sig = sig;
+				to_add.pk = pk;
+				idx = m_mutable_table.size() - 1;
+				m_counters.mutable_data += 1;
+			}
+			else
+			{
+				// this is the case where we already
+				compact_mutable_item& item = m_mutable_table[idx];
+
+				if (item.seq < seq)
+				{
+					set_value(item, buf);
+					item.seq = seq;
+					item.sig = sig;
+				}
+			}
+
+			touch_item(m_mutable_table[idx], addr, now_seconds(m_epoch));
+		}
+
+		int get_infohashes_sample(entry& item) override
+		{
+			item["interval"] = aux::clamp(m_settings.sample_infohashes_interval
+				, 0, sample_infohashes_interval_max);
+			item["num"] = m_torrents.size();
+
+			refresh_infohashes_sample();
+
+			aux::vector<sha1_hash> const& samples = m_infohashes_sample.samples;
+			item["samples"] = span<char const>(
+				reinterpret_cast<char const*>(samples.data()), samples.size() * 20);
+
+			return m_infohashes_sample.count();
+		}
+
+		void tick() override
+		{
+			std::uint32_t const now = now_seconds(m_epoch);
+			std::uint32_t const peer_timeout = std::uint32_t(
+				total_seconds(announce_interval * 3 / 2));
+
+			// look through all peers and see if any have timed out. Iterate
+			// backwards, since erasing moves the last torrent into the
+			// erased slot
+			for (int i = m_torrents.size() - 1; i >= 0; --i)
+			{
+				compact_torrent& t = m_torrents[i];
+				purge_peers(t.peers4, t.seeds4, now, peer_timeout);
+				purge_peers(t.peers6, t.seeds6, now, peer_timeout);
+
+				if (!t.peers4.empty() || !t.peers6.empty()) continue;
+
+				// if there are no more peers, remove the entry altogether
+				m_torrents.erase(i);
+				m_counters.torrents -= 1;// peers is decreased by purge_peers
+			}
+
+			if (0 == m_settings.item_lifetime) return;
+
+			time_duration lifetime = seconds(m_settings.item_lifetime);
+			// item lifetime must >= 120 minutes.
+			if (lifetime < minutes(120)) lifetime = minutes(120);
+			std::uint32_t const item_timeout = std::uint32_t(total_seconds(lifetime));
+
+			for (int i = m_immutable_table.size() - 1; i >= 0; --i)
+			{
+				if (m_immutable_table[i].last_seen + item_timeout > now) continue;
+				m_immutable_table.erase(i);
+				m_counters.immutable_data -= 1;
+			}
+
+			for (int i = m_mutable_table.size() - 1; i >= 0; --i)
+			{
+				if (m_mutable_table[i].last_seen + item_timeout > now) continue;
+				m_mutable_table.erase(i);
+				m_counters.mutable_data -= 1;
+			}
+		}
+
+		dht_storage_counters counters() const override
+		{
+			return m_counters;
+		}
+
+	private:
+
+		template <typename Peer>
+		bool get_peers_impl(std::vector<Peer> const& peersv, int const num_seeds
+			, bool const noseed, bool const scrape, Peer const& requester
+			, entry& peers) const
+		{
+			if (scrape)
+			{
+				bloom_filter<256> downloaders;
+				bloom_filter<256> seeds;
+
+				for (auto const& p : peersv)
+				{
+					sha1_hash const iphash = hash_address(peer_address(p));
+					if (p.seed) seeds.set(iphash);
+					else downloaders.set(iphash);
+				}
+
+				peers["BFpe"] = downloaders.to_string();
+				peers["BFsd"] = seeds.to_string();
+			}
+			else
+			{
+				int to_pick = m_settings.max_peers_reply;
+				TORRENT_ASSERT(to_pick >= 0);
+				// if these are IPv6 peers their addresses are 4x the size of IPv4
+				// so reduce the max peers 4 fold to compensate
+				// max_peers_reply should probably be specified in bytes
+				if (!peersv.empty() && sizeof(Peer) == sizeof(compact_peer6))
+					to_pick /= 4;
+				entry::list_type& pe = peers["values"].list();
+
+				int const candidates = noseed ? int(peersv.size()) - num_seeds
+					: int(peersv.size());
+				to_pick = std::min(to_pick, candidates);
+
+				if (to_pick > 0)
+				{
+					visit_random_order(int(peersv.size()), [&](int const idx)
+					{
+						Peer const& p = peersv[std::size_t(idx)];
+						// if the node asking for peers is a seed, skip seeds from the
+						// peer list
+						if (noseed && p.seed) return true;
+						pe.push_back(compact_endpoint(p));
+						return --to_pick > 0;
+					});
+				}
+			}
+
+			if (int(peersv.size()) < m_settings.max_peers)
+				return false;
+
+			// we're at the max peers stored for this torrent
+			// only send a write token if the requester is already in the set
+			// only check for a match on IP because the peer may be announcing
+			// a different port than the one it is using to send DHT messages
+			auto const requester_iter = std::lower_bound(peersv.begin(), peersv.end(), requester);
+			return requester_iter == peersv.end()
+				|| requester_iter->ip != requester.ip;
+		}
+
+		template <typename Peer>
+		void announce_impl(std::vector<Peer>& peersv, std::int32_t& num_seeds
+			, Peer peer, bool const seed, std::uint32_t const now)
+		{
+			peer.added = now;
+			peer.seed = seed;
+			auto i = std::lower_bound(peersv.begin(), peersv.end(), peer);
+			if (i != peersv.end() && i->ip == peer.ip && i->port == peer.port)
+			{
+				num_seeds += int(seed) - int(i->seed);
+				*i = peer;
+			}
+			else if (int(peersv.size()) >= m_settings.max_peers)
+			{
+				// we're at capacity, drop the announce
+				return;
+			}
+			else
+			{
+				peersv.insert(i, peer);
+				num_seeds += int(seed);
+				m_counters.peers += 1;
+			}
+		}
+
+		template <typename Peer>
+		void purge_peers(std::vector<Peer>& peers, std::int32_t& num_seeds
+			, std::uint32_t const now, std::uint32_t const timeout)
+		{
+			auto new_end = std::remove_if(peers.begin(), peers.end()
+				, [=](Peer const& e) { return e.added + timeout < now; });
+
+			for (auto i = new_end; i != peers.end(); ++i)
+				num_seeds -= int(i->seed);
+			m_counters.peers -= std::int32_t(std::distance(new_end, peers.end()));
+			peers.erase(new_end, peers.end());
+			// if we're using less than 1/4 of the capacity free up the excess
+			if (!peers.empty() && peers.capacity() / peers.size() >= 4U)
+				peers.shrink_to_fit();
+		}
+
+		void refresh_infohashes_sample()
+		{
+			time_point const now = aux::time_now();
+			int const interval = aux::clamp(m_settings.sample_infohashes_interval
+				, 0, sample_infohashes_interval_max);
+
+			int const max_count = aux::clamp(m_settings.max_infohashes_sample_count
+				, 0, infohashes_sample_count_max);
+			int const count = std::min(max_count, m_torrents.size());
+
+			if (interval > 0
+				&& m_infohashes_sample.created + seconds(interval) > now
+				&& m_infohashes_sample.count() >= max_count)
+				return;
+
+			aux::vector<sha1_hash>& samples = m_infohashes_sample.samples;
+			samples.clear();
+			samples.reserve(count);
+
+			if (count > 0)
+			{
+				visit_random_order(m_torrents.size(), [&](int const idx)
+				{
+					samples.push_back(m_torrents[idx].key);
+					return int(samples.size()) < count;
+				});
+			}
+
+			TORRENT_ASSERT(int(samples.size()) == count);
+			m_infohashes_sample.created = now;
+		}
+
+		dht_settings const& m_settings;
+		dht_storage_counters m_counters;
+
+		// all timestamps are stored as seconds relative to this
+		time_point const m_epoch;
+
+		std::vector<node_id> m_node_ids;
+		hashed_array<compact_torrent> m_torrents;
+		hashed_array<compact_immutable_item> m_immutable_table;
+		hashed_array<compact_mutable_item> m_mutable_table;
+
+		infohashes_sample m_infohashes_sample;
+	};
+}
+
+std::unique_ptr<dht_storage_interface> dht_compact_storage_constructor(
+	dht_settings const& settings)
+{
+	return std::unique_ptr<dht_compact_storage>(new dht_compact_storage(settings));
+}
+
+} } // namespace libtorrent::dht
@@ -77,9 +77,6 @@ namespace {
 		std::vector<peer_entry> peers6;
 	};
 
-	// TODO: 2 make this configurable in dht_settings
-	constexpr time_duration announce_interval = minutes(30);
-
 	struct dht_immutable_item
 	{
 		// the actual value
@@ -172,9 +169,6 @@ namespace {
 			, immutable_item_comparator(node_ids));
 	}
 
-	constexpr int sample_infohashes_interval_max = 21600;
-	constexpr int infohashes_sample_count_max = 20;
-
 	struct infohashes_sample
 	{
 		aux::vector<sha1_hash> samples;
@@ -663,10 +663,18 @@ namespace libtorrent { namespace dht {
 		m_send_buf.clear();
 		bencode(std::back_inserter(m_send_buf), e);
 
+		return send_packet(s, m_send_buf, addr);
+	}
+
+	bool dht_tracker::send_packet(aux::listen_socket_handle const& s
+		, span<char const> buf, udp::endpoint const& addr)
+	{
+		TORRENT_ASSERT(m_nodes.find(s) != m_nodes.end());
+
 		// update the quota. We won't prevent the packet to be sent if we exceed
 		// the quota, we'll just (potentially) block the next incoming request.
 
-		m_send_quota -= int(m_send_buf.size());
+		m_send_quota -= int(buf.size());
 
 		error_code ec;
 		if (s.get_local_endpoint().protocol().family() != addr.protocol().family())
@@ -679,31 +687,31 @@ namespace libtorrent { namespace dht {
 					{ return v.first.get_local_endpoint().protocol().family() == addr.protocol().family(); });
 
 			if (n != m_nodes.end())
-				m_send_fun(n->first, addr, m_send_buf, ec, {});
+				m_send_fun(n->first, addr, buf, ec, {});
 			else
 				ec = boost::asio::error::address_family_not_supported;
 		}
 		else
 		{
-			m_send_fun(s, addr, m_send_buf, ec, {});
+			m_send_fun(s, addr, buf, ec, {});
 		}
 
 		if (ec)
 		{
 			m_counters.inc_stats_counter(counters::dht_messages_out_dropped);
 #ifndef TORRENT_DISABLE_LOGGING
-			m_log->log_packet(dht_logger::outgoing_message, m_send_buf, addr);
+			m_log->log_packet(dht_logger::outgoing_message, buf, addr);
 #endif
 			return false;
 		}
 
-		m_counters.inc_stats_counter(counters::dht_bytes_out, int(m_send_buf.size()));
+		m_counters.inc_stats_counter(counters::dht_bytes_out, int(buf.size()));
 		// account for IP and UDP overhead
 		m_counters.inc_stats_counter(counters::sent_ip_overhead_bytes
 			, addr.address().is_v6() ? 48 : 28);
 		m_counters.inc_stats_counter(counters::dht_messages_out);
 #ifndef TORRENT_DISABLE_LOGGING
-		m_log->log_packet(dht_logger::outgoing_message, m_send_buf, addr);
+		m_log->log_packet(dht_logger::outgoing_message, buf, addr);
 #endif
 		return true;
 	}
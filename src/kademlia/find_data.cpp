@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/io.hpp>
 #include <libtorrent/socket.hpp>
 #include <libtorrent/socket_io.hpp>
+#include <libtorrent/aux_/alloca.hpp>
 
 #ifndef TORRENT_DISABLE_LOGGING
 #include <libtorrent/hex.hpp> // to_hex
@@ -93,12 +94,13 @@ void find_data::start()
 	// nodes from routing table.
 	if (m_results.empty())
 	{
-		std::vector<node_entry> nodes;
-		m_node.m_table.find_node(target(), nodes, routing_table::include_failed);
+		TORRENT_ALLOCA(nodes, node_entry const*, m_node.m_table.bucket_size());
+		int const num = m_node.m_table.find_node(target(), nodes
+			, routing_table::include_failed);
 
-		for (auto const& n : nodes)
+		for (auto const* n : nodes.first(num))
 		{
-			add_entry(n.id, n.ep(), observer::flag_initial);
+			add_entry(n->id, n->ep(), observer::flag_initial, n->rtt);
 		}
 	}
 
@@ -285,7 +285,7 @@ void obfuscated_get_peers::done()
 		if (o->flags & observer::flag_no_id) continue;
 		if (!(o->flags & observer::flag_alive)) continue;
 
-		ta->add_entry(o->id(), o->target_ep(), observer::flag_initial);
+		ta->add_entry(o->id(), o->target_ep(), observer::flag_initial, o->rtt());
 		++num_added;
 	}
 
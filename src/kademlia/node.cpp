@@ -50,6 +50,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/assert.hpp>
 #include <libtorrent/aux_/time.hpp>
 #include "libtorrent/aux_/throw.hpp"
+#include "libtorrent/aux_/alloca.hpp"
+#include "libtorrent/aux_/bencode_writer.hpp"
+#include "libtorrent/version.hpp"
 #include "libtorrent/alert_types.hpp" // for dht_lookup
 #include "libtorrent/performance_counters.hpp" // for counters
 
@@ -100,8 +103,41 @@ void incoming_error(entry& e, char const* msg, int error_code = 203)
 	l.emplace_back(msg);
 }
 
+// writes a compact list of the nodes closest to ``target`` in the routing
+// table of ``n`` straight into the output buffer
+void write_nodes_string(aux::bencode_writer& w, node const& n
+	, sha1_hash const& target)
+{
+	TORRENT_ALLOCA(nodes, node_entry const*, n.m_table.bucket_size());
+	int const num = n.m_table.find_node(target, nodes, 0);
+	// 20 bytes node ID, and an IPv4 or IPv6 address and a port
+	int const entry_size = n.protocol() == udp::v4() ? 20 + 4 + 2 : 20 + 16 + 2;
+	char* ptr = w.string_buffer(std::size_t(num * entry_size));
+#if TORRENT_USE_ASSERTS
+	char const* const end = ptr + num * entry_size;
+#endif
+	for (auto const* e : nodes.first(num))
+	{
+		ptr = std::copy(e->id.begin(), e->id.end(), ptr);
+		detail::write_endpoint(udp::endpoint(e->addr(), std::uint16_t(e->port())), ptr);
+	}
+	TORRENT_ASSERT(ptr == end);
+}
+
 } // anonymous namespace
 
+bool socket_manager::send_packet(aux::listen_socket_handle const& s
+	, span<char const> buf, udp::endpoint const& addr)
+{
+	error_code ec;
+	bdecode_node const msg = bdecode(buf, ec);
+	TORRENT_ASSERT(!ec);
+	if (ec) return false;
+	entry e;
+	e = msg;
+	return send_packet(s, e, addr);
+}
+
 node::node(aux::listen_socket_handle const& sock, socket_manager* sock_man
 	, dht_settings const& settings
 	, node_id const& nid
@@ -326,6 +362,18 @@ void node::incoming(aux::listen_socket_handle const& s, msg const& m)
 				return;
 			}
 
+			// the most common requests can be answered without building an
+			// entry, unless a plugin may want to see (and alter) the response
+			if (m_observer == nullptr || !m_observer->has_dht_request_handlers())
+			{
+				m_response_buf.clear();
+				if (write_response(m, m_response_buf))
+				{
+					m_sock_man->send_packet(m_sock, m_response_buf, m.addr);
+					break;
+				}
+			}
+
 			entry e;
 			incoming_request(m, e);
 			m_sock_man->send_packet(m_sock, e, m.addr);
@@ -776,6 +824,23 @@ entry write_nodes_entry(std::vector<node_entry> const& nodes)
 	return r;
 }
 
+entry write_nodes_entry(span<node_entry const* const> nodes)
+{
+	entry r;
+	std::string& str = r.string();
+	// 20 bytes node ID, and an IPv4 or IPv6 address and a port
+	std::size_t const entry_size = nodes.empty() || nodes[0]->addr().is_v4()
+		? 20 + 4 + 2 : 20 + 16 + 2;
+	str.reserve(nodes.size() * entry_size);
+	std::back_insert_iterator<std::string> out(str);
+	for (auto const* n : nodes)
+	{
+		std::copy(n->id.begin(), n->id.end(), out);
+		detail::write_endpoint(udp::endpoint(n->addr(), std::uint16_t(n->port())), out);
+	}
+	return r;
+}
+
 // build response
 void node::incoming_request(msg const& m, entry& e)
 {
@@ -1187,6 +1252,247 @@ void node::incoming_request(msg const& m, entry& e)
 	}
 }
 
+bool node::write_response(msg const& m, std::vector<char>& buf)
+{
+	static key_desc_t const top_desc[] = {
+		{"q", bdecode_node::string_t, 0, 0},
+		{"ro", bdecode_node::int_t, 0, key_desc_t::optional},
+		{"a", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
+	};
+
+	// this function must not have any side effects until the request has been
+	// validated, since anything it rejects is handled (again) by
+	// incoming_request()
+	bdecode_node top_level[4];
+	char error_string[200];
+	if (!verify_message(m.message, top_desc, top_level, error_string))
+		return false;
+
+	bdecode_node const arg_ent = top_level[2];
+	bool const read_only = top_level[1] && top_level[1].int_value() != 0;
+	node_id const id(top_level[3].string_ptr());
+
+	if (m_settings.enforce_node_id && !verify_id(id, m.addr.address()))
+		return false;
+
+	string_view const query = top_level[0].string_value();
+
+	// the nodes to include in the response, indexed by 0 for "nodes" and 1
+	// for "nodes6"
+	node const* nodes[2] = {nullptr, nullptr};
+	sha1_hash target;
+	bool get_peers = false;
+	bool noseed = false;
+	bool scrape = false;
+	bool announce = false;
+	int port = 0;
+	string_view name;
+	bool seed = false;
+	bdecode_node want;
+
+	if (query == "get_peers")
+	{
+		static key_desc_t const msg_desc[] = {
+			{"info_hash", bdecode_node::string_t, 20, 0},
+			{"noseed", bdecode_node::int_t, 0, key_desc_t::optional},
+			{"scrape", bdecode_node::int_t, 0, key_desc_t::optional},
+			{"want", bdecode_node::list_t, 0, key_desc_t::optional},
+		};
+
+		bdecode_node msg_keys[4];
+		if (!verify_message(arg_ent, msg_desc, msg_keys, error_string))
+			return false;
+
+		target = sha1_hash(msg_keys[0].string_ptr());
+		noseed = msg_keys[1] && msg_keys[1].int_value() != 0;
+		scrape = msg_keys[2] && msg_keys[2].int_value() != 0;
+		want = msg_keys[3];
+		get_peers = true;
+	}
+	else if (query == "find_node")
+	{
+		static key_desc_t const msg_desc[] = {
+			{"target", bdecode_node::string_t, 20, 0},
+			{"want", bdecode_node::list_t, 0, key_desc_t::optional},
+		};
+
+		bdecode_node msg_keys[2];
+		if (!verify_message(arg_ent, msg_desc, msg_keys, error_string))
+			return false;
+
+		target = sha1_hash(msg_keys[0].string_ptr());
+		want = msg_keys[1];
+	}
+	else if (query == "announce_peer")
+	{
+		static key_desc_t const msg_desc[] = {
+			{"info_hash", bdecode_node::string_t, 20, 0},
+			{"port", bdecode_node::int_t, 0, 0},
+			{"token", bdecode_node::string_t, 0, 0},
+			{"n", bdecode_node::string_t, 0, key_desc_t::optional},
+			{"seed", bdecode_node::int_t, 0, key_desc_t::optional},
+			{"implied_port", bdecode_node::int_t, 0, key_desc_t::optional},
+		};
+
+		bdecode_node msg_keys[6];
+		if (!verify_message(arg_ent, msg_desc, msg_keys, error_string))
+			return false;
+
+		// is the announcer asking to ignore the explicit
+		// listen port and instead use the source port of the packet?
+		std::int64_t const p = (msg_keys[5] && msg_keys[5].int_value() != 0)
+			? m.addr.port() : msg_keys[1].int_value();
+		if (p < 0 || p >= 65536) return false;
+
+		target = sha1_hash(msg_keys[0].string_ptr());
+		if (!verify_token(msg_keys[2].string_value(), target, m.addr))
+			return false;
+
+		port = int(p);
+		if (msg_keys[3]) name = msg_keys[3].string_value();
+		seed = msg_keys[4] && msg_keys[4].int_value();
+		announce = true;
+	}
+	else
+	{
+		return false;
+	}
+
+	if (!announce)
+	{
+		if (want.type() != bdecode_node::list_t)
+		{
+			nodes[m_protocol.protocol == udp::v4() ? 0 : 1] = this;
+		}
+		else
+		{
+			for (int i = 0; i < want.list_size(); ++i)
+			{
+				bdecode_node const wanted = want.list_at(i);
+				if (wanted.type() != bdecode_node::string_t)
+					continue;
+				node const* wanted_node = m_get_foreign_node(target
+					, wanted.string_value().to_string());
+				if (!wanted_node) continue;
+				nodes[wanted_node->protocol() == udp::v4() ? 0 : 1] = wanted_node;
+			}
+		}
+	}
+
+	// the request is valid, from here on we're committed to responding to it
+	if (!read_only)
+		m_table.heard_about(id, m.addr);
+
+	// peers (and scrape bloom filters) are returned by the storage as an
+	// entry, since that's what dht_storage_interface produces. Their keys are
+	// merged into the response in sorted order
+	entry peers;
+	bool full = false;
+	if (get_peers)
+	{
+		m_counters.inc_stats_counter(counters::dht_get_peers_in);
+		full = lookup_peers(target, peers, noseed, scrape, m.addr.address());
+
+#ifndef TORRENT_DISABLE_LOGGING
+		if (peers.find_key("values") && m_observer)
+		{
+			m_observer->log(dht_logger::node, "values: %d"
+				, int(peers["values"].list().size()));
+		}
+#endif
+	}
+	else if (announce)
+	{
+		if (m_observer)
+			m_observer->announce(target, m.addr.address(), port);
+
+		m_counters.inc_stats_counter(counters::dht_announce_peer_in);
+
+		// the token was correct. That means this
+		// node is not spoofing its address. So, let
+		// the table get a chance to add it.
+		m_table.node_seen(id, m.addr, 0xffff);
+
+		tcp::endpoint const addr = tcp::endpoint(m.addr.address(), std::uint16_t(port));
+		m_storage.announce_peer(target, addr, name, seed);
+	}
+	else
+	{
+		m_counters.inc_stats_counter(counters::dht_find_node_in);
+	}
+
+	aux::bencode_writer w(buf);
+	w.open_dict();
+
+	w.key("ip");
+	char* ptr = w.string_buffer(m.addr.address().is_v4() ? 4 + 2 : 16 + 2);
+	detail::write_endpoint(m.addr, ptr);
+
+	w.key("r");
+	w.open_dict();
+
+	entry::dictionary_type const empty;
+	entry::dictionary_type const& peer_keys
+		= peers.type() == entry::dictionary_t ? peers.dict() : empty;
+	auto peer_it = peer_keys.begin();
+	// writes the keys from the storage that sort before k, or all remaining
+	// ones if k is empty
+	auto const write_peers_until = [&](string_view const k)
+	{
+		for (; peer_it != peer_keys.end()
+			&& (k.empty() || peer_it->first < k); ++peer_it)
+		{
+			w.key(peer_it->first);
+			w.value(peer_it->second);
+		}
+	};
+
+	write_peers_until("id");
+	w.key("id");
+	w.string({m_id.data(), std::size_t(m_id.size())});
+
+	for (node const* n : nodes)
+	{
+		if (n == nullptr) continue;
+		write_peers_until(n->protocol_nodes_key());
+		w.key(n->protocol_nodes_key());
+		write_nodes_string(w, *n, target);
+	}
+
+	// mirror back the other node's external port
+	write_peers_until("p");
+	w.key("p");
+	w.integer(m.addr.port());
+
+	// If our storage is full we want to withhold the write token so that
+	// announces will spill over to our neighbors. This widens the
+	// perimeter of nodes which store peers for this torrent
+	if (get_peers && !full)
+	{
+		write_peers_until("token");
+		w.key("token");
+		w.string(generate_token(m.addr, target));
+	}
+	// and whatever is left
+	write_peers_until(string_view());
+	w.close();
+
+	w.key("t");
+	w.string(m.message.dict_find_string_value("t"));
+
+	static char const version_str[] = {'L', 'T'
+		, LIBTORRENT_VERSION_MAJOR, LIBTORRENT_VERSION_MINOR};
+	w.key("v");
+	w.string({version_str, sizeof(version_str)});
+
+	w.key("y");
+	w.string("r");
+	w.close();
+	TORRENT_ASSERT(w.done());
+	return true;
+}
+
 // TODO: limit number of entries in the result
 void node::write_nodes_entries(sha1_hash const& info_hash
 	, bdecode_node const& want, entry& r)
@@ -1195,9 +1501,9 @@ void node::write_nodes_entries(sha1_hash const& info_hash
 	// entry based on the protocol the request came in with
 	if (want.type() != bdecode_node::list_t)
 	{
-		std::vector<node_entry> n;
-		m_table.find_node(info_hash, n, 0);
-		r[protocol_nodes_key()] = write_nodes_entry(n);
+		TORRENT_ALLOCA(n, node_entry const*, m_table.bucket_size());
+		int const num = m_table.find_node(info_hash, n, 0);
+		r[protocol_nodes_key()] = write_nodes_entry(n.first(num));
 		return;
 	}
 
@@ -1213,9 +1519,9 @@ void node::write_nodes_entries(sha1_hash const& info_hash
 			continue;
 		node* wanted_node = m_get_foreign_node(info_hash, wanted.string_value().to_string());
 		if (!wanted_node) continue;
-		std::vector<node_entry> n;
-		wanted_node->m_table.find_node(info_hash, n, 0);
-		r[wanted_node->protocol_nodes_key()] = write_nodes_entry(n);
+		TORRENT_ALLOCA(n, node_entry const*, wanted_node->m_table.bucket_size());
+		int const num = wanted_node->m_table.find_node(info_hash, n, 0);
+		r[wanted_node->protocol_nodes_key()] = write_nodes_entry(n.first(num));
 	}
 }
 
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <cstdio> // for snprintf
 #include <cinttypes> // for PRId64 et.al.
 #include <cstdint>
+#include <cstring> // for memcpy
 
 #include "libtorrent/config.hpp"
 
@@ -53,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/invariant_check.hpp"
 #include "libtorrent/address.hpp"
 #include "libtorrent/aux_/array.hpp"
+#include "libtorrent/aux_/alloca.hpp"
 
 using namespace std::placeholders;
 
@@ -60,14 +62,23 @@ namespace libtorrent { namespace dht {
 
 namespace {
 
-	template <typename T, typename K>
-	void erase_one(T& container, K const& key)
+	std::size_t hash_ip(address_v4::bytes_type const& ip)
 	{
-		auto const i = container.find(key);
-		TORRENT_ASSERT(i != container.end());
-		container.erase(i);
+		std::uint32_t v;
+		std::memcpy(&v, ip.data(), 4);
+		return std::size_t((v * 0x9e3779b97f4a7c15ULL) >> 32);
 	}
 
+#if TORRENT_USE_IPV6
+	std::size_t hash_ip(address_v6::bytes_type const& ip)
+	{
+		std::uint64_t v[2];
+		std::memcpy(v, ip.data(), 16);
+		return std::size_t(((v[0] ^ (v[1] * 0xff51afd7ed558ccdULL))
+			* 0x9e3779b97f4a7c15ULL) >> 32);
+	}
+#endif
+
 	bool verify_node_address(dht_settings const& settings
 		, node_id const& id, address const& addr)
 	{
@@ -76,6 +87,94 @@ namespace {
 	}
 }
 
+template <typename Bytes>
+std::size_t ip_hash_table<Bytes>::find_slot(Bytes const& ip) const
+{
+	TORRENT_ASSERT(!m_slots.empty());
+	std::size_t const mask = m_slots.size() - 1;
+	std::size_t idx = hash_ip(ip) & mask;
+	while (m_slots[idx].count != 0 && m_slots[idx].ip != ip)
+		idx = (idx + 1) & mask;
+	return idx;
+}
+
+template <typename Bytes>
+void ip_hash_table<Bytes>::grow()
+{
+	std::vector<slot> old(std::max(std::size_t(16), m_slots.size() * 2), slot{Bytes(), 0});
+	old.swap(m_slots);
+	for (auto const& s : old)
+	{
+		if (s.count == 0) continue;
+		m_slots[find_slot(s.ip)] = s;
+	}
+}
+
+template <typename Bytes>
+void ip_hash_table<Bytes>::insert(Bytes const& ip)
+{
+	// keep the load factor below 1/2, to keep probe sequences short
+	if (std::size_t(m_size + 1) * 2 > m_slots.size()) grow();
+
+	slot& s = m_slots[find_slot(ip)];
+	if (s.count == 0)
+	{
+		s.ip = ip;
+		++m_size;
+	}
+	++s.count;
+}
+
+template <typename Bytes>
+bool ip_hash_table<Bytes>::exists(Bytes const& ip) const
+{
+	if (m_slots.empty()) return false;
+	return m_slots[find_slot(ip)].count != 0;
+}
+
+template <typename Bytes>
+void ip_hash_table<Bytes>::erase(Bytes const& ip)
+{
+	TORRENT_ASSERT(exists(ip));
+	if (m_slots.empty()) return;
+
+	std::size_t idx = find_slot(ip);
+	if (m_slots[idx].count == 0) return;
+	if (--m_slots[idx].count > 0) return;
+	--m_size;
+
+	// shift back any entries that were displaced by the one we just removed,
+	// to keep the probe sequences unbroken without tombstones
+	std::size_t const mask = m_slots.size() - 1;
+	std::size_t next = (idx + 1) & mask;
+	while (m_slots[next].count != 0)
+	{
+		std::size_t const home = hash_ip(m_slots[next].ip) & mask;
+		// if the entry's home slot is cyclically in (idx, next], it's
+		// reachable from its home without passing idx, and it can stay
+		if (((next - home) & mask) >= ((next - idx) & mask))
+		{
+			m_slots[idx] = m_slots[next];
+			idx = next;
+		}
+		next = (next + 1) & mask;
+	}
+	m_slots[idx].count = 0;
+}
+
+template <typename Bytes>
+bool ip_hash_table<Bytes>::operator==(ip_hash_table const& rh) const
+{
+	if (m_size != rh.m_size) return false;
+	for (auto const& s : m_slots)
+	{
+		if (s.count == 0) continue;
+		if (rh.m_slots.empty()) return false;
+		if (rh.m_slots[rh.find_slot(s.ip)].count != s.count) return false;
+	}
+	return true;
+}
+
 void ip_set::insert(address const& addr)
 {
 #if TORRENT_USE_IPV6
@@ -90,20 +189,29 @@ bool ip_set::exists(address const& addr) const
 {
 #if TORRENT_USE_IPV6
 	if (addr.is_v6())
-		return m_ip6s.find(addr.to_v6().to_bytes()) != m_ip6s.end();
+		return m_ip6s.exists(addr.to_v6().to_bytes());
 	else
 #endif
-		return m_ip4s.find(addr.to_v4().to_bytes()) != m_ip4s.end();
+		return m_ip4s.exists(addr.to_v4().to_bytes());
 }
 
 void ip_set::erase(address const& addr)
 {
 #if TORRENT_USE_IPV6
 	if (addr.is_v6())
-		erase_one(m_ip6s, addr.to_v6().to_bytes());
+		m_ip6s.erase(addr.to_v6().to_bytes());
 	else
 #endif
-		erase_one(m_ip4s, addr.to_v4().to_bytes());
+		m_ip4s.erase(addr.to_v4().to_bytes());
+}
+
+bool ip_set::operator==(ip_set const& rh) const
+{
+#if TORRENT_USE_IPV6
+	return m_ip4s == rh.m_ip4s && m_ip6s == rh.m_ip6s;
+#else
+	return m_ip4s == rh.m_ip4s;
+#endif
 }
 
 routing_table::routing_table(node_id const& id, udp proto, int bucket_size
@@ -274,24 +382,25 @@ out:
 	return candidate;
 }
 
+int routing_table::bucket_index(node_id const& id) const
+{
+	int const num_buckets = int(m_buckets.size());
+	if (num_buckets == 0) return -1;
+	return (std::min)(159 - distance_exp(m_id, id), num_buckets - 1);
+}
+
 routing_table::table_t::iterator routing_table::find_bucket(node_id const& id)
 {
 //	TORRENT_ASSERT(id != m_id);
 
-	int num_buckets = int(m_buckets.size());
-	if (num_buckets == 0)
-	{
+	if (m_buckets.empty())
 		m_buckets.push_back(routing_table_node());
-		++num_buckets;
-	}
 
-	int bucket_index = (std::min)(159 - distance_exp(m_id, id), num_buckets - 1);
-	TORRENT_ASSERT(bucket_index < int(m_buckets.size()));
-	TORRENT_ASSERT(bucket_index >= 0);
+	int const idx = bucket_index(id);
+	TORRENT_ASSERT(idx < int(m_buckets.size()));
+	TORRENT_ASSERT(idx >= 0);
 
-	auto i = m_buckets.begin();
-	std::advance(i, bucket_index);
-	return i;
+	return m_buckets.begin() + idx;
 }
 
 // returns true if the two IPs are "too close" to each other to be allowed in
@@ -326,31 +435,52 @@ bool compare_ip_cidr(address const& lhs, address const& rhs)
 	}
 }
 
+namespace {
+
+	node_entry* find_endpoint(bucket_t& b, udp::endpoint const& ep)
+	{
+		for (auto& n : b)
+		{
+			if (n.addr() != ep.address()) continue;
+			if (n.port() != ep.port()) continue;
+			return &n;
+		}
+		return nullptr;
+	}
+}
+
 node_entry* routing_table::find_node(udp::endpoint const& ep
 	, routing_table::table_t::iterator* bucket)
 {
 	for (table_t::iterator i = m_buckets.begin()
 		, end(m_buckets.end()); i != end; ++i)
 	{
-		for (bucket_t::iterator j = i->replacements.begin();
-			j != i->replacements.end(); ++j)
-		{
-			if (j->addr() != ep.address()) continue;
-			if (j->port() != ep.port()) continue;
-			*bucket = i;
-			return &*j;
-		}
-		for (bucket_t::iterator j = i->live_nodes.begin();
-			j != i->live_nodes.end(); ++j)
+		node_entry* n = find_endpoint(i->replacements, ep);
+		if (n == nullptr) n = find_endpoint(i->live_nodes, ep);
+		if (n == nullptr) continue;
+		*bucket = i;
+		return n;
+	}
+	*bucket = m_buckets.end();
+	return nullptr;
+}
+
+node_entry* routing_table::find_node(udp::endpoint const& ep
+	, node_id const& id, routing_table::table_t::iterator* bucket)
+{
+	int const idx = bucket_index(id);
+	if (idx >= 0)
+	{
+		auto const i = m_buckets.begin() + idx;
+		node_entry* n = find_endpoint(i->replacements, ep);
+		if (n == nullptr) n = find_endpoint(i->live_nodes, ep);
+		if (n != nullptr)
 		{
-			if (j->addr() != ep.address()) continue;
-			if (j->port() != ep.port()) continue;
 			*bucket = i;
-			return &*j;
+			return n;
 		}
 	}
-	*bucket = m_buckets.end();
-	return nullptr;
+	return find_node(ep, bucket);
 }
 
 void routing_table::fill_from_replacements(table_t::iterator bucket)
@@ -460,7 +590,7 @@ routing_table::add_node_status_t routing_table::add_node_impl(node_entry e)
 		// be the result of a poisoned routing table
 
 		table_t::iterator existing_bucket;
-		node_entry* existing = find_node(e.ep(), &existing_bucket);
+		node_entry* existing = find_node(e.ep(), e.id, &existing_bucket);
 		if (existing == nullptr)
 		{
 			// the node we're trying to add is not a match with an existing node. we
@@ -1053,84 +1183,76 @@ void routing_table::find_node(node_id const& target
 	l.clear();
 	if (count == 0) count = m_bucket_size;
 
-	auto const i = find_bucket(target);
-	int const bucket_index = int(std::distance(m_buckets.begin(), i));
-	int const bucket_size_limit = bucket_limit(bucket_index);
-
-	l.reserve(aux::numeric_cast<std::size_t>(bucket_size_limit));
+	TORRENT_ALLOCA(nodes, node_entry const*, count);
+	int const num = find_node(target, nodes, options);
 
-	table_t::iterator j = i;
+	l.reserve(aux::numeric_cast<std::size_t>(num));
+	for (int i = 0; i < num; ++i)
+		l.push_back(*nodes[i]);
+}
 
-	int unsorted_start_idx = 0;
-	for (; j != m_buckets.end() && int(l.size()) < count; ++j)
-	{
-		bucket_t const& b = j->live_nodes;
-		if (options & include_failed)
-		{
-			std::copy(b.begin(), b.end(), std::back_inserter(l));
-		}
-		else
-		{
-			std::remove_copy_if(b.begin(), b.end(), std::back_inserter(l)
-				, [](node_entry const& ne) { return !ne.confirmed(); });
-		}
+int routing_table::find_node(node_id const& target
+	, span<node_entry const*> const nodes, int const options) const
+{
+	int const count = int(nodes.size());
+	int const idx = bucket_index(target);
+	if (idx < 0 || count == 0) return 0;
 
-		if (int(l.size()) == count) return;
+	int num = 0;
 
-		if (int(l.size()) > count)
+	// adds the nodes from the bucket to the result. Returns true when the
+	// result is full. Once it's full, the nodes of this bucket compete for
+	// the remaining slots (the ones this bucket filled in) and the farthest
+	// one is replaced by any closer node
+	auto add_bucket = [&](bucket_t const& b)
+	{
+		int const start = num;
+		int farthest = -1;
+		node_id farthest_dist;
+		for (auto const& ne : b)
 		{
-			// sort the nodes by how close they are to the target
-			std::sort(l.begin() + unsorted_start_idx, l.end()
-				, [&target](node_entry const& lhs, node_entry const& rhs)
-				{ return compare_ref(lhs.id, rhs.id, target); });
-
-			l.resize(aux::numeric_cast<std::size_t>(count));
-			return;
-		}
-		unsorted_start_idx = int(l.size());
-	}
+			if (!(options & include_failed) && !ne.confirmed()) continue;
 
-	// if we still don't have enough nodes, copy nodes
-	// further away from us
+			if (num < count)
+			{
+				nodes[num++] = &ne;
+				continue;
+			}
 
-	if (i == m_buckets.begin())
-		return;
+			if (start == count) return true;
 
-	j = i;
+			if (farthest < 0)
+			{
+				farthest = start;
+				farthest_dist = nodes[start]->id ^ target;
+				for (int i = start + 1; i < count; ++i)
+				{
+					node_id const d = nodes[i]->id ^ target;
+					if (!(farthest_dist < d)) continue;
+					farthest = i;
+					farthest_dist = d;
+				}
+			}
 
-	unsorted_start_idx = int(l.size());
-	do
-	{
-		--j;
-		bucket_t const& b = j->live_nodes;
+			if (!((ne.id ^ target) < farthest_dist)) continue;
 
-		if (options & include_failed)
-		{
-			std::copy(b.begin(), b.end(), std::back_inserter(l));
-		}
-		else
-		{
-			std::remove_copy_if(b.begin(), b.end(), std::back_inserter(l)
-				, [](node_entry const& ne) { return !ne.confirmed(); });
+			nodes[farthest] = &ne;
+			farthest = -1;
 		}
+		return num == count;
+	};
 
-		if (int(l.size()) == count) return;
-
-		if (int(l.size()) > count)
-		{
-			// sort the nodes by how close they are to the target
-			std::sort(l.begin() + unsorted_start_idx, l.end()
-				, [&target](node_entry const& lhs, node_entry const& rhs)
-				{ return compare_ref(lhs.id, rhs.id, target); });
+	// first the bucket the target belongs in, then the buckets closer to us
+	// (whose nodes are at the same distance from the target)
+	for (int i = idx; i < int(m_buckets.size()); ++i)
+		if (add_bucket(m_buckets[i].live_nodes)) return num;
 
-			l.resize(aux::numeric_cast<std::size_t>(count));
-			return;
-		}
-		unsorted_start_idx = int(l.size());
-	}
-	while (j != m_buckets.begin() && int(l.size()) < count);
+	// if we still don't have enough nodes, use nodes further away from us
+	for (int i = idx - 1; i >= 0; --i)
+		if (add_bucket(m_buckets[i].live_nodes)) return num;
 
-	TORRENT_ASSERT(int(l.size()) <= count);
+	TORRENT_ASSERT(num <= count);
+	return num;
 }
 
 #if TORRENT_USE_INVARIANT_CHECKS
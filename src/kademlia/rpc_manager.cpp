@@ -375,31 +375,46 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 			, print_endpoint(m.addr).c_str());
 	}
 #endif
+	int const rtt = int(total_milliseconds(now - o->sent()));
+	m_rtt.add_sample(rtt);
+	o->set_rtt(rtt);
+
 	o->reply(m);
 	*id = nid;
 
-	int rtt = int(total_milliseconds(now - o->sent()));
-
 	// we found an observer for this reply, hence the node is not spoofing
 	// add it to the routing table
 	return m_table.node_seen(*id, m.addr, rtt);
 }
 
+time_duration rpc_manager::short_timeout() const
+{
+	// until we have enough samples to trust the average, stick to the
+	// conservative default
+	if (m_rtt.num_samples() < 8) return seconds(1);
+
+	// a response that's this much later than the typical one is most likely
+	// not coming. Don't go below 250 ms though, to not flood the network
+	// with requests when the round-trip times are short
+	int const ms = m_rtt.mean() + 4 * m_rtt.avg_deviation();
+	return milliseconds(std::max(250, std::min(1000, ms)));
+}
+
 time_duration rpc_manager::tick()
 {
 	INVARIANT_CHECK;
 
-	constexpr int short_timeout = 1;
+	time_duration const short_timeout = this->short_timeout();
 	constexpr int timeout = 15;
 
 	// look for observers that have timed out
 
-	if (m_transactions.empty()) return seconds(short_timeout);
+	if (m_transactions.empty()) return short_timeout;
 
 	std::vector<observer_ptr> timeouts;
 	std::vector<observer_ptr> short_timeouts;
 
-	time_duration ret = seconds(short_timeout);
+	time_duration ret = short_timeout;
 	time_point now = aux::time_now();
 
 	for (auto i = m_transactions.begin(); i != m_transactions.end();)
@@ -424,20 +439,26 @@ time_duration rpc_manager::tick()
 
 		// don't call short_timeout() again if we've
 		// already called it once
-		if (diff >= seconds(short_timeout) && !o->has_short_timeout())
+		if (!o->has_short_timeout())
 		{
-#ifndef TORRENT_DISABLE_LOGGING
-			if (m_log->should_log(dht_logger::rpc_manager))
+			if (diff >= short_timeout)
 			{
-				m_log->log(dht_logger::rpc_manager, "[%u] short-timing out transaction id: %d from: %s"
-					, o->algorithm()->id(), i->first
-					, print_endpoint(o->target_ep()).c_str());
-			}
+#ifndef TORRENT_DISABLE_LOGGING
+				if (m_log->should_log(dht_logger::rpc_manager))
+				{
+					m_log->log(dht_logger::rpc_manager, "[%u] short-timing out transaction id: %d from: %s"
+						, o->algorithm()->id(), i->first
+						, print_endpoint(o->target_ep()).c_str());
+				}
 #endif
-			++i;
+				++i;
 
-			short_timeouts.push_back(o);
-			continue;
+				short_timeouts.push_back(o);
+				continue;
+			}
+
+			// make sure we wake up in time to open up the slot
+			ret = std::min(short_timeout - diff, ret);
 		}
 
 		ret = std::min(seconds(timeout) - diff, ret);
@@ -447,7 +468,7 @@ time_duration rpc_manager::tick()
 	std::for_each(timeouts.begin(), timeouts.end(), std::bind(&observer::timeout, _1));
 	std::for_each(short_timeouts.begin(), short_timeouts.end(), std::bind(&observer::short_timeout, _1));
 
-	return (std::max)(ret, duration_cast<time_duration>(milliseconds(200)));
+	return (std::max)(ret, duration_cast<time_duration>(milliseconds(50)));
 }
 
 void rpc_manager::add_our_id(entry& e)
@@ -39,6 +39,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/socket_io.hpp> // for read_*_endpoint
 #include <libtorrent/alert_types.hpp> // for dht_lookup
 #include <libtorrent/aux_/time.hpp>
+#include <algorithm> // for find
+#include <vector>
 
 #ifndef TORRENT_DISABLE_LOGGING
 #include <libtorrent/hex.hpp> // to_hex
@@ -125,7 +127,7 @@ void traversal_algorithm::resort_result(observer* o)
 }
 
 void traversal_algorithm::add_entry(node_id const& id
-	, udp::endpoint const& addr, observer_flags_t const flags)
+	, udp::endpoint const& addr, observer_flags_t const flags, int const rtt)
 {
 	TORRENT_ASSERT(m_node.m_rpc.allocation_size() >= sizeof(find_data_observer));
 	auto o = new_observer(addr, id);
@@ -143,6 +145,7 @@ void traversal_algorithm::add_entry(node_id const& id
 	}
 
 	o->flags |= flags;
+	o->set_rtt(rtt);
 
 	if (id.is_all_zeros())
 	{
@@ -323,6 +326,7 @@ void traversal_algorithm::finished(observer_ptr o)
 	++m_responses;
 	TORRENT_ASSERT(m_invoke_count > 0);
 	--m_invoke_count;
+	update_stable_count();
 	bool const is_done = add_requests();
 	if (is_done) done();
 }
@@ -475,6 +479,11 @@ bool traversal_algorithm::add_requests()
 	// we just keep any branch-factor outstanding requests
 	bool const agg = m_node.settings().aggressive_lookups;
 
+	// nodes picked ahead of the cursor by pick_candidate() in this call.
+	// They are counted as outstanding when invoked, and must not be counted
+	// again once the cursor reaches them
+	std::vector<observer const*> picked_ahead;
+
 	// Find the first node that hasn't already been queried.
 	// and make sure that the 'm_branch_factor' top nodes
 	// stay queried at all times (obviously ignoring failed nodes)
@@ -487,26 +496,35 @@ bool traversal_algorithm::add_requests()
 		, end(m_results.end()); i != end
 		&& results_target > 0
 		&& (agg ? outstanding < m_branch_factor
-			: m_invoke_count < m_branch_factor);
-		++i)
+			: m_invoke_count < m_branch_factor);)
 	{
-		observer* o = i->get();
-		if (o->flags & observer::flag_alive)
+		if ((*i)->flags & observer::flag_alive)
 		{
-			TORRENT_ASSERT(o->flags & observer::flag_queried);
+			TORRENT_ASSERT((*i)->flags & observer::flag_queried);
 			--results_target;
+			++i;
 			continue;
 		}
-		if (o->flags & observer::flag_queried)
+		if ((*i)->flags & observer::flag_queried)
 		{
 			// if it's queried, not alive and not failed, it
 			// must be currently in flight
-			if (!(o->flags & observer::flag_failed))
+			if (!((*i)->flags & observer::flag_failed)
+				&& std::find(picked_ahead.begin(), picked_ahead.end(), i->get())
+					== picked_ahead.end())
 				++outstanding;
 
+			++i;
 			continue;
 		}
 
+		// if we pick a node further down the list, i is still unqueried and
+		// will be considered again in the next iteration
+		auto const c = pick_candidate(i, end);
+		bool const ahead = c != i;
+		if (!ahead) ++i;
+		observer* o = c->get();
+
 #ifndef TORRENT_DISABLE_LOGGING
 		dht_observer* logger = get_node().observer();
 		if (logger != nullptr && logger->should_log(dht_logger::traversal))
@@ -514,19 +532,21 @@ bool traversal_algorithm::add_requests()
 			logger->log(dht_logger::traversal
 				, "[%u] INVOKE nodes-left: %d top-invoke-count: %d "
 				"invoke-count: %d branch-factor: %d "
-				"distance: %d id: %s addr: %s type: %s"
-				, m_id, int(m_results.end() - i), outstanding, int(m_invoke_count)
-				, int(m_branch_factor), distance_exp(m_target, o->id()), aux::to_hex(o->id()).c_str()
+				"distance: %d rtt: %d id: %s addr: %s type: %s"
+				, m_id, int(m_results.end() - c), outstanding, int(m_invoke_count)
+				, int(m_branch_factor), distance_exp(m_target, o->id()), o->rtt()
+				, aux::to_hex(o->id()).c_str()
 				, print_address(o->target_addr()).c_str(), name());
 		}
 #endif
 
 		o->flags |= observer::flag_queried;
-		if (invoke(*i))
+		if (invoke(*c))
 		{
 			TORRENT_ASSERT(m_invoke_count < (std::numeric_limits<std::int8_t>::max)());
 			++m_invoke_count;
 			++outstanding;
+			if (ahead) picked_ahead.push_back(o);
 		}
 		else
 		{
@@ -539,7 +559,69 @@ bool traversal_algorithm::add_requests()
 	// outstanding requests, we're done.
 	// also, if invoke count is 0, it means we didn't even find 'k'
 	// working nodes, we still have to terminate though.
-	return (results_target == 0 && outstanding == 0) || m_invoke_count == 0;
+	// If the k closest nodes have stayed the same over the last
+	// branch-factor responses, the lookup has converged and we don't wait
+	// for the remaining (slow) outstanding requests at the top.
+	return (results_target == 0
+			&& (outstanding == 0 || m_stable_responses >= m_branch_factor))
+		|| m_invoke_count == 0;
+}
+
+std::vector<observer_ptr>::iterator traversal_algorithm::pick_candidate(
+	std::vector<observer_ptr>::iterator const i
+	, std::vector<observer_ptr>::iterator const end) const
+{
+	// don't look further than this many entries ahead. Beyond this we're
+	// unlikely to still be at the same distance from the target
+	constexpr int lookahead = 8;
+
+	TORRENT_ASSERT(i != end);
+	observer const* o = i->get();
+
+	// we can only compare distances of nodes whose ID we know, and that
+	// are in the sorted part of the results
+	int const pos = int(i - m_results.begin());
+	if ((o->flags & observer::flag_no_id)
+		|| pos >= m_sorted_results
+		|| o->rtt() == 0)
+		return i;
+
+	int const dist = distance_exp(m_target, o->id());
+	auto best = i;
+	auto const last = i + std::min({lookahead, int(end - i), m_sorted_results - pos});
+	for (auto j = std::next(i); j != last; ++j)
+	{
+		observer const* c = j->get();
+		if (distance_exp(m_target, c->id()) != dist) break;
+		if (c->flags & (observer::flag_queried | observer::flag_no_id)) continue;
+		if (c->rtt() < (*best)->rtt()) best = j;
+	}
+	return best;
+}
+
+void traversal_algorithm::update_stable_count()
+{
+	int results_target = m_node.m_table.bucket_size();
+	for (auto const& o : m_results)
+	{
+		if (!(o->flags & observer::flag_alive)) continue;
+		if (--results_target > 0) continue;
+
+		if (o->id() == m_kth_closest)
+		{
+			if (m_stable_responses < std::numeric_limits<std::int8_t>::max())
+				++m_stable_responses;
+		}
+		else
+		{
+			m_kth_closest = o->id();
+			m_stable_responses = 0;
+		}
+		return;
+	}
+
+	// we don't have k live nodes yet
+	m_stable_responses = 0;
 }
 
 void traversal_algorithm::add_router_entries()
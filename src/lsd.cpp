@@ -217,12 +217,12 @@ void lsd::on_announce(udp::endpoint const& from, char const* buf
 	if (p.method() != "bt-search")
 	{
 #ifndef TORRENT_DISABLE_LOGGING
-		debug_log("<== LSD: invalid HTTP method: %s", p.method().c_str());
+		debug_log("<== LSD: invalid HTTP method: %s", p.method().to_string().c_str());
 #endif
 		return;
 	}
 
-	std::string const& port_str = p.header("port");
+	std::string const port_str = p.header("port").to_string();
 	if (port_str.empty())
 	{
 #ifndef TORRENT_DISABLE_LOGGING
@@ -240,14 +240,12 @@ void lsd::on_announce(udp::endpoint const& from, char const* buf
 		return;
 	}
 
-	auto const& headers = p.headers();
-
-	auto const cookie_iter = headers.find("cookie");
-	if (cookie_iter != headers.end())
+	string_view const cookie_str = p.header("cookie");
+	if (!cookie_str.empty())
 	{
 		// we expect it to be hexadecimal
 		// if it isn't, it's not our cookie anyway
-		long const cookie = std::strtol(cookie_iter->second.c_str(), nullptr, 16);
+		long const cookie = std::strtol(cookie_str.to_string().c_str(), nullptr, 16);
 		if (cookie == m_cookie)
 		{
 #ifndef TORRENT_DISABLE_LOGGING
@@ -258,15 +256,15 @@ void lsd::on_announce(udp::endpoint const& from, char const* buf
 		}
 	}
 
-	auto const ihs = headers.equal_range("infohash");
-	for (auto i = ihs.first; i != ihs.second; ++i)
+	for (auto const& h : p.headers())
 	{
-		std::string const& ih_str = i->second;
+		if (h.first != "infohash") continue;
+		string_view const ih_str = h.second;
 		if (ih_str.size() != 40)
 		{
 #ifndef TORRENT_DISABLE_LOGGING
 			debug_log("<== LSD: invalid BT-SEARCH, invalid infohash: %s"
-				, ih_str.c_str());
+				, ih_str.to_string().c_str());
 #endif
 			continue;
 		}
@@ -281,7 +279,7 @@ void lsd::on_announce(udp::endpoint const& from, char const* buf
 			{
 				debug_log("<== LSD: %s:%d ih: %s"
 					, print_address(from.address()).c_str()
-					, int(port), ih_str.c_str());
+					, int(port), ih_str.to_string().c_str());
 			}
 #endif
 			// we got an announce, pass it on through the callback
@@ -68,13 +68,22 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/path.hpp"
 
 #include <functional> // for std::function
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 namespace {
 
+	// the header is written in pages of this size
+	int const header_page_size = 1024;
+
 	// round up to even kilobyte
 	int round_up(int n)
-	{ return (n + 1023) & ~0x3ff; }
+	{ return (n + header_page_size - 1) & ~(header_page_size - 1); }
+
+	// when exporting, pieces stored in consecutive slots are read in batches
+	// of up to this many bytes
+	int const export_batch_size = 4 * 1024 * 1024;
 }
 
 namespace libtorrent {
@@ -86,6 +95,8 @@ namespace libtorrent {
 		, m_max_pieces(num_pieces)
 		, m_piece_size(piece_size)
 		, m_header_size(round_up((2 + num_pieces) * 4))
+		, m_dirty_pages(std::size_t(m_header_size / header_page_size), true)
+		, m_piece_map(std::size_t(num_pieces), slot_index_t(-1))
 	{
 		TORRENT_ASSERT(num_pieces > 0);
 		TORRENT_ASSERT(m_piece_size > 0);
@@ -114,10 +125,9 @@ namespace libtorrent {
 		// consider the file empty and overwrite anything in there
 		if (num_pieces != num_pieces_ || m_piece_size != piece_size_) return;
 
-		// this is used to determine which slots are free, and how many
-		// slots are allocated
-		aux::vector<bool, slot_index_t> free_slots;
-		free_slots.resize(num_pieces, true);
+		// the header on disk is valid, from now on we only need to write the
+		// parts of it that change
+		std::fill(m_dirty_pages.begin(), m_dirty_pages.end(), false);
 
 		for (piece_index_t i = piece_index_t(0); i < piece_index_t(num_pieces); ++i)
 		{
@@ -126,19 +136,26 @@ namespace libtorrent {
 
 			// invalid part-file
 			TORRENT_ASSERT(slot < slot_index_t(num_pieces));
-			if (slot >= slot_index_t(num_pieces)) continue;
+			if (slot >= slot_index_t(num_pieces)
+				|| (slot < m_slots.end_index() && m_slots[slot].piece != piece_index_t(-1)))
+			{
+				// drop the entry, and make sure it's cleared on disk too
+				mark_dirty(i);
+				continue;
+			}
 
-			if (slot >= m_num_allocated)
-				m_num_allocated = next(slot);
+			if (slot >= m_slots.end_index())
+				m_slots.resize(static_cast<int>(slot) + 1);
 
-			free_slots[slot] = false;
+			m_slots[slot].piece = i;
 			m_piece_map[i] = slot;
+			++m_num_pieces;
 		}
 
 		// now, populate the free_list with the "holes"
-		for (slot_index_t i(0); i < m_num_allocated; ++i)
+		for (slot_index_t i(0); i < m_slots.end_index(); ++i)
 		{
-			if (free_slots[i]) m_free_slots.push_back(i);
+			if (m_slots[i].piece == piece_index_t(-1)) m_free_slots.insert(i);
 		}
 
 		m_file.close();
@@ -150,28 +167,96 @@ namespace libtorrent {
 		flush_metadata_impl(ec);
 	}
 
+	void part_file::mark_dirty(piece_index_t const piece)
+	{
+		// the mutex is assumed to be held here, since this is a private function
+		int const page = (8 + static_cast<int>(piece) * 4) / header_page_size;
+		m_dirty_pages[std::size_t(page)] = true;
+		m_dirty_metadata = true;
+	}
+
 	slot_index_t part_file::allocate_slot(piece_index_t const piece)
 	{
 		// the mutex is assumed to be held here, since this is a private function
 
-		TORRENT_ASSERT(m_piece_map.find(piece) == m_piece_map.end());
+		TORRENT_ASSERT(m_piece_map[piece] == slot_index_t(-1));
 		slot_index_t slot(-1);
-		if (!m_free_slots.empty())
+
+		// try to put the piece right after the previous one, or right before
+		// the next one. Runs of pieces stored in consecutive slots can be
+		// exported with a single read
+		if (piece > piece_index_t(0))
+		{
+			slot_index_t const p = m_piece_map[prev(piece)];
+			if (p >= slot_index_t(0))
+			{
+				slot_index_t const candidate = next(p);
+				if (candidate == m_slots.end_index())
+				{
+					m_slots.emplace_back();
+					slot = candidate;
+				}
+				else if (m_free_slots.erase(candidate) > 0)
+				{
+					slot = candidate;
+				}
+			}
+		}
+
+		if (slot < slot_index_t(0) && next(piece) < m_piece_map.end_index())
 		{
-			slot = m_free_slots.front();
+			slot_index_t const n = m_piece_map[next(piece)];
+			if (n > slot_index_t(0) && m_free_slots.erase(prev(n)) > 0)
+				slot = prev(n);
+		}
+
+		if (slot < slot_index_t(0) && !m_free_slots.empty())
+		{
+			slot = *m_free_slots.begin();
 			m_free_slots.erase(m_free_slots.begin());
 		}
-		else
+
+		if (slot < slot_index_t(0))
 		{
-			slot = m_num_allocated;
-			++m_num_allocated;
+			slot = m_slots.end_index();
+			m_slots.emplace_back();
 		}
 
+		TORRENT_ASSERT(m_slots[slot].piece == piece_index_t(-1));
+		m_slots[slot].piece = piece;
 		m_piece_map[piece] = slot;
-		m_dirty_metadata = true;
+		++m_num_pieces;
+		mark_dirty(piece);
 		return slot;
 	}
 
+	void part_file::unmap_piece(piece_index_t const piece)
+	{
+		// the mutex is assumed to be held here, since this is a private function
+		slot_index_t const slot = m_piece_map[piece];
+		TORRENT_ASSERT(slot >= slot_index_t(0));
+		TORRENT_ASSERT(m_slots[slot].piece == piece);
+
+		m_slots[slot].piece = piece_index_t(-1);
+		m_piece_map[piece] = slot_index_t(-1);
+		--m_num_pieces;
+		mark_dirty(piece);
+
+		// if someone is still reading or writing this slot, it's returned to
+		// the free list once they're done. Handing it out now could have a
+		// write to the old piece overwrite the new one
+		if (m_slots[slot].refs == 0) m_free_slots.insert(slot);
+	}
+
+	void part_file::unpin_slot(slot_index_t const slot)
+	{
+		// the mutex is assumed to be held here, since this is a private function
+		TORRENT_ASSERT(m_slots[slot].refs > 0);
+		if (--m_slots[slot].refs == 0
+			&& m_slots[slot].piece == piece_index_t(-1))
+			m_free_slots.insert(slot);
+	}
+
 	int part_file::writev(span<iovec_t const> bufs, piece_index_t const piece
 		, int const offset, error_code& ec)
 	{
@@ -181,14 +266,17 @@ namespace libtorrent {
 		open_file(open_mode::read_write, ec);
 		if (ec) return -1;
 
-		auto const i = m_piece_map.find(piece);
-		slot_index_t const slot = (i == m_piece_map.end())
-			? allocate_slot(piece) : i->second;
+		slot_index_t slot = m_piece_map[piece];
+		if (slot < slot_index_t(0)) slot = allocate_slot(piece);
+		++m_slots[slot].refs;
 
 		l.unlock();
 
-		std::int64_t slot_offset = std::int64_t(m_header_size) + std::int64_t(static_cast<int>(slot)) * m_piece_size;
-		return int(m_file.writev(slot_offset + offset, bufs, ec));
+		int const ret = int(m_file.writev(slot_offset(slot) + offset, bufs, ec));
+
+		l.lock();
+		unpin_slot(slot);
+		return ret;
 	}
 
 	int part_file::readv(span<iovec_t const> bufs
@@ -197,22 +285,25 @@ namespace libtorrent {
 		TORRENT_ASSERT(offset >= 0);
 		std::unique_lock<std::mutex> l(m_mutex);
 
-		auto const i = m_piece_map.find(piece);
-		if (i == m_piece_map.end())
+		slot_index_t const slot = m_piece_map[piece];
+		if (slot < slot_index_t(0))
 		{
 			ec = error_code(boost::system::errc::no_such_file_or_directory
 				, boost::system::generic_category());
 			return -1;
 		}
 
-		slot_index_t const slot = i->second;
 		open_file(open_mode::read_write, ec);
 		if (ec) return -1;
 
+		++m_slots[slot].refs;
 		l.unlock();
 
-		std::int64_t slot_offset = std::int64_t(m_header_size) + std::int64_t(static_cast<int>(slot)) * m_piece_size;
-		return int(m_file.readv(slot_offset + offset, bufs, ec));
+		int const ret = int(m_file.readv(slot_offset(slot) + offset, bufs, ec));
+
+		l.lock();
+		unpin_slot(slot);
+		return ret;
 	}
 
 	void part_file::open_file(open_mode_t const mode, error_code& ec)
@@ -240,17 +331,8 @@ namespace libtorrent {
 	{
 		std::lock_guard<std::mutex> l(m_mutex);
 
-		auto const i = m_piece_map.find(piece);
-		if (i == m_piece_map.end()) return;
-
-		// TODO: what do we do if someone is currently reading from the disk
-		// from this piece? does it matter? Since we won't actively erase the
-		// data from disk, but it may be overwritten soon, it's probably not that
-		// big of a deal
-
-		m_free_slots.push_back(i->second);
-		m_piece_map.erase(i);
-		m_dirty_metadata = true;
+		if (m_piece_map[piece] < slot_index_t(0)) return;
+		unmap_piece(piece);
 	}
 
 	void part_file::move_partfile(std::string const& path, error_code& ec)
@@ -262,7 +344,7 @@ namespace libtorrent {
 
 		m_file.close();
 
-		if (!m_piece_map.empty())
+		if (m_num_pieces > 0)
 		{
 			std::string old_path = combine_path(m_path, m_name);
 			std::string new_path = combine_path(path, m_name);
@@ -289,61 +371,96 @@ namespace libtorrent {
 		piece_index_t piece(int(offset / m_piece_size));
 		piece_index_t const end = piece_index_t(int(((offset + size) + m_piece_size - 1) / m_piece_size));
 
-		std::unique_ptr<char[]> buf;
+		std::vector<char> buf;
 
 		std::int64_t piece_offset = offset - std::int64_t(static_cast<int>(piece))
 			* m_piece_size;
 		std::int64_t file_offset = 0;
-		for (; piece < end; ++piece)
+		int const max_batch = std::max(1, export_batch_size / m_piece_size);
+		while (piece < end)
 		{
-			auto const i = m_piece_map.find(piece);
-			int const block_to_copy = int(std::min(m_piece_size - piece_offset, size));
-			if (i != m_piece_map.end())
+			slot_index_t const slot = m_piece_map[piece];
+			if (slot < slot_index_t(0))
 			{
-				slot_index_t const slot = i->second;
-				open_file(open_mode::read_only, ec);
-				if (ec) return;
-
-				if (!buf) buf.reset(new char[m_piece_size]);
+				int const block_to_copy = int(std::min(m_piece_size - piece_offset, size));
+				file_offset += block_to_copy;
+				piece_offset = 0;
+				size -= block_to_copy;
+				++piece;
+				continue;
+			}
 
-				std::int64_t const slot_offset = std::int64_t(m_header_size)
-					+ std::int64_t(static_cast<int>(slot)) * m_piece_size;
+			open_file(open_mode::read_only, ec);
+			if (ec) return;
 
-				// don't hold the lock during disk I/O
-				l.unlock();
+			// pieces stored in consecutive slots are laid out back-to-back in
+			// the file, and can be read in one go
+			int run = 1;
+			slot_index_t last_slot = slot;
+			for (piece_index_t p = next(piece); run < max_batch && p < end
+				&& m_piece_map[p] == next(last_slot); ++p)
+			{
+				++last_slot;
+				++run;
+			}
 
-				iovec_t v = {buf.get(), std::size_t(block_to_copy)};
-				auto bytes_read = std::size_t(m_file.readv(slot_offset + piece_offset, v, ec));
-				v = v.first(bytes_read);
-				TORRENT_ASSERT(!ec);
-				if (ec || v.size() == 0) return;
+			std::int64_t const run_size = std::min(
+				std::int64_t(run) * m_piece_size - piece_offset, size);
+			for (slot_index_t s = slot; s <= last_slot; ++s) ++m_slots[s].refs;
 
-				f(file_offset, {buf.get(), std::size_t(block_to_copy)});
+			// don't hold the lock during disk I/O
+			l.unlock();
 
-				// we're done with the disk I/O, grab the lock again to update
-				// the slot map
+			buf.resize(std::size_t(run_size));
+			iovec_t v = {buf.data(), buf.size()};
+			auto const bytes_read = std::size_t(m_file.readv(slot_offset(slot) + piece_offset, v, ec));
+			TORRENT_ASSERT(!ec);
+			if (ec || bytes_read == 0)
+			{
 				l.lock();
+				for (slot_index_t s = slot; s <= last_slot; ++s) unpin_slot(s);
+				return;
+			}
+			if (bytes_read < buf.size())
+				std::memset(buf.data() + bytes_read, 0, buf.size() - bytes_read);
 
-				if (block_to_copy == m_piece_size)
-				{
-					// since we released the lock, it's technically possible that
-					// another thread removed this slot map entry, and invalidated
-					// our iterator. Now that we hold the lock again, perform
-					// another lookup to be sure.
-					auto const j = m_piece_map.find(piece);
-					if (j != m_piece_map.end())
-					{
-						// if the slot moved, that's really suspicious
-						TORRENT_ASSERT(j->second == slot);
-						m_free_slots.push_back(j->second);
-						m_piece_map.erase(j);
-						m_dirty_metadata = true;
-					}
-				}
+			std::int64_t const run_start = piece_offset;
+			std::int64_t buf_offset = 0;
+			for (int i = 0; i < run; ++i)
+			{
+				int const block_to_copy = int(std::min(m_piece_size - piece_offset, size));
+				f(file_offset, {buf.data() + buf_offset, std::size_t(block_to_copy)});
+				buf_offset += block_to_copy;
+				file_offset += block_to_copy;
+				piece_offset = 0;
+				size -= block_to_copy;
+			}
+
+			// we're done with the disk I/O, grab the lock again to update
+			// the slot map
+			l.lock();
+
+			buf_offset = -run_start;
+			for (slot_index_t s = slot; s <= last_slot; ++s, ++piece)
+			{
+				unpin_slot(s);
+
+				// pieces that were exported in full are no longer needed in the
+				// part file
+				std::int64_t const piece_end = buf_offset + m_piece_size;
+				bool const whole_piece = buf_offset >= 0 && piece_end <= run_size;
+				buf_offset = piece_end;
+				if (!whole_piece) continue;
+
+				// since we released the lock, it's technically possible that
+				// another thread removed this slot map entry. Now that we hold
+				// the lock again, check to be sure.
+				if (m_piece_map[piece] < slot_index_t(0)) continue;
+
+				// if the slot moved, that's really suspicious
+				TORRENT_ASSERT(m_piece_map[piece] == s);
+				unmap_piece(piece);
 			}
-			file_offset += block_to_copy;
-			piece_offset = 0;
-			size -= block_to_copy;
 		}
 	}
 
@@ -354,15 +471,19 @@ namespace libtorrent {
 		flush_metadata_impl(ec);
 	}
 
-	// TODO: instead of rebuilding the whole file header
-	// and flushing it, update the slot entries as we go
 	void part_file::flush_metadata_impl(error_code& ec)
 	{
 		// do we need to flush the metadata?
 		if (m_dirty_metadata == false) return;
 
-		if (m_piece_map.empty())
+		if (m_num_pieces == 0)
 		{
+			// we can't remove the file while someone is still reading or
+			// writing it
+			if (std::any_of(m_slots.begin(), m_slots.end()
+				, [](slot_entry const& s) { return s.refs > 0; }))
+				return;
+
 			m_file.close();
 
 			// if we don't have any pieces left in the
@@ -372,29 +493,62 @@ namespace libtorrent {
 
 			if (ec == boost::system::errc::no_such_file_or_directory)
 				ec.clear();
+			if (ec) return;
+
+			// the next time we create the file, we start from the first slot
+			// and need to write the whole header
+			m_slots.clear();
+			m_free_slots.clear();
+			std::fill(m_dirty_pages.begin(), m_dirty_pages.end(), true);
+			m_dirty_metadata = false;
 			return;
 		}
 
 		open_file(open_mode::read_write, ec);
 		if (ec) return;
 
-		std::vector<char> header(static_cast<std::size_t>(m_header_size));
-
 		using namespace libtorrent::detail;
 
-		char* ptr = header.data();
-		write_uint32(m_max_pieces, ptr);
-		write_uint32(m_piece_size, ptr);
-
-		for (piece_index_t piece(0); piece < piece_index_t(m_max_pieces); ++piece)
+		// write each run of dirty header pages with a single write. Entries
+		// are 4 bytes and pages are aligned to 4 bytes, so no entry straddles
+		// two pages
+		std::vector<char> header;
+		int const num_pages = int(m_dirty_pages.size());
+		for (int page = 0; page < num_pages;)
 		{
-			auto const i = m_piece_map.find(piece);
-			slot_index_t const slot(i == m_piece_map.end()
-				? slot_index_t(-1) : i->second);
-			write_int32(static_cast<int>(slot), ptr);
+			if (!m_dirty_pages[std::size_t(page)])
+			{
+				++page;
+				continue;
+			}
+
+			int const first_page = page;
+			while (page < num_pages && m_dirty_pages[std::size_t(page)]) ++page;
+
+			int const begin = first_page * header_page_size;
+			int const end = page * header_page_size;
+			header.assign(std::size_t(end - begin), 0);
+
+			char* ptr = header.data();
+			if (begin == 0)
+			{
+				write_uint32(m_max_pieces, ptr);
+				write_uint32(m_piece_size, ptr);
+			}
+
+			piece_index_t const first_piece(std::max(0, (begin - 8) / 4));
+			piece_index_t const last_piece(std::min(m_max_pieces, (end - 8) / 4));
+			TORRENT_ASSERT(ptr == header.data() + 8 + static_cast<int>(first_piece) * 4 - begin);
+			for (piece_index_t i = first_piece; i < last_piece; ++i)
+				write_int32(static_cast<int>(m_piece_map[i]), ptr);
+
+			iovec_t b = header;
+			m_file.writev(begin, b, ec);
+			if (ec) return;
+
+			std::fill(m_dirty_pages.begin() + first_page
+				, m_dirty_pages.begin() + page, false);
 		}
-		std::memset(ptr, 0, std::size_t(m_header_size - (ptr - header.data())));
-		iovec_t b = header;
-		m_file.writev(0, b, ec);
+		m_dirty_metadata = false;
 	}
 }
@@ -217,6 +217,7 @@ namespace libtorrent {
 		s->ctime = file_time_to_posix(data.ftCreationTime);
 		s->atime = file_time_to_posix(data.ftLastAccessTime);
 		s->mtime = file_time_to_posix(data.ftLastWriteTime);
+		s->inode = (std::uint64_t(data.nFileIndexHigh) << 32) | data.nFileIndexLow;
 
 		s->mode = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
 			? file_status::directory
@@ -243,6 +244,7 @@ namespace libtorrent {
 		s->atime = std::uint64_t(ret.st_atime);
 		s->mtime = std::uint64_t(ret.st_mtime);
 		s->ctime = std::uint64_t(ret.st_ctime);
+		s->inode = std::uint64_t(ret.st_ino);
 
 		s->mode = (S_ISREG(ret.st_mode) ? file_status::regular_file : 0)
 			| (S_ISDIR(ret.st_mode) ? file_status::directory : 0)
@@ -345,6 +345,57 @@ namespace libtorrent {
 		return std::make_tuple(0, bytes_processed, 0);
 	}
 
+	constexpr int chacha20_handler::key_size;
+
+	chacha20_handler::chacha20_handler()
+		: m_encrypt(false)
+		, m_decrypt(false)
+	{}
+
+	void chacha20_handler::set_incoming_key(span<char const> key)
+	{
+		TORRENT_ASSERT(key.size() == key_size);
+		m_decrypt = true;
+		m_incoming.set_key(key.first(aux::chacha20::key_size)
+			, key.subspan(aux::chacha20::key_size));
+	}
+
+	void chacha20_handler::set_outgoing_key(span<char const> key)
+	{
+		TORRENT_ASSERT(key.size() == key_size);
+		m_encrypt = true;
+		m_outgoing.set_key(key.first(aux::chacha20::key_size)
+			, key.subspan(aux::chacha20::key_size));
+	}
+
+	std::tuple<int, span<span<char const>>>
+	chacha20_handler::encrypt(span<span<char>> bufs)
+	{
+		span<span<char const>> empty;
+		if (!m_encrypt) return std::make_tuple(0, empty);
+
+		int bytes_processed = 0;
+		for (auto& buf : bufs)
+		{
+			bytes_processed += int(buf.size());
+			m_outgoing.crypt(buf);
+		}
+		return std::make_tuple(bytes_processed, empty);
+	}
+
+	std::tuple<int, int, int> chacha20_handler::decrypt(span<span<char>> bufs)
+	{
+		if (!m_decrypt) return std::make_tuple(0, 0, 0);
+
+		int bytes_processed = 0;
+		for (auto& buf : bufs)
+		{
+			bytes_processed += int(buf.size());
+			m_incoming.crypt(buf);
+		}
+		return std::make_tuple(0, bytes_processed, 0);
+	}
+
 // All this code is based on libTomCrypt (http://www.libtomcrypt.com/)
 // this library is public domain and has been specially
 // tailored for libtorrent by Arvid Norberg
@@ -386,28 +437,77 @@ void rc4_init(const unsigned char* in, std::size_t len, rc4 *state)
 	state->y = 0;
 }
 
-std::size_t rc4_encrypt(unsigned char *out, std::size_t outlen, rc4 *state)
+namespace {
+
+// generates the key stream in words of 8 bytes. ``S`` is the type of the
+// state array, either the state itself or a copy widened to 32 bit words
+template <typename S>
+void rc4_crypt(unsigned char* out, std::size_t len, S* s
+	, std::uint32_t& x, std::uint32_t& y)
 {
-	std::uint8_t x, y, *s, tmp;
-	std::size_t n;
+	while (len >= 8)
+	{
+		std::uint8_t stream[8];
+		for (int i = 0; i < 8; ++i)
+		{
+			x = (x + 1) & 0xff;
+			std::uint32_t const sx = s[x];
+			y = (y + sx) & 0xff;
+			std::uint32_t const sy = s[y];
+			s[x] = S(sy);
+			s[y] = S(sx);
+			stream[i] = std::uint8_t(s[(sx + sy) & 0xff]);
+		}
+		std::uint64_t v;
+		std::uint64_t k;
+		std::memcpy(&v, out, 8);
+		std::memcpy(&k, stream, 8);
+		v ^= k;
+		std::memcpy(out, &v, 8);
+		out += 8;
+		len -= 8;
+	}
+	while (len--)
+	{
+		x = (x + 1) & 0xff;
+		std::uint32_t const sx = s[x];
+		y = (y + sx) & 0xff;
+		std::uint32_t const sy = s[y];
+		s[x] = S(sy);
+		s[y] = S(sx);
+		*out++ ^= std::uint8_t(s[(sx + sy) & 0xff]);
+	}
+}
+
+}
 
+std::size_t rc4_encrypt(unsigned char *out, std::size_t outlen, rc4 *state)
+{
 	TORRENT_ASSERT(out != nullptr);
 	TORRENT_ASSERT(state != nullptr);
 
-	n = outlen;
-	x = state->x & 0xff;
-	y = state->y & 0xff;
-	s = state->buf.data();
-	while (outlen--) {
-		x = (x + 1) & 255;
-		y = (y + s[x]) & 255;
-		tmp = s[x]; s[x] = s[y]; s[y] = tmp;
-		tmp = (s[x] + s[y]) & 255;
-		*out++ ^= s[tmp];
+	std::uint32_t x = std::uint32_t(state->x) & 0xff;
+	std::uint32_t y = std::uint32_t(state->y) & 0xff;
+
+	// operating on bytes makes every swap a pair of partial word stores that
+	// the next iteration likely reads back, which is a lot slower than
+	// working on full words. For larger buffers it pays off to widen the
+	// state for the duration of the call
+	if (outlen >= 1024)
+	{
+		std::uint32_t s[256];
+		std::copy(state->buf.begin(), state->buf.end(), s);
+		rc4_crypt(out, outlen, s, x, y);
+		std::copy(s, s + 256, state->buf.begin());
 	}
-	state->x = x;
-	state->y = y;
-	return n;
+	else
+	{
+		rc4_crypt(out, outlen, state->buf.data(), x, y);
+	}
+
+	state->x = int(x);
+	state->y = int(y);
+	return outlen;
 }
 
 } // namespace libtorrent
@@ -4636,6 +4636,19 @@ namespace libtorrent {
 			m_desired_queue_size = std::uint16_t(queue_time * download_rate / block_size);
 		}
 
+		// connections that merge contiguous blocks into large requests (i.e.
+		// web seeds) need room for more than one such request in the queue.
+		// Otherwise the next request isn't sent until the current one has been
+		// received in full, leaving the connection idle for a round-trip
+		// between every request
+		if (m_request_large_blocks && m_prefer_contiguous_blocks > 0)
+		{
+			int const pipelined = std::min(m_prefer_contiguous_blocks + 1
+				, m_max_out_request_queue);
+			if (m_desired_queue_size < pipelined)
+				m_desired_queue_size = std::uint16_t(pipelined);
+		}
+
 		if (m_desired_queue_size > m_max_out_request_queue)
 			m_desired_queue_size = std::uint16_t(m_max_out_request_queue);
 		if (m_desired_queue_size < min_request_queue)
@@ -5284,6 +5297,11 @@ namespace libtorrent {
 					, t->resolve_filename(error.file())
 					, error.operation, t->get_handle());
 
+			// if the file changed since the resume data was saved, the torrent
+			// checks its pieces again
+			t->handle_file_changed(error);
+			if (is_disconnecting()) return;
+
 			++m_disk_read_failures;
 			if (m_disk_read_failures > 100) disconnect(error.ec, operation_t::file_read);
 			return;
@@ -5481,10 +5499,11 @@ namespace libtorrent {
 
 		if (m_send_barrier == 0)
 		{
-			std::vector<span<char>> vec;
+			std::array<span<char>, chained_buffer::max_iovec> storage;
 			// limit outgoing crypto messages to 1MB
 			int const send_bytes = std::min(m_send_buffer.size(), 1024 * 1024);
-			m_send_buffer.build_mutable_iovec(send_bytes, vec);
+			span<span<char>> const vec = m_send_buffer.build_mutable_iovec(
+				send_bytes, storage);
 			int next_barrier;
 			span<span<char const>> inject_vec;
 			std::tie(next_barrier, inject_vec) = hit_send_barrier(vec);
@@ -5589,7 +5608,7 @@ namespace libtorrent {
 #ifndef TORRENT_DISABLE_LOGGING
 		peer_log(peer_log_alert::outgoing, "ASYNC_WRITE", "bytes: %d", amount_to_send);
 #endif
-		std::vector<boost::asio::const_buffer> const& vec = m_send_buffer.build_iovec(amount_to_send);
+		chained_buffer::iovec_t const vec = m_send_buffer.build_iovec(amount_to_send);
 		ADD_OUTSTANDING_ASYNC("peer_connection::on_send_data");
 
 #if TORRENT_USE_ASSERTS
@@ -58,6 +58,7 @@ namespace libtorrent {
 	constexpr peer_flags_t peer_info::ssl_socket;
 	constexpr peer_flags_t peer_info::rc4_encrypted;
 	constexpr peer_flags_t peer_info::plaintext_encrypted;
+	constexpr peer_flags_t peer_info::chacha20_encrypted;
 
 	constexpr peer_source_flags_t peer_info::tracker;
 	constexpr peer_source_flags_t peer_info::dht;
@@ -110,6 +110,208 @@ namespace {
 	};
 #endif
 
+	// peers with a higher score are better candidates for being erased from
+	// the peer list. Primarily, prefer getting rid of peers we've already
+	// tried and failed, then peers whose only source is resume data, then
+	// peers we can't connect to and last peers that have sent us corrupt
+	// data. This works on both torrent_peer and cold peers
+	template <typename Peer>
+	std::uint32_t erase_score(Peer const& p)
+	{
+		return (std::uint32_t(p.failcount) << 6)
+			| (std::uint32_t(peer_source_flags_t(p.source) == peer_info::resume_data) << 5)
+			| (std::uint32_t(!p.connectable) << 4)
+			| std::uint32_t(8 - p.trust_points);
+	}
+
+	std::uint32_t cold_key(address_v4 const& a)
+	{ return std::uint32_t(a.to_ulong()); }
+
+	address cold_address(std::uint32_t const a)
+	{ return address_v4(a); }
+
+#if TORRENT_USE_IPV6
+	address cold_address(address_v6::bytes_type const& a)
+	{ return address_v6(a); }
+#endif
+
+	template <typename Addr>
+	void to_cold(torrent_peer const& p, aux::cold_peer<Addr>& c)
+	{
+		c.port = p.port;
+		c.last_connected = p.last_connected;
+		c.last_optimistically_unchoked = p.last_optimistically_unchoked;
+		c.hashfails = p.hashfails;
+		c.failcount = p.failcount;
+		c.connectable = p.connectable;
+		c.seed = p.seed;
+		c.banned = p.banned;
+#if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
+		c.pe_support = p.pe_support;
+#endif
+		c.on_parole = p.on_parole;
+		c.supports_utp = p.supports_utp;
+		c.confirmed_supports_utp = p.confirmed_supports_utp;
+		c.supports_holepunch = p.supports_holepunch;
+		c.fast_reconnects = p.fast_reconnects;
+		c.trust_points = p.trust_points;
+		c.source = p.source;
+	}
+
+	// this is the inverse of to_cold(). ``p`` is expected to have been
+	// constructed with the cold peer's endpoint
+	template <typename Addr>
+	void from_cold(aux::cold_peer<Addr> const& c, torrent_peer& p)
+	{
+		TORRENT_ASSERT(p.port == c.port);
+		p.last_connected = c.last_connected;
+		p.last_optimistically_unchoked = c.last_optimistically_unchoked;
+		p.hashfails = c.hashfails;
+		p.failcount = c.failcount;
+		p.connectable = c.connectable;
+		p.seed = c.seed;
+		p.banned = c.banned;
+#if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
+		p.pe_support = c.pe_support;
+#endif
+		p.on_parole = c.on_parole;
+		p.supports_utp = c.supports_utp;
+		p.confirmed_supports_utp = c.confirmed_supports_utp;
+		p.supports_holepunch = c.supports_holepunch;
+		p.fast_reconnects = c.fast_reconnects;
+		p.trust_points = c.trust_points;
+		p.source = c.source;
+	}
+
+	// looks at (at most) 300 peers in ``table``, starting at a random slot,
+	// and returns the slot and erase_score() of the best erase candidate
+	// among them, or -1 if there is none. Unless ``force`` is set, only peers
+	// that peer_list::is_erase_candidate() would accept are considered
+	template <typename Addr>
+	std::pair<int, std::uint32_t> pick_cold_erase_candidate(
+		aux::cold_peer_table<Addr>& table, bool const force)
+	{
+		std::pair<int, std::uint32_t> ret(-1, 0);
+		if (table.empty()) return ret;
+
+		auto const& slots = table.slots();
+		std::size_t const mask = slots.size() - 1;
+		std::size_t i = random(std::uint32_t(mask));
+		for (int budget = std::min(table.size(), 300); budget > 0; i = (i + 1) & mask)
+		{
+			auto const& c = slots[i];
+			if (!c.used) continue;
+			--budget;
+			if (!force && c.failcount == 0
+				&& peer_source_flags_t(c.source) != peer_info::resume_data)
+				continue;
+			std::uint32_t const score = erase_score(c);
+			if (ret.first == -1 || score > ret.second)
+				ret = std::make_pair(int(i), score);
+		}
+		return ret;
+	}
+
+	std::uint16_t clamped_subtract_u16(int const a, int const b)
+	{
+		if (a < b) return 0;
+		return std::uint16_t(a - b);
+	}
+
+	// the connect candidate heaps are binary heaps where every torrent_peer
+	// knows its own position (torrent_peer::heap_index), so that it can be
+	// moved or removed when it changes. Elements are either torrent_peer
+	// pointers or structures with a peer member. above(a, b) returns true if
+	// a belongs closer to the front than b
+	torrent_peer* heap_peer(torrent_peer* p) { return p; }
+
+	template <typename T>
+	torrent_peer* heap_peer(T const& e) { return e.peer; }
+
+	struct earlier_time
+	{
+		template <typename T>
+		bool operator()(T const& lhs, T const& rhs) const
+		{ return lhs.time < rhs.time; }
+	};
+
+	template <typename T, typename Above>
+	void heap_sift_up(std::vector<T>& heap, std::size_t i, Above const& above)
+	{
+		T const e = heap[i];
+		while (i > 0)
+		{
+			std::size_t const parent = (i - 1) / 2;
+			if (!above(e, heap[parent])) break;
+			heap[i] = heap[parent];
+			heap_peer(heap[i])->heap_index = std::uint32_t(i);
+			i = parent;
+		}
+		heap[i] = e;
+		heap_peer(e)->heap_index = std::uint32_t(i);
+	}
+
+	template <typename T, typename Above>
+	void heap_sift_down(std::vector<T>& heap, std::size_t i, Above const& above)
+	{
+		T const e = heap[i];
+		std::size_t const size = heap.size();
+		for (;;)
+		{
+			std::size_t child = i * 2 + 1;
+			if (child >= size) break;
+			if (child + 1 < size && above(heap[child + 1], heap[child])) ++child;
+			if (!above(heap[child], e)) break;
+			heap[i] = heap[child];
+			heap_peer(heap[i])->heap_index = std::uint32_t(i);
+			i = child;
+		}
+		heap[i] = e;
+		heap_peer(e)->heap_index = std::uint32_t(i);
+	}
+
+	// restores the heap property after the element at i has changed
+	template <typename T, typename Above>
+	void heap_update(std::vector<T>& heap, std::size_t const i, Above const& above)
+	{
+		torrent_peer* const p = heap_peer(heap[i]);
+		heap_sift_up(heap, i, above);
+		heap_sift_down(heap, p->heap_index, above);
+	}
+
+	template <typename T, typename Above>
+	void heap_push(std::vector<T>& heap, T const& e, Above const& above)
+	{
+		heap.push_back(e);
+		heap_sift_up(heap, heap.size() - 1, above);
+	}
+
+	// removes the element at i by moving the last element into its place.
+	// Returns true if the heap property needs to be restored at i (with
+	// heap_update())
+	template <typename T>
+	bool heap_remove(std::vector<T>& heap, std::size_t const i)
+	{
+		heap_peer(heap[i])->heap_index = torrent_peer::not_in_heap;
+		if (i + 1 == heap.size())
+		{
+			heap.pop_back();
+			return false;
+		}
+		heap[i] = heap.back();
+		heap.pop_back();
+		heap_peer(heap[i])->heap_index = std::uint32_t(i);
+		return true;
+	}
+
+	template <typename T, typename Above>
+	void heap_make(std::vector<T>& heap, Above const& above)
+	{
+		for (std::size_t i = 0; i < heap.size(); ++i)
+			heap_peer(heap[i])->heap_index = std::uint32_t(i);
+		for (std::size_t i = heap.size() / 2; i > 0; --i)
+			heap_sift_down(heap, i - 1, above);
+	}
 }
 
 namespace libtorrent {
@@ -129,6 +331,69 @@ namespace libtorrent {
 			m_peer_allocator.free_peer_entry(p);
 	}
 
+	void peer_list::for_each_peer(std::function<void(torrent_peer const&)> const& f) const
+	{
+		for (auto const p : m_peers) f(*p);
+
+		m_cold4.for_each([&f](aux::cold_peer4 const& c)
+		{
+			ipv4_peer p(tcp::endpoint(cold_address(c.addr), c.port)
+				, c.connectable, peer_source_flags_t(c.source));
+			from_cold(c, p);
+			f(p);
+		});
+#if TORRENT_USE_IPV6
+		m_cold6.for_each([&f](aux::cold_peer6 const& c)
+		{
+			ipv6_peer p(tcp::endpoint(cold_address(c.addr), c.port)
+				, c.connectable, peer_source_flags_t(c.source));
+			from_cold(c, p);
+			f(p);
+		});
+#endif
+	}
+
+	void peer_list::clear_last_connected()
+	{
+		for (auto const p : m_peers) p->last_connected = 0;
+		m_cold4.for_each([](aux::cold_peer4& c) { c.last_connected = 0; });
+#if TORRENT_USE_IPV6
+		m_cold6.for_each([](aux::cold_peer6& c) { c.last_connected = 0; });
+#endif
+		// all candidates can be connected to right away now
+		rebuild_candidates();
+	}
+
+	void peer_list::step_session_time(int const seconds)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		for (auto const p : m_peers)
+		{
+			p->last_optimistically_unchoked
+				= clamped_subtract_u16(p->last_optimistically_unchoked, seconds);
+			p->last_connected = clamped_subtract_u16(p->last_connected, seconds);
+		}
+		m_cold4.for_each([=](aux::cold_peer4& c)
+		{
+			c.last_optimistically_unchoked
+				= clamped_subtract_u16(c.last_optimistically_unchoked, seconds);
+			c.last_connected = clamped_subtract_u16(c.last_connected, seconds);
+		});
+#if TORRENT_USE_IPV6
+		m_cold6.for_each([=](aux::cold_peer6& c)
+		{
+			c.last_optimistically_unchoked
+				= clamped_subtract_u16(c.last_optimistically_unchoked, seconds);
+			c.last_connected = clamped_subtract_u16(c.last_connected, seconds);
+		});
+#endif
+
+		// this preserves the order of m_waiting, but clamping last_connected
+		// may change the order of m_candidates
+		for (auto& w : m_waiting) w.time = std::max(0, w.time - seconds);
+		m_candidates_dirty = true;
+	}
+
 	void peer_list::set_max_failcount(torrent_state* state)
 	{
 		if (state->max_failcount == m_max_failcount) return;
@@ -189,12 +454,42 @@ namespace libtorrent {
 			erase_peer(i, state);
 			i = m_peers.begin() + current;
 		}
+
+		// cold peers aren't connected, they can just be dropped
+		m_cold4.erase_if([&](aux::cold_peer4 const& c)
+		{
+			if ((filter.access(cold_address(c.addr)) & ip_filter::blocked) == 0)
+				return false;
+			if (c.seed)
+			{
+				TORRENT_ASSERT(m_num_seeds > 0);
+				--m_num_seeds;
+			}
+			return true;
+		});
+#if TORRENT_USE_IPV6
+		m_cold6.erase_if([&](aux::cold_peer6 const& c)
+		{
+			if ((filter.access(cold_address(c.addr)) & ip_filter::blocked) == 0)
+				return false;
+			if (c.seed)
+			{
+				TORRENT_ASSERT(m_num_seeds > 0);
+				--m_num_seeds;
+			}
+			return true;
+		});
+#endif
 	}
 
 	void peer_list::clear_peer_prio()
 	{
 		for (auto& p : m_peers)
 			p->peer_rank = 0;
+
+		// the ranks are recalculated (against the new external address)
+		// the next time m_candidates is used
+		m_candidates_dirty = true;
 	}
 
 	// disconnects and removes all peers that are now filtered
@@ -248,6 +543,31 @@ namespace libtorrent {
 			erase_peer(i, state);
 			i = m_peers.begin() + current;
 		}
+
+		m_cold4.erase_if([&](aux::cold_peer4 const& c)
+		{
+			if ((filter.access(c.port) & port_filter::blocked) == 0)
+				return false;
+			if (c.seed)
+			{
+				TORRENT_ASSERT(m_num_seeds > 0);
+				--m_num_seeds;
+			}
+			return true;
+		});
+#if TORRENT_USE_IPV6
+		m_cold6.erase_if([&](aux::cold_peer6 const& c)
+		{
+			if ((filter.access(c.port) & port_filter::blocked) == 0)
+				return false;
+			if (c.seed)
+			{
+				TORRENT_ASSERT(m_num_seeds > 0);
+				--m_num_seeds;
+			}
+			return true;
+		});
+#endif
 	}
 
 	void peer_list::erase_peer(torrent_peer* p, torrent_state* state)
@@ -275,27 +595,154 @@ namespace libtorrent {
 		TORRENT_ASSERT(i != m_peers.end());
 		TORRENT_ASSERT(m_locked_peer != *i);
 
-		state->erased.push_back(*i);
 		if ((*i)->seed)
 		{
 			TORRENT_ASSERT(m_num_seeds > 0);
 			--m_num_seeds;
 		}
-		if (is_connect_candidate(**i))
-			update_connect_candidates(-1);
-		TORRENT_ASSERT(m_num_connect_candidates < int(m_peers.size()));
+		if ((*i)->heap_index != torrent_peer::not_in_heap)
+			remove_candidate(*i);
+		remove_peer_entry(i, state);
+	}
+
+	void peer_list::remove_peer_entry(iterator i, torrent_state* state)
+	{
+		state->erased.push_back(*i);
 		if (m_round_robin > i - m_peers.begin()) --m_round_robin;
 		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
 
-		// if this peer is in the connect candidate
-		// cache, erase it from there as well
-		std::vector<torrent_peer*>::iterator ci = std::find(m_candidate_cache.begin(), m_candidate_cache.end(), *i);
-		if (ci != m_candidate_cache.end()) m_candidate_cache.erase(ci);
+		// the caller is expected to have taken it out of the connect
+		// candidate heaps
+		TORRENT_ASSERT((*i)->heap_index == torrent_peer::not_in_heap);
 
 		m_peer_allocator.free_peer_entry(*i);
 		m_peers.erase(i);
 	}
 
+	bool peer_list::can_demote(torrent_peer const& p) const
+	{
+		TORRENT_ASSERT(p.in_use);
+		if (&p == m_locked_peer) return false;
+		if (p.connection) return false;
+		if (is_connect_candidate(p)) return false;
+#if TORRENT_USE_I2P
+		if (p.is_i2p_addr) return false;
+#endif
+		// the amount transferred in earlier connections is restored when we
+		// connect again, but it's not kept in cold peers. Peers that have
+		// sent or received any payload are rare enough to leave alone
+		return p.prev_amount_upload == 0 && p.prev_amount_download == 0;
+	}
+
+	void peer_list::demote_peer(iterator i, torrent_state* state)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(i != m_peers.end());
+		torrent_peer const& p = **i;
+		TORRENT_ASSERT(can_demote(p));
+
+		// the seed and connect candidate counters include cold peers, so
+		// they're not affected
+#if TORRENT_USE_IPV6
+		if (p.is_v6_addr)
+			to_cold(p, m_cold6.insert(p.address().to_v6().to_bytes()));
+		else
+#endif
+			to_cold(p, m_cold4.insert(cold_key(p.address().to_v4())));
+
+		remove_peer_entry(i, state);
+	}
+
+	template <typename Addr>
+	peer_list::iterator peer_list::materialize_peer(aux::cold_peer<Addr> const& c)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(c.used);
+		tcp::endpoint const remote(cold_address(c.addr), c.port);
+
+#if TORRENT_USE_IPV6
+		bool const is_v6 = remote.address().is_v6();
+#else
+		bool const is_v6 = false;
+#endif
+		torrent_peer* p = m_peer_allocator.allocate_peer_entry(
+			is_v6 ? torrent_peer_allocator_interface::ipv6_peer_type
+			: torrent_peer_allocator_interface::ipv4_peer_type);
+		if (p == nullptr) return m_peers.end();
+
+#if TORRENT_USE_IPV6
+		if (is_v6)
+			new (p) ipv6_peer(remote, c.connectable, peer_source_flags_t(c.source));
+		else
+#endif
+			new (p) ipv4_peer(remote, c.connectable, peer_source_flags_t(c.source));
+		from_cold(c, *p);
+
+		iterator iter = std::lower_bound(m_peers.begin(), m_peers.end()
+			, remote.address(), peer_address_compare());
+		try
+		{
+			iter = m_peers.insert(iter, p);
+		}
+		catch (std::exception const&)
+		{
+			m_peer_allocator.free_peer_entry(p);
+			return m_peers.end();
+		}
+
+		if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
+		update_candidate(p);
+		return iter;
+	}
+
+	peer_list::iterator peer_list::promote_peer(address const& a, int const port)
+	{
+#if TORRENT_USE_IPV6
+		if (a.is_v6())
+		{
+			auto* c = m_cold6.find(a.to_v6().to_bytes(), port);
+			if (c == nullptr) return m_peers.end();
+			iterator const ret = materialize_peer(*c);
+			if (ret != m_peers.end()) m_cold6.erase(c);
+			return ret;
+		}
+#endif
+		auto* c = m_cold4.find(cold_key(a.to_v4()), port);
+		if (c == nullptr) return m_peers.end();
+		iterator const ret = materialize_peer(*c);
+		if (ret != m_peers.end()) m_cold4.erase(c);
+		return ret;
+	}
+
+	// turns the cold peers that are connect candidates back into
+	// torrent_peers. This is necessary when the rules for what's a connect
+	// candidate change
+	void peer_list::promote_cold_candidates()
+	{
+		TORRENT_ASSERT(is_single_thread());
+		// this mirrors is_connect_candidate(). Cold peers are never connected
+		auto const is_candidate = [this](bool banned, bool connectable, bool seed, int failcount)
+		{
+			return !banned && connectable && !(seed && m_finished) && failcount < m_max_failcount;
+		};
+
+		m_cold4.erase_if([&](aux::cold_peer4 const& c)
+		{
+			if (!is_candidate(c.banned, c.connectable, c.seed, int(c.failcount))) return false;
+			// end() must be evaluated after the insertion
+			iterator const i = materialize_peer(c);
+			return i != m_peers.end();
+		});
+#if TORRENT_USE_IPV6
+		m_cold6.erase_if([&](aux::cold_peer6 const& c)
+		{
+			if (!is_candidate(c.banned, c.connectable, c.seed, int(c.failcount))) return false;
+			iterator const i = materialize_peer(c);
+			return i != m_peers.end();
+		});
+#endif
+	}
+
 	bool peer_list::should_erase_immediately(torrent_peer const& p) const
 	{
 		TORRENT_ASSERT(is_single_thread());
@@ -331,7 +778,7 @@ namespace libtorrent {
 
 		int max_peerlist_size = state->max_peerlist_size;
 
-		if (max_peerlist_size == 0 || m_peers.empty()) return;
+		if (max_peerlist_size == 0 || num_peers() == 0) return;
 
 		int erase_candidate = -1;
 		int force_erase_candidate = -1;
@@ -339,6 +786,11 @@ namespace libtorrent {
 		if (bool(m_finished) != state->is_finished)
 			recalculate_connect_candidates(state);
 
+		// cold peers are neither connected nor connect candidates, which
+		// makes them the first ones to go
+		if (erase_cold_peer(flags)) return;
+		if (m_peers.empty()) return;
+
 		int round_robin = aux::numeric_cast<int>(random(std::uint32_t(m_peers.size() - 1)));
 
 		int low_watermark = max_peerlist_size * 95 / 100;
@@ -347,7 +799,7 @@ namespace libtorrent {
 		for (int iterations = std::min(int(m_peers.size()), 300);
 			iterations > 0; --iterations)
 		{
-			if (int(m_peers.size()) < low_watermark)
+			if (num_peers() < low_watermark)
 				break;
 
 			if (round_robin == int(m_peers.size())) round_robin = 0;
@@ -395,6 +847,39 @@ namespace libtorrent {
 		}
 	}
 
+	// erases the best erase candidate among a sample of the cold peers. If
+	// force_erase is set, any cold peer may be erased. Returns true if a peer
+	// was erased
+	bool peer_list::erase_cold_peer(int const flags)
+	{
+		bool const force = (flags & force_erase) != 0;
+		auto const v4 = pick_cold_erase_candidate(m_cold4, force);
+#if TORRENT_USE_IPV6
+		auto const v6 = pick_cold_erase_candidate(m_cold6, force);
+		if (v6.first != -1 && (v4.first == -1 || v6.second > v4.second))
+		{
+			aux::cold_peer6& c = m_cold6.slots()[std::size_t(v6.first)];
+			if (c.seed)
+			{
+				TORRENT_ASSERT(m_num_seeds > 0);
+				--m_num_seeds;
+			}
+			m_cold6.erase(&c);
+			return true;
+		}
+#endif
+		if (v4.first == -1) return false;
+
+		aux::cold_peer4& c = m_cold4.slots()[std::size_t(v4.first)];
+		if (c.seed)
+		{
+			TORRENT_ASSERT(m_num_seeds > 0);
+			--m_num_seeds;
+		}
+		m_cold4.erase(&c);
+		return true;
+	}
+
 	// returns true if the peer was actually banned
 	bool peer_list::ban_peer(torrent_peer* p)
 	{
@@ -403,10 +888,8 @@ namespace libtorrent {
 
 		TORRENT_ASSERT(p->in_use);
 
-		if (is_connect_candidate(*p))
-			update_connect_candidates(-1);
-
 		p->banned = true;
+		update_candidate(p);
 		TORRENT_ASSERT(!is_connect_candidate(*p));
 		return true;
 	}
@@ -419,9 +902,8 @@ namespace libtorrent {
 		TORRENT_ASSERT(p->in_use);
 		TORRENT_ASSERT(c);
 
-		const bool was_conn_cand = is_connect_candidate(*p);
 		p->connection = c;
-		if (was_conn_cand) update_connect_candidates(-1);
+		update_candidate(p);
 	}
 
 	void peer_list::inc_failcount(torrent_peer* p)
@@ -429,10 +911,8 @@ namespace libtorrent {
 		// failcount is a 5 bit value
 		if (p->failcount == 31) return;
 
-		bool const was_conn_cand = is_connect_candidate(*p);
 		++p->failcount;
-		if (was_conn_cand && !is_connect_candidate(*p))
-			update_connect_candidates(-1);
+		update_candidate(p);
 	}
 
 	void peer_list::set_failcount(torrent_peer* p, int const f)
@@ -441,12 +921,8 @@ namespace libtorrent {
 		INVARIANT_CHECK;
 
 		TORRENT_ASSERT(p->in_use);
-		bool const was_conn_cand = is_connect_candidate(*p);
 		p->failcount = aux::numeric_cast<std::uint32_t>(f);
-		if (was_conn_cand != is_connect_candidate(*p))
-		{
-			update_connect_candidates(was_conn_cand ? -1 : 1);
-		}
+		update_candidate(p);
 	}
 
 	bool peer_list::is_connect_candidate(torrent_peer const& p) const
@@ -464,45 +940,50 @@ namespace libtorrent {
 		return true;
 	}
 
-	void peer_list::find_connect_candidates(std::vector<torrent_peer*>& peers
-		, int session_time, torrent_state* state)
+	int peer_list::weed_peers(torrent_state* state)
 	{
 		TORRENT_ASSERT(is_single_thread());
-		INVARIANT_CHECK;
 
-		const int candidate_count = 10;
-		peers.reserve(candidate_count);
+		// connect candidates are picked from the candidate heaps, so this
+		// only needs to make slow progress through the list
+		int const weed_step = 10;
 
 		int erase_candidate = -1;
-
-		if (bool(m_finished) != state->is_finished)
-			recalculate_connect_candidates(state);
-
-		external_ip const& external = state->ip;
-		int external_port = state->port;
+		int const max_peerlist_size = state->max_peerlist_size;
 
 		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
 
-		int max_peerlist_size = state->max_peerlist_size;
-
 		// TODO: 2 it would be nice if there was a way to iterate over these
 		// torrent_peer objects in the order they are allocated in the pool
 		// instead. It would probably be more efficient
-		for (int iterations = std::min(int(m_peers.size()), 300);
+		int visited = 0;
+		for (int iterations = std::min(int(m_peers.size()), weed_step);
 			iterations > 0; --iterations)
 		{
 			++state->loop_counter;
+			++visited;
 
+			// demoting peers may have emptied the list
+			if (m_peers.empty()) break;
 			if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
 
 			torrent_peer& pe = *m_peers[m_round_robin];
 			TORRENT_ASSERT(pe.in_use);
 			int current = m_round_robin;
 
+			// peers that can't be connected to don't need to be kept as
+			// torrent_peer objects
+			if (can_demote(pe))
+			{
+				if (erase_candidate > current) --erase_candidate;
+				demote_peer(m_peers.begin() + current, state);
+				continue;
+			}
+
 			// if the number of peers is growing large
 			// we need to start weeding.
 
-			if (int(m_peers.size()) >= max_peerlist_size * 0.95
+			if (num_peers() >= max_peerlist_size * 0.95
 				&& max_peerlist_size > 0)
 			{
 				if (is_erase_candidate(pe)
@@ -523,35 +1004,13 @@ namespace libtorrent {
 			}
 
 			++m_round_robin;
-
-			if (!is_connect_candidate(pe)) continue;
-
-			if (pe.last_connected
-				&& session_time - pe.last_connected <
-				(int(pe.failcount) + 1) * state->min_reconnect_time)
-				continue;
-
-			// compare peer returns true if lhs is better than rhs. In this
-			// case, it returns true if the current candidate is better than
-			// pe, which is the peer m_round_robin points to. If it is, just
-			// keep looking.
-			if (peers.size() == candidate_count
-				&& compare_peer(peers.back(), &pe, external, external_port)) continue;
-
-			if (peers.size() >= candidate_count)
-				peers.resize(candidate_count - 1);
-
-			// insert this candidate sorted into peers
-			auto const i = std::lower_bound(peers.begin(), peers.end()
-				, &pe, std::bind(&peer_list::compare_peer, this, _1, _2, std::cref(external), external_port));
-
-			peers.insert(i, &pe);
 		}
 
 		if (erase_candidate > -1)
 		{
 			erase_peer(m_peers.begin() + erase_candidate, state);
 		}
+		return visited;
 	}
 
 	bool peer_list::new_connection(peer_connection_interface& c, int session_time
@@ -594,6 +1053,18 @@ namespace libtorrent {
 			}
 		}
 
+		if (!found)
+		{
+			// we may know of this peer as a cold peer
+			iterator const cold = promote_peer(c.remote().address()
+				, state->allow_multiple_connections_per_ip ? c.remote().port() : -1);
+			if (cold != m_peers.end())
+			{
+				iter = cold;
+				found = true;
+			}
+		}
+
 		// make sure the iterator we got is properly sorted relative
 		// to the connection's address
 //		TORRENT_ASSERT(m_peers.empty()
@@ -715,8 +1186,8 @@ namespace libtorrent {
 				}
 			}
 
-			if (is_connect_candidate(*i))
-				update_connect_candidates(-1);
+			if (i->heap_index != torrent_peer::not_in_heap)
+				remove_candidate(i);
 		}
 		else
 		{
@@ -724,11 +1195,11 @@ namespace libtorrent {
 			// add a new entry
 
 			if (state->max_peerlist_size
-				&& int(m_peers.size()) >= state->max_peerlist_size)
+				&& num_peers() >= state->max_peerlist_size)
 			{
 				// this may invalidate our iterator!
 				erase_peers(state, force_erase);
-				if (int(m_peers.size()) >= state->max_peerlist_size)
+				if (num_peers() >= state->max_peerlist_size)
 				{
 					c.disconnect(errors::too_many_connections, operation_t::bittorrent);
 					return false;
@@ -802,19 +1273,19 @@ namespace libtorrent {
 			std::pair<iterator, iterator> range = find_peers(remote.address());
 			iterator i = std::find_if(range.first, range.second
 				, match_peer_endpoint(remote));
-			if (i != range.second)
+			// it may be a cold peer
+			if (i == range.second) i = promote_peer(remote.address(), port);
+			if (i != m_peers.end())
 			{
 				torrent_peer& pp = **i;
 				TORRENT_ASSERT(pp.in_use);
 				if (pp.connection)
 				{
-					bool const was_conn_cand = is_connect_candidate(pp);
 					// if we already have an entry with this
 					// new endpoint, disconnect this one
 					pp.connectable = true;
 					pp.source |= static_cast<std::uint8_t>(src);
-					if (!was_conn_cand && is_connect_candidate(pp))
-						update_connect_candidates(1);
+					update_candidate(&pp);
 					// calling disconnect() on a peer, may actually end
 					// up "garbage collecting" its torrent_peer entry
 					// as well, if it's considered useless (which this specific)
@@ -844,13 +1315,10 @@ namespace libtorrent {
 		}
 #endif
 
-		bool const was_conn_cand = is_connect_candidate(*p);
 		p->port = std::uint16_t(port);
 		p->source |= static_cast<std::uint8_t>(src);
 		p->connectable = true;
-
-		if (was_conn_cand != is_connect_candidate(*p))
-			update_connect_candidates(was_conn_cand ? -1 : 1);
+		update_candidate(p);
 		return true;
 	}
 
@@ -870,15 +1338,13 @@ namespace libtorrent {
 		if (p == nullptr) return;
 		TORRENT_ASSERT(p->in_use);
 		if (p->seed == s) return;
-		bool const was_conn_cand = is_connect_candidate(*p);
 		p->seed = s;
-		if (was_conn_cand && !is_connect_candidate(*p))
-			update_connect_candidates(-1);
+		update_candidate(p);
 
 		if (p->web_seed) return;
 		if (s)
 		{
-			TORRENT_ASSERT(m_num_seeds < int(m_peers.size()));
+			TORRENT_ASSERT(m_num_seeds < num_peers());
 			++m_num_seeds;
 		}
 		else
@@ -899,12 +1365,12 @@ namespace libtorrent {
 		int const max_peerlist_size = state->max_peerlist_size;
 
 		if (max_peerlist_size
-			&& int(m_peers.size()) >= max_peerlist_size)
+			&& num_peers() >= max_peerlist_size)
 		{
 			if (p->peer_source() == peer_info::resume_data) return false;
 
 			erase_peers(state);
-			if (int(m_peers.size()) >= max_peerlist_size)
+			if (num_peers() >= max_peerlist_size)
 				return false;
 
 			// since some peers were removed, we need to
@@ -933,15 +1399,14 @@ namespace libtorrent {
 		if (flags & flag_seed)
 		{
 			p->seed = true;
-			TORRENT_ASSERT(m_num_seeds < int(m_peers.size()));
+			TORRENT_ASSERT(m_num_seeds < num_peers());
 			++m_num_seeds;
 		}
 		if (flags & flag_utp)
 			p->supports_utp = true;
 		if (flags & flag_holepunch)
 			p->supports_holepunch = true;
-		if (is_connect_candidate(*p))
-			update_connect_candidates(1);
+		update_candidate(p);
 
 		return true;
 	}
@@ -950,8 +1415,6 @@ namespace libtorrent {
 		, int flags, tcp::endpoint const& remote)
 	{
 		TORRENT_ASSERT(is_single_thread());
-		bool const was_conn_cand = is_connect_candidate(*p);
-
 		TORRENT_ASSERT(p->in_use);
 		p->connectable = true;
 
@@ -973,7 +1436,7 @@ namespace libtorrent {
 		{
 			if (!p->seed)
 			{
-				TORRENT_ASSERT(m_num_seeds < int(m_peers.size()));
+				TORRENT_ASSERT(m_num_seeds < num_peers());
 				++m_num_seeds;
 			}
 			p->seed = true;
@@ -983,22 +1446,92 @@ namespace libtorrent {
 		if (flags & flag_holepunch)
 			p->supports_holepunch = true;
 
-		if (was_conn_cand != is_connect_candidate(*p))
+		update_candidate(p);
+	}
+
+	int peer_list::reconnect_time(torrent_peer const& p) const
+	{
+		// peers we haven't tried yet don't need to wait
+		if (p.last_connected == 0) return 0;
+		return int(p.last_connected) + (int(p.failcount) + 1) * m_min_reconnect_time;
+	}
+
+	void peer_list::update_candidate(torrent_peer* p)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(p->in_use);
+
+		bool const in_heap = p->heap_index != torrent_peer::not_in_heap;
+		if (is_connect_candidate(*p) != in_heap)
 		{
-			update_connect_candidates(was_conn_cand ? -1 : 1);
+			if (in_heap) remove_candidate(p);
+			else add_candidate(p, reconnect_time(*p));
+			return;
+		}
+		if (!in_heap) return;
+
+		// it's still a candidate, but it may be a better or worse one than
+		// before
+		if (p->candidate_waiting)
+		{
+			m_waiting[p->heap_index].time = reconnect_time(*p);
+			heap_update(m_waiting, p->heap_index, earlier_time());
+		}
+		else if (!m_candidates_dirty)
+		{
+			heap_update(m_candidates, p->heap_index, std::bind(&peer_list::compare_peer
+				, this, _1, _2, std::cref(m_external), m_external_port));
 		}
 	}
 
-	void peer_list::update_connect_candidates(int delta)
+	void peer_list::add_candidate(torrent_peer* p, int const time)
 	{
 		TORRENT_ASSERT(is_single_thread());
-		if (delta == 0) return;
-		m_num_connect_candidates += delta;
-		if (delta < 0)
+		TORRENT_ASSERT(p->heap_index == torrent_peer::not_in_heap);
+		TORRENT_ASSERT(is_connect_candidate(*p));
+		p->candidate_waiting = true;
+		heap_push(m_waiting, waiting_peer{time, p}, earlier_time());
+	}
+
+	void peer_list::remove_candidate(torrent_peer* p)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(p->heap_index != torrent_peer::not_in_heap);
+		std::size_t const i = p->heap_index;
+		if (p->candidate_waiting)
 		{
-			TORRENT_ASSERT(m_num_connect_candidates >= 0);
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
+			TORRENT_ASSERT(m_waiting[i].peer == p);
+			if (heap_remove(m_waiting, i))
+				heap_update(m_waiting, i, earlier_time());
 		}
+		else
+		{
+			TORRENT_ASSERT(m_candidates[i] == p);
+			if (heap_remove(m_candidates, i) && !m_candidates_dirty)
+			{
+				heap_update(m_candidates, i, std::bind(&peer_list::compare_peer
+					, this, _1, _2, std::cref(m_external), m_external_port));
+			}
+		}
+		p->candidate_waiting = false;
+	}
+
+	void peer_list::rebuild_candidates()
+	{
+		TORRENT_ASSERT(is_single_thread());
+		for (auto const p : m_candidates) p->heap_index = torrent_peer::not_in_heap;
+		for (auto const& w : m_waiting) w.peer->heap_index = torrent_peer::not_in_heap;
+		m_candidates.clear();
+		m_waiting.clear();
+		m_candidates_dirty = false;
+
+		for (auto const p : m_peers)
+		{
+			if (!is_connect_candidate(*p)) continue;
+			p->candidate_waiting = true;
+			m_waiting.push_back(waiting_peer{reconnect_time(*p), p});
+		}
+		heap_make(m_waiting, earlier_time());
 	}
 
 #if TORRENT_USE_I2P
@@ -1071,6 +1604,17 @@ namespace libtorrent {
 			if (iter != m_peers.end() && (*iter)->address() == remote.address()) found = true;
 		}
 
+		if (!found)
+		{
+			iterator const cold = promote_peer(remote.address()
+				, state->allow_multiple_connections_per_ip ? remote.port() : -1);
+			if (cold != m_peers.end())
+			{
+				iter = cold;
+				found = true;
+			}
+		}
+
 		if (!found)
 		{
 			// we don't have any info about this peer.
@@ -1127,25 +1671,63 @@ namespace libtorrent {
 		if (bool(m_finished) != state->is_finished)
 			recalculate_connect_candidates(state);
 
-		// clear out any peers from the cache that no longer
-		// are connection candidates
-		for (std::vector<torrent_peer*>::iterator i = m_candidate_cache.begin();
-			i != m_candidate_cache.end();)
+		m_external = state->ip;
+		m_external_port = state->port;
+		auto const better = std::bind(&peer_list::compare_peer, this, _1, _2
+			, std::cref(m_external), m_external_port);
+
+		if (m_candidates_dirty)
 		{
-			if (!is_connect_candidate(**i))
-				i = m_candidate_cache.erase(i);
-			else
-				++i;
+			heap_make(m_candidates, better);
+			m_candidates_dirty = false;
 		}
 
-		if (m_candidate_cache.empty())
+		if (m_min_reconnect_time != state->min_reconnect_time)
 		{
-			find_connect_candidates(m_candidate_cache, session_time, state);
-			if (m_candidate_cache.empty()) return nullptr;
+			m_min_reconnect_time = state->min_reconnect_time;
+			for (auto& w : m_waiting) w.time = reconnect_time(*w.peer);
+			heap_make(m_waiting, earlier_time());
 		}
 
-		torrent_peer* p = m_candidate_cache.front();
-		m_candidate_cache.erase(m_candidate_cache.begin());
+		int const visited = weed_peers(state);
+
+		// move the candidates whose reconnect time has passed over to the
+		// ones we may connect to
+		while (!m_waiting.empty() && m_waiting.front().time <= session_time)
+		{
+			torrent_peer* p = m_waiting.front().peer;
+			if (heap_remove(m_waiting, 0))
+				heap_update(m_waiting, 0, earlier_time());
+
+			// last_connected may have been updated since p was put in the heap.
+			// connect_to_peer() does
+			int const t = reconnect_time(*p);
+			if (t > session_time)
+			{
+				heap_push(m_waiting, waiting_peer{t, p}, earlier_time());
+			}
+			else
+			{
+				p->candidate_waiting = false;
+				heap_push(m_candidates, p, better);
+			}
+		}
+
+		// candidates used to be found by scanning (at most) 300 peers for the
+		// 10 best ones
+		state->loops_saved += std::max(0
+			, std::min(int(m_peers.size()), 300) / 10 - visited);
+
+		if (m_candidates.empty()) return nullptr;
+
+		torrent_peer* p = m_candidates.front();
+		if (heap_remove(m_candidates, 0))
+			heap_update(m_candidates, 0, better);
+
+		// the caller is about to try to connect to p. Unless that succeeds
+		// (in which case it's not a candidate anymore) it will have to wait
+		// for its reconnect time
+		add_candidate(p, session_time + (int(p->failcount) + 1) * m_min_reconnect_time);
 
 		TORRENT_ASSERT(p->in_use);
 
@@ -1153,7 +1735,8 @@ namespace libtorrent {
 		TORRENT_ASSERT(!p->connection);
 		TORRENT_ASSERT(p->connectable);
 
-		// this should hold because find_connect_candidates should have done this
+		// this should hold because recalculate_connect_candidates() should
+		// have been called above
 		TORRENT_ASSERT(bool(m_finished) == state->is_finished);
 
 		TORRENT_ASSERT(is_connect_candidate(*p));
@@ -1203,8 +1786,7 @@ namespace libtorrent {
 			if (p->failcount < 31) ++p->failcount;
 		}
 
-		if (is_connect_candidate(*p))
-			update_connect_candidates(1);
+		update_candidate(p);
 
 		// if we're already a seed, it's not as important
 		// to keep all the possibly stale peers
@@ -1230,19 +1812,41 @@ namespace libtorrent {
 		{
 			erase_peer(p, state);
 		}
+		else if (can_demote(*p))
+		{
+			// if we're not going to connect to this peer again, there's no
+			// need to keep all of its state around (can_demote() excludes
+			// the locked peer, mentioned above)
+			std::pair<iterator, iterator> const range = find_peers(p->address());
+			iterator const i = std::find(range.first, range.second, p);
+			TORRENT_ASSERT(i != range.second);
+			if (i != range.second) demote_peer(i, state);
+		}
 	}
 
 	void peer_list::recalculate_connect_candidates(torrent_state* state)
 	{
 		TORRENT_ASSERT(is_single_thread());
 
-		m_num_connect_candidates = 0;
 		m_finished = state->is_finished;
 		m_max_failcount = state->max_failcount;
+		rebuild_candidates();
+
+		// the set of connect candidates may have changed in both directions.
+		// Cold peers that are candidates now need to be torrent_peers, and
+		// torrent_peers that aren't anymore can be demoted
+		promote_cold_candidates();
 
-		for (auto const& p : m_peers)
+		for (iterator i = m_peers.begin(); i != m_peers.end();)
 		{
-			m_num_connect_candidates += is_connect_candidate(*p);
+			if (can_demote(**i))
+			{
+				int const current = int(i - m_peers.begin());
+				demote_peer(i, state);
+				i = m_peers.begin() + current;
+				continue;
+			}
+			++i;
 		}
 
 #if TORRENT_USE_INVARIANT_CHECKS
@@ -1278,10 +1882,24 @@ namespace libtorrent {
 	void peer_list::check_invariant() const
 	{
 		TORRENT_ASSERT(is_single_thread());
-		TORRENT_ASSERT(m_num_connect_candidates >= 0);
-		TORRENT_ASSERT(m_num_connect_candidates <= int(m_peers.size()));
+		TORRENT_ASSERT(num_connect_candidates() <= int(m_peers.size()));
+		TORRENT_ASSERT(int(m_num_seeds) <= num_peers());
 
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
+		// cold peers are never connect candidates
+		m_cold4.for_each([this](aux::cold_peer4 const& c)
+		{
+			TORRENT_ASSERT(c.banned || !c.connectable || (c.seed && m_finished)
+				|| int(c.failcount) >= m_max_failcount);
+		});
+#if TORRENT_USE_IPV6
+		m_cold6.for_each([this](aux::cold_peer6 const& c)
+		{
+			TORRENT_ASSERT(c.banned || !c.connectable || (c.seed && m_finished)
+				|| int(c.failcount) >= m_max_failcount);
+		});
+#endif
+
 		int total_connections = 0;
 		int nonempty_connections = 0;
 		int connect_candidates = 0;
@@ -1298,6 +1916,8 @@ namespace libtorrent {
 			torrent_peer const& p = **i;
 			TORRENT_ASSERT(p.in_use);
 			if (is_connect_candidate(p)) ++connect_candidates;
+			TORRENT_ASSERT(is_connect_candidate(p)
+				== (p.heap_index != torrent_peer::not_in_heap));
 			++total_connections;
 			if (!p.connection)
 			{
@@ -1313,7 +1933,21 @@ namespace libtorrent {
 			++nonempty_connections;
 		}
 
-		TORRENT_ASSERT(m_num_connect_candidates == connect_candidates);
+		TORRENT_ASSERT(num_connect_candidates() == connect_candidates);
+
+		for (std::size_t i = 0; i < m_waiting.size(); ++i)
+		{
+			torrent_peer const& p = *m_waiting[i].peer;
+			TORRENT_ASSERT(p.heap_index == i && p.candidate_waiting);
+			TORRENT_ASSERT(i == 0 || m_waiting[(i - 1) / 2].time <= m_waiting[i].time);
+		}
+		for (std::size_t i = 0; i < m_candidates.size(); ++i)
+		{
+			torrent_peer const& p = *m_candidates[i];
+			TORRENT_ASSERT(p.heap_index == i && !p.candidate_waiting);
+			TORRENT_ASSERT(i == 0 || m_candidates_dirty
+				|| !compare_peer(&p, m_candidates[(i - 1) / 2], m_external, m_external_port));
+		}
 #endif // TORRENT_EXPENSIVE_INVARIANT_CHECKS
 
 	}
@@ -1326,21 +1960,7 @@ namespace libtorrent {
 		TORRENT_ASSERT(lhs.connection == nullptr);
 		TORRENT_ASSERT(rhs.connection == nullptr);
 
-		// primarily, prefer getting rid of peers we've already tried and failed
-		if (lhs.failcount != rhs.failcount)
-			return lhs.failcount > rhs.failcount;
-
-		bool const lhs_resume_data_source = lhs.peer_source() == peer_info::resume_data;
-		bool const rhs_resume_data_source = rhs.peer_source() == peer_info::resume_data;
-
-		// prefer to drop peers whose only source is resume data
-		if (lhs_resume_data_source != rhs_resume_data_source)
-			return int(lhs_resume_data_source) > int(rhs_resume_data_source);
-
-		if (lhs.connectable != rhs.connectable)
-			return int(lhs.connectable) < int(rhs.connectable);
-
-		return lhs.trust_points < rhs.trust_points;
+		return erase_score(lhs) > erase_score(rhs);
 	}
 
 	// this returns true if lhs is a better connect candidate than rhs
@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/torrent_info.hpp"
 #include "libtorrent/aux_/numeric_cast.hpp"
 #include "libtorrent/download_priority.hpp" // for default_priority
+#include "libtorrent/aux_/resume_data_binary.hpp"
 
 namespace libtorrent {
 
@@ -185,6 +186,23 @@ namespace {
 			}
 		}
 
+		bdecode_node const file_snapshots = rd.dict_find_list("file_snapshots");
+		if (file_snapshots)
+		{
+			int const num_files = file_snapshots.list_size();
+			ret.file_snapshots.resize(aux::numeric_cast<std::size_t>(num_files));
+			for (int i = 0; i < num_files; ++i)
+			{
+				bdecode_node const e = file_snapshots.list_at(i);
+				if (e.type() != bdecode_node::list_t || e.list_size() < 3)
+					continue;
+				file_snapshot& f = ret.file_snapshots[std::size_t(i)];
+				f.size = e.list_int_value_at(0, -1);
+				f.mtime = e.list_int_value_at(1);
+				f.inode = std::uint64_t(e.list_int_value_at(2));
+			}
+		}
+
 		bdecode_node const trackers = rd.dict_find_list("trackers");
 		if (trackers)
 		{
@@ -340,9 +358,14 @@ namespace {
 
 	add_torrent_params read_resume_data(span<char const> buffer, error_code& ec)
 	{
+		if (aux::is_binary_resume_data(buffer))
+			return aux::read_binary_resume_data(buffer, ec);
+
 		bdecode_node rd = bdecode(buffer, ec);
 		if (ec) return add_torrent_params();
 
+		// most keys of the resume file are looked up
+		if (rd.type() == bdecode_node::dict_t) rd.dict_build_index();
 		return read_resume_data(rd, ec);
 	}
 }
@@ -0,0 +1,1022 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+#include "libtorrent/aux_/resume_data_binary.hpp"
+#include "libtorrent/add_torrent_params.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/io.hpp"
+#include "libtorrent/socket_io.hpp" // for write_endpoint()
+#include "libtorrent/download_priority.hpp"
+#include "libtorrent/aux_/numeric_cast.hpp"
+
+#include "libtorrent/aux_/disable_warnings_push.hpp"
+#include <boost/crc.hpp>
+#include "libtorrent/aux_/disable_warnings_pop.hpp"
+
+namespace libtorrent { namespace aux {
+
+namespace {
+
+	char const binary_resume_magic[4] = {'L', 'T', 'R', 'B'};
+
+	// the torrent flags saved in resume data. These are the same ones the
+	// bencoded format stores
+	constexpr torrent_flags_t resume_flags = torrent_flags::seed_mode
+		| torrent_flags::super_seeding | torrent_flags::auto_managed
+		| torrent_flags::sequential_download | torrent_flags::paused;
+
+	std::uint32_t checksum(char const* p, std::size_t const len)
+	{
+		boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true> crc;
+		crc.process_bytes(p, len);
+		return crc.checksum();
+	}
+
+	int write_varint(char* out, std::uint64_t v)
+	{
+		int n = 0;
+		while (v >= 0x80)
+		{
+			out[n++] = char((v & 0x7f) | 0x80);
+			v >>= 7;
+		}
+		out[n++] = char(v);
+		return n;
+	}
+
+	std::uint64_t zigzag(std::int64_t const v)
+	{ return (std::uint64_t(v) << 1) ^ std::uint64_t(v >> 63); }
+
+	std::int64_t unzigzag(std::uint64_t const v)
+	{ return std::int64_t(v >> 1) ^ -std::int64_t(v & 1); }
+
+	int num_bytes(bitfield const& bf) { return (bf.size() + 7) / 8; }
+
+	// appends fields to a record's payload
+	struct field_writer
+	{
+		explicit field_writer(std::vector<char>& buf) : m_buf(buf) {}
+
+		// the length of a field isn't known until it's been written. Since most
+		// fields are short, one byte is reserved for it and the payload is
+		// shifted in the rare case it needs more
+		void begin(resume_field const f)
+		{
+			TORRENT_ASSERT(m_start == 0);
+			varint(std::uint8_t(f));
+			m_buf.push_back('\0');
+			m_start = m_buf.size();
+		}
+
+		void end()
+		{
+			TORRENT_ASSERT(m_start > 0);
+			std::size_t const len = m_buf.size() - m_start;
+			char tmp[10];
+			int const n = write_varint(tmp, len);
+			if (n > 1)
+				m_buf.insert(m_buf.begin() + std::ptrdiff_t(m_start), tmp + 1, tmp + n);
+			std::memcpy(&m_buf[m_start - 1], tmp, std::size_t(n));
+			m_start = 0;
+		}
+
+		void varint(std::uint64_t const v)
+		{
+			char tmp[10];
+			int const n = write_varint(tmp, v);
+			m_buf.insert(m_buf.end(), tmp, tmp + n);
+		}
+
+		void u8(std::uint8_t const v) { m_buf.push_back(char(v)); }
+
+		void raw(char const* p, std::size_t const len)
+		{ m_buf.insert(m_buf.end(), p, p + len); }
+
+		void string(std::string const& s)
+		{
+			varint(s.size());
+			raw(s.data(), s.size());
+		}
+
+		void endpoint(tcp::endpoint const& ep)
+		{
+			u8(ep.address().is_v4() ? 4 : 6);
+			char tmp[18];
+			char* ptr = tmp;
+			detail::write_endpoint(ep, ptr);
+			raw(tmp, std::size_t(ptr - tmp));
+		}
+
+		void bits(bitfield const& bf)
+		{
+			varint(std::uint64_t(bf.size()));
+			raw(bf.data(), std::size_t(num_bytes(bf)));
+		}
+
+		// convenience functions for fields with a single value
+		void integer(resume_field const f, std::int64_t const v)
+		{
+			begin(f);
+			varint(zigzag(v));
+			end();
+		}
+
+		void bytes(resume_field const f, char const* p, std::size_t const len)
+		{
+			begin(f);
+			raw(p, len);
+			end();
+		}
+
+	private:
+		std::vector<char>& m_buf;
+		std::size_t m_start = 0;
+	};
+
+	void write_trackers(field_writer& w, add_torrent_params const& atp)
+	{
+		w.begin(resume_field::trackers);
+		w.varint(atp.trackers.size());
+		int tier = 0;
+		auto tier_it = atp.tracker_tiers.begin();
+		for (std::string const& tr : atp.trackers)
+		{
+			if (tier_it != atp.tracker_tiers.end())
+				tier = aux::clamp(*tier_it++, 0, 1024);
+			w.varint(std::uint64_t(tier));
+			w.string(tr);
+		}
+		w.end();
+	}
+
+	void write_strings(field_writer& w, resume_field const f
+		, std::vector<std::string> const& v)
+	{
+		w.begin(f);
+		w.varint(v.size());
+		for (auto const& s : v) w.string(s);
+		w.end();
+	}
+
+	void write_endpoints(field_writer& w, resume_field const f
+		, std::vector<tcp::endpoint> const& v)
+	{
+		w.begin(f);
+		w.varint(v.size());
+		for (auto const& ep : v) w.endpoint(ep);
+		w.end();
+	}
+
+	void write_renamed_files(field_writer& w
+		, std::map<file_index_t, std::string> const& files)
+	{
+		w.begin(resume_field::renamed_files);
+		w.varint(files.size());
+		for (auto const& f : files)
+		{
+			w.varint(std::uint64_t(static_cast<int>(f.first)));
+			w.string(f.second);
+		}
+		w.end();
+	}
+
+	void write_unfinished(field_writer& w
+		, std::map<piece_index_t, bitfield> const& pieces)
+	{
+		w.begin(resume_field::unfinished_pieces);
+		w.varint(pieces.size());
+		for (auto const& p : pieces)
+		{
+			w.varint(std::uint64_t(static_cast<int>(p.first)));
+			w.bits(p.second);
+		}
+		w.end();
+	}
+
+	void write_priorities(field_writer& w, resume_field const f
+		, std::vector<download_priority_t> const& prio)
+	{
+		w.begin(f);
+		for (auto const p : prio) w.u8(static_cast<std::uint8_t>(p));
+		w.end();
+	}
+
+	void write_pieces(field_writer& w, add_torrent_params const& atp)
+	{
+		w.begin(resume_field::have_pieces);
+		w.bits(atp.have_pieces);
+		w.end();
+		w.begin(resume_field::verified_pieces);
+		w.bits(atp.verified_pieces);
+		w.end();
+	}
+
+	void write_snapshots(field_writer& w, std::vector<file_snapshot> const& files)
+	{
+		w.begin(resume_field::file_snapshots);
+		w.varint(files.size());
+		for (auto const& f : files)
+		{
+			w.varint(zigzag(f.size));
+			w.varint(zigzag(f.mtime));
+			w.varint(f.inode);
+		}
+		w.end();
+	}
+
+	bool has_metadata(add_torrent_params const& atp)
+	{
+		return atp.ti && atp.ti->metadata() && atp.ti->metadata_size() > 0;
+	}
+
+	void write_info(field_writer& w, add_torrent_params const& atp)
+	{
+		w.bytes(resume_field::info, atp.ti->metadata().get()
+			, std::size_t(atp.ti->metadata_size()));
+	}
+
+	void write_merkle_tree(field_writer& w, add_torrent_params const& atp)
+	{
+		w.bytes(resume_field::merkle_tree
+			, atp.merkle_tree.empty() ? nullptr : atp.merkle_tree[0].data()
+			, atp.merkle_tree.size() * 20);
+	}
+
+	std::int64_t saved_flags(add_torrent_params const& atp)
+	{
+		return std::int64_t(static_cast<std::uint64_t>(atp.flags & resume_flags));
+	}
+
+	// the scalar fields, shared by checkpoints and deltas
+	struct int_field
+	{
+		resume_field field;
+		std::int64_t (*get)(add_torrent_params const&);
+	};
+
+#define TORRENT_INT_FIELD(name, expr) \
+	int_field{resume_field::name, [](add_torrent_params const& p) { return std::int64_t(expr); }}
+
+	int_field const int_fields[] = {
+		TORRENT_INT_FIELD(storage_mode, p.storage_mode),
+		TORRENT_INT_FIELD(flags, saved_flags(p)),
+		TORRENT_INT_FIELD(total_uploaded, p.total_uploaded),
+		TORRENT_INT_FIELD(total_downloaded, p.total_downloaded),
+		TORRENT_INT_FIELD(active_time, p.active_time),
+		TORRENT_INT_FIELD(finished_time, p.finished_time),
+		TORRENT_INT_FIELD(seeding_time, p.seeding_time),
+		TORRENT_INT_FIELD(last_seen_complete, p.last_seen_complete),
+		TORRENT_INT_FIELD(added_time, p.added_time),
+		TORRENT_INT_FIELD(completed_time, p.completed_time),
+		TORRENT_INT_FIELD(num_complete, p.num_complete),
+		TORRENT_INT_FIELD(num_incomplete, p.num_incomplete),
+		TORRENT_INT_FIELD(num_downloaded, p.num_downloaded),
+		TORRENT_INT_FIELD(upload_limit, p.upload_limit),
+		TORRENT_INT_FIELD(download_limit, p.download_limit),
+		TORRENT_INT_FIELD(max_connections, p.max_connections),
+		TORRENT_INT_FIELD(max_uploads, p.max_uploads),
+	};
+
+#undef TORRENT_INT_FIELD
+
+	std::vector<char> start_record(record_kind const kind)
+	{
+		std::vector<char> ret(static_cast<std::size_t>(binary_resume_header_size));
+		std::memcpy(ret.data(), binary_resume_magic, 4);
+		ret[4] = char(binary_resume_version);
+		ret[5] = char(kind);
+		return ret;
+	}
+
+	void finish_record(std::vector<char>& rec)
+	{
+		std::size_t const len = rec.size() - std::size_t(binary_resume_header_size);
+		char* ptr = rec.data() + 6;
+		detail::write_uint32(std::uint32_t(len), ptr);
+		detail::write_uint32(checksum(rec.data() + binary_resume_header_size, len), ptr);
+	}
+
+	bool same_bits(bitfield const& lhs, bitfield const& rhs)
+	{
+		return lhs.size() == rhs.size()
+			&& (lhs.size() == 0 || std::memcmp(lhs.data(), rhs.data()
+				, std::size_t(num_bytes(lhs))) == 0);
+	}
+
+	template <typename T>
+	std::size_t varint_size(T const v)
+	{
+		std::size_t n = 1;
+		for (auto i = std::uint64_t(v); i >= 0x80; i >>= 7) ++n;
+		return n;
+	}
+
+	// writes either the piece_changes field, or the full bitfields, whichever
+	// is smaller
+	void write_piece_delta(field_writer& w, add_torrent_params const& prev
+		, add_torrent_params const& atp)
+	{
+		bool const have_same = same_bits(prev.have_pieces, atp.have_pieces);
+		bool const verified_same = same_bits(prev.verified_pieces, atp.verified_pieces);
+		if (have_same && verified_same) return;
+
+		if (prev.have_pieces.size() != atp.have_pieces.size()
+			|| prev.verified_pieces.size() != atp.verified_pieces.size())
+		{
+			write_pieces(w, atp);
+			return;
+		}
+
+		// only look at the bits in bytes that differ
+		std::vector<int> changed;
+		int const num_bits = std::max(atp.have_pieces.size(), atp.verified_pieces.size());
+		auto const collect = [&](bitfield const& a, bitfield const& b)
+		{
+			char const* pa = a.data();
+			char const* pb = b.data();
+			for (int i = 0; i < num_bytes(a); ++i)
+			{
+				if (pa[i] == pb[i]) continue;
+				for (int k = 0; k < 8; ++k)
+				{
+					int const bit = i * 8 + k;
+					if (bit < a.size() && a.get_bit(bit) != b.get_bit(bit))
+						changed.push_back(bit);
+				}
+			}
+		};
+		if (!have_same) collect(prev.have_pieces, atp.have_pieces);
+		if (!verified_same) collect(prev.verified_pieces, atp.verified_pieces);
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+		std::size_t delta_size = varint_size(changed.size());
+		int last = -1;
+		for (int const p : changed)
+		{
+			delta_size += varint_size(p - last - 1) + 1;
+			last = p;
+		}
+
+		std::size_t const full_size = std::size_t(num_bytes(atp.have_pieces)
+			+ num_bytes(atp.verified_pieces)) + 2 * varint_size(num_bits);
+		if (delta_size >= full_size)
+		{
+			write_pieces(w, atp);
+			return;
+		}
+
+		w.begin(resume_field::piece_changes);
+		w.varint(changed.size());
+		last = -1;
+		for (int const p : changed)
+		{
+			std::uint8_t state = 0;
+			if (p < atp.have_pieces.size() && atp.have_pieces.get_bit(p)) state |= 1;
+			if (p < atp.verified_pieces.size() && atp.verified_pieces.get_bit(p)) state |= 2;
+			w.varint(std::uint64_t(p - last - 1));
+			w.u8(state);
+			last = p;
+		}
+		w.end();
+	}
+
+	// writes either the list of changed priorities, or all of them, whichever
+	// is smaller
+	void write_priority_delta(field_writer& w, resume_field const full
+		, resume_field const changes
+		, std::vector<download_priority_t> const& prev
+		, std::vector<download_priority_t> const& cur)
+	{
+		if (prev == cur) return;
+		if (prev.size() != cur.size())
+		{
+			write_priorities(w, full, cur);
+			return;
+		}
+
+		std::vector<std::size_t> changed;
+		std::size_t delta_size = 0;
+		std::size_t last = 0;
+		for (std::size_t i = 0; i < cur.size(); ++i)
+		{
+			if (prev[i] == cur[i]) continue;
+			changed.push_back(i);
+			delta_size += varint_size(i - last) + 1;
+			last = i + 1;
+		}
+
+		if (delta_size + varint_size(changed.size()) >= cur.size())
+		{
+			write_priorities(w, full, cur);
+			return;
+		}
+
+		w.begin(changes);
+		w.varint(changed.size());
+		last = 0;
+		for (std::size_t const i : changed)
+		{
+			w.varint(i - last);
+			w.u8(static_cast<std::uint8_t>(cur[i]));
+			last = i + 1;
+		}
+		w.end();
+	}
+
+	// reads values out of a record payload, or a field. Any attempt to read
+	// past the end marks the reader as failed, and subsequent reads return
+	// zeroes
+	struct field_reader
+	{
+		field_reader(char const* p, char const* end) : m_ptr(p), m_end(end) {}
+
+		bool ok() const { return m_ok; }
+		bool empty() const { return m_ptr == m_end; }
+		std::size_t remaining() const { return std::size_t(m_end - m_ptr); }
+
+		std::uint64_t varint()
+		{
+			std::uint64_t ret = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				if (m_ptr == m_end) return fail();
+				std::uint8_t const b = std::uint8_t(*m_ptr++);
+				ret |= std::uint64_t(b & 0x7f) << shift;
+				if ((b & 0x80) == 0) return ret;
+			}
+			return fail();
+		}
+
+		// reads a varint used as a count or an index, and makes sure it's
+		// within [0, limit]
+		int bounded(std::size_t const limit)
+		{
+			std::uint64_t const v = varint();
+			if (v > limit) return int(fail());
+			return int(v);
+		}
+
+		std::int64_t integer() { return unzigzag(varint()); }
+
+		std::uint8_t u8()
+		{
+			if (m_ptr == m_end) return std::uint8_t(fail());
+			return std::uint8_t(*m_ptr++);
+		}
+
+		char const* raw(std::size_t const len)
+		{
+			if (remaining() < len) { fail(); return nullptr; }
+			char const* ret = m_ptr;
+			m_ptr += len;
+			return ret;
+		}
+
+		std::string string()
+		{
+			std::size_t const len = std::size_t(varint());
+			char const* p = raw(len);
+			return p ? std::string(p, len) : std::string();
+		}
+
+		bool endpoint(tcp::endpoint& ep)
+		{
+			std::uint8_t const family = u8();
+			if (family == 4)
+			{
+				char const* p = raw(6);
+				if (p == nullptr) return false;
+				ep = detail::read_v4_endpoint<tcp::endpoint>(p);
+				return true;
+			}
+#if TORRENT_USE_IPV6
+			if (family == 6)
+			{
+				char const* p = raw(18);
+				if (p == nullptr) return false;
+				ep = detail::read_v6_endpoint<tcp::endpoint>(p);
+				return true;
+			}
+#endif
+			fail();
+			return false;
+		}
+
+		bool bits(bitfield& bf)
+		{
+			// no torrent has more pieces (or blocks per piece) than fit in an int
+			int const num_bits = bounded(std::size_t(std::numeric_limits<int>::max() - 7));
+			char const* p = raw(std::size_t(num_bits + 7) / 8);
+			if (p == nullptr) return false;
+			bf.assign(p, num_bits);
+			return true;
+		}
+
+		std::uint64_t fail()
+		{
+			m_ok = false;
+			m_ptr = m_end;
+			return 0;
+		}
+
+	private:
+		char const* m_ptr;
+		char const* m_end;
+		bool m_ok = true;
+	};
+
+	download_priority_t clamp_priority(std::uint8_t const p)
+	{
+		return download_priority_t(aux::clamp(p
+			, static_cast<std::uint8_t>(dont_download)
+			, static_cast<std::uint8_t>(top_priority)));
+	}
+
+	void read_priorities(field_reader& r, std::vector<download_priority_t>& prio)
+	{
+		std::size_t const n = r.remaining();
+		char const* p = r.raw(n);
+		prio.resize(n);
+		for (std::size_t i = 0; i < n; ++i)
+			prio[i] = clamp_priority(std::uint8_t(p[i]));
+	}
+
+	void read_priority_changes(field_reader& r, std::vector<download_priority_t>& prio)
+	{
+		int const n = r.bounded(prio.size());
+		std::size_t idx = 0;
+		for (int i = 0; i < n && r.ok(); ++i)
+		{
+			idx += std::size_t(r.varint());
+			download_priority_t const p = clamp_priority(r.u8());
+			if (!r.ok() || idx >= prio.size()) break;
+			prio[idx] = p;
+			++idx;
+		}
+	}
+
+	void read_piece_changes(field_reader& r, add_torrent_params& atp)
+	{
+		std::size_t const num_pieces = std::size_t(std::max(atp.have_pieces.size()
+			, atp.verified_pieces.size()));
+		int const n = r.bounded(num_pieces);
+		std::size_t idx = 0;
+		for (int i = 0; i < n && r.ok(); ++i)
+		{
+			// every step has to land on a piece. A step past the end (or one
+			// large enough to wrap around) fails the record
+			if (idx >= num_pieces) { r.fail(); break; }
+			idx += std::size_t(r.bounded(num_pieces - 1 - idx));
+			std::uint8_t const state = r.u8();
+			if (!r.ok()) break;
+			piece_index_t const p(static_cast<int>(idx));
+			if (p < atp.have_pieces.end_index())
+			{
+				if (state & 1) atp.have_pieces.set_bit(p);
+				else atp.have_pieces.clear_bit(p);
+			}
+			if (p < atp.verified_pieces.end_index())
+			{
+				if (state & 2) atp.verified_pieces.set_bit(p);
+				else atp.verified_pieces.clear_bit(p);
+			}
+			++idx;
+		}
+	}
+
+	// applies the fields of one record to ``atp``. ``info`` is set to the
+	// most recent info dictionary, which is parsed once all records have been
+	// applied
+	void apply_record(field_reader& rec, add_torrent_params& atp
+		, span<char const>& info)
+	{
+		while (!rec.empty() && rec.ok())
+		{
+			std::uint64_t const tag = rec.varint();
+			std::size_t const len = std::size_t(rec.varint());
+			char const* data = rec.raw(len);
+			if (data == nullptr) break;
+			field_reader r(data, data + len);
+
+			switch (resume_field(tag))
+			{
+				case resume_field::info_hash:
+					if (len == 20) atp.info_hash.assign(data);
+					break;
+				case resume_field::name: atp.name.assign(data, len); break;
+				case resume_field::save_path: atp.save_path.assign(data, len); break;
+				case resume_field::storage_mode:
+					atp.storage_mode = r.integer() == storage_mode_allocate
+						? storage_mode_allocate : storage_mode_sparse;
+					break;
+				case resume_field::flags:
+					atp.flags = (atp.flags & ~resume_flags)
+						| (torrent_flags_t(static_cast<std::uint64_t>(r.integer())) & resume_flags);
+					break;
+				case resume_field::info: info = {data, len}; break;
+				case resume_field::merkle_tree:
+					atp.merkle_tree.resize(len / 20);
+					if (!atp.merkle_tree.empty())
+						std::memcpy(atp.merkle_tree[0].data(), data, atp.merkle_tree.size() * 20);
+					break;
+				case resume_field::total_uploaded: atp.total_uploaded = r.integer(); break;
+				case resume_field::total_downloaded: atp.total_downloaded = r.integer(); break;
+				case resume_field::active_time: atp.active_time = int(r.integer()); break;
+				case resume_field::finished_time: atp.finished_time = int(r.integer()); break;
+				case resume_field::seeding_time: atp.seeding_time = int(r.integer()); break;
+				case resume_field::last_seen_complete: atp.last_seen_complete = std::time_t(r.integer()); break;
+				case resume_field::added_time: atp.added_time = std::time_t(r.integer()); break;
+				case resume_field::completed_time: atp.completed_time = std::time_t(r.integer()); break;
+				case resume_field::num_complete: atp.num_complete = int(r.integer()); break;
+				case resume_field::num_incomplete: atp.num_incomplete = int(r.integer()); break;
+				case resume_field::num_downloaded: atp.num_downloaded = int(r.integer()); break;
+				case resume_field::upload_limit: atp.upload_limit = int(r.integer()); break;
+				case resume_field::download_limit: atp.download_limit = int(r.integer()); break;
+				case resume_field::max_connections: atp.max_connections = int(r.integer()); break;
+				case resume_field::max_uploads: atp.max_uploads = int(r.integer()); break;
+				case resume_field::have_pieces:
+					r.bits(atp.have_pieces);
+					break;
+				case resume_field::verified_pieces:
+					r.bits(atp.verified_pieces);
+					break;
+				case resume_field::piece_changes:
+					read_piece_changes(r, atp);
+					break;
+				case resume_field::unfinished_pieces:
+				{
+					atp.unfinished_pieces.clear();
+					int const n = r.bounded(len);
+					for (int i = 0; i < n && r.ok(); ++i)
+					{
+						int const piece = r.bounded(std::size_t(std::numeric_limits<int>::max()));
+						bitfield bf;
+						if (!r.bits(bf)) break;
+						atp.unfinished_pieces[piece_index_t(piece)] = std::move(bf);
+					}
+					break;
+				}
+				case resume_field::trackers:
+				{
+					atp.trackers.clear();
+					atp.tracker_tiers.clear();
+					int const n = r.bounded(len);
+					for (int i = 0; i < n && r.ok(); ++i)
+					{
+						int const tier = r.bounded(1024);
+						std::string url = r.string();
+						if (!r.ok()) break;
+						atp.trackers.push_back(std::move(url));
+						atp.tracker_tiers.push_back(tier);
+					}
+					// checkpoints leave out empty lists, which means the trackers
+					// from the .torrent file are used. An empty list in a delta
+					// means the same thing
+					if (atp.trackers.empty()) atp.flags &= ~torrent_flags::override_trackers;
+					else atp.flags |= torrent_flags::override_trackers;
+					break;
+				}
+				case resume_field::url_seeds:
+				case resume_field::http_seeds:
+				{
+					auto& seeds = resume_field(tag) == resume_field::url_seeds
+						? atp.url_seeds : atp.http_seeds;
+					seeds.clear();
+					int const n = r.bounded(len);
+					for (int i = 0; i < n && r.ok(); ++i)
+					{
+						std::string url = r.string();
+						if (!r.ok()) break;
+						if (!url.empty()) seeds.push_back(std::move(url));
+					}
+					// just like trackers, empty lists don't override the web
+					// seeds from the .torrent file
+					if (atp.url_seeds.empty() && atp.http_seeds.empty())
+						atp.flags &= ~torrent_flags::override_web_seeds;
+					else
+						atp.flags |= torrent_flags::override_web_seeds;
+					break;
+				}
+				case resume_field::peers:
+				case resume_field::banned_peers:
+				{
+					auto& peers = resume_field(tag) == resume_field::peers
+						? atp.peers : atp.banned_peers;
+					peers.clear();
+					int const n = r.bounded(len);
+					for (int i = 0; i < n && r.ok(); ++i)
+					{
+						tcp::endpoint ep;
+						if (r.endpoint(ep)) peers.push_back(ep);
+					}
+					break;
+				}
+				case resume_field::renamed_files:
+				{
+					atp.renamed_files.clear();
+					int const n = r.bounded(len);
+					for (int i = 0; i < n && r.ok(); ++i)
+					{
+						int const idx = r.bounded(std::size_t(std::numeric_limits<int>::max()));
+						std::string name = r.string();
+						if (!r.ok()) break;
+						if (!name.empty()) atp.renamed_files[file_index_t(idx)] = std::move(name);
+					}
+					break;
+				}
+				case resume_field::file_priorities:
+					read_priorities(r, atp.file_priorities);
+					break;
+				case resume_field::piece_priorities:
+					read_priorities(r, atp.piece_priorities);
+					break;
+				case resume_field::file_priority_changes:
+					read_priority_changes(r, atp.file_priorities);
+					break;
+				case resume_field::piece_priority_changes:
+					read_priority_changes(r, atp.piece_priorities);
+					break;
+				case resume_field::file_snapshots:
+				{
+					atp.file_snapshots.clear();
+					int const n = r.bounded(len);
+					for (int i = 0; i < n && r.ok(); ++i)
+					{
+						file_snapshot f;
+						f.size = r.integer();
+						f.mtime = r.integer();
+						f.inode = r.varint();
+						if (!r.ok()) break;
+						atp.file_snapshots.push_back(f);
+					}
+					break;
+				}
+				default:
+					// a field from a later version of the format. skip it
+					break;
+			}
+
+			// a field that doesn't parse fails the whole record
+			if (!r.ok()) rec.fail();
+		}
+	}
+}
+
+	bool is_binary_resume_data(span<char const> const buf)
+	{
+		return buf.size() >= binary_resume_header_size
+			&& std::memcmp(buf.data(), binary_resume_magic, 4) == 0;
+	}
+
+	std::vector<char> write_binary_resume_data(add_torrent_params const& atp)
+	{
+		std::vector<char> ret = start_record(record_kind::checkpoint);
+		ret.reserve(std::size_t(256
+			+ (has_metadata(atp) ? atp.ti->metadata_size() : 0)
+			+ num_bytes(atp.have_pieces) * 2
+			+ int(atp.piece_priorities.size())));
+		field_writer w(ret);
+
+		w.bytes(resume_field::info_hash, atp.info_hash.data(), atp.info_hash.size());
+		if (!atp.name.empty())
+			w.bytes(resume_field::name, atp.name.data(), atp.name.size());
+		w.bytes(resume_field::save_path, atp.save_path.data(), atp.save_path.size());
+		for (auto const& f : int_fields) w.integer(f.field, f.get(atp));
+
+		if (has_metadata(atp)) write_info(w, atp);
+		if (!atp.merkle_tree.empty()) write_merkle_tree(w, atp);
+
+		write_pieces(w, atp);
+		if (!atp.unfinished_pieces.empty()) write_unfinished(w, atp.unfinished_pieces);
+
+		// like the bencoded format, empty lists are left out, which means
+		// they won't override the ones from the .torrent file
+		if (!atp.trackers.empty()) write_trackers(w, atp);
+		if (!atp.url_seeds.empty()) write_strings(w, resume_field::url_seeds, atp.url_seeds);
+		if (!atp.http_seeds.empty()) write_strings(w, resume_field::http_seeds, atp.http_seeds);
+		if (!atp.peers.empty()) write_endpoints(w, resume_field::peers, atp.peers);
+		if (!atp.banned_peers.empty()) write_endpoints(w, resume_field::banned_peers, atp.banned_peers);
+		if (!atp.renamed_files.empty()) write_renamed_files(w, atp.renamed_files);
+
+		if (!atp.file_priorities.empty())
+			write_priorities(w, resume_field::file_priorities, atp.file_priorities);
+		if (!atp.piece_priorities.empty())
+			write_priorities(w, resume_field::piece_priorities, atp.piece_priorities);
+		if (!atp.file_snapshots.empty()) write_snapshots(w, atp.file_snapshots);
+
+		finish_record(ret);
+		return ret;
+	}
+
+	std::vector<char> write_binary_resume_delta(add_torrent_params const& prev
+		, add_torrent_params const& atp)
+	{
+		std::vector<char> ret = start_record(record_kind::delta);
+		field_writer w(ret);
+
+		// the info-hash is always included, to catch deltas being applied to
+		// the wrong torrent
+		w.bytes(resume_field::info_hash, atp.info_hash.data(), atp.info_hash.size());
+
+		if (prev.name != atp.name)
+			w.bytes(resume_field::name, atp.name.data(), atp.name.size());
+		if (prev.save_path != atp.save_path)
+			w.bytes(resume_field::save_path, atp.save_path.data(), atp.save_path.size());
+
+		for (auto const& f : int_fields)
+		{
+			std::int64_t const v = f.get(atp);
+			if (v != f.get(prev)) w.integer(f.field, v);
+		}
+
+		if (has_metadata(atp) && (!has_metadata(prev)
+			|| (prev.ti != atp.ti && (prev.ti->metadata_size() != atp.ti->metadata_size()
+				|| std::memcmp(prev.ti->metadata().get(), atp.ti->metadata().get()
+					, std::size_t(atp.ti->metadata_size())) != 0))))
+		{
+			write_info(w, atp);
+		}
+
+		if (prev.merkle_tree != atp.merkle_tree) write_merkle_tree(w, atp);
+
+		write_piece_delta(w, prev, atp);
+
+		if (prev.unfinished_pieces.size() != atp.unfinished_pieces.size()
+			|| !std::equal(prev.unfinished_pieces.begin(), prev.unfinished_pieces.end()
+				, atp.unfinished_pieces.begin()
+				, [](std::pair<piece_index_t const, bitfield> const& lhs
+					, std::pair<piece_index_t const, bitfield> const& rhs)
+				{ return lhs.first == rhs.first && same_bits(lhs.second, rhs.second); }))
+		{
+			write_unfinished(w, atp.unfinished_pieces);
+		}
+
+		if (prev.trackers != atp.trackers || prev.tracker_tiers != atp.tracker_tiers)
+			write_trackers(w, atp);
+		if (prev.url_seeds != atp.url_seeds)
+			write_strings(w, resume_field::url_seeds, atp.url_seeds);
+		if (prev.http_seeds != atp.http_seeds)
+			write_strings(w, resume_field::http_seeds, atp.http_seeds);
+		if (prev.peers != atp.peers)
+			write_endpoints(w, resume_field::peers, atp.peers);
+		if (prev.banned_peers != atp.banned_peers)
+			write_endpoints(w, resume_field::banned_peers, atp.banned_peers);
+		if (prev.renamed_files != atp.renamed_files)
+			write_renamed_files(w, atp.renamed_files);
+
+		write_priority_delta(w, resume_field::file_priorities
+			, resume_field::file_priority_changes, prev.file_priorities, atp.file_priorities);
+		write_priority_delta(w, resume_field::piece_priorities
+			, resume_field::piece_priority_changes, prev.piece_priorities, atp.piece_priorities);
+
+		if (prev.file_snapshots != atp.file_snapshots)
+			write_snapshots(w, atp.file_snapshots);
+
+		finish_record(ret);
+		return ret;
+	}
+
+	add_torrent_params read_binary_resume_data(span<char const> buf, error_code& ec)
+	{
+		add_torrent_params ret;
+		span<char const> info;
+		bool first = true;
+
+		while (buf.size() >= binary_resume_header_size)
+		{
+			char const* ptr = buf.data();
+			bool const valid_header = std::memcmp(ptr, binary_resume_magic, 4) == 0
+				&& std::uint8_t(ptr[4]) == binary_resume_version;
+			record_kind const kind = record_kind(std::uint8_t(ptr[5]));
+			ptr += 6;
+			std::size_t const len = detail::read_uint32(ptr);
+			std::uint32_t const crc = detail::read_uint32(ptr);
+			std::size_t const available = std::size_t(buf.size() - binary_resume_header_size);
+
+			// a record that was only partially written (or that we don't
+			// understand, or with a field that doesn't parse) ends the log. Only
+			// the checkpoint is required to be intact
+			bool intact = valid_header
+				&& len <= available
+				&& checksum(ptr, len) == crc
+				&& (!first || kind == record_kind::checkpoint);
+
+			// the record is applied to a copy, to be able to drop it if one of
+			// its fields turns out to be invalid. A checkpoint later in the log
+			// supersedes everything before it
+			add_torrent_params next;
+			span<char const> next_info;
+			if (intact)
+			{
+				if (kind != record_kind::checkpoint)
+				{
+					next = ret;
+					next_info = info;
+				}
+				field_reader rec(ptr, ptr + len);
+				apply_record(rec, next, next_info);
+				intact = rec.ok();
+			}
+
+			if (!intact)
+			{
+				if (first)
+				{
+					ec = errors::invalid_file_tag;
+					return ret;
+				}
+				break;
+			}
+
+			sha1_hash const prev_ih = ret.info_hash;
+			ret = std::move(next);
+			info = next_info;
+
+			if (!first && kind == record_kind::delta && ret.info_hash != prev_ih)
+			{
+				ec = errors::mismatching_info_hash;
+				return ret;
+			}
+
+			first = false;
+			buf = buf.subspan(binary_resume_header_size + std::ptrdiff_t(len));
+		}
+
+		if (first)
+		{
+			ec = errors::invalid_file_tag;
+			return ret;
+		}
+
+		if (ret.info_hash.is_all_zeros())
+		{
+			ec = errors::missing_info_hash;
+			return ret;
+		}
+
+		if (!info.empty())
+		{
+			// like with bencoded resume data, the metadata is only used if it
+			// matches the info-hash
+			sha1_hash const resume_ih = hasher(info).final();
+			if (resume_ih == ret.info_hash)
+			{
+				error_code err;
+				bdecode_node const info_node = bdecode(info, err);
+				if (!err)
+				{
+					ret.ti = std::make_shared<torrent_info>(resume_ih);
+					if (!ret.ti->parse_info_section(info_node, err)) ec = err;
+				}
+			}
+		}
+
+		// this is suspicious, leave seed mode
+		for (auto const p : ret.file_priorities)
+		{
+			if (p != dont_download) continue;
+			ret.flags &= ~torrent_flags::seed_mode;
+			break;
+		}
+
+		ret.flags &= ~torrent_flags::need_save_resume;
+		return ret;
+	}
+}}
@@ -782,6 +782,9 @@ namespace {
 	void session_handle::set_ip_filter(ip_filter const& f)
 	{
 		std::shared_ptr<ip_filter> copy = std::make_shared<ip_filter>(f);
+		// build the lookup table here, rather than on the network thread. The
+		// session swaps in the new filter once it's ready
+		copy->compile();
 		async_call(&session_impl::set_ip_filter, copy);
 	}
 
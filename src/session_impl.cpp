@@ -1010,6 +1010,7 @@ namespace aux {
 		INVARIANT_CHECK;
 
 		m_ip_filter = f;
+		m_ip_filter_dirty = false;
 
 		// Close connections whose endpoint is filtered
 		// by the new ip-filter
@@ -1022,6 +1023,7 @@ namespace aux {
 		TORRENT_ASSERT(is_single_thread());
 		if (!m_ip_filter) m_ip_filter = std::make_shared<ip_filter>();
 		m_ip_filter->add_rule(addr, addr, ip_filter::blocked);
+		m_ip_filter_dirty = true;
 		for (auto& i : m_torrents)
 			i.second->set_ip_filter(m_ip_filter);
 	}
@@ -1190,6 +1192,7 @@ namespace {
 	{
 		INVARIANT_CHECK;
 		m_peer_class_filter = f;
+		m_peer_class_filter.compile();
 	}
 
 	ip_filter const& session_impl::get_peer_class_filter() const
@@ -3282,6 +3285,12 @@ namespace {
 		m_ssl_utp_socket_manager.decay();
 #endif
 
+		if (m_ip_filter_dirty)
+		{
+			m_ip_filter_dirty = false;
+			if (m_ip_filter) m_ip_filter->compile();
+		}
+
 		int const tick_interval_ms = aux::numeric_cast<int>(total_milliseconds(now - m_last_second_tick));
 		m_last_second_tick = now;
 
@@ -6883,6 +6892,15 @@ namespace {
 		return false;
 	}
 
+	bool session_impl::has_dht_request_handlers() const
+	{
+#ifndef TORRENT_DISABLE_EXTENSIONS
+		return !m_ses_extensions[plugins_dht_request_idx].empty();
+#else
+		return false;
+#endif
+	}
+
 	void session_impl::set_external_address(address const& ip
 		, ip_source_t const source_type, address const& source)
 	{
@@ -119,6 +119,7 @@ namespace {
 
 		METRIC(peer, connection_attempts)
 		METRIC(peer, connection_attempt_loops)
+		METRIC(peer, connection_attempt_loops_saved)
 		METRIC(peer, incoming_connections)
 
 		// the number of peer connections for each kind of socket.
@@ -232,6 +233,17 @@ namespace {
 		METRIC(ses, num_piece_passed)
 		METRIC(ses, num_piece_failed)
 
+		// the smart ban plugin records a fingerprint of every block of a failed
+		// piece, to find the peer that sent bad data once the piece passes.
+		// These count the number of blocks it hashed, the time it spent
+		// hashing them (in microseconds), and the number of failed pieces it
+		// forgot to stay within its memory limit. ``smart_ban_memory`` is the
+		// number of bytes used by all torrents' tables
+		METRIC(ses, smart_ban_hashed_blocks)
+		METRIC(ses, smart_ban_hash_time)
+		METRIC(ses, smart_ban_evicted_pieces)
+		METRIC(ses, smart_ban_memory)
+
 		METRIC(ses, num_have_pieces)
 		METRIC(ses, num_total_pieces_added)
 
@@ -200,6 +200,7 @@ constexpr int CLOSE_FILE_INTERVAL = 0;
 		SET(auto_sequential, true, &session_impl::update_auto_sequential),
 		SET(proxy_tracker_connections, true, nullptr),
 		SET(enable_ip_notifier, true, &session_impl::update_ip_notifier),
+		SET(resume_file_snapshots, false, nullptr),
 	}});
 
 	aux::array<int_setting_entry_t, settings_pack::num_int_settings> const int_settings
@@ -336,6 +337,7 @@ constexpr int CLOSE_FILE_INTERVAL = 0;
 		SET(close_file_interval, CLOSE_FILE_INTERVAL, nullptr),
 		SET(max_web_seed_connections, 3, nullptr),
 		SET(resolver_cache_timeout, 1200, &session_impl::update_resolver_cache_timeout),
+		SET(smart_ban_memory_limit, 1024 * 1024, nullptr),
 	}});
 
 #undef SET
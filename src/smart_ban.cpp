@@ -33,11 +33,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_DISABLE_EXTENSIONS
 
 #include <vector>
-#include <map>
 #include <utility>
 #include <numeric>
 #include <cstdio>
+#include <cstring>
 #include <functional>
+#include <algorithm>
+#include <memory>
+#include <cinttypes> // for PRIx64
 
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/torrent.hpp"
@@ -50,10 +53,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/peer_info.hpp"
 #include "libtorrent/random.hpp"
 #include "libtorrent/operations.hpp" // for operation_t enum
+#include "libtorrent/performance_counters.hpp" // for counters
+#include "libtorrent/aux_/smart_ban_table.hpp"
 
 #ifndef TORRENT_DISABLE_LOGGING
 #include "libtorrent/socket_io.hpp"
-#include "libtorrent/hex.hpp" // to_hex
 #endif
 
 using namespace std::placeholders;
@@ -64,6 +68,11 @@ class torrent;
 
 namespace {
 
+	// the fingerprint of a block is the first 8 bytes of the SHA-1 digest of
+	// the block and the salt. Since the salt is secret, a peer can't forge
+	// data that collides with the fingerprint of the good data.
+	using fingerprint_t = aux::block_fingerprint;
+	using block_entry = aux::smart_ban_block;
 
 	struct smart_ban_plugin final
 		: torrent_plugin
@@ -71,64 +80,42 @@ namespace {
 	{
 		explicit smart_ban_plugin(torrent& t)
 			: m_torrent(t)
+			, m_counters(t.session().stats_counters())
+			, m_table(m_counters)
 			, m_salt(random(0xffffffff))
 		{}
 
 		void on_piece_pass(piece_index_t const p) override
 		{
 #ifndef TORRENT_DISABLE_LOGGING
-			m_torrent.debug_log(" PIECE PASS [ p: %d | block_hash_size: %d ]"
-				, static_cast<int>(p), int(m_block_hashes.size()));
+			m_torrent.debug_log(" PIECE PASS [ p: %d | failed_pieces: %d | memory: %d ]"
+				, static_cast<int>(p), m_table.num_pieces(), int(m_table.memory()));
 #endif
-			// has this piece failed earlier? If it has, go through the
-			// CRCs from the time it failed and ban the peers that
-			// sent bad blocks
-			std::map<piece_block, block_entry>::iterator i = m_block_hashes.lower_bound(piece_block(p, 0));
-			if (i == m_block_hashes.end() || i->first.piece_index != p) return;
-
-			int size = m_torrent.torrent_file().piece_size(p);
-			peer_request r = {p, 0, (std::min)(16 * 1024, size)};
-			piece_block pb(p, 0);
-			while (size > 0)
+			// has this piece failed earlier? If it has, read it back and
+			// compare the blocks against the ones we recorded when it failed,
+			// and ban the peers that sent bad blocks
+			std::vector<block_entry> const blocks = m_table.piece_passed(p);
+			if (!blocks.empty())
 			{
-				if (i->first.block_index == pb.block_index)
+				auto batch = std::make_shared<read_batch>(p, true);
+				batch->blocks.resize(blocks.size());
+				for (std::size_t b = 0; b < blocks.size(); ++b)
 				{
-					m_torrent.session().disk_thread().async_read(m_torrent.storage()
-						, r, std::bind(&smart_ban_plugin::on_read_ok_block
-						, shared_from_this(), *i, i->second.peer->address(), _1, r.length, _2, _3));
-					i = m_block_hashes.erase(i);
+					block_entry const& e = blocks[b];
+					if (e.peer == nullptr) continue;
+					batch->blocks[b].stored = e;
+					batch->blocks[b].addr = e.peer->address();
 				}
-				else
-				{
-					TORRENT_ASSERT(i->first.block_index > pb.block_index);
-				}
-
-				if (i == m_block_hashes.end() || i->first.piece_index != p)
-					break;
-
-				r.start += 16 * 1024;
-				size -= 16 * 1024;
-				r.length = (std::min)(16 * 1024, size);
-				++pb.block_index;
+				read_piece(batch, {});
 			}
 
-#ifndef NDEBUG
-			// make sure we actually removed all the entries for piece 'p'
-			i = m_block_hashes.lower_bound(piece_block(p, 0));
-			TORRENT_ASSERT(i == m_block_hashes.end() || i->first.piece_index != p);
-#endif
-
-			if (m_torrent.is_seed())
-			{
-				std::map<piece_block, block_entry>().swap(m_block_hashes);
-				return;
-			}
+			if (m_torrent.is_seed()) m_table.clear();
 		}
 
-		void on_piece_failed(piece_index_t p) override
+		void on_piece_failed(piece_index_t const p) override
 		{
 			// The piece failed the hash check. Record
-			// the CRC and origin peer of every block
+			// the fingerprint and origin peer of every block
 
 			// if the torrent is aborted, no point in starting
 			// a bunch of read operations on it
@@ -137,185 +124,214 @@ namespace {
 			std::vector<torrent_peer*> downloaders;
 			m_torrent.picker().get_downloaders(downloaders, p);
 
-			int size = m_torrent.torrent_file().piece_size(p);
-			peer_request r = {p, 0, (std::min)(16*1024, size)};
-			piece_block pb(p, 0);
-			for (auto const& i : downloaders)
+			auto batch = std::make_shared<read_batch>(p, false);
+			batch->blocks.resize(downloaders.size());
+			for (std::size_t b = 0; b < downloaders.size(); ++b)
 			{
-				if (i != nullptr)
-				{
-					// for very sad and involved reasons, this read need to force a copy out of the cache
-					// since the piece has failed, this block is very likely to be replaced with a newly
-					// downloaded one very soon, and to get a block by reference would fail, since the
-					// block read will have been deleted by the time it gets back to the network thread
-					m_torrent.session().disk_thread().async_read(m_torrent.storage(), r
-						, std::bind(&smart_ban_plugin::on_read_failed_block
-						, shared_from_this(), pb, i->address(), _1, r.length, _2, _3)
-						, disk_interface::force_copy);
-				}
-
-				r.start += 16*1024;
-				size -= 16*1024;
-				r.length = (std::min)(16*1024, size);
-				++pb.block_index;
+				if (downloaders[b] == nullptr) continue;
+				batch->blocks[b].stored.peer = downloaders[b];
+				batch->blocks[b].addr = downloaders[b]->address();
 			}
-			TORRENT_ASSERT(size <= 0);
+
+			// for very sad and involved reasons, this read need to force a copy out of the cache
+			// since the piece has failed, this block is very likely to be replaced with a newly
+			// downloaded one very soon, and to get a block by reference would fail, since the
+			// block read will have been deleted by the time it gets back to the network thread
+			read_piece(batch, disk_interface::force_copy);
 		}
 
 	private:
 
-		// this entry ties a specific block CRC to
-		// a peer.
-		struct block_entry
+		// the blocks of a piece being read back from disk. When the last
+		// block has been read and hashed, the batch is checked against the
+		// table in one go
+		struct read_batch
 		{
-			torrent_peer* peer;
-			sha1_hash digest;
+			read_batch(piece_index_t const p, bool const pass)
+				: piece(p), passed(pass) {}
+
+			struct block
+			{
+				// when the piece passed, this is the entry recorded when it
+				// failed. Otherwise it's the peer that sent us the block. The
+				// fingerprint is only valid if ``stored.peer`` is set
+				block_entry stored{nullptr, 0};
+
+				// the address of the peer, used to look the peer up again
+				// once the read completes, since it may be gone by then
+				address addr;
+
+				fingerprint_t fingerprint = 0;
+				bool hashed = false;
+			};
+
+			piece_index_t const piece;
+			bool const passed;
+			int outstanding = 0;
+			std::vector<block> blocks;
 		};
 
-		void on_read_failed_block(piece_block b, address a
-			, disk_buffer_holder buffer, int const block_size, disk_job_flags_t
+		// issues reads for all blocks in ``batch`` that have a peer. The reads
+		// are issued back to back, to let the disk thread coalesce them into
+		// contiguous reads, and marked volatile to not evict other blocks
+		// from the cache
+		void read_piece(std::shared_ptr<read_batch> const& batch, disk_job_flags_t const flags)
+		{
+			int const block_size = 16 * 1024;
+			int const piece_size = m_torrent.torrent_file().piece_size(batch->piece);
+			for (std::size_t b = 0; b < batch->blocks.size(); ++b)
+			{
+				if (batch->blocks[b].stored.peer == nullptr) continue;
+				int const start = int(b) * block_size;
+				if (start >= piece_size) break;
+				peer_request const r = {batch->piece, start
+					, std::min(block_size, piece_size - start)};
+				++batch->outstanding;
+				m_torrent.session().disk_thread().async_read(m_torrent.storage()
+					, r, std::bind(&smart_ban_plugin::on_read_block
+					, shared_from_this(), batch, int(b), _1, r.length, _3)
+					, flags | disk_interface::volatile_read);
+			}
+		}
+
+		void on_read_block(std::shared_ptr<read_batch> const& batch, int const block
+			, disk_buffer_holder buffer, int const block_size
 			, storage_error const& error)
 		{
 			TORRENT_ASSERT(m_torrent.session().is_single_thread());
+			TORRENT_ASSERT(batch->outstanding > 0);
 
 			// ignore read errors
-			if (error) return;
+			if (!error)
+			{
+				time_point const start = clock_type::now();
+				auto& b = batch->blocks[std::size_t(block)];
+				b.fingerprint = fingerprint({buffer.get(), std::size_t(block_size)});
+				b.hashed = true;
+				m_counters.inc_stats_counter(counters::smart_ban_hashed_blocks);
+				m_counters.inc_stats_counter(counters::smart_ban_hash_time
+					, total_microseconds(clock_type::now() - start));
+			}
+
+			if (--batch->outstanding > 0) return;
+			if (batch->passed) check_passed(*batch);
+			else record_failed(*batch);
+		}
 
-			hasher h;
-			h.update({buffer.get(), std::size_t(block_size)});
+		fingerprint_t fingerprint(span<char const> block) const
+		{
+			hasher h(block);
 			h.update(reinterpret_cast<char const*>(&m_salt), sizeof(m_salt));
+			sha1_hash const digest = h.final();
+			fingerprint_t ret;
+			std::memcpy(&ret, digest.data(), sizeof(ret));
+			return ret;
+		}
+
+		// records the blocks of a failed piece. If a peer sent us a block
+		// before, with different contents, it sent bad data at least once
+		void record_failed(read_batch const& batch)
+		{
+			std::vector<block_entry> blocks(batch.blocks.size(), block_entry{nullptr, 0});
+			for (std::size_t b = 0; b < batch.blocks.size(); ++b)
+			{
+				read_batch::block const& rb = batch.blocks[b];
+				if (!rb.hashed) continue;
 
-			std::pair<peer_list::iterator, peer_list::iterator> const range
-				= m_torrent.find_peers(a);
+				auto const range = m_torrent.find_peers(rb.addr);
 
-			// there is no peer with this address anymore
-			if (range.first == range.second) return;
+				// there is no peer with this address anymore
+				if (range.first == range.second) continue;
 
-			torrent_peer* p = (*range.first);
-			block_entry e = {p, h.final()};
+				blocks[b] = block_entry{*range.first, rb.fingerprint};
+			}
 
-			std::map<piece_block, block_entry>::iterator i = m_block_hashes.lower_bound(b);
+			std::vector<aux::smart_ban_mismatch> mismatches;
+			m_table.record_failed(batch.piece, blocks
+				, m_torrent.settings().get_int(settings_pack::smart_ban_memory_limit)
+				, mismatches);
 
-			if (i != m_block_hashes.end() && i->first == b && i->second.peer == p)
+			for (auto const& m : mismatches)
 			{
-				// this peer has sent us this block before
+				torrent_peer* p = blocks[std::size_t(m.block)].peer;
+
 				// if the peer is already banned, it doesn't matter if it sent
 				// good or bad data. Nothings going to change it
-				if (!p->banned && i->second.digest != e.digest)
-				{
-					// this time the digest of the block is different
-					// from the first time it sent it
-					// at least one of them must be bad
+				if (p->banned) continue;
+
 #ifndef TORRENT_DISABLE_LOGGING
-					if (m_torrent.should_log())
-					{
-						char const* client = "-";
-						peer_info info;
-						if (p->connection)
-						{
-							p->connection->get_peer_info(info);
-							client = info.client.c_str();
-						}
-						m_torrent.debug_log(" BANNING PEER [ p: %d | b: %d | c: %s"
-							" | hash1: %s | hash2: %s | ip: %s ]"
-							, static_cast<int>(b.piece_index), b.block_index, client
-							, aux::to_hex(i->second.digest).c_str()
-							, aux::to_hex(e.digest).c_str()
-							, print_endpoint(p->ip()).c_str());
-					}
+				log_ban(p, batch.piece, m.block, m.recorded
+					, blocks[std::size_t(m.block)].fingerprint);
 #endif
-					m_torrent.ban_peer(p);
-					if (p->connection) p->connection->disconnect(
-						errors::peer_banned, operation_t::bittorrent);
-				}
-				// we already have this exact entry in the map
-				// we don't have to insert it
-				return;
+				ban(p);
 			}
+		}
 
-			m_block_hashes.insert(i, std::pair<const piece_block, block_entry>(b, e));
-
-#ifndef TORRENT_DISABLE_LOGGING
-			if (m_torrent.should_log())
+		// compares the blocks of a piece that passed against the ones
+		// recorded when it failed. Peers that sent blocks that differ from
+		// the good ones are banned
+		void check_passed(read_batch const& batch)
+		{
+			for (std::size_t b = 0; b < batch.blocks.size(); ++b)
 			{
-				char const* client = "-";
-				peer_info info;
-				if (p->connection)
+				read_batch::block const& rb = batch.blocks[b];
+				if (!rb.hashed || rb.stored.fingerprint == rb.fingerprint) continue;
+
+				// find the peer
+				auto range = m_torrent.find_peers(rb.addr);
+				torrent_peer* p = nullptr;
+				for (; range.first != range.second; ++range.first)
 				{
-					p->connection->get_peer_info(info);
-					client = info.client.c_str();
+					if (rb.stored.peer != *range.first) continue;
+					p = *range.first;
 				}
-				m_torrent.debug_log(" STORE BLOCK CRC [ p: %d | b: %d | c: %s"
-					" | digest: %s | ip: %s ]"
-					, static_cast<int>(b.piece_index), b.block_index, client
-					, aux::to_hex(e.digest).c_str()
-					, print_address(p->ip().address()).c_str());
-			}
+				if (p == nullptr) continue;
+
+#ifndef TORRENT_DISABLE_LOGGING
+				log_ban(p, batch.piece, int(b), rb.fingerprint, rb.stored.fingerprint);
 #endif
+				ban(p);
+			}
 		}
 
-		void on_read_ok_block(std::pair<piece_block, block_entry> b, address a
-			, disk_buffer_holder buffer, int const block_size, disk_job_flags_t
-			, storage_error const& error)
+		void ban(torrent_peer* p)
 		{
-			TORRENT_ASSERT(m_torrent.session().is_single_thread());
-
-			// ignore read errors
-			if (error) return;
-
-			hasher h;
-			h.update({buffer.get(), std::size_t(block_size)});
-			h.update(reinterpret_cast<char const*>(&m_salt), sizeof(m_salt));
-			sha1_hash const ok_digest = h.final();
-
-			if (b.second.digest == ok_digest) return;
-
-			// find the peer
-			std::pair<peer_list::iterator, peer_list::iterator> range
-				= m_torrent.find_peers(a);
-			if (range.first == range.second) return;
-			torrent_peer* p = nullptr;
-			for (; range.first != range.second; ++range.first)
-			{
-				if (b.second.peer != *range.first) continue;
-				p = *range.first;
-			}
-			if (p == nullptr) return;
+			m_torrent.ban_peer(p);
+			if (p->connection) p->connection->disconnect(
+				errors::peer_banned, operation_t::bittorrent);
+		}
 
 #ifndef TORRENT_DISABLE_LOGGING
-			if (m_torrent.should_log())
+		void log_ban(torrent_peer* p, piece_index_t const piece, int const block
+			, fingerprint_t const good, fingerprint_t const bad)
+		{
+			if (!m_torrent.should_log()) return;
+			char const* client = "-";
+			peer_info info;
+			if (p->connection)
 			{
-				char const* client = "-";
-				peer_info info;
-				if (p->connection)
-				{
-					p->connection->get_peer_info(info);
-					client = info.client.c_str();
-				}
-				m_torrent.debug_log(" BANNING PEER [ p: %d | b: %d | c: %s"
-					" | ok_digest: %s | bad_digest: %s | ip: %s ]"
-					, static_cast<int>(b.first.piece_index), b.first.block_index, client
-					, aux::to_hex(ok_digest).c_str()
-					, aux::to_hex(b.second.digest).c_str()
-					, print_address(p->ip().address()).c_str());
+				p->connection->get_peer_info(info);
+				client = info.client.c_str();
 			}
-#endif
-			m_torrent.ban_peer(p);
-			if (p->connection) p->connection->disconnect(
-				errors::peer_banned, operation_t::bittorrent);
+			m_torrent.debug_log(" BANNING PEER [ p: %d | b: %d | c: %s"
+				" | fingerprint1: %016" PRIx64 " | fingerprint2: %016" PRIx64 " | ip: %s ]"
+				, static_cast<int>(piece), block, client, good, bad
+				, print_address(p->ip().address()).c_str());
 		}
+#endif
 
 		torrent& m_torrent;
+		counters& m_counters;
 
-		// This table maps a piece_block (piece and block index
-		// pair) to a peer and the block CRC. The CRC is calculated
-		// from the data in the block + the salt
-		std::map<piece_block, block_entry> m_block_hashes;
+		// the pieces that have failed the hash check, but not yet passed.
+		// Each piece maps its blocks to the peer that sent it and the block's
+		// fingerprint
+		aux::smart_ban_table m_table;
 
-		// This salt is a random value used to calculate the block CRCs
-		// Since the CRC function that is used is not a one way function
-		// the salt is required to avoid attacks where bad data is sent
-		// that is forged to match the CRC of the good data.
+		// This salt is a random value used to calculate the block fingerprints.
+		// Without it, the fingerprint of a block could be known in advance,
+		// letting a peer forge bad data that matches the fingerprint of the
+		// good data.
 		std::uint32_t const m_salt;
 
 		// explicitly disallow assignment, to silence msvc warning
@@ -0,0 +1,133 @@
+/*
+
+Copyright (c) 2007-2016, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/aux_/smart_ban_table.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <algorithm>
+
+namespace libtorrent { namespace aux {
+
+	smart_ban_table::~smart_ban_table()
+	{
+		m_counters.inc_stats_counter(counters::smart_ban_memory, -m_memory);
+	}
+
+	void smart_ban_table::record_failed(piece_index_t const piece
+		, span<smart_ban_block const> const blocks, std::int64_t const memory_limit
+		, std::vector<smart_ban_mismatch>& mismatches)
+	{
+		auto i = find_piece(piece);
+		if (i == m_pieces.end() || i->piece != piece)
+		{
+			i = m_pieces.insert(i, piece_entry{piece, m_seq++, {}});
+			i->blocks.resize(std::size_t(blocks.size()), smart_ban_block{nullptr, 0});
+			std::int64_t const size = piece_entry_size(*i);
+			m_memory += size;
+			m_counters.inc_stats_counter(counters::smart_ban_memory, size);
+		}
+		TORRENT_ASSERT(i->blocks.size() == std::size_t(blocks.size()));
+
+		for (std::size_t b = 0; b < i->blocks.size(); ++b)
+		{
+			smart_ban_block const& received = blocks[std::ptrdiff_t(b)];
+			if (received.peer == nullptr) continue;
+
+			smart_ban_block& e = i->blocks[b];
+			if (e.peer == nullptr)
+			{
+				e = received;
+				continue;
+			}
+
+			// we only keep the first peer that sent us this block
+			if (e.peer != received.peer) continue;
+
+			// this peer has sent us this block before. If the fingerprint is
+			// different this time, at least one of them must be bad
+			if (e.fingerprint == received.fingerprint) continue;
+			mismatches.push_back({int(b), e.fingerprint});
+		}
+
+		// stay within the memory limit by forgetting about the pieces that
+		// failed the longest time ago
+		while (m_memory > memory_limit && !m_pieces.empty())
+		{
+			auto const oldest = std::min_element(m_pieces.begin(), m_pieces.end()
+				, [](piece_entry const& lhs, piece_entry const& rhs)
+				{ return lhs.seq < rhs.seq; });
+			erase_piece(oldest);
+			m_counters.inc_stats_counter(counters::smart_ban_evicted_pieces);
+		}
+	}
+
+	std::vector<smart_ban_block> smart_ban_table::piece_passed(piece_index_t const piece)
+	{
+		auto const i = find_piece(piece);
+		if (i == m_pieces.end() || i->piece != piece) return {};
+		return erase_piece(i);
+	}
+
+	void smart_ban_table::clear()
+	{
+		m_counters.inc_stats_counter(counters::smart_ban_memory, -m_memory);
+		m_memory = 0;
+		m_pieces.clear();
+		m_pieces.shrink_to_fit();
+	}
+
+	std::vector<smart_ban_table::piece_entry>::iterator smart_ban_table::find_piece(
+		piece_index_t const p)
+	{
+		return std::lower_bound(m_pieces.begin(), m_pieces.end(), p
+			, [](piece_entry const& e, piece_index_t const piece)
+			{ return e.piece < piece; });
+	}
+
+	std::vector<smart_ban_block> smart_ban_table::erase_piece(
+		std::vector<piece_entry>::iterator const i)
+	{
+		std::int64_t const size = piece_entry_size(*i);
+		m_memory -= size;
+		m_counters.inc_stats_counter(counters::smart_ban_memory, -size);
+		std::vector<smart_ban_block> ret = std::move(i->blocks);
+		m_pieces.erase(i);
+		return ret;
+	}
+
+	std::int64_t smart_ban_table::piece_entry_size(piece_entry const& e)
+	{
+		return std::int64_t(sizeof(piece_entry)
+			+ e.blocks.capacity() * sizeof(smart_ban_block));
+	}
+}}
@@ -40,14 +40,35 @@ namespace libtorrent {
 	stat_cache::stat_cache() {}
 	stat_cache::~stat_cache() = default;
 
-	void stat_cache::set_cache(file_index_t const i, std::int64_t size)
+	void stat_cache::set_cache(file_index_t const i, std::int64_t const size)
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		set_cache_impl(i, size, 0, 0);
+	}
+
+	void stat_cache::set_cache(file_index_t const i, file_status const& st)
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		set_cache_impl(i, st.file_size, std::int64_t(st.mtime), st.inode);
+	}
+
+	void stat_cache::set_cache_impl(file_index_t const i, std::int64_t const size
+		, std::int64_t const mtime, std::uint64_t const inode)
 	{
 		if (i >= m_stat_cache.end_index())
 			m_stat_cache.resize(static_cast<int>(i) + 1, not_in_cache);
 		m_stat_cache[i].file_size = size;
+		m_stat_cache[i].mtime = mtime;
+		m_stat_cache[i].inode = inode;
 	}
 
 	void stat_cache::set_error(file_index_t const i, error_code const& ec)
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		set_error_impl(i, ec);
+	}
+
+	void stat_cache::set_error_impl(file_index_t const i, error_code const& ec)
 	{
 		if (i >= m_stat_cache.end_index())
 			m_stat_cache.resize(static_cast<int>(i) + 1, not_in_cache);
@@ -58,14 +79,17 @@ namespace libtorrent {
 
 	void stat_cache::set_dirty(file_index_t const i)
 	{
+		std::lock_guard<std::mutex> l(m_mutex);
 		if (i >= m_stat_cache.end_index()) return;
 		m_stat_cache[i].file_size = not_in_cache;
+		if (i < m_unchecked.end_index()) m_unchecked.clear_bit(i);
 	}
 
 	std::int64_t stat_cache::get_filesize(file_index_t const i, file_storage const& fs
 		, std::string const& save_path, error_code& ec)
 	{
 		TORRENT_ASSERT(i < fs.end_file());
+		std::unique_lock<std::mutex> l(m_mutex);
 		if (i >= m_stat_cache.end_index()) m_stat_cache.resize(static_cast<int>(i) + 1, not_in_cache);
 		std::int64_t sz = m_stat_cache[i].file_size;
 		if (sz < not_in_cache)
@@ -75,18 +99,22 @@ namespace libtorrent {
 		}
 		else if (sz == not_in_cache)
 		{
+			l.unlock();
+
 			// query the filesystem
 			file_status s;
 			std::string const file_path = fs.file_path(i, save_path);
 			stat_file(file_path, &s, ec);
+
+			l.lock();
 			if (ec)
 			{
-				set_error(i, ec);
+				set_error_impl(i, ec);
 				sz = file_error;
 			}
 			else
 			{
-				set_cache(i, s.file_size);
+				set_cache_impl(i, s.file_size, std::int64_t(s.mtime), s.inode);
 				sz = s.file_size;
 			}
 		}
@@ -95,17 +123,82 @@ namespace libtorrent {
 
 	void stat_cache::reserve(int num_files)
 	{
+		std::lock_guard<std::mutex> l(m_mutex);
 		m_stat_cache.resize(num_files, not_in_cache);
 	}
 
 	void stat_cache::clear()
 	{
+		std::lock_guard<std::mutex> l(m_mutex);
+
 		m_stat_cache.clear();
 		m_stat_cache.shrink_to_fit();
+		m_unchecked.clear();
 		m_errors.clear();
 		m_errors.shrink_to_fit();
 	}
 
+	void stat_cache::load_snapshot(std::vector<file_snapshot> const& s)
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+
+		int const num_files = int(s.size());
+		if (m_stat_cache.end_index() < file_index_t(num_files))
+			m_stat_cache.resize(num_files, not_in_cache);
+		if (m_unchecked.size() < int(m_stat_cache.size()))
+			m_unchecked.resize(int(m_stat_cache.size()), false);
+
+		for (file_index_t i(0); i < file_index_t(num_files); ++i)
+		{
+			file_snapshot const& e = s[std::size_t(static_cast<int>(i))];
+			if (e.size < 0) continue;
+			set_cache_impl(i, e.size, e.mtime, e.inode);
+			m_unchecked.set_bit(i);
+		}
+	}
+
+	std::vector<file_snapshot> stat_cache::snapshot(int const num_files) const
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+
+		std::vector<file_snapshot> ret;
+		for (file_index_t i(0); i < m_stat_cache.end_index()
+			&& i < file_index_t(num_files); ++i)
+		{
+			stat_cache_t const& e = m_stat_cache[i];
+			if (e.file_size < 0) continue;
+			if (ret.empty()) ret.resize(std::size_t(num_files));
+			file_snapshot& out = ret[std::size_t(static_cast<int>(i))];
+			out.size = e.file_size;
+			out.mtime = e.mtime;
+			out.inode = e.inode;
+		}
+		return ret;
+	}
+
+	bool stat_cache::needs_check(file_index_t const i) const
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		return i < m_unchecked.end_index() && m_unchecked.get_bit(i);
+	}
+
+	void stat_cache::check_snapshot(file_index_t const i, file_status const& st
+		, error_code& ec)
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		if (i >= m_unchecked.end_index() || !m_unchecked.get_bit(i)) return;
+		m_unchecked.clear_bit(i);
+
+		stat_cache_t const& e = m_stat_cache[i];
+		if (e.file_size != st.file_size)
+			ec = errors::mismatching_file_size;
+		else if (e.mtime != std::int64_t(st.mtime) || e.inode != st.inode)
+			ec = errors::mismatching_file_timestamp;
+
+		// from now on, report the file the way it actually is
+		set_cache_impl(i, st.file_size, std::int64_t(st.mtime), st.inode);
+	}
+
 	int stat_cache::add_error(error_code const& ec)
 	{
 		auto const i = std::find(m_errors.begin(), m_errors.end(), ec);
@@ -430,8 +430,24 @@ namespace libtorrent {
 		, aux::vector<std::string, file_index_t> const& links
 		, storage_error& ec)
 	{
-		return aux::verify_resume_data(rd, links, files()
+		// if the resume data has a snapshot of the files, trust it rather than
+		// stat()ing every file now. Each file is checked against it the first
+		// time it's opened instead
+		if (int(rd.file_snapshots.size()) == files().num_files())
+			m_stat_cache.load_snapshot(rd.file_snapshots);
+
+		bool const ret = aux::verify_resume_data(rd, links, files()
 			, m_file_priority, m_stat_cache, m_save_path, ec);
+
+		// if the resume data was rejected, the files will be checked. Don't
+		// let that rely on the snapshot
+		if (!ret) m_stat_cache.clear();
+		return ret;
+	}
+
+	std::vector<file_snapshot> default_storage::file_snapshots() const
+	{
+		return m_stat_cache.snapshot(files().num_files());
 	}
 
 	status_t default_storage::move_storage(std::string const& sp
@@ -552,18 +568,23 @@ namespace libtorrent {
 				return ret;
 			}
 
-			// invalidate our stat cache for this file, since
-			// we're writing to it
-			m_stat_cache.set_dirty(file_index);
-
 			file_handle handle = open_file(file_index
 				, open_mode::read_write, ec);
 			if (ec) return -1;
 
+			// invalidate our stat cache for this file, since
+			// we're writing to it. This is done after opening it, to still have
+			// a snapshot entry to check the file against
+			m_stat_cache.set_dirty(file_index);
+
 			error_code e;
 			int const ret = int(handle->writev(file_offset
 				, vec, e, flags));
 
+			// another disk thread may have stat()ed the file while we were
+			// writing to it
+			m_stat_cache.set_dirty(file_index);
+
 			// set this unconditionally in case the upper layer would like to treat
 			// short reads as errors
 			ec.operation = operation_t::file_write;
@@ -615,6 +636,21 @@ namespace libtorrent {
 		}
 		TORRENT_ASSERT(h);
 
+		if (m_stat_cache.needs_check(file))
+		{
+			// the first time we open a file whose state was restored from the
+			// resume data, make sure it hasn't been touched since
+			file_status st;
+			h->stat(&st, ec.ec);
+			if (!ec.ec) m_stat_cache.check_snapshot(file, st, ec.ec);
+			if (ec.ec)
+			{
+				ec.file(file);
+				ec.operation = operation_t::file_stat;
+				return file_handle();
+			}
+		}
+
 		if (m_allocate_files && (mode & open_mode::rw_mask) != open_mode::read_only)
 		{
 			std::unique_lock<std::mutex> l(m_file_created_mutex);
@@ -648,6 +684,14 @@ namespace libtorrent {
 
 	file_handle default_storage::open_file_impl(file_index_t file, open_mode_t mode
 		, error_code& ec) const
+	{
+		file_handle ret = m_pool.open_file(storage_index(), m_save_path, file
+			, files(), open_mode_for(file, mode), ec);
+		return ret;
+	}
+
+	open_mode_t default_storage::open_mode_for(file_index_t const file
+		, open_mode_t mode) const
 	{
 		if (!m_allocate_files) mode |= open_mode::sparse;
 
@@ -667,10 +711,7 @@ namespace libtorrent {
 		{
 			mode |= open_mode::no_cache;
 		}
-
-		file_handle ret = m_pool.open_file(storage_index(), m_save_path, file
-			, files(), mode, ec);
-		return ret;
+		return mode;
 	}
 
 	bool default_storage::tick()
@@ -681,6 +722,23 @@ namespace libtorrent {
 		return false;
 	}
 
+	void default_storage::hint_read(piece_index_t const piece, int const offset
+		, int const size, open_mode_t const flags)
+	{
+		for (auto const& f : files().map_block(piece, offset, size))
+		{
+			if (files().pad_file_at(f.file_index)) continue;
+
+			// files with priority 0 are read from the part file
+			if (f.file_index < m_file_priority.end_index()
+				&& m_file_priority[f.file_index] == dont_download)
+				continue;
+
+			m_pool.prefetch_file(storage_index(), m_save_path, f.file_index
+				, files(), open_mode_for(f.file_index, open_mode::read_only | flags));
+		}
+	}
+
 	storage_interface* default_storage_constructor(storage_params const& params
 		, file_pool& pool)
 	{
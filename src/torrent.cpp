@@ -129,7 +129,7 @@ namespace libtorrent {
 	web_seed_t::web_seed_t(web_seed_entry const& wse)
 		: web_seed_entry(wse)
 	{
-		peer_info.web_seed = true;
+		free_peer();
 	}
 
 	web_seed_t::web_seed_t(std::string const& url_, web_seed_entry::type_t type_
@@ -137,7 +137,55 @@ namespace libtorrent {
 		, web_seed_entry::headers_t const& extra_headers_)
 		: web_seed_entry(url_, type_, auth_, extra_headers_)
 	{
-		peer_info.web_seed = true;
+		free_peer();
+	}
+
+	int web_seed_t::num_connections() const
+	{
+		return int(std::count_if(peers.begin(), peers.end()
+			, [](ipv4_peer const& p) { return p.connection != nullptr; }));
+	}
+
+	ipv4_peer* web_seed_t::free_peer()
+	{
+		for (auto& p : peers)
+			if (p.connection == nullptr) return &p;
+
+		peers.emplace_back(tcp::endpoint(), true, peer_source_flags_t{});
+		peers.back().web_seed = true;
+		return &peers.back();
+	}
+
+	ipv4_peer* web_seed_t::find_peer(peer_connection_interface const* c)
+	{
+		TORRENT_ASSERT(c != nullptr);
+		for (auto& p : peers)
+			if (p.connection == c) return &p;
+		return nullptr;
+	}
+
+	bool web_seed_t::banned() const
+	{
+		return std::any_of(peers.begin(), peers.end()
+			, [](ipv4_peer const& p) { return p.banned; });
+	}
+
+	void web_seed_t::update_target_connections(int const num_connections
+		, int const download_rate, int const max_connections)
+	{
+		// only grow once all the connections we asked for are up, otherwise
+		// we're measuring the connection attempts, not the server
+		if (num_connections >= target_connections
+			&& download_rate > last_download_rate + last_download_rate / 10)
+		{
+			if (target_connections < max_connections) ++target_connections;
+		}
+		else if (download_rate < last_download_rate - last_download_rate / 4)
+		{
+			if (target_connections > 1) --target_connections;
+		}
+		target_connections = std::max(1, std::min(target_connections, max_connections));
+		last_download_rate = download_rate;
 	}
 
 	torrent_hot_members::torrent_hot_members(aux::session_interface& ses
@@ -1007,10 +1055,7 @@ namespace libtorrent {
 		else if (m_peer_list)
 		{
 			// reset last_connected, to force fast reconnect after leaving upload mode
-			for (auto pe : *m_peer_list)
-			{
-				pe->last_connected = 0;
-			}
+			m_peer_list->clear_last_connected();
 
 			// send_block_requests on all peers
 			for (auto p : m_connections)
@@ -1129,6 +1174,10 @@ namespace libtorrent {
 			return;
 		}
 
+		// a file that changed since the resume data was saved is not a reason
+		// to stop the torrent. Its pieces are checked again instead
+		if (handle_file_changed(error)) return;
+
 		// put the torrent in an error-state
 		set_error(error.ec, error.file());
 
@@ -1136,6 +1185,114 @@ namespace libtorrent {
 		pause();
 	}
 
+	bool torrent::handle_file_changed(storage_error const& error)
+	{
+		TORRENT_ASSERT(is_single_thread());
+
+		// the storage fails the first operation on a file whose snapshot
+		// doesn't match it with one of these
+		if (error.operation != operation_t::file_stat
+			|| (error.ec != errors::mismatching_file_size
+				&& error.ec != errors::mismatching_file_timestamp))
+			return false;
+
+		// while checking the files, this is handled like any other error
+		if (m_state == torrent_status::checking_resume_data
+			|| m_state == torrent_status::checking_files)
+			return false;
+
+		if (m_abort || !valid_metadata()) return true;
+
+		file_storage const& fs = m_torrent_file->files();
+		file_index_t const file = error.file();
+		if (file < file_index_t(0) || file >= fs.end_file()) return true;
+		if (fs.pad_file_at(file) || fs.file_size(file) == 0) return true;
+
+#ifndef TORRENT_DISABLE_LOGGING
+		debug_log("*** FILE CHANGED, rechecking: %s"
+			, resolve_filename(file).c_str());
+#endif
+
+		piece_index_t start;
+		piece_index_t end;
+		std::tie(start, end) = file_piece_range_inclusive(fs, file);
+
+		if (m_seed_mode)
+		{
+			// in seed mode, pieces are hashed before they are sent anyway.
+			// Just forget that the ones in this file have been
+			for (piece_index_t p = start; p < end; ++p)
+			{
+				if (!m_verified.get_bit(p)) continue;
+				m_verified.clear_bit(p);
+				--m_num_verified;
+			}
+			return true;
+		}
+
+		if (!has_picker())
+		{
+			if (!m_have_all) return true;
+
+			// we're a seed and have released the piece picker. Bring it back,
+			// with all pieces, to be able to drop the ones in this file
+			m_have_all = false;
+			need_picker();
+			for (piece_index_t p(0); p < m_torrent_file->end_piece(); ++p)
+				m_picker->we_have(p);
+		}
+
+		bool const was_finished = is_finished();
+
+		// forget that we have the pieces overlapping the file. They are marked
+		// as downloaded and hashed again, just like unfinished pieces in resume
+		// data. The ones that fail will be downloaded again
+		std::vector<piece_index_t> pieces;
+		for (piece_index_t p = start; p < end; ++p)
+		{
+			if (!m_picker->have_piece(p)) continue;
+			m_picker->we_dont_have(p);
+			pieces.push_back(p);
+		}
+
+		m_file_progress.clear();
+		m_file_progress.init(picker(), fs);
+		update_gauge();
+
+		if (pieces.empty()) return true;
+
+		for (auto const p : m_connections)
+		{
+			TORRENT_INCREMENT(m_iterating_connections);
+			for (auto const piece : pieces)
+				p->write_dont_have(piece);
+		}
+
+		// is_finished() trusts the seeding state, so it has to be left before
+		// update_peer_interest() can tell whether we're downloading again
+		if (m_state == torrent_status::seeding
+			|| m_state == torrent_status::finished)
+		{
+			if (m_picker->num_passed() + m_picker->num_filtered()
+				< m_torrent_file->num_pieces())
+				set_state(torrent_status::downloading);
+			else
+				set_state(torrent_status::finished);
+		}
+		update_peer_interest(was_finished);
+
+		for (auto const piece : pieces)
+		{
+			int const num_blocks = m_picker->blocks_in_piece(piece);
+			for (int k = 0; k < num_blocks; ++k)
+				m_picker->mark_as_finished(piece_block(piece, k), nullptr);
+			verify_piece(piece);
+		}
+
+		set_need_save_resume();
+		return true;
+	}
+
 	void torrent::on_piece_fail_sync(piece_index_t, piece_block) try
 	{
 		if (m_abort) return;
@@ -1909,6 +2066,14 @@ namespace libtorrent {
 		}
 #endif // TORRENT_DISABLE_MUTABLE_TORRENTS
 
+		// only trust the file snapshots in the resume data if we've been asked
+		// to
+		if (m_add_torrent_params
+			&& !settings().get_bool(settings_pack::resume_file_snapshots))
+		{
+			m_add_torrent_params->file_snapshots.clear();
+		}
+
 #if TORRENT_USE_ASSERTS
 		TORRENT_ASSERT(m_outstanding_check_files == false);
 		m_outstanding_check_files = true;
@@ -3297,6 +3462,7 @@ namespace libtorrent {
 			torrent_peer* p = m_peer_list->connect_one_peer(m_ses.session_time(), &st);
 			peers_erased(st.erased);
 			inc_stats_counter(counters::connection_attempt_loops, st.loop_counter);
+			inc_stats_counter(counters::connection_attempt_loops_saved, st.loops_saved);
 			if (p == nullptr)
 			{
 				update_want_peers();
@@ -3795,6 +3961,15 @@ namespace libtorrent {
 
 		if (disk_error)
 		{
+			// if a file turned out to have changed since the resume data was
+			// saved, nothing was hashed. The file has been checked now, so try
+			// again
+			if (error.operation == operation_t::file_stat
+				&& (error.ec == errors::mismatching_file_size
+					|| error.ec == errors::mismatching_file_timestamp))
+			{
+				verify_piece(piece);
+			}
 			update_gauge();
 		}
 		else if (passed)
@@ -5561,17 +5736,20 @@ namespace libtorrent {
 			debug_log("removing web seed: \"%s\"", web->url.c_str());
 #endif
 
-			peer_connection* peer = static_cast<peer_connection*>(web->peer_info.connection);
-			if (peer != nullptr)
+			for (auto& pi : web->peers)
 			{
-				// if we have a connection for this web seed, we also need to
-				// disconnect it and clear its reference to the peer_info object
-				// that's part of the web_seed_t we're about to remove
-				TORRENT_ASSERT(peer->m_in_use == 1337);
-				peer->disconnect(boost::asio::error::operation_aborted, operation_t::bittorrent);
-				peer->set_peer_info(nullptr);
+				peer_connection* peer = static_cast<peer_connection*>(pi.connection);
+				if (peer != nullptr)
+				{
+					// if we have a connection for this web seed, we also need to
+					// disconnect it and clear its reference to the peer_info object
+					// that's part of the web_seed_t we're about to remove
+					TORRENT_ASSERT(peer->m_in_use == 1337);
+					peer->disconnect(boost::asio::error::operation_aborted, operation_t::bittorrent);
+					peer->set_peer_info(nullptr);
+				}
+				if (has_picker()) picker().clear_peer(&pi);
 			}
-			if (has_picker()) picker().clear_peer(&web->peer_info);
 
 			m_web_seeds.erase(web);
 		}
@@ -5620,7 +5798,7 @@ namespace libtorrent {
 			return;
 		}
 
-		if (web->peer_info.banned)
+		if (web->banned())
 		{
 #ifndef TORRENT_DISABLE_LOGGING
 			debug_log("banned web seed: %s", web->url.c_str());
@@ -5899,12 +6077,16 @@ namespace libtorrent {
 		}
 
 		TORRENT_ASSERT(!web->resolving);
-		TORRENT_ASSERT(web->peer_info.connection == nullptr);
+
+		// each connection to the web seed needs its own peer_info entry. If
+		// all of them are in use, this adds one
+		ipv4_peer* const web_peer = web->free_peer();
+		TORRENT_ASSERT(web_peer->connection == nullptr);
 
 		if (a.address().is_v4())
 		{
-			web->peer_info.addr = a.address().to_v4();
-			web->peer_info.port = a.port();
+			web_peer->addr = a.address().to_v4();
+			web_peer->port = a.port();
 		}
 
 		if (is_paused()) return;
@@ -5996,7 +6178,7 @@ namespace libtorrent {
 		pack.tor = shared_from_this();
 		pack.s = s;
 		pack.endp = a;
-		pack.peerinfo = &web->peer_info;
+		pack.peerinfo = web_peer;
 		if (web->type == web_seed_entry::url_seed)
 		{
 			c = std::make_shared<web_peer_connection>(pack, *web);
@@ -6028,22 +6210,22 @@ namespace libtorrent {
 		update_want_tick();
 		m_ses.insert_peer(c);
 
-		if (web->peer_info.seed)
+		if (web_peer->seed)
 		{
 			TORRENT_ASSERT(m_num_seeds < 0xffff);
 			++m_num_seeds;
 		}
 
-		TORRENT_ASSERT(!web->peer_info.connection);
-		web->peer_info.connection = c.get();
+		TORRENT_ASSERT(!web_peer->connection);
+		web_peer->connection = c.get();
 #if TORRENT_USE_ASSERTS
-		web->peer_info.in_use = true;
+		web_peer->in_use = true;
 #endif
 
-		c->add_stat(std::int64_t(web->peer_info.prev_amount_download) << 10
-			, std::int64_t(web->peer_info.prev_amount_upload) << 10);
-		web->peer_info.prev_amount_download = 0;
-		web->peer_info.prev_amount_upload = 0;
+		c->add_stat(std::int64_t(web_peer->prev_amount_download) << 10
+			, std::int64_t(web_peer->prev_amount_upload) << 10);
+		web_peer->prev_amount_download = 0;
+		web_peer->prev_amount_upload = 0;
 #ifndef TORRENT_DISABLE_LOGGING
 		if (should_log())
 		{
@@ -6219,19 +6401,54 @@ namespace libtorrent {
 			}
 		}
 
+		// save the state of the files, to not have to stat() them all when
+		// resuming
+		if (m_storage && settings().get_bool(settings_pack::resume_file_snapshots))
+		{
+			storage_interface* st = get_storage_impl();
+			if (st) ret.file_snapshots = st->file_snapshots();
+
+			// a file may still have writes queued in the disk cache, in which
+			// case the storage's view of it is about to change. Only files whose
+			// pieces we all have are known not to, since a piece is only had
+			// once all its blocks have been flushed
+			file_storage const& fs = m_torrent_file->files();
+			bool any_snapshot = false;
+			for (file_index_t i(0); i < fs.end_file()
+				&& i < file_index_t(int(ret.file_snapshots.size())); ++i)
+			{
+				file_snapshot& e = ret.file_snapshots[std::size_t(static_cast<int>(i))];
+				if (e.size < 0) continue;
+
+				bool have_file = has_picker() || m_have_all;
+				if (has_picker() && fs.file_size(i) > 0)
+				{
+					piece_index_t start;
+					piece_index_t end;
+					std::tie(start, end) = file_piece_range_inclusive(fs, i);
+					for (piece_index_t p = start; p < end && have_file; ++p)
+						have_file = m_picker->have_piece(p);
+				}
+
+				if (have_file) any_snapshot = true;
+				else e = file_snapshot();
+			}
+			if (!any_snapshot) ret.file_snapshots.clear();
+		}
+
 		// write local peers
-		std::vector<torrent_peer const*> deferred_peers;
+		std::vector<tcp::endpoint> deferred_peers;
 		if (m_peer_list)
 		{
-			for (auto p : *m_peer_list)
+			m_peer_list->for_each_peer([&](torrent_peer const& p)
 			{
 #if TORRENT_USE_I2P
-				if (p->is_i2p_addr) continue;
+				if (p.is_i2p_addr) return;
 #endif
-				if (p->banned)
+				if (p.banned)
 				{
-					ret.banned_peers.push_back(p->ip());
-					continue;
+					ret.banned_peers.push_back(p.ip());
+					return;
 				}
 
 				// we cannot save remote connection
@@ -6241,35 +6458,35 @@ namespace libtorrent {
 				// so, if the peer is not connectable (i.e. we
 				// don't know its listen port) or if it has
 				// been banned, don't save it.
-				if (!p->connectable) continue;
+				if (!p.connectable) return;
 
 				// don't save peers that don't work
-				if (int(p->failcount) > 0) continue;
+				if (int(p.failcount) > 0) return;
 
 				// don't save peers that appear to send corrupt data
-				if (int(p->trust_points) < 0) continue;
+				if (int(p.trust_points) < 0) return;
 
-				if (p->last_connected == 0)
+				if (p.last_connected == 0)
 				{
 					// we haven't connected to this peer. It might still
 					// be useful to save it, but only save it if we
 					// don't have enough peers that we actually did connect to
 					if (int(deferred_peers.size()) < 100)
-						deferred_peers.push_back(p);
-					continue;
+						deferred_peers.push_back(p.ip());
+					return;
 				}
 
-				ret.peers.push_back(p->ip());
-			}
+				ret.peers.push_back(p.ip());
+			});
 		}
 
 		// if we didn't save 100 peers, fill in with second choice peers
 		if (int(ret.peers.size()) < 100)
 		{
 			aux::random_shuffle(deferred_peers.begin(), deferred_peers.end());
-			for (auto const p : deferred_peers)
+			for (auto const& p : deferred_peers)
 			{
-				ret.peers.push_back(p->ip());
+				ret.peers.push_back(p);
 				if (int(ret.peers.size()) >= 100) break;
 			}
 		}
@@ -6325,15 +6542,15 @@ namespace libtorrent {
 		if (!m_peer_list) return;
 
 		v->reserve(aux::numeric_cast<std::size_t>(m_peer_list->num_peers()));
-		for (auto p : *m_peer_list)
+		m_peer_list->for_each_peer([v](torrent_peer const& p)
 		{
 			peer_list_entry e;
-			e.ip = p->ip();
-			e.flags = p->banned ? peer_list_entry::banned : 0;
-			e.failcount = p->failcount;
-			e.source = p->source;
+			e.ip = p.ip();
+			e.flags = p.banned ? peer_list_entry::banned : 0;
+			e.failcount = p.failcount;
+			e.source = p.source;
 			v->push_back(e);
-		}
+		});
 	}
 #endif
 
@@ -8262,15 +8479,7 @@ namespace libtorrent {
 	// currently representable by the session_time)
 	void torrent::step_session_time(int const seconds)
 	{
-		if (m_peer_list)
-		{
-			for (auto pe : *m_peer_list)
-			{
-				pe->last_optimistically_unchoked
-					= clamped_subtract_u16(pe->last_optimistically_unchoked, seconds);
-				pe->last_connected = clamped_subtract_u16(pe->last_connected, seconds);
-			}
-		}
+		if (m_peer_list) m_peer_list->step_session_time(seconds);
 
 #ifndef TORRENT_NO_DEPRECATE
 		m_last_scrape = clamped_subtract_s16(m_last_scrape, seconds);
@@ -9062,6 +9271,7 @@ namespace libtorrent {
 
 		// ---- WEB SEEDS ----
 
+		update_web_seed_connections();
 		maybe_connect_web_seeds();
 
 		m_swarm_last_seen_complete = m_last_seen_complete;
@@ -9171,6 +9381,12 @@ namespace libtorrent {
 
 		auto const now = aux::time_now();
 
+		// the limit is on the number of connections. Web seeds with more than
+		// one connection use up the extra ones before we get to open any new
+		// ones
+		for (auto const& w : m_web_seeds)
+			limit -= std::max(0, w.num_connections() - 1);
+
 		// keep trying web-seeds if there are any
 		// first find out which web seeds we are connected to
 		for (auto i = m_web_seeds.begin(); i != m_web_seeds.end() && limit > 0;)
@@ -9180,13 +9396,60 @@ namespace libtorrent {
 				continue;
 
 			--limit;
-			if (w->peer_info.connection || w->resolving)
+			if (w->num_connections() > 0 || w->resolving)
+				continue;
+
+			connect_to_url_seed(w);
+		}
+
+		// once every web seed has a connection, the remaining slots go to web
+		// seeds whose connection count has been found to increase throughput
+		// (see update_web_seed_connections()). Only one new connection per web
+		// seed is opened at a time, to give the server a chance to respond to
+		// it before we measure again
+		for (auto i = m_web_seeds.begin(); i != m_web_seeds.end() && limit > 0;)
+		{
+			auto const w = i++;
+			if (w->removed || w->retry > now || w->resolving)
 				continue;
 
+			int const num_connections = w->num_connections();
+			if (num_connections == 0
+				|| num_connections >= w->target_connections)
+				continue;
+
+			--limit;
 			connect_to_url_seed(w);
 		}
 	}
 
+	void torrent::update_web_seed_connections()
+	{
+		int const limit = zero_or(settings().get_int(settings_pack::max_web_seed_connections)
+			, 100);
+
+		auto const now = aux::time_now32();
+
+		for (auto& w : m_web_seeds)
+		{
+			if (w.removed || w.resolving || w.next_rate_sample > now)
+				continue;
+
+			// give new connections some time to ramp up before deciding whether
+			// they helped
+			w.next_rate_sample = now + seconds32(5);
+
+			int download_rate = 0;
+			for (auto const& pi : w.peers)
+			{
+				if (pi.connection == nullptr) continue;
+				download_rate += static_cast<peer_connection*>(pi.connection)
+					->statistics().download_payload_rate();
+			}
+			w.update_target_connections(w.num_connections(), download_rate, limit);
+		}
+	}
+
 	void torrent::recalc_share_mode()
 	{
 		TORRENT_ASSERT(share_mode());
@@ -9893,7 +10156,7 @@ namespace libtorrent {
 		std::set<std::string> ret;
 		for (auto const& s : m_web_seeds)
 		{
-			if (s.peer_info.banned) continue;
+			if (s.banned()) continue;
 			if (s.removed) continue;
 			if (s.type != type) continue;
 			ret.insert(s.url);
@@ -9915,8 +10178,9 @@ namespace libtorrent {
 
 	void torrent::disconnect_web_seed(peer_connection* p)
 	{
+		ipv4_peer* pi = nullptr;
 		auto const i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, [p] (web_seed_t const& ws) { return ws.peer_info.connection == p; });
+			, [p, &pi] (web_seed_t& ws) { return (pi = ws.find_peer(p)) != nullptr; });
 
 		// this happens if the web server responded with a redirect
 		// or with something incorrect, so that we removed the web seed
@@ -9925,29 +10189,28 @@ namespace libtorrent {
 
 		TORRENT_ASSERT(i->resolving == false);
 
-		TORRENT_ASSERT(i->peer_info.connection);
-		i->peer_info.connection = nullptr;
+		TORRENT_ASSERT(pi->connection);
+		pi->connection = nullptr;
 	}
 
 	void torrent::remove_web_seed_conn(peer_connection* p, error_code const& ec
 		, operation_t const op, int const error)
 	{
 		auto const i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, [p] (web_seed_t const& ws) { return ws.peer_info.connection == p; });
+			, [p] (web_seed_t& ws) { return ws.find_peer(p) != nullptr; });
 
 		TORRENT_ASSERT(i != m_web_seeds.end());
 		if (i == m_web_seeds.end()) return;
 
-		peer_connection* peer = static_cast<peer_connection*>(i->peer_info.connection);
-		if (peer != nullptr)
-		{
-			// if we have a connection for this web seed, we also need to
-			// disconnect it and clear its reference to the peer_info object
-			// that's part of the web_seed_t we're about to remove
-			TORRENT_ASSERT(peer->m_in_use == 1337);
-			peer->disconnect(ec, op, error);
-			peer->set_peer_info(nullptr);
-		}
+		// if we have a connection for this web seed, we also need to
+		// disconnect it and clear its reference to the peer_info object
+		// that's part of the web_seed_t we're about to remove
+		TORRENT_ASSERT(p->m_in_use == 1337);
+		p->disconnect(ec, op, error);
+		p->set_peer_info(nullptr);
+
+		// any other connections to this web seed are closed by
+		// remove_web_seed_iter()
 		remove_web_seed_iter(i);
 	}
 
@@ -9955,13 +10218,19 @@ namespace libtorrent {
 	{
 		TORRENT_ASSERT(is_single_thread());
 		auto const i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, [p] (web_seed_t const& ws) { return ws.peer_info.connection == p; });
+			, [p] (web_seed_t& ws) { return ws.find_peer(p) != nullptr; });
 
 		TORRENT_ASSERT(i != m_web_seeds.end());
 		if (i == m_web_seeds.end()) return;
 		if (i->removed) return;
 		i->retry = aux::time_now32() + value_or(retry, seconds32(
 			settings().get_int(settings_pack::urlseed_wait_retry)));
+
+		// the server may be turning us away because we have too many
+		// connections open to it. Don't open more than we have now, minus the
+		// one that's being rejected
+		i->target_connections = std::max(1, i->num_connections() - 1);
+		i->last_download_rate = 0;
 	}
 
 	torrent_state torrent::get_peer_list_state()
@@ -9991,6 +10260,7 @@ namespace libtorrent {
 		torrent_peer* p = m_peer_list->connect_one_peer(m_ses.session_time(), &st);
 		peers_erased(st.erased);
 		inc_stats_counter(counters::connection_attempt_loops, st.loop_counter);
+		inc_stats_counter(counters::connection_attempt_loops_saved, st.loops_saved);
 
 		if (p == nullptr)
 		{
@@ -363,9 +363,11 @@ namespace {
 	// "path"
 	// root_dir is the name of the torrent, unless this is a single file
 	// torrent, in which case it's empty.
+	// ``path`` is a scratch buffer for building the file's path. It's passed
+	// in to let extract_files() reuse its allocation for all files
 	bool extract_single_file(bdecode_node const& dict, file_storage& files
 		, std::string const& root_dir, std::ptrdiff_t const info_ptr_diff, bool top_level
-		, int& pad_file_cnt, error_code& ec)
+		, int& pad_file_cnt, std::string& path, error_code& ec)
 	{
 		if (dict.type() != bdecode_node::dict_t) return false;
 
@@ -384,7 +386,7 @@ namespace {
 
 		std::time_t const mtime = std::time_t(dict.dict_find_int_value("mtime", 0));
 
-		std::string path = root_dir;
+		path.assign(root_dir);
 		string_view filename;
 
 		if (top_level)
@@ -491,7 +493,7 @@ namespace {
 		}
 
 		if (filename.size() > path.length()
-			|| path.substr(path.size() - filename.size()) != filename)
+			|| string_view(path).substr(path.size() - filename.size()) != filename)
 		{
 			// if the filename was sanitized and differ, clear it to just use path
 			filename = {};
@@ -516,10 +518,11 @@ namespace {
 
 		// this is the counter used to name pad files
 		int pad_file_cnt = 0;
+		std::string path;
 		for (int i = 0, end(list.list_size()); i < end; ++i)
 		{
 			if (!extract_single_file(list.list_at(i), target, root_dir
-				, info_ptr_diff, false, pad_file_cnt, ec))
+				, info_ptr_diff, false, pad_file_cnt, path, ec))
 				return false;
 		}
 		return true;
@@ -610,6 +613,8 @@ namespace {
 		INVARIANT_CHECK;
 
 		std::unordered_set<std::uint32_t> files;
+		files.reserve(m_files.paths().size() * 2
+			+ aux::numeric_cast<std::size_t>(m_files.num_files()));
 
 		std::string empty_str;
 
@@ -989,7 +994,8 @@ namespace {
 			// field.
 			// this is the counter used to name pad files
 			int pad_file_cnt = 0;
-			if (!extract_single_file(info, files, "", info_ptr_diff, true, pad_file_cnt, ec))
+			std::string path;
+			if (!extract_single_file(info, files, "", info_ptr_diff, true, pad_file_cnt, path, ec))
 			{
 				// mark the torrent as invalid
 				m_files.set_piece_length(0);
@@ -1237,7 +1243,7 @@ namespace {
 			return false;
 		}
 
-		bdecode_node const info = torrent_file.dict_find_dict("info");
+		bdecode_node info = torrent_file.dict_find_dict("info");
 		if (!info)
 		{
 			bdecode_node link = torrent_file.dict_find_string("magnet-uri");
@@ -1259,6 +1265,8 @@ namespace {
 			ec = errors::torrent_missing_info;
 			return false;
 		}
+		// most keys of the info dictionary are looked up
+		info.dict_build_index();
 		if (!parse_info_section(info, ec)) return false;
 		resolve_duplicate_filenames();
 
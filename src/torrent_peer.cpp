@@ -141,6 +141,8 @@ namespace libtorrent {
 		return ret;
 	}
 
+	constexpr std::uint32_t torrent_peer::not_in_heap;
+
 	torrent_peer::torrent_peer(std::uint16_t port_, bool conn
 		, peer_source_flags_t const src)
 		: prev_amount_upload(0)
@@ -177,6 +179,8 @@ namespace libtorrent {
 		, confirmed_supports_utp(false)
 		, supports_holepunch(false)
 		, web_seed(false)
+		, heap_index(not_in_heap)
+		, candidate_waiting(false)
 	{}
 
 	std::uint32_t torrent_peer::rank(external_ip const& external, int external_port) const
@@ -243,6 +243,15 @@ namespace libtorrent {
 	{
 		TORRENT_ASSERT(is_single_thread());
 		m_udp_conns.erase(c->transaction_id());
+
+		tracker_request const& req = c->tracker_req();
+		if (req.kind & tracker_request::scrape_request)
+		{
+			auto const i = m_udp_scrapes.find(std::make_pair(req.url, req.outgoing_socket));
+			if (i != m_udp_scrapes.end()
+				&& (i->second.expired() || i->second.lock().get() == c))
+				m_udp_scrapes.erase(i);
+		}
 	}
 
 	void tracker_manager::update_transaction_id(
@@ -291,8 +300,30 @@ namespace libtorrent {
 		}
 		else if (protocol == "udp")
 		{
+			bool const scrape = (req.kind & tracker_request::scrape_request) != 0;
+			if (scrape)
+			{
+				// if there's a scrape to this tracker that hasn't been sent yet,
+				// ride along with it
+				auto const i = m_udp_scrapes.find(std::make_pair(req.url, req.outgoing_socket));
+				if (i != m_udp_scrapes.end())
+				{
+					std::shared_ptr<udp_tracker_connection> const con = i->second.lock();
+					if (con && con->add_scrape(req, c))
+					{
+#ifndef TORRENT_DISABLE_LOGGING
+						if (cb) cb->debug_log("*** UDP_TRACKER [ scrape batched with: %x ]"
+							, con->transaction_id());
+#endif
+						return;
+					}
+				}
+			}
+
 			auto con = std::make_shared<udp_tracker_connection>(ios, *this, req, c);
 			m_udp_conns[con->transaction_id()] = con;
+			if (scrape)
+				m_udp_scrapes[std::make_pair(req.url, req.outgoing_socket)] = con;
 			con->start();
 			return;
 		}
@@ -55,8 +55,13 @@ namespace libtorrent {
 	std::map<address, udp_tracker_connection::connection_cache_entry>
 		udp_tracker_connection::m_connection_cache;
 
+	std::map<address, udp_tracker_connection::pending_connect>
+		udp_tracker_connection::m_pending_connects;
+
 	std::mutex udp_tracker_connection::m_cache_mutex;
 
+	constexpr int udp_tracker_connection::max_scrape_hashes;
+
 	udp_tracker_connection::udp_tracker_connection(
 		io_service& ios
 		, tracker_manager& man
@@ -71,6 +76,31 @@ namespace libtorrent {
 		update_transaction_id();
 	}
 
+	udp_tracker_connection::~udp_tracker_connection()
+	{
+		// make sure connections waiting for our connect handshake aren't
+		// left waiting forever
+		release_pending_connect();
+	}
+
+	bool udp_tracker_connection::add_scrape(tracker_request const& req
+		, std::weak_ptr<request_callback> c)
+	{
+		TORRENT_ASSERT(req.kind & tracker_request::scrape_request);
+		if (m_abort || cancelled()) return false;
+		if (0 == (tracker_req().kind & tracker_request::scrape_request)) return false;
+
+		// once the scrape has been sent, it's too late to add to it
+		if (m_state != action_t::error && m_state != action_t::connect) return false;
+		if (int(m_scrape_batch.size()) + 1 >= max_scrape_hashes) return false;
+		if (req.url != tracker_req().url
+			|| req.outgoing_socket != tracker_req().outgoing_socket)
+			return false;
+
+		m_scrape_batch.emplace_back(req, std::move(c));
+		return true;
+	}
+
 	void udp_tracker_connection::start()
 	{
 		// TODO: 2 support authentication here. tracker_req().auth
@@ -128,6 +158,11 @@ namespace libtorrent {
 	void udp_tracker_connection::fail(error_code const& ec, int code
 		, char const* msg, seconds32 const interval, seconds32 const min_interval)
 	{
+		// if other connections are waiting for our connect handshake with
+		// m_target, let them try on their own
+		release_pending_connect();
+		m_waiting_for_connect = false;
+
 		// m_target failed. remove it from the endpoint list
 		auto const i = std::find(m_endpoints.begin()
 			, m_endpoints.end(), tcp::endpoint(m_target.address(), m_target.port()));
@@ -138,6 +173,8 @@ namespace libtorrent {
 		// fail the whole announce
 		if (m_endpoints.empty() || !tracker_req().outgoing_socket)
 		{
+			fail_scrape_batch(ec, code, msg
+				, interval.count() == 0 ? min_interval : interval);
 			tracker_connection::fail(ec, code, msg, interval, min_interval);
 			return;
 		}
@@ -299,6 +336,8 @@ namespace libtorrent {
 
 	void udp_tracker_connection::start_announce()
 	{
+		if (cancelled()) return;
+
 		std::unique_lock<std::mutex> l(m_cache_mutex);
 		auto const cc = m_connection_cache.find(m_target.address());
 		if (cc != m_connection_cache.end())
@@ -316,11 +355,85 @@ namespace libtorrent {
 			// if it expired, remove it from the cache
 			m_connection_cache.erase(cc);
 		}
+
+		// if another connection is already performing the connect handshake
+		// with this tracker, wait for it to complete and use its connection
+		// ID. When we only know the hostname (because we're talking to the
+		// tracker via a proxy) the address doesn't identify the tracker
+		if (m_hostname.empty())
+		{
+			pending_connect& pc = m_pending_connects[m_target.address()];
+			if (pc.connector != nullptr && pc.connector != this)
+			{
+				pc.waiters.push_back(shared_from_this());
+				m_waiting_for_connect = true;
+#ifndef TORRENT_DISABLE_LOGGING
+				std::shared_ptr<request_callback> cb = requester();
+				if (cb && cb->should_log())
+				{
+					cb->debug_log("*** UDP_TRACKER [ waiting for connect handshake: %s ]"
+						, print_endpoint(m_target).c_str());
+				}
+#endif
+				return;
+			}
+			pc.connector = this;
+			m_connecting = true;
+		}
 		l.unlock();
 
 		send_udp_connect();
 	}
 
+	void udp_tracker_connection::on_connect_released(address const& target)
+	{
+		// we may have given up on the tracker IP we were waiting for (and moved
+		// on to another one) or been aborted since
+		if (!m_waiting_for_connect || target != m_target.address()) return;
+		m_waiting_for_connect = false;
+		start_announce();
+	}
+
+	void udp_tracker_connection::release_pending_connect()
+	{
+		if (!m_connecting) return;
+		m_connecting = false;
+
+		std::vector<std::weak_ptr<udp_tracker_connection>> waiters;
+		{
+			std::lock_guard<std::mutex> l(m_cache_mutex);
+			auto const i = m_pending_connects.find(m_target.address());
+			TORRENT_ASSERT(i != m_pending_connects.end());
+			if (i == m_pending_connects.end() || i->second.connector != this) return;
+			waiters.swap(i->second.waiters);
+			m_pending_connects.erase(i);
+		}
+
+		// the waiters may belong to other sessions, running on other threads.
+		// Restart them on their own io_service
+		for (auto const& w : waiters)
+		{
+			std::shared_ptr<udp_tracker_connection> c = w.lock();
+			if (!c) continue;
+			c->get_io_service().post(std::bind(
+				&udp_tracker_connection::on_connect_released, c, m_target.address()));
+		}
+	}
+
+	void udp_tracker_connection::fail_scrape_batch(error_code const& ec
+		, int const code, char const* msg, seconds32 const interval)
+	{
+		for (auto const& s : m_scrape_batch)
+		{
+			std::shared_ptr<request_callback> cb = s.second.lock();
+			if (!cb) continue;
+			// we need to post the error to avoid deadlock
+			get_io_service().post(std::bind(&request_callback::tracker_request_error
+				, cb, s.first, code, ec, std::string(msg), interval));
+		}
+		m_scrape_batch.clear();
+	}
+
 	void udp_tracker_connection::on_timeout(error_code const& ec)
 	{
 		if (ec)
@@ -338,6 +451,8 @@ namespace libtorrent {
 
 	void udp_tracker_connection::close()
 	{
+		release_pending_connect();
+		m_waiting_for_connect = false;
 		cancel();
 		m_man.remove_request(this);
 	}
@@ -485,10 +600,16 @@ namespace libtorrent {
 		update_transaction_id();
 		std::int64_t const connection_id = aux::read_int64(buf);
 
-		std::lock_guard<std::mutex> l(m_cache_mutex);
-		connection_cache_entry& cce = m_connection_cache[m_target.address()];
-		cce.connection_id = connection_id;
-		cce.expires = aux::time_now() + seconds(m_man.settings().get_int(settings_pack::udp_tracker_token_expiry));
+		{
+			std::lock_guard<std::mutex> l(m_cache_mutex);
+			connection_cache_entry& cce = m_connection_cache[m_target.address()];
+			cce.connection_id = connection_id;
+			cce.expires = aux::time_now() + seconds(m_man.settings().get_int(settings_pack::udp_tracker_token_expiry));
+		}
+
+		// the connection ID is in the cache now, any connection waiting for
+		// it can go ahead
+		release_pending_connect();
 
 		if (0 == (tracker_req().kind & tracker_request::scrape_request))
 			send_udp_announce();
@@ -573,32 +694,49 @@ namespace libtorrent {
 		TORRENT_ASSERT(i != m_connection_cache.end());
 		if (i == m_connection_cache.end()) return;
 
-		char buf[8 + 4 + 4 + 20];
+		char buf[8 + 4 + 4 + 20 * max_scrape_hashes];
 		span<char> view = buf;
 
 		aux::write_int64(i->second.connection_id, view); // connection_id
 		aux::write_int32(action_t::scrape, view); // action (scrape)
 		aux::write_int32(m_transaction_id, view); // transaction_id
-		// info_hash
+
+		// info_hashes. Our own first, followed by the ones of the scrapes
+		// batched with it. The response lists the stats in the same order
+		TORRENT_ASSERT(int(m_scrape_batch.size()) < max_scrape_hashes);
 		std::copy(tracker_req().info_hash.begin(), tracker_req().info_hash.end()
 			, view.data());
-#if TORRENT_USE_ASSERTS
-		TORRENT_ASSERT(view.size() == 20);
+		view = view.subspan(20);
+		for (auto const& s : m_scrape_batch)
+		{
+			std::copy(s.first.info_hash.begin(), s.first.info_hash.end(), view.data());
+			view = view.subspan(20);
+		}
+		span<char const> const packet(buf, std::size_t(sizeof(buf) - std::size_t(view.size())));
+
+#ifndef TORRENT_DISABLE_LOGGING
+		std::shared_ptr<request_callback> cb = requester();
+		if (cb && cb->should_log())
+		{
+			cb->debug_log("==> UDP_TRACKER_SCRAPE [ %s info-hashes: %d ]"
+				, aux::to_hex(tracker_req().info_hash).c_str()
+				, int(m_scrape_batch.size()) + 1);
+		}
 #endif
 
 		error_code ec;
 		if (!m_hostname.empty())
 		{
 			m_man.send_hostname(bind_socket(), m_hostname.c_str(), m_target.port()
-				, buf, ec, udp_socket::tracker_connection);
+				, packet, ec, udp_socket::tracker_connection);
 		}
 		else
 		{
-			m_man.send(bind_socket(), m_target, buf, ec
+			m_man.send(bind_socket(), m_target, packet, ec
 				, udp_socket::tracker_connection);
 		}
 		m_state = action_t::scrape;
-		sent_bytes(sizeof(buf) + 28); // assuming UDP/IP header
+		sent_bytes(int(packet.size()) + 28); // assuming UDP/IP header
 		++m_attempts;
 		if (ec)
 		{
@@ -719,19 +857,37 @@ namespace libtorrent {
 			return true;
 		}
 
+		// the stats for each info-hash are listed in the order they were
+		// requested in
 		int const complete = aux::read_int32(buf);
 		int const downloaded = aux::read_int32(buf);
 		int const incomplete = aux::read_int32(buf);
 
 		std::shared_ptr<request_callback> cb = requester();
-		if (!cb)
+		if (cb)
 		{
-			close();
-			return true;
+			cb->tracker_scrape_response(tracker_req()
+				, complete, incomplete, downloaded, -1);
+		}
+
+		auto s = m_scrape_batch.begin();
+		for (; s != m_scrape_batch.end() && buf.size() >= 12; ++s)
+		{
+			int const batch_complete = aux::read_int32(buf);
+			int const batch_downloaded = aux::read_int32(buf);
+			int const batch_incomplete = aux::read_int32(buf);
+
+			std::shared_ptr<request_callback> batch_cb = s->second.lock();
+			if (!batch_cb) continue;
+			batch_cb->tracker_scrape_response(s->first
+				, batch_complete, batch_incomplete, batch_downloaded, -1);
 		}
 
-		cb->tracker_scrape_response(tracker_req()
-			, complete, incomplete, downloaded, -1);
+		// if the response was truncated, fail the scrapes that weren't
+		// included
+		m_scrape_batch.erase(m_scrape_batch.begin(), s);
+		fail_scrape_batch(error_code(errors::invalid_tracker_response_length)
+			, -1, "", seconds32(0));
 
 		close();
 		return true;
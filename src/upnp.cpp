@@ -512,7 +512,7 @@ void upnp::on_reply(udp::endpoint const& from, char* buffer
 			else
 			{
 				log("HTTP method %s from %s"
-					, p.method().c_str(), print_endpoint(from).c_str());
+					, p.method().to_string().c_str(), print_endpoint(from).c_str());
 			}
 		}
 #endif
@@ -531,7 +531,7 @@ void upnp::on_reply(udp::endpoint const& from, char* buffer
 		return;
 	}
 
-	std::string url = p.header("location");
+	std::string url = p.header("location").to_string();
 	if (url.empty())
 	{
 #ifndef TORRENT_DISABLE_LOGGING
@@ -997,7 +997,7 @@ void upnp::on_upnp_xml(error_code const& e
 		if (should_log())
 		{
 			log("error while fetching control url from: %s: %s"
-				, d.url.c_str(), convert_from_native(p.message()).c_str());
+				, d.url.c_str(), convert_from_native(p.message().to_string()).c_str());
 		}
 #endif
 		d.disabled = true;
@@ -1276,7 +1276,7 @@ void upnp::on_upnp_get_ip_address_response(error_code const& e
 		if (should_log())
 		{
 			log("error while getting external IP address: %s"
-				, convert_from_native(p.message()).c_str());
+				, convert_from_native(p.message().to_string()).c_str());
 		}
 #endif
 		if (num_mappings() > 0) update_map(d, port_mapping_t{0});
@@ -1382,7 +1382,7 @@ void upnp::on_upnp_map_response(error_code const& e
 		return;
 	}
 
-	std::string const& ct = p.header("content-type");
+	std::string const ct = p.header("content-type").to_string();
 	if (!ct.empty()
 		&& ct.find_first_of("text/xml") == std::string::npos
 		&& ct.find_first_of("text/soap+xml") == std::string::npos
@@ -1539,7 +1539,7 @@ void upnp::on_upnp_unmap_response(error_code const& e
 		if (should_log())
 		{
 			log("error while deleting portmap: %s"
-				, convert_from_native(p.message()).c_str());
+				, convert_from_native(p.message().to_string()).c_str());
 		}
 #endif
 	}
@@ -37,6 +37,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <utility>
 #include <numeric>
 #include <cstdio>
+#include <memory>
+#include <algorithm>
 
 #include "libtorrent/peer_connection.hpp"
 #include "libtorrent/bt_peer_connection.hpp"
@@ -52,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/io.hpp"
 #include "libtorrent/performance_counters.hpp" // for counters
 #include "libtorrent/aux_/time.hpp"
+#include "libtorrent/aux_/bencode_writer.hpp"
 
 namespace libtorrent {namespace {
 
@@ -85,6 +88,30 @@ namespace libtorrent {namespace {
 
 	struct ut_metadata_peer_plugin;
 
+	// the payload of the data message of every metadata piece, i.e. the
+	// bencoded dictionary followed by the piece of the metadata, laid out
+	// back to back
+	struct framed_pieces
+	{
+		std::vector<char> buffer;
+
+		// the offset in buffer where each piece's message starts, followed
+		// by the size of buffer
+		std::vector<int> offsets;
+	};
+
+	// the send buffer holder for a pre-framed piece message. It keeps the
+	// messages alive until the peer has sent it
+	struct framed_piece_holder
+	{
+		std::shared_ptr<framed_pieces const> pieces;
+		char* ptr;
+		int len;
+
+		char* data() const { return ptr; }
+		std::size_t size() const { return std::size_t(len); }
+	};
+
 	struct ut_metadata_plugin final
 		: torrent_plugin
 	{
@@ -125,6 +152,11 @@ namespace libtorrent {namespace {
 			return {m_metadata.get(), aux::numeric_cast<std::size_t>(m_metadata_size)};
 		}
 
+		// returns the data messages of all metadata pieces. They are built
+		// the first time a peer requests a piece, and then shared by all
+		// peers, so serving a request doesn't need to encode anything
+		std::shared_ptr<framed_pieces const> framed_metadata() const;
+
 		bool received_metadata(ut_metadata_peer_plugin& source
 			, char const* buf, int const size, int const piece, int const total_size);
 
@@ -160,6 +192,8 @@ namespace libtorrent {namespace {
 
 		mutable int m_metadata_size = 0;
 
+		mutable std::shared_ptr<framed_pieces const> m_framed;
+
 		struct metadata_piece
 		{
 			metadata_piece(): num_requests(0), last_request(min_time()) {}
@@ -241,51 +275,60 @@ namespace libtorrent {namespace {
 			// abort if the peer doesn't support the metadata extension
 			if (m_message_index == 0) return;
 
-			entry e;
-			e["msg_type"] = type;
-			e["piece"] = piece;
-
-			char const* metadata = nullptr;
-			int metadata_piece_size = 0;
-
-			if (m_torrent.valid_metadata())
-				e["total_size"] = m_tp.get_metadata_size();
+			namespace io = detail;
 
-			if (type == 1)
+			if (type == metadata_piece)
 			{
 				TORRENT_ASSERT(piece >= 0 && piece < int(m_tp.get_metadata_size() + 16 * 1024 - 1)/(16*1024));
 				TORRENT_ASSERT(m_pc.associated_torrent().lock()->valid_metadata());
 				TORRENT_ASSERT(m_torrent.valid_metadata());
 
-				int offset = piece * 16 * 1024;
-				metadata = m_tp.metadata().data() + offset;
-				metadata_piece_size = (std::min)(
-					m_tp.get_metadata_size() - offset, 16 * 1024);
-				TORRENT_ASSERT(metadata_piece_size > 0);
-				TORRENT_ASSERT(offset >= 0);
-				TORRENT_ASSERT(offset + metadata_piece_size <= int(m_tp.get_metadata_size()));
+				std::shared_ptr<framed_pieces const> framed = m_tp.framed_metadata();
+				int const start = framed->offsets[std::size_t(piece)];
+				int const len = framed->offsets[std::size_t(piece) + 1] - start;
+				TORRENT_ASSERT(len > 0);
+
+				char header[6];
+				char* ptr = header;
+				io::write_uint32(2 + len, ptr);
+				io::write_uint8(bt_peer_connection::msg_extended, ptr);
+				io::write_uint8(m_message_index, ptr);
+				m_pc.send_buffer(header);
+
+				char* msg = const_cast<char*>(framed->buffer.data()) + start;
+				m_pc.append_const_send_buffer(
+					framed_piece_holder{std::move(framed), msg, len}, len);
+
+				m_pc.stats_counters().inc_stats_counter(counters::num_outgoing_extended);
+				m_pc.stats_counters().inc_stats_counter(counters::num_outgoing_metadata);
+				return;
 			}
 
-			// TODO: 3 use the aux::write_* functions and the span here instead, it
-			// will fit better with send_buffer()
-			char msg[200];
-			char* header = msg;
-			char* p = &msg[6];
-			int const len = bencode(p, e);
-			int const total_size = 2 + len + metadata_piece_size;
-			namespace io = detail;
-			io::write_uint32(total_size, header);
+			static_assert(aux::keys_sorted("msg_type", "piece", "total_size")
+				, "ut_metadata keys out of order");
+
+			// leave room for the message header, it's filled in once we know
+			// the size of the dictionary
+			aux::fixed_buffer<100> msg;
+			msg.resize(6);
+			aux::basic_bencode_writer<aux::fixed_buffer<100>> w(msg);
+			w.open_dict();
+			w.key("msg_type"); w.integer(type);
+			w.key("piece"); w.integer(piece);
+			if (m_torrent.valid_metadata())
+			{
+				w.key("total_size"); w.integer(m_tp.get_metadata_size());
+			}
+			w.close();
+			TORRENT_ASSERT(w.done());
+
+			int const len = int(msg.size()) - 6;
+			char* header = msg.data();
+			io::write_uint32(2 + len, header);
 			io::write_uint8(bt_peer_connection::msg_extended, header);
 			io::write_uint8(m_message_index, header);
 
-			m_pc.send_buffer({msg, static_cast<std::size_t>(len + 6)});
-			// TODO: we really need to increment the refcounter on the torrent
-			// while this buffer is still in the peer's send buffer
-			if (metadata_piece_size)
-			{
-				m_pc.append_const_send_buffer(
-					span<char>(const_cast<char*>(metadata), std::size_t(metadata_piece_size)), metadata_piece_size);
-			}
+			m_pc.send_buffer({msg.data(), msg.size()});
 
 			m_pc.stats_counters().inc_stats_counter(counters::num_outgoing_extended);
 			m_pc.stats_counters().inc_stats_counter(counters::num_outgoing_metadata);
@@ -523,6 +566,41 @@ namespace libtorrent {namespace {
 		return piece;
 	}
 
+	std::shared_ptr<framed_pieces const> ut_metadata_plugin::framed_metadata() const
+	{
+		if (m_framed) return m_framed;
+
+		static_assert(aux::keys_sorted("msg_type", "piece", "total_size")
+			, "ut_metadata keys out of order");
+
+		span<char const> const md = metadata();
+		int const num_pieces = div_round_up(m_metadata_size, 16 * 1024);
+
+		auto framed = std::make_shared<framed_pieces>();
+		framed->buffer.reserve(std::size_t(m_metadata_size + num_pieces * 64));
+		framed->offsets.reserve(std::size_t(num_pieces + 1));
+		aux::bencode_writer w(framed->buffer);
+		for (int piece = 0; piece < num_pieces; ++piece)
+		{
+			framed->offsets.push_back(int(framed->buffer.size()));
+			w.open_dict();
+			w.key("msg_type"); w.integer(1); // data message
+			w.key("piece"); w.integer(piece);
+			w.key("total_size"); w.integer(m_metadata_size);
+			w.close();
+
+			int const offset = piece * 16 * 1024;
+			int const size = std::min(m_metadata_size - offset, 16 * 1024);
+			framed->buffer.insert(framed->buffer.end(), md.data() + offset
+				, md.data() + offset + size);
+		}
+		framed->offsets.push_back(int(framed->buffer.size()));
+		TORRENT_ASSERT(w.done());
+
+		m_framed = std::move(framed);
+		return m_framed;
+	}
+
 	bool ut_metadata_plugin::received_metadata(
 		ut_metadata_peer_plugin& source
 		, char const* buf, int const size, int const piece, int const total_size)
@@ -43,6 +43,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/performance_counters.hpp" // for counters
 #include "libtorrent/extensions/ut_pex.hpp"
 #include "libtorrent/aux_/time.hpp"
+#include "libtorrent/aux_/bencode_writer.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <utility>
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
 
@@ -68,6 +73,69 @@ namespace libtorrent {namespace {
 		return true;
 	}
 
+	struct pex_peer
+	{
+		tcp::endpoint ep;
+		std::uint8_t flags;
+	};
+
+	// writes the compact endpoints of one address family (and optionally
+	// their flags) as a string under ``key``
+	template <typename Range, typename GetEndpoint>
+	void write_compact(aux::bencode_writer& w, char const* key
+		, Range const& peers, bool const v6, GetEndpoint get_ep)
+	{
+		std::size_t n = 0;
+		for (auto const& p : peers)
+			if (get_ep(p).address().is_v6() == v6) ++n;
+
+		w.key(key);
+		char* ptr = w.string_buffer(n * (v6 ? 18 : 6));
+		for (auto const& p : peers)
+			if (get_ep(p).address().is_v6() == v6) detail::write_endpoint(get_ep(p), ptr);
+	}
+
+	void write_flags(aux::bencode_writer& w, char const* key
+		, std::vector<pex_peer> const& peers, bool const v6)
+	{
+		std::size_t n = 0;
+		for (auto const& p : peers)
+			if (p.ep.address().is_v6() == v6) ++n;
+
+		w.key(key);
+		char* ptr = w.string_buffer(n);
+		for (auto const& p : peers)
+			if (p.ep.address().is_v6() == v6) detail::write_uint8(p.flags, ptr);
+	}
+
+	// bencodes a pex message with the ``added`` peers and ``dropped``
+	// endpoints into ``buf`` (which is cleared first)
+	void write_pex_msg(std::vector<char>& buf, std::vector<pex_peer> const& added
+		, std::vector<tcp::endpoint> const& dropped)
+	{
+		static_assert(aux::keys_sorted("added", "added.f", "added6", "added6.f"
+			, "dropped", "dropped6"), "pex keys out of order");
+
+		auto const added_ep = [](pex_peer const& p) -> tcp::endpoint const& { return p.ep; };
+		auto const dropped_ep = [](tcp::endpoint const& ep) -> tcp::endpoint const& { return ep; };
+
+		buf.clear();
+		aux::bencode_writer w(buf);
+		w.open_dict();
+		write_compact(w, "added", added, false, added_ep);
+		write_flags(w, "added.f", added, false);
+#if TORRENT_USE_IPV6
+		write_compact(w, "added6", added, true, added_ep);
+		write_flags(w, "added6.f", added, true);
+#endif
+		write_compact(w, "dropped", dropped, false, dropped_ep);
+#if TORRENT_USE_IPV6
+		write_compact(w, "dropped6", dropped, true, dropped_ep);
+#endif
+		w.close();
+		TORRENT_ASSERT(w.done());
+	}
+
 	struct ut_pex_plugin final
 		: torrent_plugin
 	{
@@ -106,118 +174,105 @@ namespace libtorrent {namespace {
 
 			if (m_torrent.num_peers() == 0) return;
 
-			entry pex;
-			std::string& pla = pex["added"].string();
-			std::string& pld = pex["dropped"].string();
-			std::string& plf = pex["added.f"].string();
-			std::back_insert_iterator<std::string> pla_out(pla);
-			std::back_insert_iterator<std::string> pld_out(pld);
-			std::back_insert_iterator<std::string> plf_out(plf);
-#if TORRENT_USE_IPV6
-			std::string& pla6 = pex["added6"].string();
-			std::string& pld6 = pex["dropped6"].string();
-			std::string& plf6 = pex["added6.f"].string();
-			std::back_insert_iterator<std::string> pla6_out(pla6);
-			std::back_insert_iterator<std::string> pld6_out(pld6);
-			std::back_insert_iterator<std::string> plf6_out(plf6);
-#endif
+			m_added.clear();
+			m_dropped.clear();
+			m_next_peers.clear();
 
-			std::set<tcp::endpoint> dropped;
-			m_old_peers.swap(dropped);
-
-			m_peers_in_message = 0;
-			int num_added = 0;
+			m_current.clear();
 			for (auto const peer : m_torrent)
 			{
 				if (!send_peer(*peer)) continue;
+				m_current.emplace_back(peer->remote(), peer);
+			}
+			std::sort(m_current.begin(), m_current.end()
+				, [](std::pair<tcp::endpoint, peer_connection*> const& lhs
+					, std::pair<tcp::endpoint, peer_connection*> const& rhs)
+				{ return lhs.first < rhs.first; });
+
+			// both lists are sorted, walk them side by side to find the peers
+			// that were added and dropped since the last message
+			auto old = m_old_peers.begin();
+			int num_added = 0;
+			for (auto const& c : m_current)
+			{
+				while (old != m_old_peers.end() && *old < c.first)
+					m_dropped.push_back(*old++);
 
-				tcp::endpoint remote = peer->remote();
-				m_old_peers.insert(remote);
-
-				auto const di = dropped.find(remote);
-				if (di == dropped.end())
-				{
-					// don't write too big of a package
-					if (num_added >= max_peer_entries) break;
-
-					// only send proper bittorrent peers
-					if (peer->type() != connection_type::bittorrent)
-						continue;
-
-					bt_peer_connection* p = static_cast<bt_peer_connection*>(peer);
-
-					// if the peer has told us which port its listening on,
-					// use that port. But only if we didn't connect to the peer.
-					// if we connected to it, use the port we know works
-					if (!p->is_outgoing())
-					{
-						torrent_peer const* const pi = peer->peer_info_struct();
-						if (pi != nullptr && pi->port > 0)
-							remote.port(pi->port);
-					}
-
-					// no supported flags to set yet
-					// 0x01 - peer supports encryption
-					// 0x02 - peer is a seed
-					// 0x04 - supports uTP. This is only a positive flags
-					//        passing 0 doesn't mean the peer doesn't
-					//        support uTP
-					// 0x08 - supports hole punching protocol. If this
-					//        flag is received from a peer, it can be
-					//        used as a rendezvous point in case direct
-					//        connections to the peer fail
-					int flags = p->is_seed() ? 2 : 0;
-#if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
-					flags |= p->supports_encryption() ? 1 : 0;
-#endif
-					flags |= is_utp(*p->get_socket()) ? 4 :  0;
-					flags |= p->supports_holepunch() ? 8 : 0;
-
-					// i->first was added since the last time
-					if (remote.address().is_v4())
-					{
-						detail::write_endpoint(remote, pla_out);
-						detail::write_uint8(flags, plf_out);
-					}
-#if TORRENT_USE_IPV6
-					else
-					{
-						detail::write_endpoint(remote, pla6_out);
-						detail::write_uint8(flags, plf6_out);
-					}
-#endif
-					++num_added;
-					++m_peers_in_message;
-				}
-				else
+				if (old != m_old_peers.end() && *old == c.first)
 				{
 					// this was in the previous message
 					// so, it wasn't dropped
-					dropped.erase(di);
+					m_next_peers.push_back(*old++);
+					continue;
 				}
-			}
 
-			for (auto const& i : dropped)
-			{
-				if (i.address().is_v4())
-					detail::write_endpoint(i, pld_out);
-#if TORRENT_USE_IPV6
-				else
-					detail::write_endpoint(i, pld6_out);
+				// don't write too big of a package. Peers that don't fit are
+				// left out of m_next_peers, to be added in the next message
+				if (num_added >= max_peer_entries) continue;
+
+				peer_connection* const peer = c.second;
+				m_next_peers.push_back(c.first);
+
+				// only send proper bittorrent peers
+				if (peer->type() != connection_type::bittorrent)
+					continue;
+
+				bt_peer_connection* p = static_cast<bt_peer_connection*>(peer);
+
+				// if the peer has told us which port its listening on,
+				// use that port. But only if we didn't connect to the peer.
+				// if we connected to it, use the port we know works
+				tcp::endpoint remote = c.first;
+				if (!p->is_outgoing())
+				{
+					torrent_peer const* const pi = peer->peer_info_struct();
+					if (pi != nullptr && pi->port > 0)
+						remote.port(pi->port);
+				}
+
+				// no supported flags to set yet
+				// 0x01 - peer supports encryption
+				// 0x02 - peer is a seed
+				// 0x04 - supports uTP. This is only a positive flags
+				//        passing 0 doesn't mean the peer doesn't
+				//        support uTP
+				// 0x08 - supports hole punching protocol. If this
+				//        flag is received from a peer, it can be
+				//        used as a rendezvous point in case direct
+				//        connections to the peer fail
+				int flags = p->is_seed() ? 2 : 0;
+#if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
+				flags |= p->supports_encryption() ? 1 : 0;
 #endif
-				++m_peers_in_message;
+				flags |= is_utp(*p->get_socket()) ? 4 :  0;
+				flags |= p->supports_holepunch() ? 8 : 0;
+
+				m_added.push_back({remote, std::uint8_t(flags)});
+				++num_added;
 			}
+			m_dropped.insert(m_dropped.end(), old, m_old_peers.end());
+			m_old_peers.swap(m_next_peers);
 
-			m_ut_pex_msg.clear();
-			bencode(std::back_inserter(m_ut_pex_msg), pex);
+			m_peers_in_message = num_added + int(m_dropped.size());
+
+			write_pex_msg(m_ut_pex_msg, m_added, m_dropped);
 		}
 
 	private:
 		torrent& m_torrent;
 
-		std::set<tcp::endpoint> m_old_peers;
+		// the peers we told our peers about in the last message, sorted
+		std::vector<tcp::endpoint> m_old_peers;
 		time_point m_last_msg;
 		std::vector<char> m_ut_pex_msg;
+
+		// scratch space for building the next message, kept around to avoid
+		// reallocating it every time. m_current is the peers we're connected
+		// to (sorted by endpoint) and m_next_peers becomes m_old_peers
+		std::vector<std::pair<tcp::endpoint, peer_connection*>> m_current;
+		std::vector<tcp::endpoint> m_next_peers;
+		std::vector<pex_peer> m_added;
+		std::vector<tcp::endpoint> m_dropped;
 		int m_peers_in_message;
 
 		// explicitly disallow assignment, to silence msvc warning
@@ -511,21 +566,8 @@ namespace libtorrent {namespace {
 
 		void send_ut_peer_list()
 		{
-			entry pex;
-			// leave the dropped string empty
-			pex["dropped"].string();
-			std::string& pla = pex["added"].string();
-			std::string& plf = pex["added.f"].string();
-			std::back_insert_iterator<std::string> pla_out(pla);
-			std::back_insert_iterator<std::string> plf_out(plf);
-
-#if TORRENT_USE_IPV6
-			pex["dropped6"].string();
-			std::string& pla6 = pex["added6"].string();
-			std::string& plf6 = pex["added6.f"].string();
-			std::back_insert_iterator<std::string> pla6_out(pla6);
-			std::back_insert_iterator<std::string> plf6_out(plf6);
-#endif
+			std::vector<pex_peer> added;
+			added.reserve(std::size_t(std::min(m_torrent.num_peers(), int(max_peer_entries))));
 
 			int num_added = 0;
 			for (auto const peer : m_torrent)
@@ -568,22 +610,13 @@ namespace libtorrent {namespace {
 				}
 
 				// i->first was added since the last time
-				if (remote.address().is_v4())
-				{
-					detail::write_endpoint(remote, pla_out);
-					detail::write_uint8(flags, plf_out);
-				}
-#if TORRENT_USE_IPV6
-				else
-				{
-					detail::write_endpoint(remote, pla6_out);
-					detail::write_uint8(flags, plf6_out);
-				}
-#endif
+				added.push_back({remote, std::uint8_t(flags)});
 				++num_added;
 			}
+
+			// leave the dropped strings empty
 			std::vector<char> pex_msg;
-			bencode(std::back_inserter(pex_msg), pex);
+			write_pex_msg(pex_msg, added, std::vector<tcp::endpoint>());
 
 			char msg[6];
 			char* ptr = msg;
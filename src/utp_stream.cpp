@@ -41,6 +41,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/invariant_check.hpp"
 #include "libtorrent/performance_counters.hpp"
 #include "libtorrent/io_service.hpp"
+#include "libtorrent/aux_/ring_buffer.hpp"
 #include <cstdint>
 #include <limits>
 
@@ -216,9 +217,16 @@ bool compare_less_wrap(std::uint32_t lhs
 
 // when we receive data into m_receive_buffer (i.e. the buffer
 // used when there's no user provided one) is stored as a
-// number of heap allocated packets. This is just because it's
+// number of packets from the packet pool. This is just because it's
 // simple to reuse the data structured and it provides all the
-// functionality needed for this buffer.
+// functionality needed for this buffer. The packets are queued in a
+// ring buffer, which only allocates while it grows to its steady-state
+// depth.
+
+// the user provided buffers are kept in fixed size inline rings of
+// iovecs. If the user passes in more buffers than fit, the extra buffers
+// are simply not used for this operation. That's fine, since a read or
+// write operation is allowed to transfer fewer bytes than requested.
 
 struct utp_socket_impl
 {
@@ -316,6 +324,7 @@ private:
 public:
 
 	void check_receive_buffers() const;
+	void check_write_buffer() const;
 
 #if TORRENT_USE_INVARIANT_CHECKS
 	void check_invariant() const;
@@ -343,19 +352,25 @@ public:
 	// the system's type.
 	struct iovec_t
 	{
+		iovec_t() = default;
 		iovec_t(void* b, std::size_t l): buf(b), len(l) {}
-		void* buf;
-		std::size_t len;
+		void* buf = nullptr;
+		std::size_t len = 0;
 	};
 
+	// the max number of user buffers a single read or write
+	// operation can refer to. Any buffers beyond this are ignored
+	static constexpr std::size_t max_write_iovecs = 16;
+	static constexpr std::size_t max_read_iovecs = 8;
+
 	// if there's currently an async read or write
 	// operation in progress, these buffers are initialized
 	// and used, otherwise any bytes received are stuck in
 	// m_receive_buffer until another read is made
 	// as we flush from the write buffer, individual iovecs
 	// are updated to only refer to unflushed portions of the
-	// buffers. Buffers that empty are erased from the vector.
-	std::vector<iovec_t> m_write_buffer;
+	// buffers. Buffers that empty are popped from the ring.
+	aux::static_ring<iovec_t, max_write_iovecs> m_write_buffer;
 
 	// if this is non nullptr, it's a packet. This packet was held off because
 	// of NAGLE. We couldn't send it immediately. It's left
@@ -367,13 +382,13 @@ public:
 	// data in the m_receive_buffer. As data is stored in the
 	// read buffer, the iovec_t elements are adjusted to only
 	// refer to the unwritten portions of the buffers, and the
-	// ones that fill up are erased from the vector
-	std::vector<iovec_t> m_read_buffer;
+	// ones that fill up are popped from the ring
+	aux::static_ring<iovec_t, max_read_iovecs> m_read_buffer;
 
 	// packets we've received without a read operation
 	// active. Store them here until the client triggers
 	// an async_read_some
-	std::vector<packet_ptr> m_receive_buffer;
+	aux::ring_buffer<packet_ptr> m_receive_buffer;
 
 	// this is the error on this socket. If m_state is
 	// set to UTP_STATE_ERROR_WAIT, this error should be
@@ -890,8 +905,7 @@ void utp_stream::on_read(void* self, std::size_t const bytes_transferred
 
 	TORRENT_ASSERT(s->m_read_handler);
 	TORRENT_ASSERT(bytes_transferred > 0 || ec || s->m_impl->m_null_buffers);
-	s->m_io_service.post(std::bind<void>(std::move(s->m_read_handler), ec, bytes_transferred));
-	s->m_read_handler = nullptr;
+	s->m_read_handler.post(s->m_io_service, ec, bytes_transferred);
 	if (shutdown && s->m_impl)
 	{
 		TORRENT_ASSERT(ec);
@@ -911,8 +925,7 @@ void utp_stream::on_write(void* self, std::size_t const bytes_transferred
 
 	TORRENT_ASSERT(s->m_write_handler);
 	TORRENT_ASSERT(bytes_transferred > 0 || ec);
-	s->m_io_service.post(std::bind<void>(std::move(s->m_write_handler), ec, bytes_transferred));
-	s->m_write_handler = nullptr;
+	s->m_write_handler.post(s->m_io_service, ec, bytes_transferred);
 	if (shutdown && s->m_impl)
 	{
 		TORRENT_ASSERT(ec);
@@ -940,52 +953,40 @@ void utp_stream::on_connect(void* self, error_code const& ec, bool shutdown)
 	}
 }
 
-void utp_stream::add_read_buffer(void* buf, std::size_t const len)
+bool utp_stream::add_read_buffer(void* buf, std::size_t const len)
 {
 	TORRENT_ASSERT(m_impl);
 	TORRENT_ASSERT(len < INT_MAX);
 	TORRENT_ASSERT(len > 0);
 	TORRENT_ASSERT(buf);
-	m_impl->m_read_buffer.emplace_back(buf, len);
+	if (!m_impl->m_read_buffer.push_back({buf, len})) return false;
 	m_impl->m_read_buffer_size += int(len);
 
 	UTP_LOGV("%8p: add_read_buffer %d bytes\n", static_cast<void*>(m_impl), int(len));
+	return true;
 }
 
 // this is the wrapper to add a user provided write buffer to the
 // utp_socket_impl. It makes sure the m_write_buffer_size is kept
-// up to date
-void utp_stream::add_write_buffer(void const* buf, std::size_t const len)
+// up to date. Returns false if the buffer could not be added because
+// the write operation already refers to the max number of buffers
+bool utp_stream::add_write_buffer(void const* buf, std::size_t const len)
 {
 	TORRENT_ASSERT(m_impl);
 	TORRENT_ASSERT(len < INT_MAX);
 	TORRENT_ASSERT(len > 0);
 	TORRENT_ASSERT(buf);
 
-#if TORRENT_USE_ASSERTS
-	int write_buffer_size = 0;
-	for (auto const& i : m_impl->m_write_buffer)
-	{
-		TORRENT_ASSERT(std::numeric_limits<int>::max() - int(i.len) > write_buffer_size);
-		write_buffer_size += int(i.len);
-	}
-	TORRENT_ASSERT(m_impl->m_write_buffer_size == write_buffer_size);
-#endif
+	m_impl->check_write_buffer();
 
-	m_impl->m_write_buffer.emplace_back(const_cast<void*>(buf), len);
+	if (!m_impl->m_write_buffer.push_back({const_cast<void*>(buf), len}))
+		return false;
 	m_impl->m_write_buffer_size += int(len);
 
-#if TORRENT_USE_ASSERTS
-	write_buffer_size = 0;
-	for (auto const& i : m_impl->m_write_buffer)
-	{
-		TORRENT_ASSERT(std::numeric_limits<int>::max() - int(i.len) > write_buffer_size);
-		write_buffer_size += int(i.len);
-	}
-	TORRENT_ASSERT(m_impl->m_write_buffer_size == write_buffer_size);
-#endif
+	m_impl->check_write_buffer();
 
 	UTP_LOGV("%8p: add_write_buffer %d bytes\n", static_cast<void*>(m_impl), int(len));
+	return true;
 }
 
 // this is called when all user provided read buffers have been added
@@ -1026,15 +1027,12 @@ std::size_t utp_stream::read_some(bool const clear_buffers)
 		return 0;
 	}
 
-	auto target = m_impl->m_read_buffer.begin();
-
 	std::size_t ret = 0;
 
 	int pop_packets = 0;
-	for (auto i = m_impl->m_receive_buffer.begin()
-		, end(m_impl->m_receive_buffer.end()); i != end;)
+	for (int i = 0; i < m_impl->m_receive_buffer.size();)
 	{
-		if (target == m_impl->m_read_buffer.end())
+		if (m_impl->m_read_buffer.empty())
 		{
 			UTP_LOGV("  No more target buffers: %d bytes left in buffer\n"
 				, m_impl->m_receive_buffer_size);
@@ -1044,7 +1042,8 @@ std::size_t utp_stream::read_some(bool const clear_buffers)
 
 		m_impl->check_receive_buffers();
 
-		packet* p = i->get();
+		packet* p = m_impl->m_receive_buffer[i].get();
+		auto* target = &m_impl->m_read_buffer.front();
 		int to_copy = std::min(p->size - p->header_size, aux::numeric_cast<int>(target->len));
 		TORRENT_ASSERT(to_copy >= 0);
 		std::memcpy(target->buf, p->buf + p->header_size, std::size_t(to_copy));
@@ -1056,7 +1055,7 @@ std::size_t utp_stream::read_some(bool const clear_buffers)
 		TORRENT_ASSERT(m_impl->m_read_buffer_size >= to_copy);
 		m_impl->m_read_buffer_size -= to_copy;
 		p->header_size += std::uint16_t(to_copy);
-		if (target->len == 0) target = m_impl->m_read_buffer.erase(target);
+		if (target->len == 0) m_impl->m_read_buffer.pop_front();
 
 		m_impl->check_receive_buffers();
 
@@ -1065,8 +1064,7 @@ std::size_t utp_stream::read_some(bool const clear_buffers)
 		// Consumed entire packet
 		if (p->header_size == p->size)
 		{
-			m_impl->release_packet(std::move(*i));
-			i->reset();
+			m_impl->release_packet(std::move(m_impl->m_receive_buffer[i]));
 			++pop_packets;
 			++i;
 		}
@@ -1080,8 +1078,7 @@ std::size_t utp_stream::read_some(bool const clear_buffers)
 	}
 	// remove the packets from the receive_buffer that we already copied over
 	// and freed
-	m_impl->m_receive_buffer.erase(m_impl->m_receive_buffer.begin()
-		, m_impl->m_receive_buffer.begin() + pop_packets);
+	m_impl->m_receive_buffer.pop_front(pop_packets);
 	// we exited either because we ran out of bytes to copy
 	// or because we ran out of space to copy the bytes to
 	TORRENT_ASSERT(m_impl->m_receive_buffer_size == 0
@@ -1168,8 +1165,11 @@ utp_socket_impl::~utp_socket_impl()
 		release_packet(std::move(p));
 	}
 
-	for (auto& p : m_receive_buffer)
-		release_packet(std::move(p));
+	while (!m_receive_buffer.empty())
+	{
+		release_packet(std::move(m_receive_buffer.front()));
+		m_receive_buffer.pop_front();
+	}
 
 	release_packet(std::move(m_nagle_packet));
 	m_nagle_packet.reset();
@@ -1568,25 +1568,16 @@ void utp_socket_impl::write_payload(std::uint8_t* ptr, int size)
 {
 	INVARIANT_CHECK;
 
-#if TORRENT_USE_ASSERTS
-	int write_buffer_size = 0;
-	for (auto const& i : m_write_buffer)
-	{
-		TORRENT_ASSERT(std::numeric_limits<int>::max() - int(i.len) > write_buffer_size);
-		write_buffer_size += int(i.len);
-	}
-	TORRENT_ASSERT(m_write_buffer_size == write_buffer_size);
-#endif
+	check_write_buffer();
 	TORRENT_ASSERT(!m_write_buffer.empty() || size == 0);
 	TORRENT_ASSERT(m_write_buffer_size >= size);
-	auto i = m_write_buffer.begin();
 
 	if (size == 0) return;
 
-	int buffers_to_clear = 0;
 	while (size > 0)
 	{
 		// i points to the iovec we'll start copying from
+		iovec_t* i = &m_write_buffer.front();
 		int to_copy = std::min(size, int(i->len));
 		TORRENT_ASSERT(to_copy >= 0);
 		TORRENT_ASSERT(to_copy < INT_MAX / 2 && m_written < INT_MAX / 2);
@@ -1598,23 +1589,10 @@ void utp_socket_impl::write_payload(std::uint8_t* ptr, int size)
 		TORRENT_ASSERT(m_write_buffer_size >= to_copy);
 		m_write_buffer_size -= to_copy;
 		i->buf = static_cast<char*>(i->buf) + to_copy;
-		if (i->len == 0) ++buffers_to_clear;
-		++i;
+		if (i->len == 0) m_write_buffer.pop_front();
 	}
 
-	if (buffers_to_clear)
-		m_write_buffer.erase(m_write_buffer.begin()
-			, m_write_buffer.begin() + buffers_to_clear);
-
-#if TORRENT_USE_ASSERTS
-	write_buffer_size = 0;
-	for (auto const& j : m_write_buffer)
-	{
-		TORRENT_ASSERT(std::numeric_limits<int>::max() - int(j.len) > write_buffer_size);
-		write_buffer_size += int(j.len);
-	}
-	TORRENT_ASSERT(m_write_buffer_size == write_buffer_size);
-#endif
+	check_write_buffer();
 }
 
 void utp_socket_impl::subscribe_drained()
@@ -2057,6 +2035,9 @@ bool utp_socket_impl::send_pkt(int const flags)
 	else
 	{
 		TORRENT_ASSERT(h->seq_nr == m_seq_nr);
+		// packets without payload are not saved for resending, hand them
+		// back to the pool rather than freeing them
+		release_packet(std::move(p));
 	}
 
 	// if the socket is stalled, always return false, don't
@@ -2362,7 +2343,7 @@ void utp_socket_impl::incoming(std::uint8_t const* buf, int size, packet_ptr p
 		TORRENT_ASSERT(m_read_buffer_size >= to_copy);
 		m_read_buffer_size -= to_copy;
 		size -= to_copy;
-		if (target->len == 0) m_read_buffer.erase(m_read_buffer.begin());
+		if (target->len == 0) m_read_buffer.pop_front();
 		if (p)
 		{
 			p->header_size += std::uint16_t(to_copy);
@@ -2389,7 +2370,7 @@ void utp_socket_impl::incoming(std::uint8_t const* buf, int size, packet_ptr p
 	}
 	// save this packet until the client issues another read
 	m_receive_buffer_size += p->size - p->header_size;
-	m_receive_buffer.emplace_back(std::move(p));
+	m_receive_buffer.push_back(std::move(p));
 
 	UTP_LOGV("%8p: incoming: saving packet in receive buffer (%d)\n", static_cast<void*>(this), m_receive_buffer_size);
 
@@ -3640,12 +3621,28 @@ void utp_socket_impl::check_receive_buffers() const
 	INVARIANT_CHECK;
 
 	int size = 0;
-	for (auto const& p : m_receive_buffer)
+	for (int i = 0; i < m_receive_buffer.size(); ++i)
+	{
+		packet const* p = m_receive_buffer[i].get();
 		size += p ? p->size - p->header_size : 0;
+	}
 
 	TORRENT_ASSERT(size == m_receive_buffer_size);
 }
 
+void utp_socket_impl::check_write_buffer() const
+{
+#if TORRENT_USE_ASSERTS
+	int size = 0;
+	for (int i = 0; i < m_write_buffer.size(); ++i)
+	{
+		TORRENT_ASSERT(std::numeric_limits<int>::max() - int(m_write_buffer[i].len) > size);
+		size += int(m_write_buffer[i].len);
+	}
+	TORRENT_ASSERT(m_write_buffer_size == size);
+#endif
+}
+
 #if TORRENT_USE_INVARIANT_CHECKS
 void utp_socket_impl::check_invariant() const
 {
@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <limits>
 #include <cstdlib>
+#include <algorithm>
 
 #include "libtorrent/web_connection_base.hpp"
 #include "libtorrent/invariant_check.hpp"
@@ -53,7 +54,8 @@ namespace libtorrent {
 		, m_parser(http_parser::dont_parse_chunks)
 		, m_body_start(0)
 	{
-		TORRENT_ASSERT(&web.peer_info == pack.peerinfo);
+		TORRENT_ASSERT(std::any_of(web.peers.begin(), web.peers.end()
+			, [&pack](ipv4_peer const& p) { return &p == pack.peerinfo; }));
 		// when going through a proxy, we don't necessarily have an endpoint here,
 		// since the proxy might be resolving the hostname, not us
 		TORRENT_ASSERT(web.endpoints.empty() || web.endpoints.front() == pack.endp);
@@ -474,11 +474,11 @@ namespace {
 		std::string ret = "URL seed @ ";
 		ret += host;
 
-		std::string const& server_version = p.header("server");
+		string_view const server_version = p.header("server");
 		if (!server_version.empty())
 		{
 			ret += " (";
-			ret += server_version;
+			ret.append(server_version.data(), server_version.size());
 			ret += ")";
 		}
 		return ret;
@@ -585,7 +585,7 @@ void web_peer_connection::handle_error(int const bytes_left)
 	if (t->alerts().should_post<url_seed_alert>())
 	{
 		std::string const error_msg = to_string(m_parser.status_code()).data()
-			+ (" " + m_parser.message());
+			+ (" " + m_parser.message().to_string());
 		t->alerts().emplace_alert<url_seed_alert>(t->get_handle(), m_url
 			, error_msg);
 	}
@@ -597,7 +597,7 @@ void web_peer_connection::handle_redirect(int const bytes_left)
 {
 	// this means we got a redirection request
 	// look for the location header
-	std::string location = m_parser.header("location");
+	std::string location = m_parser.header("location").to_string();
 	received_bytes(0, bytes_left);
 
 	std::shared_ptr<torrent> t = associated_torrent().lock();
@@ -660,9 +660,10 @@ void web_peer_connection::handle_redirect(int const bytes_left)
 		{
 			web->have_files.set_bit(file_index);
 
-			if (web->peer_info.connection != nullptr)
+			for (auto const& pi : web->peers)
 			{
-				peer_connection* pc = static_cast<peer_connection*>(web->peer_info.connection);
+				if (pi.connection == nullptr) continue;
+				peer_connection* pc = static_cast<peer_connection*>(pi.connection);
 
 				// we just learned that this host has this file, and we're currently
 				// connected to it. Make it advertise that it has this file to the
@@ -788,10 +789,10 @@ void web_peer_connection::on_receive(error_code const& error
 			if (should_log(peer_log_alert::info))
 			{
 				peer_log(peer_log_alert::info, "STATUS"
-					, "%d %s", m_parser.status_code(), m_parser.message().c_str());
-				std::multimap<std::string, std::string> const& headers = m_parser.headers();
-				for (auto const &i : headers)
-					peer_log(peer_log_alert::info, "STATUS", "   %s: %s", i.first.c_str(), i.second.c_str());
+					, "%d %s", m_parser.status_code(), m_parser.message().to_string().c_str());
+				for (auto const& i : m_parser.headers())
+					peer_log(peer_log_alert::info, "STATUS", "   %s: %s"
+						, i.first.to_string().c_str(), i.second.to_string().c_str());
 			}
 #endif
 
@@ -1031,6 +1032,30 @@ void web_peer_connection::incoming_payload(char const* buf, int len)
 		TORRENT_ASSERT(!m_requests.empty());
 		peer_request const& front_request = m_requests.front();
 		int const piece_size = int(m_piece.size());
+
+		if (piece_size == 0 && len >= front_request.length)
+		{
+			// the whole block is in the receive buffer already. Hand it
+			// straight to the disk write, without staging it in m_piece
+			incoming_piece_fragment(front_request.length);
+
+#ifndef TORRENT_DISABLE_LOGGING
+			peer_log(peer_log_alert::incoming_message, "POP_REQUEST"
+				, "piece: %d start: %d len: %d"
+				, static_cast<int>(front_request.piece), front_request.start, front_request.length);
+#endif
+
+			peer_request const front_request_copy = front_request;
+			m_requests.pop_front();
+			char const* const block = buf;
+			len -= front_request_copy.length;
+			buf += front_request_copy.length;
+
+			incoming_piece(front_request_copy, block);
+			if (is_disconnecting()) return;
+			continue;
+		}
+
 		int const copy_size = std::min(front_request.length - piece_size, len);
 
 		// m_piece may not hold more than the response to the next BT request
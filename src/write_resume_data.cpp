@@ -31,6 +31,8 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <cstdint>
+#include <algorithm>
+#include <cstring>
 
 #include "libtorrent/bdecode.hpp"
 #include "libtorrent/write_resume_data.hpp"
@@ -41,6 +43,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/numeric_cast.hpp"
 #include "libtorrent/torrent.hpp" // for default_piece_priority
 #include "libtorrent/aux_/numeric_cast.hpp" // for clamp
+#include "libtorrent/aux_/bencode_writer.hpp"
+#include "libtorrent/aux_/resume_data_binary.hpp"
 
 namespace libtorrent {
 
@@ -237,6 +241,21 @@ namespace libtorrent {
 				prio.emplace_back(static_cast<std::uint8_t>(p));
 		}
 
+		if (!atp.file_snapshots.empty())
+		{
+			// write the state of the files, as [size, mtime, inode]
+			entry::list_type& files = ret["file_snapshots"].list();
+			files.reserve(atp.file_snapshots.size());
+			for (auto const& f : atp.file_snapshots)
+			{
+				files.emplace_back(entry::list_type());
+				entry::list_type& e = files.back().list();
+				e.emplace_back(f.size);
+				e.emplace_back(f.mtime);
+				e.emplace_back(std::int64_t(f.inode));
+			}
+		}
+
 		if (!atp.piece_priorities.empty())
 		{
 			// write piece priorities
@@ -249,11 +268,287 @@ namespace libtorrent {
 		return ret;
 	}
 
+namespace {
+
+	template <typename Endpoints>
+	void write_endpoints(aux::bencode_writer& w, char const* key
+		, Endpoints const& eps, bool const v6)
+	{
+		std::size_t const size = v6 ? 18 : 6;
+		std::size_t n = 0;
+		for (auto const& ep : eps)
+			if (ep.address().is_v6() == v6) ++n;
+
+		w.key(key);
+		char* ptr = w.string_buffer(n * size);
+		for (auto const& ep : eps)
+			if (ep.address().is_v6() == v6) detail::write_endpoint(ep, ptr);
+	}
+}
+
+	// this produces the exact same output as bencoding the entry returned by
+	// write_resume_data(), but streams it straight into the buffer instead
+	// of building the intermediate tree. Keys have to be written in sorted
+	// order, which is why they don't appear in the same order as above.
 	std::vector<char> write_resume_data_buf(add_torrent_params const& atp)
 	{
+		static_assert(aux::keys_sorted("active_time", "added_time", "allocation"
+			, "auto_managed", "banned_peers", "banned_peers6", "completed_time"
+			, "download_rate_limit", "file-format", "file-version", "file_priority"
+			, "file_snapshots", "finished_time", "httpseeds", "info", "info-hash", "last_seen_complete"
+			, "libtorrent-version", "mapped_files", "max_connections", "max_uploads"
+			, "merkle tree", "num_complete", "num_downloaded", "num_incomplete"
+			, "paused", "peers", "peers6", "piece_priority", "pieces", "save_path"
+			, "seed_mode", "seeding_time", "sequential_download", "super_seeding"
+			, "total_downloaded", "total_uploaded", "trackers", "unfinished"
+			, "upload_rate_limit", "url", "url-list", "uuid")
+			, "resume data keys must be written in sorted order");
+
 		std::vector<char> ret;
-		entry rd = write_resume_data(atp);
-		bencode(std::back_inserter(ret), rd);
+		ret.reserve(std::size_t(512 + (atp.ti ? atp.ti->metadata_size() : 0)
+			+ std::max(atp.have_pieces.size(), atp.verified_pieces.size())));
+		aux::bencode_writer w(ret);
+
+		w.open_dict();
+		w.key("active_time"); w.integer(atp.active_time);
+		w.key("added_time"); w.integer(atp.added_time);
+		w.key("allocation"); w.string(atp.storage_mode == storage_mode_allocate
+			? "allocate" : "sparse");
+		w.key("auto_managed"); w.integer(bool(atp.flags & torrent_flags::auto_managed));
+
+		if (!atp.banned_peers.empty())
+		{
+			write_endpoints(w, "banned_peers", atp.banned_peers, false);
+#if TORRENT_USE_IPV6
+			write_endpoints(w, "banned_peers6", atp.banned_peers, true);
+#endif
+		}
+
+		w.key("completed_time"); w.integer(atp.completed_time);
+		w.key("download_rate_limit"); w.integer(atp.download_limit);
+		w.key("file-format"); w.string("libtorrent resume file");
+		w.key("file-version"); w.integer(1);
+
+		if (!atp.file_priorities.empty())
+		{
+			w.key("file_priority");
+			w.open_list();
+			for (auto const p : atp.file_priorities)
+				w.integer(static_cast<std::uint8_t>(p));
+			w.close();
+		}
+
+		if (!atp.file_snapshots.empty())
+		{
+			w.key("file_snapshots");
+			w.open_list();
+			for (auto const& f : atp.file_snapshots)
+			{
+				w.open_list();
+				w.integer(f.size);
+				w.integer(f.mtime);
+				w.integer(std::int64_t(f.inode));
+				w.close();
+			}
+			w.close();
+		}
+
+		w.key("finished_time"); w.integer(atp.finished_time);
+
+		if (!atp.http_seeds.empty())
+		{
+			w.key("httpseeds");
+			w.open_list();
+			for (auto const& s : atp.http_seeds) w.string(s);
+			w.close();
+		}
+
+		if (atp.ti)
+		{
+			auto const info = atp.ti->metadata();
+			int const size = atp.ti->metadata_size();
+			w.key("info");
+			w.raw({info.get(), std::size_t(size)});
+		}
+
+		w.key("info-hash"); w.string({atp.info_hash.data(), atp.info_hash.size()});
+		w.key("last_seen_complete"); w.integer(atp.last_seen_complete);
+		w.key("libtorrent-version"); w.string(LIBTORRENT_VERSION);
+
+		if (!atp.renamed_files.empty())
+		{
+			w.key("mapped_files");
+			w.open_list();
+			// renamed_files is ordered by file index. Files that aren't renamed
+			// are written as empty strings
+			int idx = 0;
+			for (auto const& ent : atp.renamed_files)
+			{
+				for (; idx < static_cast<int>(ent.first); ++idx) w.string("");
+				w.string(ent.second);
+				++idx;
+			}
+			w.close();
+		}
+
+		w.key("max_connections"); w.integer(atp.max_connections);
+		w.key("max_uploads"); w.integer(atp.upload_limit);
+
+		if (!atp.merkle_tree.empty())
+		{
+			// we need to save the whole merkle hash tree
+			// in order to resume
+			auto const& tree = atp.merkle_tree;
+			w.key("merkle tree");
+			char* ptr = w.string_buffer(tree.size() * 20);
+			std::memcpy(ptr, tree[0].data(), tree.size() * 20);
+		}
+
+		w.key("num_complete"); w.integer(atp.num_complete);
+		w.key("num_downloaded"); w.integer(atp.num_downloaded);
+		w.key("num_incomplete"); w.integer(atp.num_incomplete);
+		w.key("paused"); w.integer(bool(atp.flags & torrent_flags::paused));
+
+		if (!atp.peers.empty())
+		{
+			write_endpoints(w, "peers", atp.peers, false);
+#if TORRENT_USE_IPV6
+			write_endpoints(w, "peers6", atp.peers, true);
+#endif
+		}
+
+		if (!atp.piece_priorities.empty())
+		{
+			w.key("piece_priority");
+			char* ptr = w.string_buffer(atp.piece_priorities.size());
+			for (auto const p : atp.piece_priorities)
+				*ptr++ = static_cast<char>(static_cast<std::uint8_t>(p));
+		}
+
+		{
+			// write have bitmask
+			std::size_t const num_pieces = aux::numeric_cast<std::size_t>(std::max(
+				atp.have_pieces.size(), atp.verified_pieces.size()));
+			w.key("pieces");
+			char* pieces = w.string_buffer(num_pieces);
+			std::memset(pieces, 0, num_pieces);
+
+			std::size_t piece(0);
+			for (auto const bit : atp.have_pieces)
+			{
+				pieces[piece] = bit ? 1 : 0;
+				++piece;
+			}
+
+			piece = 0;
+			for (auto const bit : atp.verified_pieces)
+			{
+				pieces[piece] |= bit ? 2 : 0;
+				++piece;
+			}
+		}
+
+		w.key("save_path"); w.string(atp.save_path);
+		w.key("seed_mode"); w.integer(bool(atp.flags & torrent_flags::seed_mode));
+		w.key("seeding_time"); w.integer(atp.seeding_time);
+		w.key("sequential_download"); w.integer(bool(atp.flags & torrent_flags::sequential_download));
+		w.key("super_seeding"); w.integer(bool(atp.flags & torrent_flags::super_seeding));
+		w.key("total_downloaded"); w.integer(atp.total_downloaded);
+		w.key("total_uploaded"); w.integer(atp.total_uploaded);
+
+		if (!atp.trackers.empty())
+		{
+			// assign each tracker its tier (the last tier sticks for trackers
+			// past the end of tracker_tiers) and write them grouped by tier,
+			// preserving their relative order
+			std::vector<std::pair<std::size_t, std::size_t>> tiers;
+			tiers.reserve(atp.trackers.size());
+			std::size_t tier = 0;
+			auto tier_it = atp.tracker_tiers.begin();
+			for (std::size_t i = 0; i < atp.trackers.size(); ++i)
+			{
+				if (tier_it != atp.tracker_tiers.end())
+					tier = aux::clamp(std::size_t(*tier_it++), std::size_t{0}, std::size_t{1024});
+				tiers.emplace_back(tier, i);
+			}
+			std::stable_sort(tiers.begin(), tiers.end()
+				, [](std::pair<std::size_t, std::size_t> const& lhs
+					, std::pair<std::size_t, std::size_t> const& rhs)
+				{ return lhs.first < rhs.first; });
+
+			w.key("trackers");
+			w.open_list();
+			w.open_list();
+			std::size_t cur_tier = 0;
+			for (auto const& t : tiers)
+			{
+				if (cur_tier < t.first)
+				{
+					// tiers without any trackers have always been saved as empty
+					// strings (undefined entries)
+					w.close();
+					for (++cur_tier; cur_tier < t.first; ++cur_tier) w.string("");
+					w.open_list();
+				}
+				w.string(atp.trackers[t.second]);
+			}
+			w.close();
+			w.close();
+		}
+
+		if (!atp.unfinished_pieces.empty())
+		{
+			w.key("unfinished");
+			w.open_list();
+			for (auto const& p : atp.unfinished_pieces)
+			{
+				w.open_dict();
+				w.key("bitmask");
+				char* bitmask = w.string_buffer(std::size_t(p.second.size()));
+				for (auto const bit : p.second)
+					*bitmask++ = bit ? '1' : '0';
+				w.key("piece"); w.integer(static_cast<int>(p.first));
+				w.close();
+			}
+			w.close();
+		}
+
+		w.key("upload_rate_limit"); w.integer(atp.upload_limit);
+
+#ifndef TORRENT_NO_DEPRECATE
+		// deprecated in 1.2
+		if (!atp.url.empty()) { w.key("url"); w.string(atp.url); }
+#endif
+
+		if (!atp.url_seeds.empty())
+		{
+			w.key("url-list");
+			w.open_list();
+			for (auto const& s : atp.url_seeds) w.string(s);
+			w.close();
+		}
+
+#ifndef TORRENT_NO_DEPRECATE
+		if (!atp.uuid.empty()) { w.key("uuid"); w.string(atp.uuid); }
+#endif
+
+		w.close();
+		TORRENT_ASSERT(w.done());
 		return ret;
 	}
+
+	std::vector<char> write_resume_data_buf(add_torrent_params const& atp
+		, resume_data_format const fmt)
+	{
+		if (fmt == resume_data_format::binary)
+			return aux::write_binary_resume_data(atp);
+		return write_resume_data_buf(atp);
+	}
+
+	std::vector<char> write_resume_data_delta(add_torrent_params const& prev
+		, add_torrent_params const& atp)
+	{
+		TORRENT_ASSERT(prev.info_hash == atp.info_hash);
+		return aux::write_binary_resume_delta(prev, atp);
+	}
 }
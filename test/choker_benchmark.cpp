@@ -0,0 +1,255 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+// replays per-round peer transfer rates against the unchoker's ranking, both
+// the way it used to be done (partial_sort over peer pointers, reading the
+// counters in every comparison) and through the rank snapshots in
+// libtorrent/choker.hpp. The two must pick the same peers.
+//
+// usage: choker_benchmark [trace-file] [num-peers] [rounds] [slots]
+//
+// a trace file has one line per peer and round:
+//
+//	<round> <peer> <downloaded-bytes> <uploaded-bytes>
+//
+// with rounds in increasing order. If no trace file is given (or it's "-"),
+// a synthetic trace where every peer's rates take a random walk is used
+
+#include "libtorrent/choker.hpp"
+#include "libtorrent/time.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cinttypes>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <memory>
+
+using namespace lt;
+
+namespace {
+
+// the real unchoker locks the peer's torrent to look at it, which is a
+// good part of what a comparison costs. The simulated peers have a torrent
+// to lock too
+struct sim_peer
+{
+	std::weak_ptr<int> torrent;
+	std::int64_t downloaded = 0;
+	std::int64_t uploaded = 0;
+	time_point last_unchoke;
+	int prio = 1;
+	bool choked = true;
+};
+
+// same order as the round-robin unchoker, minus the quota rotation
+bool old_compare(sim_peer const* lhs, sim_peer const* rhs)
+{
+	std::shared_ptr<int> t1 = lhs->torrent.lock();
+	std::shared_ptr<int> t2 = rhs->torrent.lock();
+	if (!t1 || !t2) std::abort();
+	if (lhs->prio != rhs->prio) return lhs->prio > rhs->prio;
+	if (lhs->downloaded != rhs->downloaded) return lhs->downloaded > rhs->downloaded;
+	std::int64_t const c1 = lhs->choked ? 0 : lhs->uploaded;
+	std::int64_t const c2 = rhs->choked ? 0 : rhs->uploaded;
+	if (c1 != c2) return c1 > c2;
+	return lhs->last_unchoke < rhs->last_unchoke;
+}
+
+struct trace
+{
+	// rounds x peers
+	std::vector<std::vector<sim_peer>> rounds;
+};
+
+bool load_trace(char const* filename, trace& t)
+{
+	FILE* f = std::fopen(filename, "r");
+	if (f == nullptr)
+	{
+		std::fprintf(stderr, "failed to open \"%s\": %s\n", filename, std::strerror(errno));
+		return false;
+	}
+	int round, peer;
+	std::int64_t down, up;
+	while (std::fscanf(f, "%d %d %" SCNd64 " %" SCNd64, &round, &peer, &down, &up) == 4)
+	{
+		if (round < 0 || peer < 0) continue;
+		if (std::size_t(round) >= t.rounds.size()) t.rounds.resize(std::size_t(round) + 1);
+		std::vector<sim_peer>& r = t.rounds[std::size_t(round)];
+		if (std::size_t(peer) >= r.size()) r.resize(std::size_t(peer) + 1);
+		r[std::size_t(peer)].downloaded = down;
+		r[std::size_t(peer)].uploaded = up;
+	}
+	std::fclose(f);
+	return true;
+}
+
+void synthetic_trace(trace& t, int const num_peers, int const num_rounds)
+{
+	std::mt19937 rng(0x1337);
+	std::normal_distribution<double> step(0.0, 4000.0);
+	std::vector<double> down(static_cast<std::size_t>(num_peers));
+	std::vector<double> up(static_cast<std::size_t>(num_peers));
+	for (int i = 0; i < num_peers; ++i)
+	{
+		down[std::size_t(i)] = std::abs(step(rng)) * 10;
+		up[std::size_t(i)] = std::abs(step(rng)) * 10;
+	}
+
+	t.rounds.resize(std::size_t(num_rounds));
+	for (auto& r : t.rounds)
+	{
+		r.resize(std::size_t(num_peers));
+		for (int i = 0; i < num_peers; ++i)
+		{
+			down[std::size_t(i)] = std::max(0.0, down[std::size_t(i)] + step(rng));
+			up[std::size_t(i)] = std::max(0.0, up[std::size_t(i)] + step(rng));
+			// a good share of peers don't send anything at all
+			r[std::size_t(i)].downloaded = i % 3 == 0 ? 0 : std::int64_t(down[std::size_t(i)]);
+			r[std::size_t(i)].uploaded = std::int64_t(up[std::size_t(i)]);
+			r[std::size_t(i)].prio = 1 + (i % 7 == 0);
+		}
+	}
+}
+
+// runs the choker over every round of the trace and records which peers are
+// unchoked. Returns the total time spent ranking
+template <typename Choker>
+time_duration run(trace const& t, int const slots, Choker choker
+	, std::vector<std::vector<int>>& unchoked)
+{
+	auto const torrent = std::make_shared<int>(0);
+	std::vector<sim_peer> state;
+	time_duration total = seconds(0);
+	time_point now = time_point(seconds(1));
+	unchoked.clear();
+	for (auto const& round : t.rounds)
+	{
+		if (state.size() < round.size()) state.resize(round.size());
+		for (std::size_t i = 0; i < round.size(); ++i)
+		{
+			state[i].downloaded = round[i].downloaded;
+			state[i].uploaded = round[i].uploaded;
+			state[i].prio = round[i].prio;
+			state[i].torrent = torrent;
+		}
+
+		std::vector<sim_peer*> peers;
+		for (auto& p : state) peers.push_back(&p);
+
+		time_point const start = clock_type::now();
+		choker(peers, slots);
+		total += clock_type::now() - start;
+
+		int const n = std::min(slots, int(peers.size()));
+		std::vector<int> picked;
+		for (int i = 0; i < int(peers.size()); ++i)
+		{
+			sim_peer& p = *peers[std::size_t(i)];
+			bool const unchoke = i < n;
+			if (unchoke && p.choked) p.last_unchoke = now;
+			p.choked = !unchoke;
+			if (unchoke) picked.push_back(int(&p - state.data()));
+		}
+		std::sort(picked.begin(), picked.end());
+		unchoked.push_back(std::move(picked));
+		now += seconds(15);
+	}
+	return total;
+}
+
+void old_choker(std::vector<sim_peer*>& peers, int const slots)
+{
+	std::partial_sort(peers.begin(), peers.begin()
+		+ std::min(slots, int(peers.size())), peers.end(), &old_compare);
+}
+
+void new_choker(std::vector<sim_peer*>& peers, int const slots)
+{
+	std::vector<aux::unchoke_rank> ranks;
+	ranks.reserve(peers.size());
+	for (int i = 0; i < int(peers.size()); ++i)
+	{
+		sim_peer const* p = peers[std::size_t(i)];
+		std::shared_ptr<int> t = p->torrent.lock();
+		if (!t) std::abort();
+		aux::unchoke_rank r;
+		r.prio = p->prio;
+		r.primary = p->downloaded;
+		r.secondary = p->choked ? 0 : p->uploaded;
+		r.tertiary = 0;
+		r.last_unchoke = p->last_unchoke;
+		r.peer = i;
+		ranks.push_back(r);
+	}
+	aux::rank_range(ranks, 0, std::min(std::size_t(slots), ranks.size()));
+	std::vector<sim_peer*> const orig(peers);
+	for (std::size_t i = 0; i < ranks.size(); ++i)
+		peers[i] = orig[std::size_t(ranks[i].peer)];
+}
+
+} // anonymous namespace
+
+int main(int argc, char const* argv[])
+{
+	char const* filename = argc > 1 ? argv[1] : "-";
+	int const num_peers = argc > 2 ? std::atoi(argv[2]) : 5000;
+	int const num_rounds = argc > 3 ? std::atoi(argv[3]) : 200;
+	int const slots = argc > 4 ? std::atoi(argv[4]) : 50;
+
+	trace t;
+	if (std::strcmp(filename, "-") == 0)
+		synthetic_trace(t, num_peers, num_rounds);
+	else if (!load_trace(filename, t))
+		return 1;
+
+	std::vector<std::vector<int>> old_unchoked;
+	std::vector<std::vector<int>> new_unchoked;
+	time_duration const old_time = run(t, slots, &old_choker, old_unchoked);
+	time_duration const new_time = run(t, slots, &new_choker, new_unchoked);
+
+	int mismatches = 0;
+	for (std::size_t i = 0; i < old_unchoked.size(); ++i)
+		if (old_unchoked[i] != new_unchoked[i]) ++mismatches;
+
+	std::printf("rounds: %d peers: %d slots: %d\n"
+		"old: %" PRId64 " us\nnew: %" PRId64 " us\nmismatching rounds: %d\n"
+		, int(t.rounds.size()), t.rounds.empty() ? 0 : int(t.rounds.front().size())
+		, slots, std::int64_t(total_microseconds(old_time))
+		, std::int64_t(total_microseconds(new_time)), mismatches);
+
+	return mismatches == 0 ? 0 : 1;
+}
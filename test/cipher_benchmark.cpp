@@ -0,0 +1,159 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+// measures the throughput of the stream ciphers used for peer connections,
+// in GB/s on a single core. Each cipher encrypts the same buffer over and
+// over, the way a connection encrypts its send buffer.
+//
+// usage: cipher_benchmark [buffer-size] [total-MiB]
+//
+// the buffer size defaults to 16 kiB (a block) and the total amount of data
+// to 1024 MiB per cipher
+
+#include "libtorrent/pe_crypto.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/time.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <array>
+
+#if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
+
+using namespace lt;
+
+namespace {
+
+// the byte-at-a-time RC4 loop, for reference
+struct reference_rc4 : crypto_plugin
+{
+	explicit reference_rc4(span<char const> key)
+	{
+		for (int i = 0; i < 256; ++i) s[std::size_t(i)] = std::uint8_t(i);
+		std::uint8_t j = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			j = std::uint8_t(j + s[std::size_t(i)] + std::uint8_t(key[std::size_t(i) % key.size()]));
+			std::swap(s[std::size_t(i)], s[j]);
+		}
+	}
+
+	void set_incoming_key(span<char const>) override {}
+	void set_outgoing_key(span<char const>) override {}
+
+	std::tuple<int, span<span<char const>>> encrypt(span<span<char>> bufs) override
+	{
+		int ret = 0;
+		for (auto& b : bufs)
+		{
+			for (char& c : b)
+			{
+				x = std::uint8_t(x + 1);
+				y = std::uint8_t(y + s[x]);
+				std::swap(s[x], s[y]);
+				c = char(c ^ s[std::uint8_t(s[x] + s[y])]);
+			}
+			ret += int(b.size());
+		}
+		return std::make_tuple(ret, span<span<char const>>());
+	}
+
+	std::tuple<int, int, int> decrypt(span<span<char>>) override
+	{ return std::make_tuple(0, 0, 0); }
+
+	std::array<std::uint8_t, 256> s;
+	std::uint8_t x = 0;
+	std::uint8_t y = 0;
+};
+
+void run(char const* name, crypto_plugin& c, std::vector<char>& buf
+	, std::int64_t const total)
+{
+	// warm up
+	span<char> v(buf);
+	c.encrypt(v);
+
+	std::int64_t processed = 0;
+	time_point const start = clock_type::now();
+	while (processed < total)
+	{
+		c.encrypt(v);
+		processed += std::int64_t(buf.size());
+	}
+	double const elapsed = double(total_microseconds(clock_type::now() - start)) / 1000000.0;
+	std::printf("%-16s %8.3f GB/s\n", name, double(processed) / elapsed / 1e9);
+}
+
+}
+
+int main(int argc, char const* argv[])
+{
+	std::size_t const buffer_size = argc > 1 ? std::size_t(std::atoi(argv[1])) : 16 * 1024;
+	std::int64_t const total = (argc > 2 ? std::atoi(argv[2]) : 1024) * std::int64_t(1024 * 1024);
+	if (buffer_size == 0 || total <= 0)
+	{
+		std::fprintf(stderr, "usage: cipher_benchmark [buffer-size] [total-MiB]\n");
+		return 1;
+	}
+
+	std::vector<char> buf(buffer_size, 'a');
+	std::printf("buffer size: %d bytes\n", int(buffer_size));
+
+	sha1_hash const key = hasher("benchmark", 9).final();
+
+	reference_rc4 ref(key);
+	run("rc4 (reference)", ref, buf, total);
+
+	rc4_handler rc4;
+	rc4.set_outgoing_key(key);
+	run("rc4", rc4, buf, total);
+
+	std::array<char, chacha20_handler::key_size> chacha_key{};
+	std::copy(key.begin(), key.end(), chacha_key.begin());
+	chacha20_handler chacha;
+	chacha.set_outgoing_key(chacha_key);
+	run("chacha20", chacha, buf, total);
+
+	return 0;
+}
+
+#else
+
+int main()
+{
+	std::printf("encryption is disabled\n");
+	return 0;
+}
+
+#endif
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/session_settings.hpp"
 
 #include <cmath>
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <utility>
@@ -68,9 +69,12 @@ struct peer_connection: bandwidth_socket, std::enable_shared_from_this<peer_conn
 		, m_ignore_limits(ignore_limits)
 		, m_name(std::move(name))
 		, m_quota(0)
+		, m_num_assigned(0)
+		, m_own_channel(true)
+		, m_disconnecting(false)
 	{}
 
-	bool is_disconnecting() const override { return false; }
+	bool is_disconnecting() const override { return m_disconnecting; }
 	bool ignore_bandwidth_limits() { return m_ignore_limits; }
 	void assign_bandwidth(int channel, int amount) override;
 
@@ -87,15 +91,23 @@ struct peer_connection: bandwidth_socket, std::enable_shared_from_this<peer_conn
 	bool m_ignore_limits;
 	std::string m_name;
 	std::int64_t m_quota;
+	// the number of times bandwidth has been assigned
+	int m_num_assigned;
+	// when false, the peer is only limited by the torrent and global
+	// channels, which puts all such peers in the same queue
+	bool m_own_channel;
+	bool m_disconnecting;
 };
 
 void peer_connection::assign_bandwidth(int channel, int amount)
 {
 	m_quota += amount;
+	++m_num_assigned;
 #ifdef VERBOSE_LOGGING
 	std::cout << " [" << m_name
 		<< "] assign bandwidth, " << amount << std::endl;
 #endif
+	if (m_disconnecting) return;
 	TEST_CHECK(amount > 0);
 	start();
 }
@@ -108,7 +120,10 @@ void peer_connection::start()
 		, &global_bwc
 	};
 
-	m_bwm.request_bandwidth(shared_from_this(), 400000000, m_priority, channels, 3);
+	if (m_own_channel)
+		m_bwm.request_bandwidth(shared_from_this(), 400000000, m_priority, channels, 3);
+	else
+		m_bwm.request_bandwidth(shared_from_this(), 400000000, m_priority, channels + 1, 2);
 }
 
 
@@ -455,6 +470,124 @@ void test_no_starvation(int limit)
 	TEST_CHECK(close_to(p->m_quota / sample_time, float(limit) / 200 / num_peers, 5));
 }
 
+void test_shared_queue_priority(int num, int limit)
+{
+	std::cout << "\ntest shared queue priority " << num << " " << limit << std::endl;
+	bandwidth_manager manager(0);
+	bandwidth_channel t1;
+	global_bwc.throttle(limit);
+
+	// peers of priority 1, 2 and 3, all in the same queue
+	connections_t v;
+	for (int i = 0; i < num; ++i)
+	{
+		char name[200];
+		std::snprintf(name, sizeof(name), "p%d", i);
+		v.push_back(std::make_shared<peer_connection>(manager, t1, 1 + i % 3, false, name));
+		v.back()->m_own_channel = false;
+	}
+	run_test(v, manager);
+
+	// hand out what's been assigned to requests that are still queued. With
+	// many peers in one queue, a good share of the quota is waiting for its
+	// request to be satisfied (or reach its deadline) at any given time
+	for (auto const& p : v) p->m_disconnecting = true;
+	manager.close();
+
+	float sum = 0.f;
+	float by_prio[3] = {0.f, 0.f, 0.f};
+	for (auto const& p : v)
+	{
+		sum += p->m_quota;
+		by_prio[p->m_priority - 1] += p->m_quota;
+	}
+	sum /= sample_time;
+	std::cout << "sum: " << sum << " target: " << limit << std::endl;
+	TEST_CHECK(close_to(sum, float(limit), limit * 0.05f));
+
+	// each priority level should get its share, in proportion to the
+	// priority
+	for (int i = 0; i < 3; ++i)
+	{
+		float const rate = by_prio[i] / sample_time;
+		float const target = float(limit) * (i + 1) / 6;
+		std::cout << "prio " << (i + 1) << ": " << rate << " target: " << target << std::endl;
+		TEST_CHECK(close_to(rate, target, target * 0.1f));
+	}
+
+	// and no peer is starved
+	for (auto const& p : v)
+		TEST_CHECK(p->m_quota > 0);
+}
+
+void test_shared_queue_scaling(int num, int limit)
+{
+	std::cout << "\ntest shared queue scaling " << num << " " << limit << std::endl;
+	bandwidth_manager manager(0);
+	bandwidth_channel t1;
+	global_bwc.throttle(limit);
+
+	connections_t v;
+	spawn_connections(v, manager, t1, num, "p");
+	for (auto const& p : v) p->m_own_channel = false;
+
+	auto const start = std::chrono::steady_clock::now();
+	run_test(v, manager);
+	auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	int num_assigned = 0;
+	for (auto const& p : v) num_assigned += p->m_num_assigned;
+
+	// hand out what's been assigned to requests that are still queued. With
+	// many peers in one queue, a good share of the quota is waiting for its
+	// request to be satisfied (or reach its deadline) at any given time
+	for (auto const& p : v) p->m_disconnecting = true;
+	manager.close();
+
+	float sum = 0.f;
+	for (auto const& p : v) sum += p->m_quota;
+	sum /= sample_time;
+	std::cout << "sum: " << sum << " target: " << limit
+		<< " assignments: " << num_assigned
+		<< " time: " << elapsed << " us" << std::endl;
+	TEST_CHECK(close_to(sum, float(limit), limit * 0.05f));
+
+	// at low rates per peer, bandwidth is handed out in slices of at least
+	// about a kilobyte, rather than a few bytes to every peer each round
+	TEST_CHECK(num_assigned > 0);
+	TEST_CHECK(sum * sample_time / num_assigned > 512);
+}
+
+void test_disconnect_queued(int num)
+{
+	std::cout << "\ntest disconnect queued " << num << std::endl;
+	bandwidth_manager manager(0);
+	bandwidth_channel t1;
+	global_bwc.throttle(1000);
+
+	connections_t v;
+	spawn_connections(v, manager, t1, num, "p");
+	for (auto const& p : v)
+	{
+		p->m_own_channel = false;
+		p->start();
+	}
+	TEST_EQUAL(manager.queue_size(), num);
+
+	for (auto const& p : v) p->m_disconnecting = true;
+
+	// requests of disconnecting peers are dropped within a few rounds, even
+	// the ones the rate limit doesn't get to
+	for (int i = 0; i < 10; ++i)
+		manager.update_quotas(milliseconds(500));
+
+	TEST_EQUAL(manager.queue_size(), 0);
+	TEST_EQUAL(manager.queued_bytes(), 0);
+	for (auto const& p : v)
+		TEST_EQUAL(p.use_count(), 1);
+}
+
 TORRENT_TEST(equal_connection)
 {
 	test_equal_connections( 2,      20);
@@ -512,3 +645,21 @@ TORRENT_TEST(no_starvation)
 {
 	test_no_starvation(40000);
 }
+
+TORRENT_TEST(shared_queue_priority)
+{
+	test_shared_queue_priority(30, 60000);
+	test_shared_queue_priority(300, 60000);
+}
+
+TORRENT_TEST(shared_queue_scaling)
+{
+	test_shared_queue_scaling(100, 100000);
+	test_shared_queue_scaling(10000, 100000);
+	test_shared_queue_scaling(10000, 10000000);
+}
+
+TORRENT_TEST(disconnect_queued)
+{
+	test_disconnect_queued(1000);
+}
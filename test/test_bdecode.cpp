@@ -31,8 +31,14 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "test.hpp"
+#include "setup_transfer.hpp" // for load_file
+#include "libtorrent/aux_/path.hpp" // for combine_path
 #include "libtorrent/bdecode.hpp"
+#include "libtorrent/bencode.hpp"
 #include "libtorrent/entry.hpp"
+#include "libtorrent/time.hpp"
+
+#include <cinttypes> // for PRId64 et.al.
 
 using namespace lt;
 
@@ -1310,3 +1316,260 @@ TORRENT_TEST(switch_buffer)
 	TEST_EQUAL(string1, string2);
 }
 
+
+// lookups through the hash index of a dictionary's keys must behave exactly
+// like the linear search
+TORRENT_TEST(dict_find_index)
+{
+	entry e;
+	for (int i = 0; i < 50; ++i)
+	{
+		char key[10];
+		std::snprintf(key, sizeof(key), "key%d", i);
+		e[key] = i;
+	}
+	e["str"] = "foobar";
+	e["d"]["x"] = 1;
+	e["l"].list().push_back(entry(2));
+	e[std::string("a\0b", 3)] = 3;
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), e);
+
+	error_code ec;
+	bdecode_node n = bdecode(buf, ec);
+	TEST_CHECK(!ec);
+
+	// do the lookups without and with the index
+	for (int round = 0; round < 3; ++round)
+	{
+		if (round == 1) n.dict_build_index();
+		for (int i = 0; i < 50; ++i)
+		{
+			char key[10];
+			std::snprintf(key, sizeof(key), "key%d", i);
+			TEST_EQUAL(n.dict_find_int_value(key), i);
+		}
+		TEST_EQUAL(n.dict_find_string_value("str"), "foobar");
+		TEST_EQUAL(n.dict_find_dict("d").dict_find_int_value("x"), 1);
+		TEST_EQUAL(n.dict_find_list("l").list_int_value_at(0), 2);
+		TEST_EQUAL(n.dict_find_int_value(string_view("a\0b", 3)), 3);
+		TEST_CHECK(!n.dict_find("key50"));
+		TEST_CHECK(!n.dict_find("ke"));
+		TEST_CHECK(!n.dict_find(""));
+		TEST_CHECK(!n.dict_find_string("key1"));
+		TEST_EQUAL(n.dict_size(), 54);
+	}
+
+	// building the index again is a no-op
+	n.dict_build_index();
+	TEST_EQUAL(n.dict_find_int_value("key3"), 3);
+
+	// copies start out without an index, but still work
+	bdecode_node const copy = n;
+	TEST_EQUAL(copy.dict_find_int_value("key7"), 7);
+	bdecode_node const ref = n.non_owning();
+	TEST_EQUAL(ref.dict_find_int_value("key8"), 8);
+}
+
+// with duplicate keys, the first one is found whether or not the dictionary
+// is indexed
+TORRENT_TEST(dict_find_index_duplicate_key)
+{
+	char b[] = "d1:ai1e1:bi2e1:ci3e1:di4e1:ei5e1:fi6e1:gi7e1:hi8e1:ai9ee";
+	error_code ec;
+	bdecode_node e = bdecode(b, ec);
+	TEST_CHECK(!ec);
+	for (int i = 0; i < 2; ++i)
+	{
+		if (i == 1) e.dict_build_index();
+		TEST_EQUAL(e.dict_find_int_value("a"), 1);
+		TEST_EQUAL(e.dict_find_int_value("h"), 8);
+	}
+}
+
+TORRENT_TEST(long_digit_runs)
+{
+	// lengths and integers long enough to span multiple 8 byte words, with
+	// the terminator at every possible position
+	for (int digits = 1; digits < 22; ++digits)
+	{
+		std::string const num = "1" + std::string(std::size_t(digits - 1), '0');
+		std::string const b = "li" + num + "ei-" + num + "e1:ae";
+		error_code ec;
+		bdecode_node const e = bdecode(b, ec);
+		if (digits > 20)
+		{
+			TEST_EQUAL(ec, error_code(bdecode_errors::overflow));
+			continue;
+		}
+		TEST_CHECK(!ec);
+		TEST_EQUAL(e.list_size(), 3);
+		TEST_EQUAL(e.list_at(2).string_value(), "a");
+		if (digits < 19)
+		{
+			TEST_EQUAL(e.list_int_value_at(0), std::stoll(num));
+			TEST_EQUAL(e.list_int_value_at(1), -std::stoll(num));
+		}
+	}
+
+	// the length prefix (including the colon) may be at most 9 characters
+	for (int digits = 1; digits < 8; ++digits)
+	{
+		std::string b = "000000000000000";
+		b.resize(std::size_t(digits));
+		b += "3:abc";
+		error_code ec;
+		bdecode_node const e = bdecode(b, ec);
+		TEST_CHECK(!ec);
+		TEST_EQUAL(e.string_value(), "abc");
+
+		// a non-digit in the length prefix
+		b[std::size_t(digits)] = 'x';
+		int pos = 0;
+		bdecode(b, ec, &pos);
+		TEST_EQUAL(ec, error_code(bdecode_errors::expected_digit));
+		TEST_EQUAL(pos, digits);
+	}
+
+	// a non-digit in an integer
+	char b[] = "i1234567x9e";
+	error_code ec;
+	int pos = 0;
+	bdecode({b, sizeof(b) - 1}, ec, &pos);
+	TEST_EQUAL(ec, error_code(bdecode_errors::expected_digit));
+	TEST_EQUAL(pos, 8);
+}
+
+namespace {
+
+	std::vector<char> resume_file()
+	{
+		entry rd;
+		rd["file-format"] = "libtorrent resume file";
+		rd["file-version"] = 1;
+		rd["libtorrent-version"] = "1.2.0.0";
+		rd["allocation"] = "sparse";
+		rd["info-hash"] = std::string(20, 'a');
+		rd["name"] = "test torrent";
+		rd["save_path"] = "/home/user/downloads";
+		rd["total_uploaded"] = 1234567890;
+		rd["total_downloaded"] = 9876543210;
+		rd["active_time"] = 12345;
+		rd["finished_time"] = 1234;
+		rd["seeding_time"] = 123;
+		rd["last_seen_complete"] = 1500000000;
+		rd["last_download"] = 1500000001;
+		rd["last_upload"] = 1500000002;
+		rd["num_complete"] = 10;
+		rd["num_incomplete"] = 20;
+		rd["num_downloaded"] = 30;
+		rd["seed_mode"] = 0;
+		rd["super_seeding"] = 0;
+		rd["added_time"] = 1400000000;
+		rd["completed_time"] = 1400000100;
+		rd["upload_rate_limit"] = -1;
+		rd["download_rate_limit"] = -1;
+		rd["max_connections"] = 100;
+		rd["max_uploads"] = 8;
+		rd["paused"] = 0;
+		rd["auto_managed"] = 1;
+		rd["sequential_download"] = 0;
+		rd["pieces"] = std::string(2000, '\\x01');
+		rd["piece_priority"] = std::string(2000, '\\x04');
+		entry::list_type& fp = rd["file_priority"].list();
+		for (int i = 0; i < 100; ++i) fp.emplace_back(4);
+		entry::list_type& tr = rd["trackers"].list();
+		tr.emplace_back(entry::list_type{entry("http://tracker.example.com/announce")});
+		tr.emplace_back(entry::list_type{entry("udp://tracker.example.com:1337")});
+		rd["url-list"].list().emplace_back("http://example.com/files");
+		std::string& peers = rd["peers"].string();
+		for (int i = 0; i < 100; ++i) peers.append("\\x0a\\x00\\x00\\x01\\x1a\\xe1");
+		std::vector<char> ret;
+		bencode(std::back_inserter(ret), rd);
+		return ret;
+	}
+
+	std::vector<char> dht_response()
+	{
+		entry e;
+		e["ip"] = std::string(6, 'x');
+		e["t"] = "aa";
+		e["v"] = "LT\\x01\\x02";
+		e["y"] = "r";
+		entry& r = e["r"];
+		r["id"] = std::string(20, 'b');
+		r["nodes"] = std::string(26 * 8, 'c');
+		r["p"] = 6881;
+		r["token"] = "abcd";
+		entry::list_type& values = r["values"].list();
+		for (int i = 0; i < 50; ++i) values.emplace_back(std::string(6, char(i)));
+		std::vector<char> ret;
+		bencode(std::back_inserter(ret), e);
+		return ret;
+	}
+
+	std::vector<std::string> dict_keys(bdecode_node const& d)
+	{
+		std::vector<std::string> ret;
+		for (int i = 0; i < d.dict_size(); ++i)
+			ret.push_back(d.dict_at(i).first.to_string());
+		return ret;
+	}
+
+	// parses buf the given number of times and looks up each of keys in the
+	// top level dictionary, or in the dictionary under sub_dict
+	void benchmark(char const* name, std::vector<char> const& buf
+		, int const rounds, char const* sub_dict
+		, std::vector<std::string> const& keys)
+	{
+		bdecode_node e;
+		error_code ec;
+		std::int64_t found = 0;
+		time_point const start = clock_type::now();
+		for (int i = 0; i < rounds; ++i)
+		{
+			e = bdecode(buf, ec);
+			bdecode_node d = sub_dict ? e.dict_find_dict(sub_dict) : e.non_owning();
+			if (keys.size() > 8) d.dict_build_index();
+			for (auto const& k : keys)
+				found += d.dict_find(k) ? 1 : 0;
+		}
+		time_point const end = clock_type::now();
+		TEST_CHECK(!ec);
+		TEST_EQUAL(found, std::int64_t(rounds) * std::int64_t(keys.size()));
+		std::int64_t const us = std::max(std::int64_t(1), total_microseconds(end - start));
+		std::printf("%s: %d bytes, %d parses in %d ms (%" PRId64 " parses/s, %" PRId64
+			" MB/s) with %d lookups each\n", name, int(buf.size()), rounds, int(us / 1000)
+			, std::int64_t(rounds) * 1000000 / us
+			, std::int64_t(rounds) * std::int64_t(buf.size()) / us
+			, int(keys.size()));
+	}
+}
+
+TORRENT_TEST(parse_benchmark)
+{
+	// torrent_info looks up most keys of the info dictionary
+	for (char const* name : {"large.torrent", "sample.torrent"})
+	{
+		std::vector<char> buf;
+		error_code ec;
+		load_file(combine_path(combine_path("..", "test_torrents"), name), buf, ec);
+		if (ec)
+		{
+			std::printf("failed to load %s: %s\n", name, ec.message().c_str());
+			continue;
+		}
+		bdecode_node const e = bdecode(buf, ec);
+		TEST_CHECK(!ec);
+		benchmark(name, buf, 100000, "info", dict_keys(e.dict_find_dict("info")));
+	}
+
+	// and read_resume_data() looks up most keys of the resume file
+	std::vector<char> const resume = resume_file();
+	error_code ec;
+	benchmark("resume file", resume, 50000, nullptr
+		, dict_keys(bdecode(resume, ec)));
+
+	benchmark("DHT response", dht_response(), 500000, "r"
+		, {"id", "nodes", "p", "token", "values"});
+}
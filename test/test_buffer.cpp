@@ -34,12 +34,18 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <utility>
 #include <set>
+#include <cstdlib>
+#include <cstdio>
+#include <array>
+#include <algorithm>
 
 #include "libtorrent/buffer.hpp"
 #include "libtorrent/chained_buffer.hpp"
 #include "libtorrent/socket.hpp"
+#include "libtorrent/time.hpp"
 
 #include "test.hpp"
+#include "allocation_counter.hpp"
 
 using namespace lt;
 
@@ -174,7 +180,7 @@ bool compare_chained_buffer(chained_buffer& b, char const* mem, int size)
 {
 	if (size == 0) return true;
 	std::vector<char> flat(size);
-	std::vector<boost::asio::const_buffer> const& iovec2 = b.build_iovec(size);
+	auto const iovec2 = b.build_iovec(size);
 	int copied = copy_buffers(iovec2, &flat[0]);
 	TEST_CHECK(copied == size);
 	return std::memcmp(&flat[0], mem, size) == 0;
@@ -312,3 +318,120 @@ TORRENT_TEST(chained_buffer)
 	TEST_CHECK(buffer_list.empty());
 }
 
+
+// append enough buffers to make the ring grow out of its inline storage, with
+// both holders that need to be moved and plain spans
+TORRENT_TEST(chained_buffer_grow)
+{
+	{
+		chained_buffer b;
+		std::vector<char> expected;
+		char plain[10];
+		std::memcpy(plain, data, 10);
+
+		for (int i = 0; i < 100; ++i)
+		{
+			char* mem = allocate_buffer(10);
+			std::memset(mem, 'a' + i % 26, 10);
+			if (i % 3 == 0)
+			{
+				b.append_buffer(span<char>(plain, 10), 10);
+				expected.insert(expected.end(), plain, plain + 10);
+				free_buffer(mem);
+			}
+			else
+			{
+				b.append_buffer(holder(mem, 10), 10);
+				expected.insert(expected.end(), mem, mem + 10);
+			}
+			// make the ring wrap around before it grows
+			if (i == 4)
+			{
+				b.pop_front(30);
+				expected.erase(expected.begin(), expected.begin() + 30);
+			}
+		}
+
+		char* front = allocate_buffer(5);
+		std::memset(front, 'x', 5);
+		b.prepend_buffer(holder(front, 5), 5);
+		expected.insert(expected.begin(), front, front + 5);
+
+		TEST_EQUAL(b.size(), int(expected.size()));
+		int offset = 0;
+		while (!b.empty())
+		{
+			// at most max_iovec buffers are returned in one go
+			auto const iovec = b.build_iovec(b.size());
+			TEST_CHECK(int(iovec.size()) <= chained_buffer::max_iovec);
+			std::vector<char> flat(std::size_t(b.size()));
+			int const copied = copy_buffers(iovec, flat.data());
+			TEST_CHECK(copied > 0);
+			TEST_CHECK(std::memcmp(flat.data(), expected.data() + offset
+				, std::size_t(copied)) == 0);
+
+			std::array<span<char>, chained_buffer::max_iovec> storage;
+			span<span<char>> const mut = b.build_mutable_iovec(copied, storage);
+			TEST_EQUAL(mut.size(), iovec.size());
+
+			b.pop_front(copied);
+			offset += copied;
+		}
+		TEST_EQUAL(offset, int(expected.size()));
+	}
+	TEST_CHECK(buffer_list.empty());
+}
+
+// simulates the send path of a peer connection: messages are appended, the
+// iovecs are built and the sent bytes are popped. After the first round has
+// grown the ring to its steady-state size, no more heap allocations are
+// expected
+TORRENT_TEST(chained_buffer_steady_state_allocations)
+{
+	int const rounds = 20000;
+	int const blocks = 20;
+	int const block_size = 0x4000;
+
+	std::vector<char> block_data(block_size, 'b');
+	char header[13] = {};
+	std::vector<char> send_buffer(512);
+	chained_buffer b;
+
+	auto run_round = [&]
+	{
+		for (int i = 0; i < blocks; ++i)
+		{
+			// a piece message is a small header followed by the block
+			if (b.append(header) == nullptr)
+			{
+				b.append_buffer(span<char>(send_buffer), 0);
+				b.append(header);
+			}
+			b.append_buffer(span<char>(block_data), block_size);
+		}
+		std::array<span<char>, chained_buffer::max_iovec> storage;
+		while (!b.empty())
+		{
+			int const to_send = std::min(b.size(), 5 * block_size);
+			auto const iovec = b.build_iovec(to_send);
+			TEST_CHECK(iovec.size() > 0);
+			b.build_mutable_iovec(to_send, storage);
+			b.pop_front(to_send);
+		}
+	};
+
+	run_round();
+
+	int const allocations_before = num_allocations();
+	time_point const start = clock_type::now();
+	for (int r = 0; r < rounds; ++r) run_round();
+	time_point const end = clock_type::now();
+	int const allocations = num_allocations() - allocations_before;
+
+	std::int64_t const us = std::max(std::int64_t(1), total_microseconds(end - start));
+	std::printf("%d messages in %d us (%.1f Mmessages/s), heap allocations: %d\n"
+		, blocks * rounds, int(us), double(blocks) * rounds / double(us)
+		, allocations);
+
+	TEST_EQUAL(allocations, 0);
+}
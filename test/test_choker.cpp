@@ -0,0 +1,159 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/choker.hpp"
+#include "libtorrent/time.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace lt;
+
+namespace {
+
+aux::unchoke_rank rank(int const peer, std::int64_t const primary
+	, int const prio = 0, std::int64_t const secondary = 0)
+{
+	aux::unchoke_rank r;
+	r.primary = primary;
+	r.secondary = secondary;
+	r.tertiary = 0;
+	r.last_unchoke = time_point(seconds(peer));
+	r.prio = prio;
+	r.peer = peer;
+	return r;
+}
+
+std::vector<aux::unchoke_rank> random_ranks(int const n)
+{
+	std::vector<aux::unchoke_rank> ret;
+	for (int i = 0; i < n; ++i)
+		ret.push_back(rank(i, std::rand() % 20, std::rand() % 3, std::rand() % 5));
+	return ret;
+}
+
+}
+
+TORRENT_TEST(better_rank)
+{
+	aux::better_rank const cmp;
+	// priority goes first
+	TEST_CHECK(cmp(rank(0, 10, 2), rank(1, 1000, 1)));
+	TEST_CHECK(!cmp(rank(1, 1000, 1), rank(0, 10, 2)));
+	// then primary, secondary
+	TEST_CHECK(cmp(rank(0, 11), rank(1, 10)));
+	TEST_CHECK(cmp(rank(0, 10, 0, 2), rank(1, 10, 0, 1)));
+	// and last, the peer that has waited the longest
+	TEST_CHECK(cmp(rank(0, 10), rank(1, 10)));
+	TEST_CHECK(!cmp(rank(1, 10), rank(0, 10)));
+	TEST_CHECK(!cmp(rank(0, 10), rank(0, 10)));
+}
+
+TORRENT_TEST(rank_range)
+{
+	for (int n : {0, 1, 5, 50, 300})
+	{
+		for (int k : {0, 1, 4, 40, 300})
+		{
+			if (k > n) continue;
+			std::vector<aux::unchoke_rank> ranks = random_ranks(n);
+			std::vector<aux::unchoke_rank> expect = ranks;
+			std::sort(expect.begin(), expect.end(), aux::better_rank());
+
+			aux::rank_range(ranks, 0, std::size_t(k));
+			for (int i = 0; i < k; ++i)
+				TEST_EQUAL(ranks[std::size_t(i)].peer, expect[std::size_t(i)].peer);
+
+			// the rest may be in any order, but it must be the same peers
+			std::vector<int> rest;
+			std::vector<int> expect_rest;
+			for (int i = k; i < n; ++i)
+			{
+				rest.push_back(ranks[std::size_t(i)].peer);
+				expect_rest.push_back(expect[std::size_t(i)].peer);
+			}
+			std::sort(rest.begin(), rest.end());
+			std::sort(expect_rest.begin(), expect_rest.end());
+			TEST_CHECK(rest == expect_rest);
+		}
+	}
+}
+
+TORRENT_TEST(rank_range_offset)
+{
+	std::vector<aux::unchoke_rank> ranks = random_ranks(100);
+	std::vector<aux::unchoke_rank> expect = ranks;
+	std::sort(expect.begin(), expect.end(), aux::better_rank());
+
+	aux::rank_range(ranks, 0, 10);
+	aux::rank_range(ranks, 10, 30);
+	for (int i = 0; i < 30; ++i)
+		TEST_EQUAL(ranks[std::size_t(i)].peer, expect[std::size_t(i)].peer);
+}
+
+TORRENT_TEST(for_each_rank)
+{
+	std::vector<aux::unchoke_rank> ranks = random_ranks(200);
+	std::vector<aux::unchoke_rank> expect = ranks;
+	std::sort(expect.begin(), expect.end(), aux::better_rank());
+
+	// visit all of them
+	std::vector<int> visited;
+	int ret = aux::for_each_rank(ranks, [&](aux::unchoke_rank const& r)
+		{ visited.push_back(r.peer); return true; });
+	TEST_EQUAL(ret, 200);
+	TEST_EQUAL(int(visited.size()), 200);
+	for (int i = 0; i < 200; ++i)
+	{
+		TEST_EQUAL(visited[std::size_t(i)], expect[std::size_t(i)].peer);
+		TEST_EQUAL(ranks[std::size_t(i)].peer, expect[std::size_t(i)].peer);
+	}
+
+	// stop early, past the first chunk
+	ranks = random_ranks(200);
+	expect = ranks;
+	std::sort(expect.begin(), expect.end(), aux::better_rank());
+	visited.clear();
+	ret = aux::for_each_rank(ranks, [&](aux::unchoke_rank const& r)
+		{
+			if (visited.size() == 37) return false;
+			visited.push_back(r.peer);
+			return true;
+		});
+	TEST_EQUAL(ret, 37);
+	for (int i = 0; i < 37; ++i)
+		TEST_EQUAL(ranks[std::size_t(i)].peer, expect[std::size_t(i)].peer);
+
+	std::vector<aux::unchoke_rank> empty;
+	TEST_EQUAL(aux::for_each_rank(empty, [](aux::unchoke_rank const&) { return true; }), 0);
+}
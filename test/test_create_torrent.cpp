@@ -37,8 +37,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/aux_/escape_string.hpp" // for convert_path_to_posix
 #include "libtorrent/announce_entry.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/aux_/path.hpp"
 
 #include <cstring>
+#include <fstream>
 
 
 // make sure creating a torrent from an existing handle preserves the
@@ -70,3 +73,105 @@ TORRENT_TEST(create_verbatim_torrent)
 	TEST_CHECK(memcmp(dest_info, test_torrent + 1, sizeof(test_torrent)-3) == 0);
 }
 
+
+namespace {
+
+	// writes the files of ``fs`` to disk under ``path``, filled with a
+	// pattern, and returns the torrent's payload, including pad files
+	std::vector<char> write_files(lt::file_storage const& fs, std::string const& path)
+	{
+		std::vector<char> payload;
+		for (lt::file_index_t i(0); i < fs.end_file(); ++i)
+		{
+			std::vector<char> content(std::size_t(fs.file_size(i)));
+			if (!fs.pad_file_at(i))
+			{
+				for (std::size_t k = 0; k < content.size(); ++k)
+					content[k] = char((k * 7 + static_cast<int>(i)) & 0xff);
+				std::string const file_path = fs.file_path(i, path);
+				lt::error_code ec;
+				lt::create_directories(lt::parent_path(file_path), ec);
+				std::ofstream out(file_path.c_str(), std::ios_base::binary);
+				out.write(content.data(), std::streamsize(content.size()));
+			}
+			payload.insert(payload.end(), content.begin(), content.end());
+		}
+		return payload;
+	}
+
+	lt::file_storage test_files()
+	{
+		lt::file_storage fs;
+		fs.add_file("test_torrent/a", 100000);
+		fs.add_file("test_torrent/empty", 0);
+		fs.add_file("test_torrent/b", 1234567);
+		fs.add_file("test_torrent/c", 16);
+		fs.add_file("test_torrent/d", 3000000);
+		return fs;
+	}
+}
+
+// the hashes set_piece_hashes() computes must match the payload, regardless
+// of the number of hashing threads, including with pad files
+TORRENT_TEST(set_piece_hashes_threads)
+{
+	for (int threads : {1, 3, 8})
+	{
+		lt::file_storage fs = test_files();
+		lt::create_torrent t(fs, 0x4000, 0x4000, lt::create_torrent::optimize_alignment);
+		std::vector<char> const payload = write_files(t.files(), "create_torrent_files");
+		TEST_EQUAL(std::int64_t(payload.size()), t.files().total_size());
+
+		int next_piece = 0;
+		lt::error_code ec;
+		lt::set_piece_hashes(t, "create_torrent_files", threads
+			, [&](lt::piece_index_t const p)
+			{
+				// progress is reported in order
+				TEST_EQUAL(static_cast<int>(p), next_piece);
+				++next_piece;
+				return true;
+			}, ec);
+		TEST_CHECK(!ec);
+		TEST_EQUAL(next_piece, t.num_pieces());
+
+		std::vector<char> buf;
+		lt::bencode(std::back_inserter(buf), t.generate());
+		lt::torrent_info ti(buf, lt::from_span);
+		for (lt::piece_index_t i(0); i < t.files().end_piece(); ++i)
+		{
+			std::size_t const offset = std::size_t(static_cast<int>(i)) * 0x4000;
+			lt::sha1_hash const expected = lt::hasher(payload.data() + offset
+				, t.files().piece_size(i)).final();
+			TEST_EQUAL(ti.hash_for_piece(i), expected);
+		}
+	}
+	lt::error_code ec;
+	lt::remove_all("create_torrent_files", ec);
+}
+
+TORRENT_TEST(set_piece_hashes_cancel)
+{
+	lt::file_storage fs = test_files();
+	lt::create_torrent t(fs, 0x4000);
+	write_files(t.files(), "create_torrent_cancel");
+
+	int calls = 0;
+	lt::error_code ec;
+	lt::set_piece_hashes(t, "create_torrent_cancel", 4
+		, [&](lt::piece_index_t) { return ++calls < 10; }, ec);
+	TEST_CHECK(ec == boost::asio::error::operation_aborted);
+	TEST_EQUAL(calls, 10);
+
+	lt::remove_all("create_torrent_cancel", ec);
+}
+
+TORRENT_TEST(set_piece_hashes_missing_file)
+{
+	lt::file_storage fs = test_files();
+	lt::create_torrent t(fs, 0x4000);
+
+	lt::error_code ec;
+	lt::set_piece_hashes(t, "create_torrent_missing", ec);
+	TEST_CHECK(ec == boost::system::errc::no_such_file_or_directory);
+}
@@ -51,6 +51,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/time.hpp"
 #include "libtorrent/aux_/listen_socket_handle.hpp"
 #include "libtorrent/aux_/session_impl.hpp"
+#include "libtorrent/version.hpp"
 
 #include "libtorrent/kademlia/node_id.hpp"
 #include "libtorrent/kademlia/routing_table.hpp"
@@ -112,6 +113,33 @@ void nop_node() {}
 // packets instead of having a global variable
 std::list<std::pair<udp::endpoint, entry>> g_sent_packets;
 
+// bencodes responses the same way dht_tracker does and keeps the last one
+struct capture_socket final : socket_manager
+{
+	bool has_quota() override { return true; }
+	bool send_packet(aux::listen_socket_handle const& s, entry& msg
+		, udp::endpoint const& ep) override
+	{
+		static char const version_str[] = {'L', 'T'
+			, LIBTORRENT_VERSION_MAJOR, LIBTORRENT_VERSION_MINOR};
+		msg["v"] = std::string(version_str, version_str + 4);
+		encoded.clear();
+		bencode(std::back_inserter(encoded), msg);
+		return send_packet(s, span<char const>(encoded), ep);
+	}
+	bool send_packet(aux::listen_socket_handle const&, span<char const> buf
+		, udp::endpoint const&) override
+	{
+		last.assign(buf.begin(), buf.end());
+		++packets;
+		return true;
+	}
+
+	std::vector<char> encoded;
+	std::vector<char> last;
+	int packets = 0;
+};
+
 struct mock_socket final : socket_manager
 {
 	bool has_quota() override { return true; }
@@ -547,6 +575,11 @@ struct obs : dht::dht_observer
 #endif
 	bool on_dht_request(string_view query
 		, dht::msg const& request, entry& response) override { return false; }
+	bool has_dht_request_handlers() const override { return request_handlers; }
+
+	// when set, the node is told there may be plugins handling requests,
+	// which makes it build its responses as entries
+	bool request_handlers = false;
 
 #ifndef TORRENT_DISABLE_LOGGING
 	std::vector<std::string> m_log;
@@ -3138,6 +3171,298 @@ TORRENT_TEST(routing_table_for_each)
 	TEST_EQUAL(v.size(), 4);
 }
 
+TORRENT_TEST(routing_table_ip_set)
+{
+	ip_set ips;
+	std::vector<address> addrs;
+	for (int i = 0; i < 200; ++i)
+		addrs.push_back(rand_v4());
+
+	for (auto const& a : addrs) ips.insert(a);
+	// the same IP can be inserted more than once, and has to be erased the
+	// same number of times
+	ips.insert(addrs[10]);
+
+	for (auto const& a : addrs) TEST_CHECK(ips.exists(a));
+	TEST_CHECK(!ips.exists(addr4("1.2.3.4")));
+
+	ips.erase(addrs[10]);
+	TEST_CHECK(ips.exists(addrs[10]));
+
+	// erase every other address, the remaining ones must still be found
+	for (int i = 0; i < int(addrs.size()); i += 2) ips.erase(addrs[std::size_t(i)]);
+	for (int i = 0; i < int(addrs.size()); ++i)
+		TEST_EQUAL(ips.exists(addrs[std::size_t(i)]), (i % 2) == 1);
+
+	ip_set ips2;
+	for (int i = 1; i < int(addrs.size()); i += 2) ips2.insert(addrs[std::size_t(i)]);
+	TEST_CHECK(ips == ips2);
+	ips2.insert(addrs[1]);
+	TEST_CHECK(!(ips == ips2));
+
+#if TORRENT_USE_IPV6
+	address const a6 = addr6("2001:1111:1111:1111:1111:1111:1111:1111");
+	TEST_CHECK(!ips.exists(a6));
+	ips.insert(a6);
+	TEST_CHECK(ips.exists(a6));
+	ips.erase(a6);
+	TEST_CHECK(!ips.exists(a6));
+#endif
+}
+
+TORRENT_TEST(routing_table_find_node_span)
+{
+	dht::dht_settings sett = test_settings();
+	sett.restrict_routing_ips = false;
+	obs observer;
+	node_id id = to_hash("1234876923549721020394873245098347598635");
+	node_id diff = to_hash("15764f7459456a9453f8719b09547c11d5f34061");
+
+	routing_table tbl(id, udp::v4(), 8, sett, &observer);
+	std::array<node_entry const*, 8> nodes;
+	TEST_EQUAL(tbl.find_node(id, nodes, 0), 0);
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		add_and_replace(id, diff);
+		tbl.node_seen(id, rand_udp_ep(), 20 + (id[19] & 0xff));
+	}
+
+	std::vector<node_entry> v;
+	for (int i = 0; i < 50; ++i)
+	{
+		node_id target;
+		aux::random_bytes(target);
+		int const num = tbl.find_node(target, nodes, 0);
+		tbl.find_node(target, v, 0);
+		TEST_EQUAL(num, 8);
+		TEST_EQUAL(int(v.size()), num);
+		for (int k = 0; k < num; ++k)
+			TEST_CHECK(nodes[std::size_t(k)]->id == v[std::size_t(k)].id);
+	}
+}
+
+TORRENT_TEST(routing_table_benchmark)
+{
+	dht::dht_settings sett = test_settings();
+	sett.restrict_routing_ips = false;
+	sett.extended_routing_table = true;
+	obs observer;
+	node_id id = to_hash("1234876923549721020394873245098347598635");
+
+	routing_table tbl(id, udp::v4(), 8, sett, &observer);
+
+	std::vector<std::pair<node_id, udp::endpoint>> seen;
+	for (int i = 0; i < 5000; ++i)
+	{
+		node_id nid;
+		aux::random_bytes(nid);
+		seen.emplace_back(nid, rand_udp_ep());
+	}
+
+	int const num_queries = 200000;
+	std::vector<node_id> targets(1000);
+	for (auto& t : targets) aux::random_bytes(t);
+
+	time_point start = clock_type::now();
+	for (auto const& n : seen)
+		tbl.node_seen(n.first, n.second, 20 + (n.first[19] & 0xff));
+	// seeing nodes that are already in the table is the common case
+	for (int r = 0; r < 10; ++r)
+		for (auto const& n : seen)
+			tbl.node_seen(n.first, n.second, 20 + (n.first[19] & 0xff));
+	time_point end = clock_type::now();
+	std::printf("node_seen: %d calls in %d ms\n", int(seen.size()) * 11
+		, int(total_milliseconds(end - start)));
+
+	std::array<node_entry const*, 8> nodes;
+	int total = 0;
+	start = clock_type::now();
+	for (int i = 0; i < num_queries; ++i)
+		total += tbl.find_node(targets[std::size_t(i % int(targets.size()))], nodes, 0);
+	end = clock_type::now();
+	std::int64_t const us = std::max(std::int64_t(1), total_microseconds(end - start));
+	std::printf("find_node: %d queries in %d ms (%" PRId64 " queries/s)\n"
+		, num_queries, int(us / 1000), std::int64_t(num_queries) * 1000000 / us);
+	TEST_EQUAL(total, num_queries * 8);
+}
+
+namespace {
+
+	bdecode_node make_request(std::vector<char>& buf, char const* q
+		, msg_args const& args)
+	{
+		entry e;
+		e["q"] = q;
+		e["t"] = "10";
+		e["y"] = "q";
+		e["a"] = args.a;
+		e["a"]["id"] = generate_next().to_string();
+		// read-only, to keep the requests from altering the routing table
+		e["ro"] = 1;
+		buf.clear();
+		bencode(std::back_inserter(buf), e);
+		error_code ec;
+		bdecode_node ret = bdecode(buf, ec);
+		TEST_CHECK(!ec);
+		return ret;
+	}
+
+	struct response_setup
+	{
+		response_setup()
+			: sett(test_settings())
+			, ls(dummy_listen_socket4())
+			, storage(dht_default_storage_constructor(sett))
+			, dht_node(ls, &s, sett, node_id(nullptr), &observer, cnt
+				, get_foreign_node_stub, *storage)
+		{
+			storage->update_node_ids({node_id::min()});
+			for (int i = 0; i < 1000; ++i)
+			{
+				node_id id;
+				aux::random_bytes(id);
+				dht_node.m_table.node_seen(id, rand_udp_ep(rand_v4), 50);
+			}
+		}
+
+		// sends the request and returns the encoded response
+		std::vector<char> request(bdecode_node const& req, udp::endpoint const& ep)
+		{
+			s.last.clear();
+			dht_node.incoming(dht_node.m_sock, dht::msg(req, ep));
+			return s.last;
+		}
+
+		dht::dht_settings sett;
+		capture_socket s;
+		std::shared_ptr<aux::listen_socket_t> ls;
+		obs observer;
+		counters cnt;
+		std::unique_ptr<dht_storage_interface> storage;
+		dht::node dht_node;
+	};
+}
+
+// the responses written without building an entry must be identical to the
+// ones built as entries
+TORRENT_TEST(dht_response_writer)
+{
+	response_setup t;
+	udp::endpoint const ep(rand_v4(), 6881);
+	sha1_hash const ih = to_hash("1234876923549721020394873245098347598635");
+	std::vector<char> req_buf;
+
+	bdecode_node req = make_request(req_buf, "find_node", msg_args().target(ih));
+	std::vector<char> const find_node_fast = t.request(req, ep);
+	t.observer.request_handlers = true;
+	TEST_CHECK(find_node_fast == t.request(req, ep));
+	t.observer.request_handlers = false;
+	TEST_CHECK(!find_node_fast.empty());
+
+	// an invalid request is answered with an error either way
+	req = make_request(req_buf, "get_peers", msg_args());
+	TEST_CHECK(!t.request(req, ep).empty());
+
+	req = make_request(req_buf, "get_peers", msg_args().info_hash(ih.data()));
+	std::vector<char> const get_peers_fast = t.request(req, ep);
+	t.observer.request_handlers = true;
+	TEST_CHECK(get_peers_fast == t.request(req, ep));
+	t.observer.request_handlers = false;
+
+	error_code ec;
+	bdecode_node resp = bdecode(get_peers_fast, ec);
+	TEST_CHECK(!ec);
+	dht::key_desc_t const get_peers_desc[] = {
+		{"ip", bdecode_node::string_t, 6, 0},
+		{"r", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"id", bdecode_node::string_t, 20, 0},
+			{"nodes", bdecode_node::string_t, 8 * 26, 0},
+			{"p", bdecode_node::int_t, 0, 0},
+			{"token", bdecode_node::string_t, 0, key_desc_t::last_child},
+		{"t", bdecode_node::string_t, 2, 0},
+		{"v", bdecode_node::string_t, 4, 0},
+		{"y", bdecode_node::string_t, 1, 0},
+	};
+	bdecode_node keys[9];
+	char error_string[200];
+	bool const ret = verify_message(resp, get_peers_desc, keys, error_string);
+	TEST_CHECK(ret);
+	if (!ret)
+	{
+		std::printf("invalid get_peers response: %s\n", error_string);
+		return;
+	}
+	TEST_EQUAL(keys[8].string_value(), "r");
+	TEST_EQUAL(keys[4].int_value(), 6881);
+	std::string const token = keys[5].string_value().to_string();
+
+	// announce a few peers, then make sure get_peers returns the same values
+	for (int i = 0; i < 3; ++i)
+	{
+		req = make_request(req_buf, "announce_peer", msg_args()
+			.info_hash(ih.data()).port(1000 + i).token(token).name("test"));
+		std::vector<char> const announce_fast = t.request(req, ep);
+		t.observer.request_handlers = true;
+		TEST_CHECK(announce_fast == t.request(req, ep));
+		t.observer.request_handlers = false;
+	}
+
+	req = make_request(req_buf, "get_peers", msg_args().info_hash(ih.data()));
+	std::vector<char> const peers_fast = t.request(req, ep);
+	t.observer.request_handlers = true;
+	TEST_CHECK(peers_fast == t.request(req, ep));
+	t.observer.request_handlers = false;
+	resp = bdecode(peers_fast, ec);
+	TEST_CHECK(resp.dict_find_dict("r").dict_find_list("values"));
+	TEST_EQUAL(resp.dict_find_dict("r").dict_find_string_value("n"), "test");
+
+	req = make_request(req_buf, "get_peers", msg_args().info_hash(ih.data())
+		.scrape(true));
+	std::vector<char> const scrape_fast = t.request(req, ep);
+	t.observer.request_handlers = true;
+	TEST_CHECK(scrape_fast == t.request(req, ep));
+	t.observer.request_handlers = false;
+	resp = bdecode(scrape_fast, ec);
+	TEST_CHECK(resp.dict_find_dict("r").dict_find_string("BFpe"));
+
+	// an announce with an invalid token is rejected either way
+	req = make_request(req_buf, "announce_peer", msg_args()
+		.info_hash(ih.data()).port(1000).token("abcd"));
+	resp = bdecode(t.request(req, ep), ec);
+	TEST_EQUAL(resp.dict_find_string_value("y"), "e");
+}
+
+TORRENT_TEST(dht_response_benchmark)
+{
+	response_setup t;
+	sha1_hash const ih = to_hash("1234876923549721020394873245098347598635");
+	std::vector<char> req_buf[2];
+	bdecode_node const reqs[] = {
+		make_request(req_buf[0], "find_node", msg_args().target(ih)),
+		make_request(req_buf[1], "get_peers", msg_args().info_hash(ih.data())),
+	};
+
+	int const num_messages = 100000;
+	for (bool const entries : {true, false})
+	{
+		t.observer.request_handlers = entries;
+		int const before = t.s.packets;
+		time_point const start = clock_type::now();
+		for (int i = 0; i < num_messages; ++i)
+		{
+			t.dht_node.incoming(t.dht_node.m_sock, dht::msg(reqs[i & 1]
+				, udp::endpoint(address_v4(std::uint32_t(0x0a000000 + (i & 0xffff))), 6881)));
+		}
+		time_point const end = clock_type::now();
+		TEST_EQUAL(t.s.packets - before, num_messages);
+		std::int64_t const us = std::max(std::int64_t(1), total_microseconds(end - start));
+		std::printf("%s: %d responses in %d ms (%" PRId64 " messages/s)\n"
+			, entries ? "entry" : "bencode_writer"
+			, num_messages, int(us / 1000), std::int64_t(num_messages) * 1000000 / us);
+	}
+}
+
 TORRENT_TEST(node_set_id)
 {
 	dht_test_setup t(udp::endpoint(rand_v4(), 20));
@@ -3345,6 +3670,92 @@ TORRENT_TEST(unsorted_traversal_results)
 	TEST_CHECK(eps[5] == results[0]->target_ep());
 }
 
+struct rtt_test_algo : dht::traversal_algorithm
+{
+	rtt_test_algo(node& dht_node, node_id const& target)
+		: traversal_algorithm(dht_node, target)
+	{}
+
+	bool invoke(observer_ptr o) override
+	{
+		invoked.push_back(o->target_ep());
+		return true;
+	}
+
+	using traversal_algorithm::add_requests;
+
+	std::vector<udp::endpoint> invoked;
+};
+
+TORRENT_TEST(traversal_prefers_low_rtt)
+{
+	// among nodes that are equally close to the target, the ones we know
+	// respond quickly should be queried first
+
+	dht_test_setup t(udp::endpoint(rand_v4(), 20));
+
+	auto algo = std::make_shared<rtt_test_algo>(t.dht_node, node_id());
+
+	char const* ids[] = {
+		"8000000000000000000000000000000000000001",
+		"8000000000000000000000000000000000000002",
+		"8000000000000000000000000000000000000003",
+		"8000000000000000000000000000000000000004",
+		"4000000000000000000000000000000000000001"
+	};
+	int const rtts[] = { 300, 0xffff, 50, 100, 400 };
+
+	std::vector<udp::endpoint> eps;
+	for (int i = 0; i < 5; ++i)
+	{
+		eps.push_back(rand_udp_ep(rand_v4));
+		algo->add_entry(to_hash(ids[i]), eps.back(), observer::flag_initial, rtts[i]);
+	}
+
+	algo->add_requests();
+
+	// the closest node is always queried first, then the fast ones among
+	// the equally distant nodes
+	TEST_EQUAL(algo->invoked.size(), 3);
+	TEST_CHECK(algo->invoked[0] == eps[4]);
+	TEST_CHECK(algo->invoked[1] == eps[2]);
+	TEST_CHECK(algo->invoked[2] == eps[3]);
+}
+
+TORRENT_TEST(traversal_low_rtt_pick_ahead_counted_once)
+{
+	// a node picked ahead of the cursor because of its low RTT must only
+	// count once against the branch factor, also when the cursor reaches it
+
+	dht_test_setup t(udp::endpoint(rand_v4(), 20));
+	TEST_CHECK(t.sett.aggressive_lookups);
+
+	auto algo = std::make_shared<rtt_test_algo>(t.dht_node, node_id());
+	TEST_EQUAL(algo->branch_factor(), 3);
+
+	char const* ids[] = {
+		"8000000000000000000000000000000000000001",
+		"8000000000000000000000000000000000000002",
+		"8000000000000000000000000000000000000003"
+	};
+	int const rtts[] = { 300, 50, 0xffff };
+
+	std::vector<udp::endpoint> eps;
+	for (int i = 0; i < 3; ++i)
+	{
+		eps.push_back(rand_udp_ep(rand_v4));
+		algo->add_entry(to_hash(ids[i]), eps.back(), observer::flag_initial, rtts[i]);
+	}
+
+	algo->add_requests();
+
+	// all three nodes fit in the branch factor
+	TEST_EQUAL(algo->invoked.size(), 3);
+	TEST_CHECK(algo->invoked[0] == eps[1]);
+	TEST_CHECK(algo->invoked[1] == eps[0]);
+	TEST_CHECK(algo->invoked[2] == eps[2]);
+}
+
 TORRENT_TEST(rpc_invalid_error_msg)
 {
 	// TODO: 3 use dht_test_setup class to simplify the node setup
@@ -76,10 +76,10 @@ namespace
 		return dht_default_storage_constructor(settings);
 	}
 
-	std::unique_ptr<dht_storage_interface> create_default_dht_storage(
-		dht::dht_settings const& sett)
+	std::unique_ptr<dht_storage_interface> create_dht_storage(
+		dht::dht_settings const& sett, dht_storage_constructor_type const& ctor)
 	{
-		std::unique_ptr<dht_storage_interface> s(dht_default_storage_constructor(sett));
+		std::unique_ptr<dht_storage_interface> s(ctor(sett));
 		TEST_CHECK(s != nullptr);
 
 		s->update_node_ids({to_hash("0000000000000000000000000000000000000200")});
@@ -88,15 +88,26 @@ namespace
 	}
 }
 
+// all the built-in storage implementations are expected to fulfill the same
+// contract. This defines a test that's run once against each of them, with
+// the storage constructor passed in as ``ctor``
+#define STORAGE_TEST(test_name) \
+	void storage_test_##test_name(dht_storage_constructor_type const& ctor); \
+	TORRENT_TEST(test_name) \
+	{ storage_test_##test_name(dht_default_storage_constructor); } \
+	TORRENT_TEST(test_name##_compact) \
+	{ storage_test_##test_name(dht_compact_storage_constructor); } \
+	void storage_test_##test_name(dht_storage_constructor_type const& ctor)
+
 sha1_hash const n1 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee401");
 sha1_hash const n2 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee402");
 sha1_hash const n3 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee403");
 sha1_hash const n4 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee404");
 
-TORRENT_TEST(announce_peer)
+STORAGE_TEST(announce_peer)
 {
 	dht::dht_settings sett = test_settings();
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	entry peers;
 	s->get_peers(n1, false, false, address(), peers);
@@ -124,10 +135,10 @@ TORRENT_TEST(announce_peer)
 }
 
 #if TORRENT_USE_IPV6
-TORRENT_TEST(dual_stack)
+STORAGE_TEST(dual_stack)
 {
 	dht::dht_settings sett = test_settings();
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	tcp::endpoint const p1 = ep("124.31.75.21", 1);
 	tcp::endpoint const p2 = ep("124.31.75.22", 1);
@@ -151,10 +162,10 @@ TORRENT_TEST(dual_stack)
 }
 #endif
 
-TORRENT_TEST(put_items)
+STORAGE_TEST(put_items)
 {
 	dht::dht_settings sett = test_settings();
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	entry item;
 	bool r = s->get_immutable_item(n4, item);
@@ -181,10 +192,10 @@ TORRENT_TEST(put_items)
 	TEST_CHECK(r);
 }
 
-TORRENT_TEST(counters)
+STORAGE_TEST(counters)
 {
 	dht::dht_settings sett = test_settings();
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	sha1_hash const n1 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee401");
 	sha1_hash const n2 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee402");
@@ -271,11 +282,11 @@ TORRENT_TEST(default_set_custom)
 	TEST_EQUAL(g_storage_constructor_invoked, true);
 }
 
-TORRENT_TEST(peer_limit)
+STORAGE_TEST(peer_limit)
 {
 	dht::dht_settings sett = test_settings();
 	sett.max_peers = 42;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	for (int i = 0; i < 200; ++i)
 	{
@@ -288,11 +299,11 @@ TORRENT_TEST(peer_limit)
 	TEST_EQUAL(cnt.peers, 42);
 }
 
-TORRENT_TEST(torrent_limit)
+STORAGE_TEST(torrent_limit)
 {
 	dht::dht_settings sett = test_settings();
 	sett.max_torrents = 42;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	for (int i = 0; i < 200; ++i)
 	{
@@ -305,11 +316,11 @@ TORRENT_TEST(torrent_limit)
 	TEST_EQUAL(cnt.torrents, 42);
 }
 
-TORRENT_TEST(immutable_item_limit)
+STORAGE_TEST(immutable_item_limit)
 {
 	dht::dht_settings sett = test_settings();
 	sett.max_dht_items = 42;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	for (int i = 0; i < 200; ++i)
 	{
@@ -321,11 +332,11 @@ TORRENT_TEST(immutable_item_limit)
 	TEST_EQUAL(cnt.immutable_data, 42);
 }
 
-TORRENT_TEST(mutable_item_limit)
+STORAGE_TEST(mutable_item_limit)
 {
 	dht::dht_settings sett = test_settings();
 	sett.max_dht_items = 42;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	public_key pk;
 	signature sig;
@@ -340,7 +351,7 @@ TORRENT_TEST(mutable_item_limit)
 	TEST_EQUAL(cnt.mutable_data, 42);
 }
 
-TORRENT_TEST(get_peers_dist)
+STORAGE_TEST(get_peers_dist)
 {
 	// test that get_peers returns reasonably disjoint sets of peers with each call
 	// take two samples of 100 peers from 1000 and make sure there aren't too many
@@ -348,7 +359,7 @@ TORRENT_TEST(get_peers_dist)
 	dht::dht_settings sett = test_settings();
 	sett.max_peers = 2000;
 	sett.max_peers_reply = 100;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	address addr = rand_v4();
 	for (int i = 0; i < 1000; ++i)
@@ -389,10 +400,10 @@ TORRENT_TEST(get_peers_dist)
 	}
 }
 
-TORRENT_TEST(update_node_ids)
+STORAGE_TEST(update_node_ids)
 {
 	dht::dht_settings sett = test_settings();
-	std::unique_ptr<dht_storage_interface> s(dht_default_storage_constructor(sett));
+	std::unique_ptr<dht_storage_interface> s(ctor(sett));
 	TEST_CHECK(s != nullptr);
 
 	node_id const n1 = to_hash("0000000000000000000000000000000000000200");
@@ -439,13 +450,13 @@ TORRENT_TEST(update_node_ids)
 	TEST_CHECK(r);
 }
 
-TORRENT_TEST(infohashes_sample)
+STORAGE_TEST(infohashes_sample)
 {
 	dht::dht_settings sett = test_settings();
 	sett.max_torrents = 5;
 	sett.sample_infohashes_interval = 10;
 	sett.max_infohashes_sample_count = 2;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	tcp::endpoint const p1 = ep("124.31.75.21", 1);
 	tcp::endpoint const p2 = ep("124.31.75.22", 1);
@@ -481,13 +492,13 @@ TORRENT_TEST(infohashes_sample)
 	TEST_CHECK(samples.find(aux::to_hex(n4)) != std::string::npos);
 }
 
-TORRENT_TEST(infohashes_sample_dist)
+STORAGE_TEST(infohashes_sample_dist)
 {
 	dht::dht_settings sett = test_settings();
 	sett.max_torrents = 1000;
 	sett.sample_infohashes_interval = 0; // need this to force refresh every call
 	sett.max_infohashes_sample_count = 1;
-	std::unique_ptr<dht_storage_interface> s(create_default_dht_storage(sett));
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
 
 	for (int i = 0; i < 1000; ++i)
 	{
@@ -511,4 +522,51 @@ TORRENT_TEST(infohashes_sample_dist)
 	TEST_CHECK(infohash_set.size() > 500);
 }
 
+namespace {
+
+void benchmark_storage(char const* name, dht_storage_constructor_type const& ctor)
+{
+	dht::dht_settings sett = test_settings();
+	sett.max_torrents = 5000;
+	sett.max_peers = 100;
+	std::unique_ptr<dht_storage_interface> s(create_dht_storage(sett, ctor));
+
+	std::vector<sha1_hash> info_hashes;
+	for (int i = 0; i < sett.max_torrents; ++i)
+		info_hashes.push_back(rand_hash());
+
+	time_point const start = clock_type::now();
+	for (int i = 0; i < sett.max_peers; ++i)
+	{
+		for (auto const& ih : info_hashes)
+			s->announce_peer(ih, tcp::endpoint(rand_v4(), std::uint16_t(i)), "", (i & 1) == 0);
+	}
+	time_point const announced = clock_type::now();
+
+	for (auto const& ih : info_hashes)
+	{
+		entry peers;
+		s->get_peers(ih, false, false, address(), peers);
+	}
+	time_point const end = clock_type::now();
+
+	dht_storage_counters const cnt = s->counters();
+	TEST_EQUAL(cnt.torrents, sett.max_torrents);
+	TEST_EQUAL(cnt.peers, sett.max_torrents * sett.max_peers);
+
+	std::printf("%s: %d announces: %d ms, %d get_peers: %d ms\n", name
+		, sett.max_torrents * sett.max_peers
+		, int(total_milliseconds(announced - start))
+		, sett.max_torrents
+		, int(total_milliseconds(end - announced)));
+}
+
+}
+
+TORRENT_TEST(storage_benchmark)
+{
+	benchmark_storage("default", dht_default_storage_constructor);
+	benchmark_storage("compact", dht_compact_storage_constructor);
+}
+
 #endif
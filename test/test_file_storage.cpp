@@ -615,6 +615,110 @@ TORRENT_TEST(map_block_mid)
 	}
 }
 
+namespace {
+
+// the reference implementation of file_index_at_offset(), a linear scan
+file_index_t linear_file_at_offset(file_storage const& fs, std::int64_t const offset)
+{
+	file_index_t ret(0);
+	for (file_index_t i(0); i < fs.end_file(); ++i)
+	{
+		if (fs.file_offset(i) > offset) break;
+		ret = i;
+	}
+	return ret;
+}
+
+void check_offset_lookups(file_storage const& fs)
+{
+	for (std::int64_t off = 0; off < fs.total_size(); ++off)
+	{
+		file_index_t const f = fs.file_index_at_offset(off);
+		TEST_EQUAL(f, linear_file_at_offset(fs, off));
+		std::vector<file_slice> const map = fs.map_block(
+			piece_index_t(int(off / fs.piece_length())), off % fs.piece_length(), 1);
+		TEST_EQUAL(int(map.size()), 1);
+		if (map.size() != 1) continue;
+		TEST_EQUAL(map[0].file_index, f);
+		TEST_EQUAL(map[0].offset, off - fs.file_offset(f));
+	}
+}
+}
+
+TORRENT_TEST(file_index_at_offset_many_files)
+{
+	// enough files to span several blocks of the offset index, with zero
+	// sized files (sharing offsets with their neighbors) sprinkled in,
+	// including on block boundaries
+	file_storage fs;
+	fs.set_piece_length(16);
+	for (int i = 0; i < 300; ++i)
+	{
+		char name[30];
+		std::snprintf(name, sizeof(name), "test/%d", i);
+		fs.add_file(name, (i % 7 == 0 || i % 64 == 63 || i % 64 == 0) ? 0 : i % 5 + 1);
+	}
+	fs.set_num_pieces(int((fs.total_size() + 15) / 16));
+	check_offset_lookups(fs);
+
+	// copies and swapped objects must keep working
+	file_storage copy = fs;
+	check_offset_lookups(copy);
+	file_storage swapped;
+	swapped.swap(copy);
+	check_offset_lookups(swapped);
+}
+
+TORRENT_TEST(file_index_at_offset_optimize)
+{
+	// optimize() reorders files and inserts pad files, which changes the
+	// offsets of files
+	file_storage fs;
+	fs.set_piece_length(16);
+	for (int i = 0; i < 200; ++i)
+	{
+		char name[30];
+		std::snprintf(name, sizeof(name), "test/%d", i);
+		fs.add_file(name, i % 3 == 0 ? 40 : i % 11);
+	}
+	fs.optimize(16, 16, true);
+	TEST_CHECK(fs.num_files() > 200);
+	fs.set_num_pieces(int((fs.total_size() + 15) / 16));
+	check_offset_lookups(fs);
+}
+
+namespace {
+std::string interleaved_name(int const i)
+{
+	char dir[20];
+	char sub[20];
+	char file[20];
+	std::snprintf(dir, sizeof(dir), "dir%d", i % 100);
+	std::snprintf(sub, sizeof(sub), "sub%d", i % 3);
+	std::snprintf(file, sizeof(file), "file%d", i);
+	return combine_path("test", combine_path(dir, combine_path(sub, file)));
+}
+}
+
+TORRENT_TEST(interleaved_directories)
+{
+	// files from many directories, added in an order where the directories
+	// are interleaved, must still map to one path entry per directory
+	file_storage fs;
+	for (int i = 0; i < 2000; ++i)
+		fs.add_file(interleaved_name(i), 1);
+
+	TEST_EQUAL(int(fs.paths().size()), 300);
+	for (int i = 0; i < 2000; ++i)
+		TEST_EQUAL(fs.file_path(file_index_t(i)), interleaved_name(i));
+
+	// renaming a file into an existing directory reuses its path entry
+	fs.rename_file(file_index_t(0), combine_path("test", combine_path("dir1", combine_path("sub1", "x"))));
+	TEST_EQUAL(int(fs.paths().size()), 300);
+	fs.rename_file(file_index_t(0), combine_path("test", combine_path("new", "x")));
+	TEST_EQUAL(int(fs.paths().size()), 301);
+}
+
 // TODO: test file attributes
 // TODO: test symlinks
 // TODO: test reorder_file (make sure internal_file_entry::swap() is used)
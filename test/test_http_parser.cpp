@@ -36,6 +36,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/string_view.hpp"
 
 #include <tuple>
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <string>
 
 using namespace lt;
 
@@ -90,7 +94,7 @@ TORRENT_TEST(http_parser)
 	span<char const> body = parser.get_body();
 	TEST_CHECK(std::equal(body.begin(), body.end(), "test"));
 	TEST_CHECK(parser.header("content-type") == "text/plain");
-	TEST_CHECK(atoi(parser.header("content-length").c_str()) == 4);
+	TEST_CHECK(atoi(parser.header("content-length").to_string().c_str()) == 4);
 	TEST_CHECK(*parser.header_duration("content-length") == lt::seconds32(4));
 	TEST_CHECK(parser.header_duration("content-length-x") == boost::none);
 
@@ -202,7 +206,7 @@ TORRENT_TEST(http_parser)
 	TEST_CHECK(received == std::make_tuple(0, int(strlen(bt_lsd)), false));
 	TEST_CHECK(parser.method() == "bt-search");
 	TEST_CHECK(parser.path() == "*");
-	TEST_CHECK(atoi(parser.header("port").c_str()) == 6881);
+	TEST_CHECK(atoi(parser.header("port").to_string().c_str()) == 6881);
 	TEST_CHECK(parser.header("infohash") == "12345678901234567890");
 
 	TEST_CHECK(parser.finished());
@@ -233,7 +237,7 @@ TORRENT_TEST(http_parser)
 		, "4\r\ntest\r\n10\r\n0123456789abcdef"));
 	TEST_CHECK(parser.header("test-header") == "foobar");
 	TEST_CHECK(parser.header("content-type") == "text/plain");
-	TEST_CHECK(atoi(parser.header("content-length").c_str()) == 20);
+	TEST_CHECK(atoi(parser.header("content-length").to_string().c_str()) == 20);
 	TEST_CHECK(parser.chunked_encoding());
 	typedef std::pair<std::int64_t, std::int64_t> chunk_range;
 	std::vector<chunk_range> cmp;
@@ -357,8 +361,8 @@ TORRENT_TEST(http_parser)
 		TEST_EQUAL(chunk_size, 0);
 		TEST_EQUAL(header_size, sizeof(chunk_header2) - 1);
 
-		TEST_EQUAL(parser.headers().find("test1")->second, "foo");
-		TEST_EQUAL(parser.headers().find("test2")->second, "bar");
+		TEST_EQUAL(parser.header("test1"), "foo");
+		TEST_EQUAL(parser.header("test2"), "bar");
 	}
 
 	// test url parsing
@@ -682,3 +686,127 @@ TORRENT_TEST(invalid_chunk_3)
 	feed_bytes(parser, {reinterpret_cast<char const*>(invalid_chunked_input), sizeof(invalid_chunked_input)});
 }
 
+
+TORRENT_TEST(header_views_outlive_receive_buffer)
+{
+	std::string buf =
+		"HTTP/1.1 206 Partial Content\r\n"
+		"Content-Range: bytes 0-3/10\r\n"
+		"X-Dup: a\r\n"
+		"X-Dup: b\r\n"
+		"Content-Length: 4\r\n"
+		"\r\n";
+
+	http_parser parser;
+	bool error = false;
+	parser.incoming(buf, error);
+	TEST_CHECK(!error);
+	TEST_CHECK(parser.header_finished());
+
+	// the views returned by the parser must not refer to the receive buffer
+	std::fill(buf.begin(), buf.end(), 'x');
+	buf.clear();
+	buf.shrink_to_fit();
+
+	TEST_EQUAL(parser.status_code(), 206);
+	TEST_EQUAL(parser.message(), "Partial Content");
+	TEST_EQUAL(parser.protocol(), "HTTP/1.1");
+	TEST_EQUAL(parser.header("content-range"), "bytes 0-3/10");
+	TEST_EQUAL(parser.header("x-dup"), "a");
+	TEST_CHECK(parser.header("missing").empty());
+
+	auto const headers = parser.headers();
+	TEST_EQUAL(headers.size(), 4);
+	TEST_EQUAL(headers[1].first, "x-dup");
+	TEST_EQUAL(headers[1].second, "a");
+	TEST_EQUAL(headers[2].first, "x-dup");
+	TEST_EQUAL(headers[2].second, "b");
+}
+
+TORRENT_TEST(http_parser_fuzz)
+{
+	char const* const inputs[] = {
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Length: 4\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"test",
+		"HTTP/1.1 200 OK\r\n"
+		"Transfer-Encoding: chunked\r\n"
+		"\r\n"
+		"4\r\ntest\r\n4\r\n1234\r\n10\r\n0123456789abcdef\r\n"
+		"0\r\nfoo: bar\r\n\r\n",
+		"HTTP/1.1 206 OK\r\n"
+		"Content-Range: bytes 50-99/100\r\n"
+		"\r\n",
+		"BT-SEARCH * HTTP/1.1\r\n"
+		"Host: 239.192.152.143:6771\r\n"
+		"Port: 6881\r\n"
+		"Infohash: 12345678901234567890\r\n"
+		"\r\n",
+	};
+	char const alphabet[] = "\r\n: ;-0123456789abcdefHTTP/";
+
+	// fixed seed to keep the test deterministic
+	std::mt19937 rng(0x1337);
+	http_parser parser;
+	for (int round = 0; round < 2000; ++round)
+	{
+		std::string msg = inputs[rng() % (sizeof(inputs) / sizeof(inputs[0]))];
+
+		int const mutations = int(rng() % 8);
+		for (int i = 0; i < mutations; ++i)
+		{
+			std::size_t const pos = rng() % msg.size();
+			switch (rng() % 3)
+			{
+				case 0: msg[pos] = alphabet[rng() % (sizeof(alphabet) - 1)]; break;
+				case 1: msg.erase(pos, 1 + rng() % 4); break;
+				case 2: msg.insert(pos, 1, alphabet[rng() % (sizeof(alphabet) - 1)]); break;
+			}
+			if (msg.empty()) msg = "\r\n";
+		}
+
+		// feed the message in random sized pieces. The receive buffer is
+		// re-allocated for every call, to make sure nothing refers back into
+		// a previous one
+		parser.reset();
+		int total = 0;
+		bool error = false;
+		std::vector<char> recv_buf;
+		std::size_t offset = 0;
+		while (offset < msg.size() && !error && !parser.finished())
+		{
+			std::size_t const len = std::min(msg.size() - offset
+				, std::size_t(1 + rng() % 20));
+			std::vector<char> next(recv_buf);
+			next.insert(next.end(), msg.begin() + std::ptrdiff_t(offset)
+				, msg.begin() + std::ptrdiff_t(offset + len));
+			recv_buf.swap(next);
+			offset += len;
+
+			int payload, protocol;
+			std::tie(payload, protocol) = parser.incoming(recv_buf, error);
+			TEST_CHECK(payload >= 0);
+			TEST_CHECK(protocol >= 0);
+			total += payload + protocol;
+			TEST_CHECK(total <= int(recv_buf.size()));
+		}
+
+		// touch everything the parser exposes
+		if (!error && parser.header_finished())
+		{
+			// header names are lower-cased and never contain the separator
+			for (auto const& h : parser.headers())
+			{
+				TEST_CHECK(h.first.find(':') == string_view::npos);
+				TEST_CHECK(std::none_of(h.first.begin(), h.first.end()
+					, [](char c) { return c >= 'A' && c <= 'Z'; }));
+			}
+			TEST_CHECK(parser.message().size() <= msg.size());
+			TEST_CHECK(parser.path().size() <= msg.size());
+			TEST_CHECK(parser.method().size() <= msg.size());
+			TEST_CHECK(parser.header("content-length").size() <= msg.size());
+		}
+	}
+}
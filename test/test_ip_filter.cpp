@@ -33,11 +33,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/ip_filter.hpp"
 #include "setup_transfer.hpp" // for addr()
 #include <utility>
+#include <random>
+#include <algorithm>
+#include <cstdio>
 
 #include "test.hpp"
 #include "settings.hpp"
 #include "libtorrent/socket_io.hpp"
 #include "libtorrent/session.hpp"
+#include "libtorrent/time.hpp"
 
 /*
 
@@ -297,3 +301,169 @@ TORRENT_TEST(ip_filter)
 	TEST_CHECK(pf.access(6881) == 0);
 	TEST_CHECK(pf.access(65535) == 0);
 }
+
+namespace {
+
+address_v4 rand_v4(std::mt19937& rng)
+{
+	return address_v4(std::uint32_t(rng()));
+}
+
+#if TORRENT_USE_IPV6
+address_v6 rand_v6(std::mt19937& rng)
+{
+	address_v6::bytes_type b;
+	// keep the addresses clustered in a few prefixes, to exercise both the
+	// radix buckets and the binary search within them
+	b[0] = std::uint8_t(rng() % 4);
+	for (std::size_t i = 1; i < b.size(); ++i) b[i] = std::uint8_t(rng());
+	return address_v6(b);
+}
+#endif
+
+void random_rules(ip_filter& f, std::mt19937& rng, int const n)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		address_v4 a = rand_v4(rng);
+		address_v4 b(std::uint32_t(a.to_ulong() + rng() % 100000));
+		if (b < a) b = a;
+		f.add_rule(a, b, (rng() & 1) ? ip_filter::blocked : 0);
+#if TORRENT_USE_IPV6
+		address_v6 c = rand_v6(rng);
+		address_v6 d = rand_v6(rng);
+		if (d < c) std::swap(c, d);
+		f.add_rule(c, d, (rng() & 1) ? ip_filter::blocked : 0);
+#endif
+	}
+}
+
+void test_compiled(int const num_rules)
+{
+	std::mt19937 rng(num_rules);
+	ip_filter f;
+	random_rules(f, rng, num_rules);
+
+	std::vector<address> probes;
+	for (int i = 0; i < 5000; ++i)
+	{
+		probes.push_back(rand_v4(rng));
+#if TORRENT_USE_IPV6
+		probes.push_back(rand_v6(rng));
+#endif
+	}
+
+	// the boundaries of every range are the interesting cases
+#if TORRENT_USE_IPV6
+	for (auto const& r : std::get<0>(f.export_filter()))
+#else
+	for (auto const& r : f.export_filter())
+#endif
+	{
+		probes.push_back(r.first);
+		probes.push_back(r.last);
+	}
+#if TORRENT_USE_IPV6
+	for (auto const& r : std::get<1>(f.export_filter()))
+	{
+		probes.push_back(r.first);
+		probes.push_back(r.last);
+	}
+#endif
+
+	std::vector<std::uint32_t> expected;
+	for (auto const& a : probes) expected.push_back(f.access(a));
+
+	ip_filter compiled = f;
+	compiled.compile();
+
+	for (std::size_t i = 0; i < probes.size(); ++i)
+		TEST_EQUAL(compiled.access(probes[i]), expected[i]);
+
+	std::vector<std::uint32_t> batch(probes.size());
+	compiled.access(probes, batch);
+	TEST_CHECK(batch == expected);
+
+	// the uncompiled filter gives the same answers through the batch
+	// interface too
+	std::fill(batch.begin(), batch.end(), 0xffffffff);
+	f.access(probes, batch);
+	TEST_CHECK(batch == expected);
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(ip_filter_compiled_small)
+{
+	test_compiled(0);
+	test_compiled(1);
+	test_compiled(20);
+}
+
+TORRENT_TEST(ip_filter_compiled_large)
+{
+	test_compiled(5000);
+}
+
+TORRENT_TEST(ip_filter_compiled_add_rule)
+{
+	ip_filter f;
+	f.add_rule(addr("1.0.0.0"), addr("2.0.0.0"), ip_filter::blocked);
+	f.compile();
+	TEST_EQUAL(f.access(addr("1.2.3.4")), ip_filter::blocked);
+	TEST_EQUAL(f.access(addr("3.0.0.0")), 0);
+
+	// copies share the compiled table, but adding a rule to one of them
+	// must not affect the other
+	ip_filter copy = f;
+	copy.add_rule(addr("3.0.0.0"), addr("4.0.0.0"), ip_filter::blocked);
+	TEST_EQUAL(copy.access(addr("3.0.0.0")), ip_filter::blocked);
+	TEST_EQUAL(f.access(addr("3.0.0.0")), 0);
+
+	copy.compile();
+	TEST_EQUAL(copy.access(addr("3.5.0.0")), ip_filter::blocked);
+	TEST_EQUAL(copy.access(addr("4.0.0.1")), 0);
+	TEST_EQUAL(copy.access(addr("1.2.3.4")), ip_filter::blocked);
+}
+
+TORRENT_TEST(ip_filter_compiled_benchmark)
+{
+	// a blocklist the size of the commonly used public ones
+	std::mt19937 rng(1337);
+	ip_filter f;
+	for (int i = 0; i < 300000; ++i)
+	{
+		address_v4 a = rand_v4(rng);
+		address_v4 b(std::uint32_t(a.to_ulong() + rng() % 256));
+		if (b < a) b = a;
+		f.add_rule(a, b, ip_filter::blocked);
+	}
+
+	std::vector<address> probes;
+	for (int i = 0; i < 1000000; ++i) probes.push_back(rand_v4(rng));
+	std::vector<std::uint32_t> flags(probes.size());
+
+	time_point start = clock_type::now();
+	f.access(probes, flags);
+	time_point const uncompiled_done = clock_type::now();
+	int blocked = int(std::count(flags.begin(), flags.end(), ip_filter::blocked));
+
+	ip_filter compiled = f;
+	compiled.compile();
+	time_point const compile_done = clock_type::now();
+	compiled.access(probes, flags);
+	time_point const compiled_done = clock_type::now();
+
+	TEST_EQUAL(int(std::count(flags.begin(), flags.end(), ip_filter::blocked)), blocked);
+
+#if TORRENT_USE_IPV6
+	int const num_ranges = int(std::get<0>(f.export_filter()).size());
+#else
+	int const num_ranges = int(f.export_filter().size());
+#endif
+	std::printf("1M lookups, %d ranges: uncompiled: %d ms compile: %d ms compiled: %d ms\n"
+		, num_ranges
+		, int(total_milliseconds(uncompiled_done - start))
+		, int(total_milliseconds(compile_done - uncompiled_done))
+		, int(total_milliseconds(compiled_done - compile_done)));
+}
@@ -31,10 +31,16 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <vector>
 #include "test.hpp"
 #include "libtorrent/part_file.hpp"
 #include "libtorrent/aux_/path.hpp"
 #include "libtorrent/error_code.hpp"
+#include "libtorrent/time.hpp"
+#include "libtorrent/io.hpp"
 
 using namespace lt;
 
@@ -137,3 +143,214 @@ TORRENT_TEST(part_file)
 	}
 }
 
+
+namespace {
+
+std::string setup_dir(char const* name)
+{
+	error_code ec;
+	std::string const dir = combine_path(complete("."), name);
+	remove_all(dir, ec);
+	create_directory(dir, ec);
+	if (ec) std::printf("create_directory: %s\n", ec.message().c_str());
+	return dir;
+}
+
+// returns the slot the piece is stored in according to the header on disk
+int slot_on_disk(std::string const& path, int const piece)
+{
+	FILE* f = std::fopen(path.c_str(), "rb");
+	if (f == nullptr) return -2;
+	char buf[4];
+	int ret = -2;
+	if (std::fseek(f, 8 + piece * 4, SEEK_SET) == 0
+		&& std::fread(buf, 1, 4, f) == 4)
+	{
+		char const* ptr = buf;
+		ret = detail::read_int32(ptr);
+	}
+	std::fclose(f);
+	return ret;
+}
+
+void write_piece(part_file& pf, int const piece, int const piece_size, error_code& ec)
+{
+	std::vector<char> buf(static_cast<std::size_t>(piece_size), static_cast<char>(piece));
+	iovec_t const v = buf;
+	pf.writev(v, piece_index_t(piece), 0, ec);
+}
+
+}
+
+TORRENT_TEST(part_file_contiguous_slots)
+{
+	std::string const dir = setup_dir("partfile_test_contiguous");
+	std::string const path = combine_path(dir, "partfile.parts");
+	int const piece_size = 0x4000;
+	error_code ec;
+
+	{
+		part_file pf(dir, "partfile.parts", 100, piece_size);
+		write_piece(pf, 10, piece_size, ec);
+		write_piece(pf, 20, piece_size, ec);
+		write_piece(pf, 30, piece_size, ec);
+		pf.free_piece(piece_index_t(20));
+
+		// slot 1 is free, but piece 31 should go right after piece 30
+		write_piece(pf, 31, piece_size, ec);
+		// and piece 11 right after piece 10, filling the hole
+		write_piece(pf, 11, piece_size, ec);
+		TEST_CHECK(!ec);
+
+		pf.flush_metadata(ec);
+		TEST_CHECK(!ec);
+
+		TEST_EQUAL(slot_on_disk(path, 10), 0);
+		TEST_EQUAL(slot_on_disk(path, 11), 1);
+		TEST_EQUAL(slot_on_disk(path, 20), -1);
+		TEST_EQUAL(slot_on_disk(path, 30), 2);
+		TEST_EQUAL(slot_on_disk(path, 31), 3);
+
+		// export a range starting in the middle of piece 10 and ending in the
+		// middle of piece 11. Both pieces are read with a single read
+		std::vector<char> exported;
+		pf.export_file([&](std::int64_t const file_offset, span<char> buf)
+		{
+			TEST_EQUAL(file_offset, std::int64_t(exported.size()));
+			exported.insert(exported.end(), buf.begin(), buf.end());
+		}, 10 * piece_size + 100, piece_size, ec);
+		TEST_CHECK(!ec);
+
+		TEST_EQUAL(int(exported.size()), piece_size);
+		TEST_CHECK(std::count(exported.begin(), exported.begin() + piece_size - 100, char(10))
+			== piece_size - 100);
+		TEST_CHECK(std::count(exported.begin() + piece_size - 100, exported.end(), char(11))
+			== 100);
+
+		// neither piece was exported in full, so they're still there
+		char buf[16];
+		iovec_t const v = buf;
+		TEST_EQUAL(pf.readv(v, piece_index_t(11), 0, ec), int(sizeof(buf)));
+		TEST_CHECK(!ec);
+
+		// exporting the whole of pieces 30 and 31 removes them
+		pf.export_file([](std::int64_t, span<char>) {}, 30 * piece_size, 2 * piece_size, ec);
+		TEST_CHECK(!ec);
+		pf.readv(v, piece_index_t(31), 0, ec);
+		TEST_CHECK(ec == boost::system::errc::no_such_file_or_directory);
+		ec.clear();
+	}
+}
+
+TORRENT_TEST(part_file_header_pages)
+{
+	std::string const dir = setup_dir("partfile_test_header");
+	int const piece_size = 0x4000;
+	// the header spans several pages
+	int const num_pieces = 3000;
+	error_code ec;
+
+	{
+		part_file pf(dir, "partfile.parts", num_pieces, piece_size);
+		write_piece(pf, 0, piece_size, ec);
+		write_piece(pf, 1500, piece_size, ec);
+		write_piece(pf, 2999, piece_size, ec);
+		pf.flush_metadata(ec);
+		TEST_CHECK(!ec);
+
+		// these only touch the pages holding piece 1500 and 2000
+		pf.free_piece(piece_index_t(1500));
+		write_piece(pf, 2000, piece_size, ec);
+		pf.flush_metadata(ec);
+		TEST_CHECK(!ec);
+	}
+
+	{
+		part_file pf(dir, "partfile.parts", num_pieces, piece_size);
+		char buf[16];
+		iovec_t const v = buf;
+		for (int const p : {0, 2000, 2999})
+		{
+			TEST_EQUAL(pf.readv(v, piece_index_t(p), 0, ec), int(sizeof(buf)));
+			TEST_CHECK(!ec);
+			TEST_EQUAL(buf[0], char(p));
+		}
+		pf.readv(v, piece_index_t(1500), 0, ec);
+		TEST_CHECK(ec == boost::system::errc::no_such_file_or_directory);
+		ec.clear();
+	}
+}
+
+TORRENT_TEST(part_file_threads)
+{
+	std::string const dir = setup_dir("partfile_test_threads");
+	int const piece_size = 0x10000;
+	int const block_size = 0x4000;
+	int const num_threads = 4;
+	int const pieces_per_thread = 32;
+
+	part_file pf(dir, "partfile.parts", num_threads * pieces_per_thread, piece_size);
+
+	time_point const start = clock_type::now();
+	std::vector<std::thread> threads;
+	int failures[num_threads] = {};
+	for (int t = 0; t < num_threads; ++t)
+	{
+		threads.emplace_back([&pf, &failures, t]
+		{
+			error_code ec;
+			std::vector<char> buf(block_size);
+			iovec_t const v = buf;
+			for (int p = t; p < num_threads * pieces_per_thread; p += num_threads)
+			{
+				for (int b = 0; b < piece_size; b += block_size)
+				{
+					std::fill(buf.begin(), buf.end(), char(p + b / block_size));
+					if (pf.writev(v, piece_index_t(p), b, ec) != block_size) ++failures[t];
+				}
+			}
+			for (int p = t; p < num_threads * pieces_per_thread; p += num_threads)
+			{
+				for (int b = 0; b < piece_size; b += block_size)
+				{
+					if (pf.readv(v, piece_index_t(p), b, ec) != block_size
+						|| std::count(buf.begin(), buf.end(), char(p + b / block_size)) != block_size)
+						++failures[t];
+				}
+				// free every other piece while the other threads are still
+				// reading and writing
+				if (p % 2) pf.free_piece(piece_index_t(p));
+			}
+			if (ec) ++failures[t];
+		});
+	}
+	for (auto& t : threads) t.join();
+
+	int const ms = std::max(1, int(total_milliseconds(clock_type::now() - start)));
+	std::printf("part_file: wrote and read %d MiB in %d ms (%.1f MiB/s)\n"
+		, 2 * num_threads * pieces_per_thread * piece_size / 1024 / 1024
+		, ms, 2.0 * num_threads * pieces_per_thread * piece_size / 1024 / 1024 * 1000 / ms);
+
+	for (int const f : failures) TEST_EQUAL(f, 0);
+
+	error_code ec;
+	pf.flush_metadata(ec);
+	TEST_CHECK(!ec);
+
+	std::vector<char> buf(block_size);
+	iovec_t const v = buf;
+	for (int p = 0; p < num_threads * pieces_per_thread; ++p)
+	{
+		int const ret = pf.readv(v, piece_index_t(p), 0, ec);
+		if (p % 2)
+		{
+			TEST_CHECK(ec == boost::system::errc::no_such_file_or_directory);
+			ec.clear();
+		}
+		else
+		{
+			TEST_EQUAL(ret, block_size);
+			TEST_EQUAL(buf[0], char(p));
+		}
+	}
+}
@@ -39,6 +39,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/random.hpp"
 #include "libtorrent/span.hpp"
 #include "libtorrent/buffer.hpp"
+#include "libtorrent/hex.hpp"
+#include "libtorrent/aux_/chacha20.hpp"
 
 #include "setup_transfer.hpp"
 #include "test.hpp"
@@ -152,6 +154,101 @@ TORRENT_TEST(rc4)
 	test_enc_handler(rc41, rc42);
 }
 
+TORRENT_TEST(rc4_buffer_sizes)
+{
+	using namespace lt;
+
+	// small and large buffers are encrypted by different code paths, they
+	// must produce the same stream
+	sha1_hash const key = hasher("test1_key", 8).final();
+	rc4_handler h1;
+	h1.set_outgoing_key(key);
+	rc4_handler h2;
+	h2.set_outgoing_key(key);
+
+	std::vector<char> buf1(20000);
+	std::generate(buf1.begin(), buf1.end(), &std::rand);
+	std::vector<char> buf2 = buf1;
+
+	span<char> whole(buf1);
+	h1.encrypt(whole);
+	for (std::size_t i = 0; i < buf2.size(); i += 113)
+	{
+		span<char> part(&buf2[i], std::min(std::size_t(113), buf2.size() - i));
+		h2.encrypt(part);
+	}
+	TEST_CHECK(buf1 == buf2);
+}
+
+TORRENT_TEST(chacha20_handler)
+{
+	using namespace lt;
+
+	char key1[chacha20_handler::key_size];
+	char key2[chacha20_handler::key_size];
+	aux::random_bytes(key1);
+	aux::random_bytes(key2);
+
+	chacha20_handler h1;
+	h1.set_incoming_key(key2);
+	h1.set_outgoing_key(key1);
+	chacha20_handler h2;
+	h2.set_incoming_key(key1);
+	h2.set_outgoing_key(key2);
+	test_enc_handler(h1, h2);
+}
+
+TORRENT_TEST(chacha20_test_vector)
+{
+	using namespace lt;
+
+	// the test vector from RFC 7539 section 2.4.2. The 96 bit nonce and 32
+	// bit counter there line up with the 64 bit counter and nonce here, as
+	// long as the first word of the nonce is zero
+	char key[32];
+	for (int i = 0; i < 32; ++i) key[i] = char(i);
+	char const nonce[8] = {0, 0, 0, 0x4a, 0, 0, 0, 0};
+	std::string const plaintext = "Ladies and Gentlemen of the class of '99: "
+		"If I could offer you only one tip for the future, sunscreen would be it.";
+	std::string const expected =
+		"6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+		"f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+		"07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+		"5af90bbf74a35be6b40b8eedf2785e42874d";
+
+	// the result must not depend on how the stream is split up
+	for (std::size_t step : {std::size_t(1), std::size_t(7), std::size_t(64), plaintext.size()})
+	{
+		aux::chacha20 c;
+		c.set_key(key, nonce, 1);
+		std::string buf = plaintext;
+		for (std::size_t i = 0; i < buf.size(); i += step)
+			c.crypt({&buf[i], std::min(step, buf.size() - i)});
+		TEST_EQUAL(aux::to_hex(buf), expected);
+	}
+}
+
+TORRENT_TEST(chacha20_blocks_hw_sw)
+{
+	using namespace lt;
+
+	std::array<std::uint32_t, 16> state1;
+	for (std::size_t i = 0; i < state1.size(); ++i)
+		state1[i] = std::uint32_t(i) * 0x9e3779b9u;
+	// make sure the block counter carries into the high word within the batch
+	state1[12] = 0xfffffffe;
+	std::array<std::uint32_t, 16> state2 = state1;
+
+	std::uint8_t out1[aux::chacha20::batch_size];
+	std::uint8_t out2[aux::chacha20::batch_size];
+	aux::chacha20_blocks_sw(state1, out1);
+	if (!aux::chacha20_blocks_hw(state2, out2)) return;
+	TEST_CHECK(std::equal(out1, out1 + sizeof(out1), out2));
+	TEST_CHECK(state1 == state2);
+	TEST_EQUAL(state1[12], 2);
+	TEST_EQUAL(state1[13], state2[13]);
+}
+
 #else
 TORRENT_TEST(disabled)
 {
@@ -46,6 +46,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <memory> // for shared_ptr
 #include <cstdarg>
+#include <map>
+#include <cstdio>
 
 using namespace lt;
 
@@ -922,6 +924,403 @@ TORRENT_TEST(new_peer_size_limit)
 		, 5);
 }
 
+// peers that aren't connect candidates are kept in compact form, but still
+// count as peers in the list and keep their state
+TORRENT_TEST(cold_peers)
+{
+	torrent_state st = init_state();
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	std::vector<torrent_peer*> peers;
+	for (int i = 0; i < 10; ++i)
+	{
+		peers.push_back(add_peer(p, st, tcp::endpoint(
+			address_v4((10 << 24) + i), std::uint16_t(i + 1000))));
+	}
+	TEST_EQUAL(p.num_connect_candidates(), 10);
+
+	// half of the peers fail too many times
+	for (int i = 0; i < 10; i += 2)
+	{
+		p.set_failcount(peers[std::size_t(i)], 3);
+		p.ban_peer(peers[std::size_t(i)]);
+	}
+	TEST_EQUAL(p.num_connect_candidates(), 5);
+	TEST_EQUAL(p.num_cold_peers(), 0);
+
+	// looking for connect candidates turns them into cold peers. They're
+	// reported as erased, since their torrent_peer objects are gone
+	torrent_peer* tp = p.connect_one_peer(0, &st);
+	TEST_CHECK(tp != nullptr);
+	TEST_EQUAL(st.erased.size(), 5);
+	st.erased.clear();
+	TEST_EQUAL(p.num_cold_peers(), 5);
+	TEST_EQUAL(p.num_peers(), 10);
+	TEST_EQUAL(p.num_connect_candidates(), 5);
+	TEST_CHECK(!has_peer(p, ep("10.0.0.0", 1000)));
+	TEST_CHECK(has_peer(p, ep("10.0.0.1", 1001)));
+
+	int visited = 0;
+	p.for_each_peer([&](torrent_peer const& pe)
+	{
+		++visited;
+		bool const cold = (pe.address().to_v4().to_ulong() % 2) == 0;
+		TEST_EQUAL(int(pe.port), int(pe.address().to_v4().to_ulong() % 256) + 1000);
+		TEST_EQUAL(int(pe.failcount), cold ? 3 : 0);
+		TEST_EQUAL(pe.banned, cold);
+		TEST_CHECK(pe.connectable);
+	});
+	TEST_EQUAL(visited, 10);
+
+	// adding a cold peer again brings its torrent_peer back, with all the
+	// state it had
+	torrent_peer* peer = p.add_peer(ep("10.0.0.2", 1002), peer_info::pex, 0, &st);
+	TEST_CHECK(peer != nullptr);
+	TEST_EQUAL(st.first_time_seen, false);
+	TEST_EQUAL(int(peer->failcount), 3);
+	TEST_EQUAL(peer->banned, true);
+	TEST_EQUAL(p.num_cold_peers(), 4);
+	TEST_EQUAL(p.num_peers(), 10);
+	TEST_CHECK(has_peer(p, ep("10.0.0.2", 1002)));
+
+	// as is an incoming connection from one
+	auto c = std::make_shared<mock_peer_connection>(&t, false, ep("10.0.0.4", 1004));
+	TEST_EQUAL(p.new_connection(*c, 0, &st), false);
+	TEST_EQUAL(c->was_disconnected(), true);
+	TEST_EQUAL(p.num_cold_peers(), 3);
+	TEST_EQUAL(p.num_peers(), 10);
+}
+
+TORRENT_TEST(cold_peers_promoted)
+{
+	torrent_state st = init_state();
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	for (int i = 0; i < 100; ++i)
+	{
+		torrent_peer* peer = p.add_peer(tcp::endpoint(
+			address_v4((10 << 24) + ((i + 10) << 16)), std::uint16_t(i + 10)), {}
+			, (i % 4) ? 0 : peer_list::flag_seed, &st);
+		TEST_CHECK(peer != nullptr);
+		if (i % 2) p.inc_failcount(peer);
+	}
+	TEST_EQUAL(p.num_seeds(), 25);
+	TEST_EQUAL(p.num_connect_candidates(), 100);
+
+	// a lower max failcount turns half of the peers into cold peers
+	st.max_failcount = 1;
+	p.set_max_failcount(&st);
+	TEST_EQUAL(p.num_connect_candidates(), 50);
+	TEST_EQUAL(p.num_cold_peers(), 50);
+	TEST_EQUAL(st.erased.size(), 50);
+	st.erased.clear();
+
+	// and once we're finished, so are the seeds
+	st.is_finished = true;
+	p.connect_one_peer(0, &st);
+	TEST_EQUAL(p.num_connect_candidates(), 25);
+	TEST_EQUAL(p.num_cold_peers(), 75);
+	TEST_EQUAL(p.num_seeds(), 25);
+	TEST_EQUAL(p.num_peers(), 100);
+	st.erased.clear();
+
+	// when the rules are relaxed again, all of them are connect candidates
+	// again, and need to be torrent_peers
+	st.is_finished = false;
+	st.max_failcount = 3;
+	p.set_max_failcount(&st);
+	TEST_EQUAL(p.num_connect_candidates(), 100);
+	TEST_EQUAL(p.num_cold_peers(), 0);
+	TEST_EQUAL(p.num_seeds(), 25);
+	TEST_EQUAL(p.num_peers(), 100);
+	TEST_EQUAL(st.erased.size(), 0);
+}
+
+TORRENT_TEST(cold_peers_filter)
+{
+	torrent_state st = init_state();
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	for (int i = 0; i < 20; ++i)
+	{
+		torrent_peer* peer = add_peer(p, st, tcp::endpoint(
+			address_v4((10 << 24) + i), std::uint16_t(i + 1000)));
+		if (i < 10) p.set_failcount(peer, 3);
+	}
+	p.connect_one_peer(0, &st);
+	st.erased.clear();
+	TEST_EQUAL(p.num_cold_peers(), 10);
+
+	// filter out 10.0.0.5 - 10.0.0.14, half of which are cold
+	ip_filter filter;
+	filter.add_rule(addr4("10.0.0.5"), addr4("10.0.0.14"), ip_filter::blocked);
+	std::vector<address> banned;
+	p.apply_ip_filter(filter, &st, banned);
+	TEST_EQUAL(p.num_peers(), 10);
+	TEST_EQUAL(p.num_cold_peers(), 5);
+	TEST_EQUAL(p.num_connect_candidates(), 5);
+	// only torrent_peer objects are reported as erased
+	TEST_EQUAL(st.erased.size(), 5);
+	st.erased.clear();
+
+	port_filter pf;
+	pf.add_rule(1000, 1001, port_filter::blocked);
+	p.apply_port_filter(pf, &st, banned);
+	TEST_EQUAL(p.num_peers(), 8);
+	TEST_EQUAL(p.num_cold_peers(), 3);
+	TEST_EQUAL(st.erased.size(), 0);
+}
+
+// when the peer list is full, cold peers are erased first
+TORRENT_TEST(cold_peers_erase)
+{
+	torrent_state st = init_state();
+	st.max_peerlist_size = 100;
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	for (int i = 0; i < 100; ++i)
+	{
+		torrent_peer* peer = add_peer(p, st, tcp::endpoint(
+			address_v4((10 << 24) + i), std::uint16_t(i + 1000)));
+		if (i < 20) p.set_failcount(peer, 3);
+	}
+	// every call to connect_one_peer() weeds through a few peers
+	for (int i = 0; i < 10; ++i) p.connect_one_peer(0, &st);
+	st.erased.clear();
+	TEST_EQUAL(p.num_cold_peers(), 20);
+	TEST_EQUAL(p.num_connect_candidates(), 80);
+
+	for (int i = 0; i < 10; ++i)
+	{
+		torrent_peer* peer = p.add_peer(tcp::endpoint(
+			address_v4((11 << 24) + i), std::uint16_t(i + 1000)), {}, 0, &st);
+		TEST_CHECK(peer != nullptr);
+	}
+	TEST_EQUAL(p.num_peers(), 100);
+	TEST_EQUAL(p.num_cold_peers(), 10);
+	TEST_EQUAL(p.num_connect_candidates(), 90);
+	TEST_EQUAL(st.erased.size(), 0);
+}
+
+// connect candidates are handed out best first, which primarily means lowest
+// failcount
+TORRENT_TEST(connect_candidate_order)
+{
+	torrent_state st = init_state();
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	for (int i = 0; i < 30; ++i)
+	{
+		torrent_peer* peer = add_peer(p, st, tcp::endpoint(
+			address_v4((10 << 24) + i), std::uint16_t(i + 1000)));
+		p.set_failcount(peer, i % 3);
+	}
+	TEST_EQUAL(p.num_connect_candidates(), 30);
+
+	int last_failcount = 0;
+	for (int i = 0; i < 30; ++i)
+	{
+		torrent_peer* tp = p.connect_one_peer(0, &st);
+		TEST_CHECK(tp != nullptr);
+		if (tp == nullptr) break;
+		TEST_CHECK(int(tp->failcount) >= last_failcount);
+		last_failcount = tp->failcount;
+		t.connect_to_peer(tp);
+		TEST_EQUAL(p.num_connect_candidates(), 29 - i);
+	}
+	TEST_CHECK(p.connect_one_peer(0, &st) == nullptr);
+}
+
+// changing the failcount of a candidate moves it in the candidate heap
+TORRENT_TEST(connect_candidate_update)
+{
+	torrent_state st = init_state();
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	torrent_peer* peer1 = add_peer(p, st, ep("10.0.0.1", 4000));
+	torrent_peer* peer2 = add_peer(p, st, ep("10.0.0.2", 4000));
+	torrent_peer* peer3 = add_peer(p, st, ep("10.0.0.3", 4000));
+	p.set_failcount(peer1, 2);
+	p.set_failcount(peer2, 1);
+
+	TEST_EQUAL(p.connect_one_peer(0, &st), peer3);
+
+	// peer3 was handed out, but not connected to. Now peer1 is the best
+	// candidate
+	p.set_failcount(peer1, 0);
+	TEST_EQUAL(p.connect_one_peer(0, &st), peer1);
+	TEST_EQUAL(p.connect_one_peer(0, &st), peer2);
+
+	// peer2 has reached the max failcount
+	p.inc_failcount(peer2);
+	p.inc_failcount(peer2);
+	TEST_EQUAL(p.num_connect_candidates(), 2);
+}
+
+// peers that have been tried recently are not handed out again until their
+// reconnect time has passed
+TORRENT_TEST(connect_candidate_reconnect_time)
+{
+	torrent_state st = init_state();
+	st.min_reconnect_time = 60;
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	torrent_peer* peer1 = add_peer(p, st, ep("10.0.0.1", 4000));
+	torrent_peer* tp = p.connect_one_peer(100, &st);
+	TEST_EQUAL(tp, peer1);
+
+	// the connection attempt failed
+	tp->last_connected = 100;
+	p.inc_failcount(tp);
+	TEST_EQUAL(p.num_connect_candidates(), 1);
+
+	// the reconnect time is 60 seconds per failure (plus one)
+	TEST_CHECK(p.connect_one_peer(200, &st) == nullptr);
+
+	torrent_peer* peer2 = add_peer(p, st, ep("10.0.0.2", 4000));
+	TEST_EQUAL(p.connect_one_peer(200, &st), peer2);
+	TEST_CHECK(p.connect_one_peer(219, &st) == nullptr);
+	TEST_EQUAL(p.connect_one_peer(220, &st), peer1);
+	TEST_EQUAL(p.num_connect_candidates(), 2);
+
+	// when leaving upload mode, all peers can be connected to right away
+	p.clear_last_connected();
+	TEST_CHECK(p.connect_one_peer(221, &st) != nullptr);
+	TEST_CHECK(p.connect_one_peer(221, &st) != nullptr);
+	TEST_CHECK(p.connect_one_peer(221, &st) == nullptr);
+}
+
+// picking a candidate doesn't scan the peer list
+TORRENT_TEST(connect_candidate_loops)
+{
+	torrent_state st = init_state();
+	mock_torrent t(&st);
+	peer_list p(allocator);
+	t.m_p = &p;
+
+	for (int i = 0; i < 500; ++i)
+	{
+		add_peer(p, st, tcp::endpoint(
+			address_v4((10 << 24) + i), std::uint16_t(i + 1000)));
+	}
+
+	for (int i = 0; i < 20; ++i)
+	{
+		st.loop_counter = 0;
+		st.loops_saved = 0;
+		torrent_peer* tp = p.connect_one_peer(0, &st);
+		TEST_CHECK(tp != nullptr);
+		if (tp == nullptr) break;
+		t.connect_to_peer(tp);
+		TEST_CHECK(st.loop_counter <= 10);
+		TEST_CHECK(st.loops_saved > 0);
+	}
+	TEST_EQUAL(p.num_connect_candidates(), 480);
+}
+
+TORRENT_TEST(cold_peer_table)
+{
+	// compare against a reference, with lots of insertions and removals to
+	// exercise the backward shift deletion
+	aux::cold_peer_table<std::uint32_t> table;
+	std::multimap<std::uint32_t, std::uint16_t> ref;
+
+	for (int round = 0; round < 20000; ++round)
+	{
+		// a small key space, to get plenty of duplicate addresses
+		std::uint32_t const a = random(400);
+		std::uint16_t const port = std::uint16_t(random(3));
+		if (random(2) == 0)
+		{
+			aux::cold_peer4* c = table.find(a, port);
+			auto r = ref.equal_range(a);
+			auto const i = std::find_if(r.first, r.second
+				, [=](std::pair<std::uint32_t const, std::uint16_t> const& e) { return e.second == port; });
+			TEST_EQUAL(c != nullptr, i != r.second);
+			if (c == nullptr) continue;
+			table.erase(c);
+			ref.erase(i);
+		}
+		else if (table.find(a, port) == nullptr)
+		{
+			aux::cold_peer4& c = table.insert(a);
+			c.port = port;
+			ref.insert(std::make_pair(a, port));
+		}
+		TEST_EQUAL(table.size(), int(ref.size()));
+	}
+
+	for (auto const& e : ref)
+		TEST_CHECK(table.find(e.first, e.second) != nullptr);
+
+	table.erase_if([](aux::cold_peer4 const& c) { return c.port == 1; });
+	for (auto i = ref.begin(); i != ref.end();)
+	{
+		if (i->second == 1) i = ref.erase(i);
+		else ++i;
+	}
+	TEST_EQUAL(table.size(), int(ref.size()));
+	int found = 0;
+	table.for_each([&](aux::cold_peer4 const& c)
+	{
+		++found;
+		TEST_CHECK(c.port != 1);
+	});
+	TEST_EQUAL(found, int(ref.size()));
+	for (auto const& e : ref)
+		TEST_CHECK(table.find(e.first, e.second) != nullptr);
+}
+
+TORRENT_TEST(cold_peer_memory)
+{
+	// the max_peerlist_size of a popular torrent
+	int const num_peers = 4000;
+	torrent_peer_allocator alloc;
+	torrent_state st = init_state();
+	st.max_peerlist_size = num_peers;
+	peer_list p(alloc);
+
+	for (int i = 0; i < num_peers; ++i)
+	{
+		torrent_peer* peer = p.add_peer(tcp::endpoint(rand_v4(), 1000), {}, 0, &st);
+		if (peer == nullptr) continue;
+		p.inc_failcount(peer);
+	}
+	int const n = p.num_peers();
+	int const hot_bytes = alloc.live_bytes();
+
+	st.max_failcount = 1;
+	p.set_max_failcount(&st);
+	TEST_EQUAL(p.num_cold_peers(), n);
+	TEST_EQUAL(alloc.live_bytes(), 0);
+
+	aux::cold_peer_table<std::uint32_t> table;
+	for (int i = 0; i < n; ++i) table.insert(std::uint32_t(i));
+
+	std::printf("bytes per peer: torrent_peer: %d (+%d list entry) cold: %d (record: %d)\n"
+		, hot_bytes / n, int(sizeof(torrent_peer*))
+		, int(table.memory_usage() / std::size_t(n)), int(sizeof(aux::cold_peer4)));
+
+	TEST_CHECK(sizeof(aux::cold_peer4) <= 16);
+#if TORRENT_USE_IPV6
+	TEST_CHECK(sizeof(aux::cold_peer6) <= 28);
+#endif
+}
+
 // TODO: test erasing peers
 // TODO: test update_peer_port with allow_multiple_connections_per_ip and without
 // TODO: test add i2p peers
@@ -34,6 +34,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "test_utils.hpp"
 
 #include <vector>
+#include <cstdio>
+#include <limits>
 
 #include "libtorrent/entry.hpp"
 #include "libtorrent/torrent_info.hpp"
@@ -42,6 +44,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/add_torrent_params.hpp"
 #include "libtorrent/read_resume_data.hpp"
+#include "libtorrent/write_resume_data.hpp"
+#include "libtorrent/time.hpp"
+#include "libtorrent/aux_/resume_data_binary.hpp"
+#include "libtorrent/io.hpp"
+
+#include "libtorrent/aux_/disable_warnings_push.hpp"
+#include <boost/crc.hpp>
+#include "libtorrent/aux_/disable_warnings_pop.hpp"
 
 using namespace lt;
 
@@ -218,3 +228,488 @@ TORRENT_TEST(read_resume_torrent)
 	TEST_EQUAL(atp.ti->info_hash(), ti->info_hash());
 	TEST_EQUAL(atp.ti->name(), ti->name());
 }
+
+TORRENT_TEST(write_resume_data_buf_matches_entry)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+
+	add_torrent_params atp;
+	atp.ti = ti;
+	atp.info_hash = ti->info_hash();
+	atp.save_path = "/foo/bar";
+	atp.total_uploaded = 1337;
+	atp.total_downloaded = 1338;
+	atp.active_time = 1339;
+	atp.seeding_time = 1340;
+	atp.finished_time = 1352;
+	atp.added_time = 1347;
+	atp.completed_time = 1348;
+	atp.last_seen_complete = 1349;
+	atp.num_complete = 1341;
+	atp.num_incomplete = 1342;
+	atp.num_downloaded = 1343;
+	atp.upload_limit = 1344;
+	atp.download_limit = 1345;
+	atp.max_connections = 1346;
+	atp.flags = torrent_flags::seed_mode | torrent_flags::paused
+		| torrent_flags::sequential_download;
+
+	atp.trackers.push_back("http://tracker-b.com/announce");
+	atp.trackers.push_back("http://tracker-a.com/announce");
+	atp.trackers.push_back("http://tracker-c.com/announce");
+	atp.trackers.push_back("http://tracker-d.com/announce");
+	atp.tracker_tiers.push_back(2);
+	atp.tracker_tiers.push_back(0);
+	atp.tracker_tiers.push_back(2);
+
+	atp.url_seeds.push_back("http://url-seed.com/");
+	atp.http_seeds.push_back("http://http-seed.com/");
+
+	atp.peers.push_back(tcp::endpoint(address::from_string("1.2.3.4"), 6881));
+	atp.peers.push_back(tcp::endpoint(address::from_string("10.0.0.1"), 1337));
+#if TORRENT_USE_IPV6
+	atp.peers.push_back(tcp::endpoint(address::from_string("::1"), 6882));
+	atp.banned_peers.push_back(tcp::endpoint(address::from_string("2001::1"), 4000));
+#endif
+	atp.banned_peers.push_back(tcp::endpoint(address::from_string("4.3.2.1"), 6000));
+
+	atp.have_pieces.resize(10);
+	atp.have_pieces.set_bit(piece_index_t(1));
+	atp.have_pieces.set_bit(piece_index_t(7));
+	atp.verified_pieces.resize(12);
+	atp.verified_pieces.set_bit(piece_index_t(7));
+	atp.verified_pieces.set_bit(piece_index_t(11));
+
+	atp.unfinished_pieces[piece_index_t(3)].resize(8, false);
+	atp.unfinished_pieces[piece_index_t(3)].set_bit(2);
+	atp.unfinished_pieces[piece_index_t(5)].resize(8, true);
+
+	atp.renamed_files[file_index_t(1)] = "renamed_1";
+	atp.renamed_files[file_index_t(4)] = "renamed_4";
+
+	atp.file_priorities.push_back(low_priority);
+	atp.file_priorities.push_back(top_priority);
+	atp.piece_priorities.push_back(dont_download);
+	atp.piece_priorities.push_back(default_priority);
+
+	atp.merkle_tree.resize(3);
+	atp.merkle_tree[1][0] = 1;
+
+	file_snapshot f;
+	f.size = 1234;
+	f.mtime = 1500000000;
+	f.inode = 0xfedcba9876543210ULL;
+	atp.file_snapshots.push_back(f);
+	atp.file_snapshots.push_back(file_snapshot());
+
+	std::vector<char> expected;
+	bencode(std::back_inserter(expected), write_resume_data(atp));
+	std::vector<char> const buf = write_resume_data_buf(atp);
+	TEST_CHECK(buf == expected);
+
+	error_code ec;
+	add_torrent_params const rd = read_resume_data(buf, ec);
+	TEST_CHECK(!ec);
+	TEST_EQUAL(rd.info_hash, ti->info_hash());
+	TEST_EQUAL(rd.trackers.size(), 4);
+	TEST_EQUAL(rd.trackers[0], "http://tracker-a.com/announce");
+	TEST_EQUAL(rd.tracker_tiers[0], 0);
+	TEST_EQUAL(rd.renamed_files.size(), 2);
+	TEST_EQUAL(rd.peers.size(), atp.peers.size());
+	TEST_CHECK(rd.file_snapshots == atp.file_snapshots);
+
+	// the minimal case, with all optional fields left empty
+	add_torrent_params empty;
+	expected.clear();
+	bencode(std::back_inserter(expected), write_resume_data(empty));
+	TEST_CHECK(write_resume_data_buf(empty) == expected);
+}
+
+TORRENT_TEST(write_resume_data_buf_benchmark)
+{
+	// saving resume data for many torrents used to build one entry tree per
+	// torrent. Make sure the streaming writer stays ahead of it
+	add_torrent_params atp;
+	atp.save_path = "/some/save/path";
+	atp.trackers.push_back("http://tracker.com/announce");
+	atp.have_pieces.resize(2000, true);
+	atp.file_priorities.resize(50, default_priority);
+	for (int i = 0; i < 50; ++i)
+		atp.peers.push_back(tcp::endpoint(address_v4(std::uint32_t(0x0a000000 + i)), 6881));
+
+	int const num_torrents = 5000;
+	std::size_t total = 0;
+
+	time_point start = clock_type::now();
+	for (int i = 0; i < num_torrents; ++i)
+	{
+		std::vector<char> buf;
+		bencode(std::back_inserter(buf), write_resume_data(atp));
+		total += buf.size();
+	}
+	time_point const mid = clock_type::now();
+	for (int i = 0; i < num_torrents; ++i)
+		total -= write_resume_data_buf(atp).size();
+	time_point const end = clock_type::now();
+
+	TEST_EQUAL(total, 0);
+	std::printf("resume data for %d torrents: entry: %d ms, writer: %d ms\n"
+		, num_torrents, int(total_milliseconds(mid - start))
+		, int(total_milliseconds(end - mid)));
+}
+
+namespace {
+
+add_torrent_params resume_params(std::shared_ptr<torrent_info> ti)
+{
+	add_torrent_params atp;
+	atp.ti = ti;
+	atp.info_hash = ti->info_hash();
+	atp.save_path = "/foo/bar";
+	atp.total_uploaded = 1337;
+	atp.total_downloaded = 1338;
+	atp.active_time = 1339;
+	atp.seeding_time = 1340;
+	atp.num_complete = 1341;
+	atp.num_incomplete = -1;
+	atp.max_uploads = 1344;
+	atp.added_time = 1347;
+	atp.flags = torrent_flags::paused | torrent_flags::sequential_download;
+	atp.trackers.push_back("http://tracker-a.com/announce");
+	atp.trackers.push_back("http://tracker-b.com/announce");
+	atp.tracker_tiers.push_back(0);
+	atp.tracker_tiers.push_back(1);
+	atp.url_seeds.push_back("http://url-seed.com/");
+	atp.peers.push_back(tcp::endpoint(address::from_string("1.2.3.4"), 6881));
+#if TORRENT_USE_IPV6
+	atp.peers.push_back(tcp::endpoint(address::from_string("2001::1"), 6882));
+#endif
+	atp.have_pieces.resize(ti->num_pieces());
+	atp.verified_pieces.resize(ti->num_pieces());
+	atp.have_pieces.set_bit(piece_index_t(2));
+	atp.unfinished_pieces[piece_index_t(3)].resize(8, false);
+	atp.unfinished_pieces[piece_index_t(3)].set_bit(5);
+	atp.renamed_files[file_index_t(1)] = "renamed_1";
+	atp.file_priorities.resize(3, default_priority);
+	atp.piece_priorities.resize(std::size_t(ti->num_pieces()), low_priority);
+	atp.file_snapshots.resize(3);
+	atp.file_snapshots[0].size = 0x4000;
+	atp.file_snapshots[0].mtime = 1500000000;
+	atp.file_snapshots[0].inode = 1337;
+	atp.file_snapshots[2].size = 10;
+	atp.file_snapshots[2].inode = 0xffffffffffffffffULL;
+	return atp;
+}
+
+bool same_bits(bitfield const& lhs, bitfield const& rhs)
+{
+	if (lhs.size() != rhs.size()) return false;
+	for (int i = 0; i < lhs.size(); ++i)
+		if (lhs.get_bit(i) != rhs.get_bit(i)) return false;
+	return true;
+}
+
+void check_equal(add_torrent_params const& lhs, add_torrent_params const& rhs)
+{
+	TEST_EQUAL(lhs.info_hash, rhs.info_hash);
+	TEST_EQUAL(lhs.save_path, rhs.save_path);
+	TEST_EQUAL(lhs.total_uploaded, rhs.total_uploaded);
+	TEST_EQUAL(lhs.total_downloaded, rhs.total_downloaded);
+	TEST_EQUAL(lhs.active_time, rhs.active_time);
+	TEST_EQUAL(lhs.seeding_time, rhs.seeding_time);
+	TEST_EQUAL(lhs.num_complete, rhs.num_complete);
+	TEST_EQUAL(lhs.num_incomplete, rhs.num_incomplete);
+	TEST_EQUAL(lhs.max_uploads, rhs.max_uploads);
+	TEST_EQUAL(lhs.added_time, rhs.added_time);
+	TEST_CHECK(lhs.trackers == rhs.trackers);
+	TEST_CHECK(lhs.tracker_tiers == rhs.tracker_tiers);
+	TEST_CHECK(lhs.url_seeds == rhs.url_seeds);
+	TEST_CHECK(lhs.peers == rhs.peers);
+	TEST_CHECK(same_bits(lhs.have_pieces, rhs.have_pieces));
+	TEST_CHECK(same_bits(lhs.verified_pieces, rhs.verified_pieces));
+	TEST_EQUAL(lhs.unfinished_pieces.size(), rhs.unfinished_pieces.size());
+	for (auto const& p : lhs.unfinished_pieces)
+	{
+		auto const it = rhs.unfinished_pieces.find(p.first);
+		TEST_CHECK(it != rhs.unfinished_pieces.end()
+			&& same_bits(p.second, it->second));
+	}
+	TEST_CHECK(lhs.renamed_files == rhs.renamed_files);
+	TEST_CHECK(lhs.file_priorities == rhs.file_priorities);
+	TEST_CHECK(lhs.piece_priorities == rhs.piece_priorities);
+	TEST_CHECK(lhs.file_snapshots == rhs.file_snapshots);
+	TEST_EQUAL(lhs.flags & (torrent_flags::paused | torrent_flags::sequential_download
+		| torrent_flags::seed_mode), rhs.flags & (torrent_flags::paused
+		| torrent_flags::sequential_download | torrent_flags::seed_mode));
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(binary_resume_round_trip)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params const atp = resume_params(ti);
+
+	std::vector<char> const buf = write_resume_data_buf(atp, resume_data_format::binary);
+
+	error_code ec;
+	add_torrent_params const rd = read_resume_data(buf, ec);
+	TEST_CHECK(!ec);
+	check_equal(rd, atp);
+	TEST_CHECK(rd.ti);
+	TEST_EQUAL(rd.ti->info_hash(), ti->info_hash());
+	TEST_CHECK(rd.flags & torrent_flags::override_trackers);
+	TEST_CHECK(rd.flags & torrent_flags::override_web_seeds);
+
+	// the binary format is smaller than the bencoded one
+	TEST_CHECK(buf.size() < write_resume_data_buf(atp).size());
+}
+
+TORRENT_TEST(binary_resume_delta)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params const base = resume_params(ti);
+	std::vector<char> log = write_resume_data_buf(base, resume_data_format::binary);
+	std::size_t const checkpoint_size = log.size();
+
+	add_torrent_params cur = base;
+	cur.total_uploaded += 100;
+	cur.active_time += 10;
+	cur.have_pieces.set_bit(piece_index_t(4));
+	cur.verified_pieces.set_bit(piece_index_t(4));
+	cur.piece_priorities[1] = top_priority;
+
+	std::vector<char> delta = write_resume_data_delta(base, cur);
+	// a delta with a few stats and piece changes should be tiny
+	TEST_CHECK(delta.size() < 64);
+	log.insert(log.end(), delta.begin(), delta.end());
+
+	add_torrent_params next = cur;
+	next.unfinished_pieces.clear();
+	next.trackers.pop_back();
+	next.tracker_tiers.pop_back();
+	next.file_priorities[0] = dont_download;
+	next.file_snapshots[0].mtime += 10;
+	next.flags |= torrent_flags::seed_mode;
+	delta = write_resume_data_delta(cur, next);
+	log.insert(log.end(), delta.begin(), delta.end());
+
+	error_code ec;
+	add_torrent_params rd = read_resume_data(log, ec);
+	TEST_CHECK(!ec);
+	// seed mode is dropped since one file isn't downloaded
+	next.flags &= ~torrent_flags::seed_mode;
+	check_equal(rd, next);
+
+	// an empty delta only carries the info-hash
+	TEST_CHECK(write_resume_data_delta(next, next).size() < 40);
+
+	// a torn append is ignored
+	std::vector<char> torn(log.begin(), log.end() - 3);
+	rd = read_resume_data(torn, ec);
+	TEST_CHECK(!ec);
+	check_equal(rd, cur);
+
+	// so is a corrupt one
+	std::vector<char> corrupt = log;
+	corrupt.back() ^= 0x55;
+	rd = read_resume_data(corrupt, ec);
+	TEST_CHECK(!ec);
+	check_equal(rd, cur);
+
+	// but the checkpoint has to be intact
+	corrupt = log;
+	corrupt[checkpoint_size - 1] ^= 0x55;
+	rd = read_resume_data(corrupt, ec);
+	TEST_EQUAL(ec, error_code(errors::invalid_file_tag));
+
+	// compacting the log produces the same state
+	ec.clear();
+	std::vector<char> const compact = write_resume_data_buf(
+		read_resume_data(log, ec), resume_data_format::binary);
+	TEST_CHECK(!ec);
+	rd = read_resume_data(compact, ec);
+	TEST_CHECK(!ec);
+	check_equal(rd, next);
+}
+
+TORRENT_TEST(binary_resume_delta_full_bitfield)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params const base = resume_params(ti);
+	add_torrent_params cur = base;
+	cur.have_pieces.set_all();
+	cur.verified_pieces.set_all();
+
+	std::vector<char> log = write_resume_data_buf(base, resume_data_format::binary);
+	std::vector<char> const delta = write_resume_data_delta(base, cur);
+	log.insert(log.end(), delta.begin(), delta.end());
+
+	error_code ec;
+	add_torrent_params const rd = read_resume_data(log, ec);
+	TEST_CHECK(!ec);
+	check_equal(rd, cur);
+}
+
+TORRENT_TEST(binary_resume_mismatching_delta)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params const base = resume_params(ti);
+	add_torrent_params other = base;
+	other.info_hash[0] ^= 1;
+
+	std::vector<char> log = write_resume_data_buf(base, resume_data_format::binary);
+	std::vector<char> const delta = aux::write_binary_resume_delta(other, other);
+	log.insert(log.end(), delta.begin(), delta.end());
+
+	error_code ec;
+	read_resume_data(log, ec);
+	TEST_EQUAL(ec, error_code(errors::mismatching_info_hash));
+}
+
+TORRENT_TEST(binary_resume_delta_remove_trackers)
+{
+	// a delta removing all trackers means the same as a checkpoint without
+	// any: the trackers from the .torrent file are used
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params const base = resume_params(ti);
+	add_torrent_params cur = base;
+	cur.trackers.clear();
+	cur.tracker_tiers.clear();
+	cur.url_seeds.clear();
+
+	std::vector<char> log = write_resume_data_buf(base, resume_data_format::binary);
+	std::vector<char> const delta = write_resume_data_delta(base, cur);
+	log.insert(log.end(), delta.begin(), delta.end());
+
+	error_code ec;
+	add_torrent_params const rd = read_resume_data(log, ec);
+	TEST_CHECK(!ec);
+	check_equal(rd, cur);
+	TEST_CHECK(!(rd.flags & torrent_flags::override_trackers));
+	TEST_CHECK(!(rd.flags & torrent_flags::override_web_seeds));
+
+	// compacting the log doesn't change that
+	add_torrent_params const compact = read_resume_data(
+		write_resume_data_buf(rd, resume_data_format::binary), ec);
+	TEST_CHECK(!ec);
+	check_equal(compact, cur);
+	TEST_EQUAL(compact.flags & (torrent_flags::override_trackers
+		| torrent_flags::override_web_seeds)
+		, rd.flags & (torrent_flags::override_trackers
+		| torrent_flags::override_web_seeds));
+}
+
+namespace {
+
+void append_varint(std::vector<char>& buf, std::uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		buf.push_back(char((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	buf.push_back(char(v));
+}
+
+// wraps ``payload`` in a record header, with a valid checksum
+std::vector<char> make_record(aux::record_kind const kind, std::vector<char> const& payload)
+{
+	std::vector<char> ret = {'L', 'T', 'R', 'B'
+		, char(aux::binary_resume_version), char(kind)};
+	ret.resize(std::size_t(aux::binary_resume_header_size));
+	boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true> crc;
+	crc.process_bytes(payload.data(), payload.size());
+	char* ptr = ret.data() + 6;
+	detail::write_uint32(std::uint32_t(payload.size()), ptr);
+	detail::write_uint32(crc.checksum(), ptr);
+	ret.insert(ret.end(), payload.begin(), payload.end());
+	return ret;
+}
+
+// a delta setting the have bit of piece 0, and of a second piece ``step``
+// pieces after it
+std::vector<char> piece_changes_delta(sha1_hash const& ih, std::uint64_t const step)
+{
+	std::vector<char> payload;
+	append_varint(payload, std::uint8_t(aux::resume_field::info_hash));
+	append_varint(payload, 20);
+	payload.insert(payload.end(), ih.begin(), ih.end());
+
+	std::vector<char> changes;
+	append_varint(changes, 2);
+	append_varint(changes, 0);
+	changes.push_back(1);
+	append_varint(changes, step);
+	changes.push_back(1);
+
+	append_varint(payload, std::uint8_t(aux::resume_field::piece_changes));
+	append_varint(payload, changes.size());
+	payload.insert(payload.end(), changes.begin(), changes.end());
+	return make_record(aux::record_kind::delta, payload);
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(binary_resume_piece_changes_out_of_range)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params const base = resume_params(ti);
+	std::vector<char> const checkpoint = write_resume_data_buf(base
+		, resume_data_format::binary);
+
+	// a well-formed delta, to make sure the record is built right
+	std::vector<char> log = checkpoint;
+	std::vector<char> delta = piece_changes_delta(base.info_hash, 3);
+	log.insert(log.end(), delta.begin(), delta.end());
+	error_code ec;
+	add_torrent_params rd = read_resume_data(log, ec);
+	TEST_CHECK(!ec);
+	TEST_CHECK(rd.have_pieces.get_bit(piece_index_t(0)));
+	TEST_CHECK(rd.have_pieces.get_bit(piece_index_t(4)));
+
+	// steps past the last piece, or large enough to wrap the index around,
+	// make the delta be ignored as a whole
+	std::uint64_t const steps[] = {
+		std::uint64_t(ti->num_pieces()) - 1
+		, std::uint64_t(1) << 63
+		, std::numeric_limits<std::uint64_t>::max()
+	};
+	for (std::uint64_t const step : steps)
+	{
+		log = checkpoint;
+		delta = piece_changes_delta(base.info_hash, step);
+		log.insert(log.end(), delta.begin(), delta.end());
+		rd = read_resume_data(log, ec);
+		TEST_CHECK(!ec);
+		check_equal(rd, base);
+	}
+}
+
+TORRENT_TEST(binary_resume_garbage)
+{
+	// make sure we don't crash on random input that happens to start with
+	// a valid record header
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	std::vector<char> const good = write_resume_data_buf(resume_params(ti)
+		, resume_data_format::binary);
+
+	for (int i = 0; i < 2000; ++i)
+	{
+		std::vector<char> buf = good;
+		for (int k = 0; k < 10; ++k)
+		{
+			std::size_t const pos = std::size_t(lt::random(std::uint32_t(buf.size() - 15))) + 14;
+			buf[pos] = char(lt::random(0xff));
+		}
+		// fix up the checksum, to get past it
+		std::size_t const len = buf.size() - 14;
+		boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true> crc;
+		crc.process_bytes(buf.data() + 14, len);
+		char* ptr = buf.data() + 10;
+		detail::write_uint32(crc.checksum(), ptr);
+
+		error_code ec;
+		read_resume_data(buf, ec);
+	}
+}
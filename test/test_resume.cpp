@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/read_resume_data.hpp"
 #include "libtorrent/write_resume_data.hpp"
+#include "libtorrent/aux_/path.hpp" // for stat_file
 #include "setup_transfer.hpp"
 
 #include "test.hpp"
@@ -1245,3 +1246,116 @@ TORRENT_TEST(paused)
 	// and trackers for instance
 }
 
+
+namespace {
+
+add_torrent_params file_snapshot_params(std::shared_ptr<torrent_info> ti)
+{
+	error_code ec;
+	create_directories(combine_path("add_torrent_params_test", "test_resume"), ec);
+	{
+		std::vector<char> a(128 * 1024 * 8);
+		std::vector<char> b(128 * 1024);
+		std::ofstream("add_torrent_params_test/test_resume/tmp1").write(a.data(), a.size());
+		std::ofstream("add_torrent_params_test/test_resume/tmp2").write(b.data(), b.size());
+		std::ofstream("add_torrent_params_test/test_resume/tmp3").write(b.data(), b.size());
+	}
+
+	add_torrent_params p;
+	p.ti = ti;
+	p.save_path = "add_torrent_params_test";
+	p.have_pieces.resize(ti->num_pieces(), true);
+	return p;
+}
+
+settings_pack file_snapshot_settings()
+{
+	settings_pack pack = settings();
+	pack.set_bool(settings_pack::resume_file_snapshots, true);
+	return pack;
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(file_snapshots_pending_writes)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params p = file_snapshot_params(ti);
+
+	// we have everything but the last piece, which is in tmp3
+	p.have_pieces.clear_bit(ti->last_piece());
+
+	lt::session ses(file_snapshot_settings());
+	torrent_handle h = ses.add_torrent(p);
+
+	wait_for_alert(ses, torrent_checked_alert::alert_type, "file_snapshots_pending_writes");
+
+	// write to tmp3 and save resume data right away, while the write may still
+	// be queued. tmp3 is about to change, so it must not be in the snapshot
+	std::vector<char> piece(std::size_t(ti->piece_size(ti->last_piece())), 'a');
+	h.add_piece(ti->last_piece(), piece.data());
+	h.save_resume_data();
+
+	alert const* a = wait_for_alert(ses, save_resume_data_alert::alert_type
+		, "file_snapshots_pending_writes");
+	save_resume_data_alert const* ra = alert_cast<save_resume_data_alert>(a);
+	TEST_CHECK(ra);
+	if (ra == nullptr) return;
+
+	auto const& s = ra->params.file_snapshots;
+	TEST_EQUAL(s.size(), 3);
+	if (s.size() != 3) return;
+	TEST_EQUAL(s[0].size, 128 * 1024 * 8);
+	TEST_EQUAL(s[1].size, 128 * 1024);
+	TEST_EQUAL(s[2].size, -1);
+}
+
+TORRENT_TEST(file_snapshots_mismatch)
+{
+	std::shared_ptr<torrent_info> ti = generate_torrent();
+	add_torrent_params p = file_snapshot_params(ti);
+
+	file_storage const& fs = ti->files();
+	for (file_index_t i(0); i < fs.end_file(); ++i)
+	{
+		error_code ec;
+		file_status st;
+		stat_file(fs.file_path(i, p.save_path), &st, ec);
+		TEST_CHECK(!ec);
+		file_snapshot f;
+		f.size = st.file_size;
+		f.mtime = std::int64_t(st.mtime);
+		f.inode = st.inode;
+		p.file_snapshots.push_back(f);
+	}
+
+	// pretend tmp2 was modified after the resume data was saved
+	p.file_snapshots[1].mtime -= 10;
+
+	lt::session ses(file_snapshot_settings());
+	torrent_handle h = ses.add_torrent(p);
+
+	wait_for_alert(ses, torrent_checked_alert::alert_type, "file_snapshots_mismatch");
+	TEST_CHECK(h.status().is_seeding);
+
+	// reading the piece in tmp2 opens the file, which finds that it changed
+	piece_index_t const piece(8);
+	h.read_piece(piece);
+	alert const* a = wait_for_alert(ses, read_piece_alert::alert_type
+		, "file_snapshots_mismatch");
+	read_piece_alert const* rp = alert_cast<read_piece_alert>(a);
+	TEST_CHECK(rp);
+	if (rp) TEST_EQUAL(rp->error, error_code(errors::mismatching_file_timestamp));
+
+	// instead of failing the torrent, the piece is checked again. The piece
+	// hashes are random, so it fails
+	a = wait_for_alert(ses, hash_failed_alert::alert_type, "file_snapshots_mismatch");
+	TEST_CHECK(a);
+
+	torrent_status const st = h.status();
+	TEST_CHECK(!st.errc);
+	TEST_CHECK(!st.is_seeding);
+	TEST_EQUAL(st.pieces[piece_index_t(0)], true);
+	TEST_EQUAL(st.pieces[piece], false);
+	TEST_EQUAL(st.pieces[piece_index_t(9)], true);
+}
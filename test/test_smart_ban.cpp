@@ -0,0 +1,194 @@
+/*
+
+Copyright (c) 2018, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/aux_/smart_ban_table.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/torrent_peer.hpp"
+#include "libtorrent/address.hpp"
+#include "test.hpp"
+
+#include <vector>
+
+using namespace lt;
+
+namespace {
+
+	ipv4_peer make_peer(char const* ip)
+	{
+		return ipv4_peer(tcp::endpoint(address_v4::from_string(ip), 6881)
+			, true, peer_source_flags_t{});
+	}
+
+	std::vector<aux::smart_ban_mismatch> record(aux::smart_ban_table& t
+		, int const piece, std::vector<aux::smart_ban_block> const& blocks
+		, std::int64_t const limit = 1024 * 1024)
+	{
+		std::vector<aux::smart_ban_mismatch> ret;
+		t.record_failed(piece_index_t(piece), blocks, limit, ret);
+		return ret;
+	}
+}
+
+// a peer that sent a block of a failed piece is found out once the piece
+// passes, and the fingerprint of its block is compared with the good one
+TORRENT_TEST(smart_ban_piece_passed)
+{
+	counters cnt;
+	aux::smart_ban_table t(cnt);
+	ipv4_peer a = make_peer("10.0.0.1");
+	ipv4_peer b = make_peer("10.0.0.2");
+
+	// block 1 (sent by b) was bad
+	TEST_CHECK(record(t, 5, {{&a, 100}, {&b, 666}, {nullptr, 0}, {&a, 103}}).empty());
+	TEST_EQUAL(t.num_pieces(), 1);
+
+	// other pieces passing don't affect it
+	TEST_CHECK(t.piece_passed(piece_index_t(4)).empty());
+	TEST_EQUAL(t.num_pieces(), 1);
+
+	std::vector<aux::block_fingerprint> const good = {100, 101, 102, 103};
+	std::vector<aux::smart_ban_block> const blocks = t.piece_passed(piece_index_t(5));
+	TEST_EQUAL(int(blocks.size()), 4);
+
+	// these are the peers the plugin bans
+	std::vector<torrent_peer*> bad;
+	for (std::size_t i = 0; i < blocks.size(); ++i)
+	{
+		if (blocks[i].peer == nullptr) continue;
+		if (blocks[i].fingerprint != good[i]) bad.push_back(blocks[i].peer);
+	}
+	TEST_EQUAL(int(bad.size()), 1);
+	TEST_CHECK(bad[0] == &b);
+
+	// the piece is forgotten once it passed
+	TEST_EQUAL(t.num_pieces(), 0);
+	TEST_CHECK(t.piece_passed(piece_index_t(5)).empty());
+}
+
+// if a piece fails again, a peer sending a block with different contents than
+// the first time sent bad data at least once
+TORRENT_TEST(smart_ban_failed_twice)
+{
+	counters cnt;
+	aux::smart_ban_table t(cnt);
+	ipv4_peer a = make_peer("10.0.0.1");
+	ipv4_peer b = make_peer("10.0.0.2");
+	ipv4_peer c = make_peer("10.0.0.3");
+
+	TEST_CHECK(record(t, 0, {{&a, 100}, {&b, 101}, {nullptr, 0}}).empty());
+
+	// a sends block 0 with different contents. b sends the same block 1. c
+	// sends block 0 as well, but only the first peer to send it is recorded,
+	// and c's block 2 fills in the empty slot
+	auto const m = record(t, 0, {{&a, 200}, {&b, 101}, {&c, 302}});
+	TEST_EQUAL(int(m.size()), 1);
+	TEST_EQUAL(m[0].block, 0);
+	TEST_EQUAL(m[0].recorded, 100);
+
+	auto const m2 = record(t, 0, {{&c, 300}, {nullptr, 0}, {&c, 302}});
+	TEST_CHECK(m2.empty());
+
+	std::vector<aux::smart_ban_block> const blocks = t.piece_passed(piece_index_t(0));
+	TEST_EQUAL(int(blocks.size()), 3);
+	TEST_CHECK(blocks[0].peer == &a);
+	TEST_EQUAL(blocks[0].fingerprint, 100);
+	TEST_CHECK(blocks[1].peer == &b);
+	TEST_CHECK(blocks[2].peer == &c);
+	TEST_EQUAL(blocks[2].fingerprint, 302);
+}
+
+// when the memory limit is exceeded, the pieces that failed the longest time
+// ago are forgotten, regardless of their index
+TORRENT_TEST(smart_ban_memory_limit)
+{
+	counters cnt;
+	aux::smart_ban_table t(cnt);
+	ipv4_peer a = make_peer("10.0.0.1");
+	std::vector<aux::smart_ban_block> const blocks(16, aux::smart_ban_block{&a, 1});
+
+	record(t, 0, blocks);
+	std::int64_t const piece_size = t.memory();
+	TEST_CHECK(piece_size > 0);
+	t.clear();
+
+	// room for three pieces
+	std::int64_t const limit = piece_size * 3 + piece_size / 2;
+	int const order[] = {9, 3, 7, 1, 8, 0, 6, 2};
+	for (int const p : order)
+	{
+		record(t, p, blocks, limit);
+		TEST_CHECK(t.memory() <= limit);
+	}
+	TEST_EQUAL(t.num_pieces(), 3);
+	TEST_EQUAL(cnt[counters::smart_ban_evicted_pieces], 5);
+
+	// the last three pieces are the ones left
+	for (int const p : {9, 3, 7, 1, 8})
+		TEST_CHECK(t.piece_passed(piece_index_t(p)).empty());
+	for (int const p : {0, 6, 2})
+		TEST_EQUAL(int(t.piece_passed(piece_index_t(p)).size()), 16);
+	TEST_EQUAL(t.num_pieces(), 0);
+
+	// a limit of 0 doesn't even keep the piece just recorded
+	record(t, 4, blocks, 0);
+	TEST_EQUAL(t.num_pieces(), 0);
+	TEST_EQUAL(t.memory(), 0);
+}
+
+// the smart_ban_memory gauge tracks the memory used by the table, and goes
+// back to 0 once it's gone
+TORRENT_TEST(smart_ban_memory_gauge)
+{
+	counters cnt;
+	ipv4_peer a = make_peer("10.0.0.1");
+	std::vector<aux::smart_ban_block> const blocks(16, aux::smart_ban_block{&a, 1});
+	{
+		aux::smart_ban_table t1(cnt);
+		aux::smart_ban_table t2(cnt);
+		for (int i = 0; i < 10; ++i)
+		{
+			record(t1, i, blocks);
+			record(t2, i * 2, blocks);
+		}
+		TEST_CHECK(t1.memory() > 0);
+		TEST_EQUAL(cnt[counters::smart_ban_memory], t1.memory() + t2.memory());
+
+		t1.piece_passed(piece_index_t(3));
+		TEST_EQUAL(cnt[counters::smart_ban_memory], t1.memory() + t2.memory());
+
+		t2.clear();
+		TEST_EQUAL(t2.memory(), 0);
+		TEST_EQUAL(cnt[counters::smart_ban_memory], t1.memory());
+		record(t2, 1, blocks);
+	}
+	TEST_EQUAL(cnt[counters::smart_ban_memory], 0);
+}
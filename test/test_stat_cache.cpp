@@ -32,6 +32,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/stat_cache.hpp"
 #include "libtorrent/error_code.hpp"
+#include "libtorrent/aux_/path.hpp"
 #include "test.hpp"
 
 using namespace lt;
@@ -85,3 +86,87 @@ TORRENT_TEST(stat_cache)
 	TEST_CHECK(!ec);
 }
 
+
+TORRENT_TEST(stat_cache_snapshot)
+{
+	error_code ec;
+
+	stat_cache sc;
+
+	file_storage fs;
+	for (int i = 0; i < 4; ++i)
+	{
+		char buf[50];
+		std::snprintf(buf, sizeof(buf), "test_torrent/does-not-exist-%d", i);
+		fs.add_file(buf, (i + 1) * 10);
+	}
+
+	std::string save_path = ".";
+
+	// nothing is known yet
+	TEST_CHECK(sc.snapshot(fs.num_files()).empty());
+
+	std::vector<file_snapshot> snap(4);
+	snap[0].size = 10;
+	snap[0].mtime = 1000;
+	snap[0].inode = 1;
+	snap[2].size = 30;
+	snap[2].mtime = 3000;
+	snap[2].inode = 3;
+	sc.reserve(fs.num_files());
+	sc.load_snapshot(snap);
+
+	// the snapshot is trusted, these files don't exist
+	TEST_EQUAL(sc.get_filesize(file_index_t(0), fs, save_path, ec), 10);
+	TEST_CHECK(!ec);
+	TEST_EQUAL(sc.get_filesize(file_index_t(2), fs, save_path, ec), 30);
+	TEST_CHECK(!ec);
+	TEST_CHECK(sc.needs_check(file_index_t(0)));
+	TEST_CHECK(!sc.needs_check(file_index_t(1)));
+
+	// files without a snapshot entry are stat()ed
+	TEST_EQUAL(sc.get_filesize(file_index_t(1), fs, save_path, ec), stat_cache::file_error);
+	TEST_CHECK(ec);
+	ec.clear();
+
+	TEST_CHECK(sc.snapshot(fs.num_files()) == snap);
+
+	// matching file
+	file_status st;
+	st.file_size = 10;
+	st.mtime = 1000;
+	st.inode = 1;
+	sc.check_snapshot(file_index_t(0), st, ec);
+	TEST_CHECK(!ec);
+	TEST_CHECK(!sc.needs_check(file_index_t(0)));
+
+	// a file that was modified
+	st.file_size = 30;
+	st.mtime = 3001;
+	st.inode = 3;
+	sc.check_snapshot(file_index_t(2), st, ec);
+	TEST_EQUAL(ec, error_code(errors::mismatching_file_timestamp));
+	ec.clear();
+	TEST_CHECK(!sc.needs_check(file_index_t(2)));
+	// and it's only reported once, the cache now reflects the file
+	sc.check_snapshot(file_index_t(2), st, ec);
+	TEST_CHECK(!ec);
+	TEST_EQUAL(sc.snapshot(fs.num_files())[2].mtime, 3001);
+
+	// a file whose size changed
+	sc.load_snapshot(snap);
+	st.file_size = 31;
+	sc.check_snapshot(file_index_t(2), st, ec);
+	TEST_EQUAL(ec, error_code(errors::mismatching_file_size));
+	ec.clear();
+
+	// written files drop out of the snapshot
+	sc.set_dirty(file_index_t(0));
+	TEST_CHECK(!sc.needs_check(file_index_t(0)));
+	TEST_EQUAL(sc.snapshot(fs.num_files())[0].size, -1);
+
+	sc.load_snapshot(snap);
+	sc.clear();
+	TEST_CHECK(!sc.needs_check(file_index_t(0)));
+	TEST_CHECK(sc.snapshot(fs.num_files()).empty());
+}
@@ -49,6 +49,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <memory>
 #include <functional> // for bind
+#include <thread>
 
 #include <iostream>
 #include <fstream>
@@ -1501,3 +1502,93 @@ TORRENT_TEST(dont_move_intermingled_files)
 	TEST_CHECK(!exists(combine_path(test_path, combine_path("temp_storage"
 		, combine_path("_folder3", "alien_folder1")))));
 }
+
+TORRENT_TEST(file_pool_evict_and_prefetch)
+{
+	std::string const test_path = combine_path(current_working_directory(), "temp_pool");
+	delete_dirs(test_path);
+	error_code ec;
+	create_directory(test_path, ec);
+
+	file_storage fs;
+	for (int i = 0; i < 4; ++i)
+		fs.add_file(combine_path("temp_pool", "test" + std::to_string(i)), 0x4000);
+
+	file_pool fp(2);
+	storage_index_t const st{0};
+	for (file_index_t i(0); i < fs.end_file(); ++i)
+	{
+		auto const f = fp.open_file(st, current_working_directory(), i, fs
+			, open_mode::read_write, ec);
+		TEST_CHECK(f);
+		TEST_CHECK(!ec);
+	}
+
+	// the two least recently used files are evicted as the new ones are opened
+	std::vector<open_file_state> status = fp.get_status(st);
+	TEST_EQUAL(int(status.size()), 2);
+	TEST_EQUAL(status[0].file_index, file_index_t(2));
+	TEST_EQUAL(status[1].file_index, file_index_t(3));
+
+	// a prefetched file is opened by the pool's thread, in the background
+	fp.prefetch_file(st, current_working_directory(), file_index_t(0), fs
+		, open_mode::read_only);
+	for (int i = 0; i < 100; ++i)
+	{
+		status = fp.get_status(st);
+		if (!status.empty() && status[0].file_index == file_index_t(0)) break;
+		std::this_thread::sleep_for(lt::milliseconds(10));
+	}
+	TEST_EQUAL(int(status.size()), 2);
+	TEST_EQUAL(status[0].file_index, file_index_t(0));
+
+	// asking for it again returns the same handle, without opening the file
+	auto const f = fp.open_file(st, current_working_directory(), file_index_t(0), fs
+		, open_mode::read_only, ec);
+	TEST_CHECK(f);
+	TEST_EQUAL(int(fp.get_status(st).size()), 2);
+
+	fp.release(st);
+	TEST_CHECK(fp.get_status(st).empty());
+}
+
+// once release() returns, prefetches requested before it must neither add
+// files to the pool nor open (and possibly create) files on disk
+TORRENT_TEST(file_pool_release_cancels_prefetch)
+{
+	std::string const test_path = combine_path(current_working_directory(), "temp_pool");
+	delete_dirs(test_path);
+	error_code ec;
+	create_directory(test_path, ec);
+
+	file_storage fs;
+	for (int i = 0; i < 40; ++i)
+		fs.add_file(combine_path("temp_pool", "test" + std::to_string(i)), 0x4000);
+
+	file_pool fp(50);
+	storage_index_t const st{0};
+	for (int round = 0; round < 10; ++round)
+	{
+		for (file_index_t i(0); i < fs.end_file(); ++i)
+		{
+			fp.prefetch_file(st, current_working_directory(), i, fs
+				, open_mode::read_write);
+		}
+		fp.release(st);
+		TEST_CHECK(fp.get_status(st).empty());
+
+		std::vector<bool> created;
+		for (file_index_t i(0); i < fs.end_file(); ++i)
+			created.push_back(exists(fs.file_path(i, current_working_directory())));
+
+		std::this_thread::sleep_for(lt::milliseconds(20));
+		TEST_CHECK(fp.get_status(st).empty());
+		for (file_index_t i(0); i < fs.end_file(); ++i)
+		{
+			TEST_EQUAL(exists(fs.file_path(i, current_working_directory()))
+				, created[std::size_t(static_cast<int>(i))]);
+		}
+		delete_dirs(test_path);
+		create_directory(test_path, ec);
+	}
+}
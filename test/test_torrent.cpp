@@ -590,3 +590,64 @@ TORRENT_TEST(test_move_storage_no_metadata)
 	TEST_EQUAL(h.status().save_path, complete("save_path_1"));
 }
 
+
+TORRENT_TEST(web_seed_target_connections)
+{
+	web_seed_t w("http://example.com/file", web_seed_entry::url_seed);
+	TEST_EQUAL(w.target_connections, 1);
+	TEST_EQUAL(int(w.peers.size()), 1);
+
+	// while each added connection makes the download rate grow, we keep
+	// asking for more
+	w.update_target_connections(1, 1000, 4);
+	TEST_EQUAL(w.target_connections, 2);
+	w.update_target_connections(2, 2000, 4);
+	TEST_EQUAL(w.target_connections, 3);
+
+	// don't grow while the connections we asked for aren't up yet
+	w.update_target_connections(2, 3000, 4);
+	TEST_EQUAL(w.target_connections, 3);
+
+	w.update_target_connections(3, 4000, 4);
+	TEST_EQUAL(w.target_connections, 4);
+
+	// never more than the limit
+	w.update_target_connections(4, 5000, 4);
+	TEST_EQUAL(w.target_connections, 4);
+
+	// a flat rate leaves the count where it is
+	w.update_target_connections(4, 5100, 4);
+	TEST_EQUAL(w.target_connections, 4);
+
+	// a significant drop gives back a connection
+	w.update_target_connections(4, 3000, 4);
+	TEST_EQUAL(w.target_connections, 3);
+
+	// a lower limit takes effect right away
+	w.update_target_connections(3, 3000, 2);
+	TEST_EQUAL(w.target_connections, 2);
+}
+
+TORRENT_TEST(web_seed_free_peer)
+{
+	web_seed_t w("http://example.com/file", web_seed_entry::url_seed);
+	ipv4_peer* const first = w.free_peer();
+	TEST_CHECK(first == &w.peers.front());
+	TEST_CHECK(first->web_seed);
+	TEST_EQUAL(w.num_connections(), 0);
+	TEST_CHECK(!w.banned());
+
+	// once the first one is in use, a new entry is added
+	int dummy;
+	first->connection = reinterpret_cast<peer_connection_interface*>(&dummy);
+	ipv4_peer* const second = w.free_peer();
+	TEST_CHECK(second != first);
+	TEST_CHECK(second->web_seed);
+	TEST_EQUAL(int(w.peers.size()), 2);
+	TEST_EQUAL(w.num_connections(), 1);
+	TEST_CHECK(w.find_peer(first->connection) == first);
+
+	second->banned = true;
+	TEST_CHECK(w.banned());
+	first->connection = nullptr;
+}
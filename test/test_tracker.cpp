@@ -43,9 +43,16 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/tracker_manager.hpp"
 #include "libtorrent/http_tracker_connection.hpp" // for parse_tracker_response
 #include "libtorrent/torrent_info.hpp"
+#include "libtorrent/create_torrent.hpp"
+#include "libtorrent/bencode.hpp"
 #include "libtorrent/announce_entry.hpp"
 #include "libtorrent/torrent.hpp"
 #include "libtorrent/aux_/path.hpp"
+#include "libtorrent/aux_/session_impl.hpp" // for listen_socket_t
+#include "libtorrent/aux_/io.hpp"
+#include "libtorrent/udp_tracker_connection.hpp"
+#include "libtorrent/resolver_interface.hpp"
+#include "libtorrent/performance_counters.hpp"
 
 #include <fstream>
 
@@ -417,6 +424,308 @@ TORRENT_TEST(udp_tracker_v6)
 }
 #endif
 
+namespace {
+
+struct mock_resolver final : resolver_interface
+{
+	explicit mock_resolver(io_service& ios) : m_ios(ios) {}
+
+	void async_resolve(std::string const& host, resolver_flags
+		, callback_t const& h) override
+	{
+		++lookups;
+		error_code ec;
+		std::vector<address> const ret{address::from_string(host, ec)};
+		m_ios.post([=] { h(ec, ret); });
+	}
+
+	void abort() override {}
+	void set_cache_timeout(seconds) override {}
+
+	int lookups = 0;
+	io_service& m_ios;
+};
+
+struct mock_session_logger final : aux::session_logger
+{
+#ifndef TORRENT_DISABLE_LOGGING
+	bool should_log() const override { return false; }
+	void session_log(char const*, ...) const override {}
+#endif
+#if TORRENT_USE_ASSERTS
+	bool is_single_thread() const override { return true; }
+	bool has_peer(peer_connection const*) const override { return false; }
+	bool any_torrent_has_peer(peer_connection const*) const override { return false; }
+	bool is_posting_torrent_updates() const override { return false; }
+#endif
+};
+
+struct mock_scrape_callback final : request_callback
+{
+	void tracker_warning(tracker_request const&, std::string const&) override {}
+	void tracker_scrape_response(tracker_request const& req
+		, int const c, int const i, int const d, int) override
+	{
+		TEST_CHECK(req.info_hash == info_hash);
+		complete = c;
+		incomplete = i;
+		downloaded = d;
+		++responses;
+	}
+	void tracker_response(tracker_request const&, address const&
+		, std::list<address> const&, struct tracker_response const&) override
+	{ TEST_ERROR("unexpected announce response"); }
+	void tracker_request_error(tracker_request const& req, int
+		, error_code const& e, std::string const&, seconds32) override
+	{
+		TEST_CHECK(req.info_hash == info_hash);
+		ec = e;
+		++errors;
+	}
+#ifndef TORRENT_DISABLE_LOGGING
+	bool should_log() const override { return false; }
+	void debug_log(const char*, ...) const override {}
+#endif
+
+	sha1_hash info_hash;
+	int complete = -1;
+	int incomplete = -1;
+	int downloaded = -1;
+	int responses = 0;
+	int errors = 0;
+	error_code ec;
+};
+
+struct sent_packet
+{
+	udp::endpoint ep;
+	std::vector<char> buf;
+};
+
+std::uint32_t packet_action(sent_packet const& p)
+{
+	span<char const> b = p.buf;
+	b = b.subspan(8);
+	return aux::read_uint32(b);
+}
+
+std::uint32_t packet_transaction(sent_packet const& p)
+{
+	span<char const> b = p.buf;
+	b = b.subspan(12);
+	return aux::read_uint32(b);
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(udp_tracker_scrape_batching)
+{
+	io_service ios;
+	counters cnt;
+	aux::session_settings sett;
+	mock_resolver res(ios);
+	mock_session_logger logger;
+	std::vector<sent_packet> sent;
+
+	tracker_manager man(
+		[&](aux::listen_socket_handle const&, udp::endpoint const& ep
+			, span<char const> p, error_code&, udp_send_flags_t)
+		{ sent.push_back({ep, {p.begin(), p.end()}}); }
+		, [](aux::listen_socket_handle const&, char const*, int
+			, span<char const>, error_code&, udp_send_flags_t)
+		{ TEST_ERROR("unexpected send_hostname"); }
+		, cnt, res, sett
+#if !defined TORRENT_DISABLE_LOGGING || TORRENT_USE_ASSERTS
+		, logger
+#endif
+		);
+
+	auto sock = std::make_shared<aux::listen_socket_t>();
+	sock->local_endpoint = tcp::endpoint(address_v4::from_string("10.0.0.2"), 6881);
+
+	// one more scrape than fits in two requests
+	int const num_torrents = udp_tracker_connection::max_scrape_hashes * 2 + 1;
+	std::vector<std::shared_ptr<mock_scrape_callback>> callbacks;
+	for (int i = 0; i < num_torrents; ++i)
+	{
+		auto cb = std::make_shared<mock_scrape_callback>();
+		cb->info_hash = rand_hash();
+		callbacks.push_back(cb);
+
+		tracker_request req;
+		req.url = "udp://10.0.0.1:1337/announce";
+		req.kind = tracker_request::scrape_request;
+		req.info_hash = cb->info_hash;
+		req.outgoing_socket = sock;
+		man.queue_request(ios, req, cb);
+	}
+	ios.poll();
+
+	// all three connections resolve the hostname, but only one of them
+	// sends a connect request. The others wait for its connection ID
+	TEST_EQUAL(res.lookups, 3);
+	TEST_EQUAL(int(sent.size()), 1);
+	TEST_EQUAL(packet_action(sent[0]), 0);
+
+	char connect_response[16];
+	{
+		span<char> view = connect_response;
+		aux::write_uint32(0, view); // action: connect
+		aux::write_uint32(packet_transaction(sent[0]), view);
+		aux::write_int64(1337, view); // connection_id
+	}
+	udp::endpoint const tracker_ep = sent[0].ep;
+	TEST_EQUAL(tracker_ep, udp::endpoint(address_v4::from_string("10.0.0.1"), 1337));
+	TEST_CHECK(man.incoming_packet(tracker_ep, connect_response));
+	ios.poll();
+
+	// three multi info-hash scrape requests
+	TEST_EQUAL(int(sent.size()), 4);
+	int total_hashes = 0;
+	std::vector<char> response;
+	for (int i = 1; i < int(sent.size()); ++i)
+	{
+		sent_packet const& p = sent[std::size_t(i)];
+		TEST_EQUAL(packet_action(p), 2);
+		TEST_EQUAL((p.buf.size() - 16) % 20, 0);
+		int const num_hashes = int((p.buf.size() - 16) / 20);
+		TEST_CHECK(num_hashes <= udp_tracker_connection::max_scrape_hashes);
+		total_hashes += num_hashes;
+
+		// the first response is truncated, the two info-hashes it's missing
+		// should fail
+		int const num_stats = i == 1 ? num_hashes - 2 : num_hashes;
+
+		response.resize(8 + std::size_t(num_stats) * 12);
+		span<char> view = response;
+		aux::write_uint32(2, view); // action: scrape
+		aux::write_uint32(packet_transaction(p), view);
+		for (int k = 0; k < num_stats; ++k)
+		{
+			// encode the first byte of the info-hash in the stats, to make sure
+			// every torrent gets its own
+			int const tag = static_cast<std::uint8_t>(p.buf[std::size_t(16 + k * 20)]);
+			aux::write_int32(tag, view); // complete
+			aux::write_int32(tag + 1, view); // downloaded
+			aux::write_int32(tag + 2, view); // incomplete
+		}
+		TEST_CHECK(man.incoming_packet(tracker_ep, response));
+	}
+	ios.poll();
+	TEST_EQUAL(total_hashes, num_torrents);
+
+	int num_errors = 0;
+	for (auto const& cb : callbacks)
+	{
+		TEST_EQUAL(cb->responses + cb->errors, 1);
+		if (cb->errors)
+		{
+			TEST_EQUAL(cb->ec, error_code(errors::invalid_tracker_response_length));
+			++num_errors;
+			continue;
+		}
+		int const tag = cb->info_hash[0];
+		TEST_EQUAL(cb->complete, tag);
+		TEST_EQUAL(cb->downloaded, tag + 1);
+		TEST_EQUAL(cb->incomplete, tag + 2);
+	}
+	TEST_EQUAL(num_errors, 2);
+	TEST_CHECK(man.empty());
+
+	man.abort_all_requests(true);
+	ios.poll();
+}
+
+// announces and scrapes many torrents against the same UDP tracker and
+// reports how many requests it took
+TORRENT_TEST(udp_tracker_many_torrents)
+{
+	int const udp_port = start_udp_tracker(address_v4::from_string("127.0.0.1"));
+	int const prev_announces = num_udp_announces();
+	int const num_torrents = 100;
+
+	settings_pack pack = settings();
+	pack.set_str(settings_pack::listen_interfaces, "127.0.0.1:48875");
+	lt::session s(pack);
+
+	char tracker_url[200];
+	std::snprintf(tracker_url, sizeof(tracker_url), "udp://127.0.0.1:%d/announce", udp_port);
+
+	time_point start = clock_type::now();
+	for (int i = 0; i < num_torrents; ++i)
+	{
+		file_storage fs;
+		char name[30];
+		std::snprintf(name, sizeof(name), "temporary%d", i);
+		fs.add_file(name, 0x4000);
+		lt::create_torrent ct(fs, 0x4000);
+		ct.set_hash(piece_index_t(0), rand_hash());
+		ct.add_tracker(tracker_url);
+		std::vector<char> buf;
+		bencode(std::back_inserter(buf), ct.generate());
+
+		add_torrent_params p;
+		p.flags &= ~torrent_flags::paused;
+		p.flags &= ~torrent_flags::auto_managed;
+		p.flags |= torrent_flags::seed_mode;
+		p.ti = std::make_shared<torrent_info>(buf, from_span);
+		p.save_path = "tmp_many_torrents";
+		s.async_add_torrent(p);
+	}
+
+	std::vector<torrent_handle> handles;
+	for (int i = 0; i < 100 && num_udp_announces() < prev_announces + num_torrents; ++i)
+	{
+		std::vector<alert*> alerts;
+		s.wait_for_alert(lt::milliseconds(100));
+		s.pop_alerts(&alerts);
+		for (auto a : alerts)
+		{
+			if (auto const* at = alert_cast<add_torrent_alert>(a))
+				handles.push_back(at->handle);
+		}
+	}
+	TEST_EQUAL(num_udp_announces(), prev_announces + num_torrents);
+	TEST_EQUAL(int(handles.size()), num_torrents);
+	std::printf("announced %d torrents in %d ms. connect requests: %d\n"
+		, num_torrents, int(total_milliseconds(clock_type::now() - start))
+		, num_udp_connects());
+
+	// the connect handshake is shared by all announces (and may even have
+	// been cached by a previous test)
+	TEST_CHECK(num_udp_connects() <= 1);
+
+	start = clock_type::now();
+	for (auto const& h : handles) h.scrape_tracker();
+
+	int scrape_replies = 0;
+	for (int i = 0; i < 100 && scrape_replies < num_torrents; ++i)
+	{
+		std::vector<alert*> alerts;
+		s.wait_for_alert(lt::milliseconds(100));
+		s.pop_alerts(&alerts);
+		for (auto a : alerts)
+		{
+			if (auto const* sr = alert_cast<scrape_reply_alert>(a))
+			{
+				TEST_EQUAL(sr->complete, 1);
+				TEST_EQUAL(sr->incomplete, 2);
+				++scrape_replies;
+			}
+		}
+	}
+	TEST_EQUAL(scrape_replies, num_torrents);
+	std::printf("scraped %d torrents in %d ms. scrape requests: %d\n"
+		, num_torrents, int(total_milliseconds(clock_type::now() - start))
+		, num_udp_scrapes());
+
+	// scrapes are batched into multi info-hash requests, as long as they
+	// arrive before the first one has been sent
+	TEST_CHECK(num_udp_scrapes() < num_torrents);
+
+	stop_udp_tracker();
+}
+
 TORRENT_TEST(http_peers)
 {
 	int http_port = start_web_server();
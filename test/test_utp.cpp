@@ -38,11 +38,21 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/time.hpp"
 #include "libtorrent/aux_/path.hpp"
 #include "libtorrent/utp_stream.hpp"
+#include "libtorrent/utp_socket_manager.hpp"
+#include "libtorrent/socket_type.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/aux_/session_settings.hpp"
+#include "libtorrent/aux_/ring_buffer.hpp"
+#include "libtorrent/aux_/allocating_handler.hpp"
 #include <tuple>
 #include <functional>
+#include <cstring>
+#include <cstdio>
+#include <vector>
 
 #include "test.hpp"
 #include "setup_transfer.hpp"
+#include "allocation_counter.hpp"
 #include <fstream>
 
 using namespace lt;
@@ -150,3 +160,317 @@ TORRENT_TEST(compare_less_wrap)
 	TEST_CHECK(compare_less_wrap(0xfff0, 0x000f, 0xffff)); // wrap
 	TEST_CHECK(!compare_less_wrap(0xfff0, 0xff00, 0xffff));
 }
+
+TORRENT_TEST(ring_buffer)
+{
+	aux::ring_buffer<int> q;
+	TEST_CHECK(q.empty());
+	TEST_EQUAL(q.capacity(), 0);
+
+	for (int i = 0; i < 20; ++i) q.push_back(i);
+	TEST_EQUAL(q.size(), 20);
+	TEST_EQUAL(q.capacity(), 32);
+	TEST_EQUAL(q.front(), 0);
+	TEST_EQUAL(q[19], 19);
+
+	q.pop_front(15);
+	TEST_EQUAL(q.size(), 5);
+	TEST_EQUAL(q.front(), 15);
+
+	// wrap around the end of the storage
+	for (int i = 20; i < 45; ++i) q.push_back(i);
+	TEST_EQUAL(q.capacity(), 32);
+	for (int i = 0; i < q.size(); ++i) TEST_EQUAL(q[i], 15 + i);
+
+	// grow while wrapped
+	for (int i = 45; i < 60; ++i) q.push_back(i);
+	TEST_EQUAL(q.capacity(), 64);
+	for (int i = 0; i < q.size(); ++i) TEST_EQUAL(q[i], 15 + i);
+
+	q.clear();
+	TEST_CHECK(q.empty());
+	TEST_EQUAL(q.capacity(), 64);
+}
+
+TORRENT_TEST(static_ring)
+{
+	aux::static_ring<int, 4> q;
+	TEST_CHECK(q.empty());
+	TEST_CHECK(q.push_back(1));
+	TEST_CHECK(q.push_back(2));
+	TEST_CHECK(q.push_back(3));
+	TEST_CHECK(q.push_back(4));
+	TEST_CHECK(q.full());
+	TEST_CHECK(!q.push_back(5));
+	TEST_EQUAL(q.size(), 4);
+
+	q.pop_front(3);
+	TEST_EQUAL(q.front(), 4);
+	TEST_CHECK(q.push_back(5));
+	TEST_CHECK(q.push_back(6));
+	TEST_EQUAL(q[0], 4);
+	TEST_EQUAL(q[1], 5);
+	TEST_EQUAL(q[2], 6);
+}
+
+namespace {
+
+	struct fake_udp_socket final : utp_socket_interface
+	{
+		explicit fake_udp_socket(udp::endpoint const& ep) : m_ep(ep) {}
+		udp::endpoint local_endpoint() override { return m_ep; }
+		udp::endpoint m_ep;
+	};
+
+	// a datagram on its way from one utp_socket_manager to the other
+	struct datagram
+	{
+		utp_socket_manager* to;
+		std::weak_ptr<utp_socket_interface> sock;
+		udp::endpoint from;
+		int size;
+		char buf[1500];
+	};
+
+	// two utp_socket_managers connected back-to-back through in-memory
+	// queues, in place of a loopback UDP socket. Each round streams
+	// round_bytes from the client to the server. Every call to pump()
+	// delivers the datagrams sent by the previous one, which makes it one
+	// round-trip. The queues are allocated up-front, so that the only heap
+	// allocations counted are the ones made by the uTP code and the
+	// io_service it posts handlers to
+	struct utp_loopback : aux::error_handler_interface
+	{
+		static int const round_bytes = 2 * 1024 * 1024;
+
+		utp_loopback(int const warmup, int const measured)
+			: ep_a(address_v4::from_string("127.0.0.1"), 1024)
+			, ep_b(address_v4::from_string("127.0.0.2"), 2048)
+			, sock_a(std::make_shared<fake_udp_socket>(ep_a))
+			, sock_b(std::make_shared<fake_udp_socket>(ep_b))
+			, sm_a(send_fun(&sm_b, sock_b, ep_a), [](std::shared_ptr<socket_type> const&) {}
+				, ios, sett, cnt, nullptr)
+			, sm_b(send_fun(&sm_a, sock_a, ep_b), [this](std::shared_ptr<socket_type> const& s)
+				{ server = s; }, ios, sett, cnt, nullptr)
+			, client(ios)
+			, send_buf(std::size_t(round_bytes))
+			, recv_buf(std::size_t(round_bytes))
+			, warmup_rounds(warmup)
+			, rounds(warmup + measured)
+		{
+			in_flight.reserve(4096);
+			delivering.reserve(4096);
+			for (std::size_t i = 0; i < send_buf.size(); ++i)
+				send_buf[i] = char(i * 7);
+
+			client.set_impl(sm_a.new_utp_socket(&client));
+			utp_init_socket(client.get_impl(), sock_a);
+			utp_loopback* self = this;
+			client.async_connect(tcp::endpoint(ep_b.address(), ep_b.port())
+				, connect_handler{self});
+			post_pump();
+		}
+
+		~utp_loopback()
+		{
+			client.close();
+			if (server) server->close();
+		}
+
+		utp_socket_manager::send_fun_t send_fun(utp_socket_manager* to
+			, std::shared_ptr<utp_socket_interface> const& sock, udp::endpoint const& from)
+		{
+			return [this, to, sock, from](std::weak_ptr<utp_socket_interface>
+				, udp::endpoint const&, span<char const> buf, error_code& ec, udp_send_flags_t)
+			{
+				TORRENT_ASSERT(buf.size() <= 1500);
+				if (in_flight.size() == in_flight.capacity())
+				{
+					ec = boost::asio::error::would_block;
+					return;
+				}
+				in_flight.emplace_back();
+				datagram& d = in_flight.back();
+				d.to = to;
+				d.sock = sock;
+				d.from = from;
+				d.size = int(buf.size());
+				std::memcpy(d.buf, buf.data(), std::size_t(buf.size()));
+			};
+		}
+
+		// async_connect() may also post the handler with a second argument
+		struct connect_handler
+		{
+			utp_loopback* self;
+			void operator()(error_code const& ec) const { self->on_connect(ec); }
+			void operator()(error_code const& ec, int) const { self->on_connect(ec); }
+		};
+
+		void on_connect(error_code const& ec)
+		{
+			TEST_CHECK(!ec);
+			TEST_CHECK(server);
+			start_round();
+		}
+
+		void start_round()
+		{
+			if (round == warmup_rounds)
+			{
+				allocations_before = num_allocations();
+				start = clock_type::now();
+			}
+			else if (round == rounds)
+			{
+				allocations = num_allocations() - allocations_before;
+				end = clock_type::now();
+				done = true;
+				return;
+			}
+			written = 0;
+			received = 0;
+			write();
+			read();
+		}
+
+		void write()
+		{
+			utp_loopback* self = this;
+			client.async_write_some(boost::asio::buffer(send_buf.data() + written
+				, std::size_t(round_bytes - written))
+				, aux::make_handler([self](error_code const& ec, std::size_t const bytes)
+				{
+					TEST_CHECK(!ec);
+					self->written += int(bytes);
+					if (self->written < round_bytes) self->write();
+					else self->maybe_next_round();
+				}, write_storage, *this));
+		}
+
+		void read()
+		{
+			utp_loopback* self = this;
+			server->get<utp_stream>()->async_read_some(boost::asio::buffer(
+				recv_buf.data() + received, std::size_t(round_bytes - received))
+				, aux::make_handler([self](error_code const& ec, std::size_t const bytes)
+				{
+					TEST_CHECK(!ec);
+					self->received += int(bytes);
+					if (self->received < round_bytes) self->read();
+					else self->maybe_next_round();
+				}, read_storage, *this));
+		}
+
+		void maybe_next_round()
+		{
+			if (written < round_bytes || received < round_bytes) return;
+			if (recv_buf != send_buf) corrupt = true;
+			std::memset(recv_buf.data(), 0, recv_buf.size());
+			++round;
+			start_round();
+		}
+
+		void pump()
+		{
+			if (done || ec_failure) return;
+			in_flight.swap(delivering);
+			int to_server = 0;
+			for (datagram const& d : delivering)
+			{
+				if (d.to == &sm_b) ++to_server;
+				d.to->incoming_packet(d.sock, d.from, {d.buf, std::size_t(d.size)});
+			}
+			delivering.clear();
+			sm_a.socket_drained();
+			sm_b.socket_drained();
+			max_window = std::max(max_window, to_server);
+
+			// give up if the connection stalls
+			if (to_server == 0 && in_flight.empty() && ++idle > 100)
+			{
+				ec_failure = true;
+				return;
+			}
+			if (to_server > 0) idle = 0;
+			post_pump();
+		}
+
+		void post_pump()
+		{
+			utp_loopback* self = this;
+			ios.post(aux::make_handler([self] { self->pump(); }, pump_storage, *this));
+		}
+
+		void on_exception(std::exception const& e) override
+		{ TEST_ERROR(e.what()); ec_failure = true; }
+		void on_error(error_code const& ec) override
+		{ TEST_ERROR(ec.message()); ec_failure = true; }
+
+		io_service ios;
+		// the read and write handlers are allocated the way peer_connection
+		// does it
+		aux::handler_storage<TORRENT_READ_HANDLER_MAX_SIZE> read_storage;
+		aux::handler_storage<TORRENT_WRITE_HANDLER_MAX_SIZE> write_storage;
+		aux::handler_storage<64> pump_storage;
+		aux::session_settings sett;
+		counters cnt;
+		udp::endpoint ep_a;
+		udp::endpoint ep_b;
+		std::shared_ptr<utp_socket_interface> sock_a;
+		std::shared_ptr<utp_socket_interface> sock_b;
+		std::vector<datagram> in_flight;
+		std::vector<datagram> delivering;
+		utp_socket_manager sm_a;
+		utp_socket_manager sm_b;
+		utp_stream client;
+		std::shared_ptr<socket_type> server;
+
+		std::vector<char> send_buf;
+		std::vector<char> recv_buf;
+		int written = 0;
+		int received = 0;
+
+		int const warmup_rounds;
+		int const rounds;
+		int round = 0;
+		int idle = 0;
+		bool done = false;
+		bool corrupt = false;
+		bool ec_failure = false;
+
+		// the largest number of datagrams sent to the server in one
+		// round-trip
+		int max_window = 0;
+
+		int allocations_before = 0;
+		int allocations = 0;
+		time_point start;
+		time_point end;
+	};
+}
+
+// streams data over a real pair of uTP sockets. Once the first rounds have
+// grown the congestion window and warmed up the packet pools, the receive
+// buffers and the io_service's handler memory, the send and ACK paths are
+// not expected to allocate
+TORRENT_TEST(utp_steady_state_allocations)
+{
+	std::unique_ptr<utp_loopback> l(new utp_loopback(4, 4));
+	l->ios.run();
+
+	TEST_CHECK(l->done);
+	TEST_CHECK(!l->ec_failure);
+	TEST_CHECK(!l->corrupt);
+
+	int const packets = int(std::int64_t(l->round_bytes) * (l->rounds - l->warmup_rounds)
+		/ (TORRENT_ETHERNET_MTU - TORRENT_IPV4_HEADER - TORRENT_UDP_HEADER));
+	std::int64_t const us = std::max(std::int64_t(1), total_microseconds(l->end - l->start));
+	std::printf("%d packets in %d us (%.1f Mpackets/s), window: %d packets, heap allocations: %d\n"
+		, packets, int(us), double(packets) / double(us), l->max_window, l->allocations);
+
+	// the window has to be deep, with hundreds of full sized packets in
+	// flight, for this to exercise the packet pool's cache of them
+	TEST_CHECK(l->max_window > 128);
+	TEST_EQUAL(l->allocations, 0);
+}
@@ -55,6 +55,8 @@ struct udp_tracker
 
 	lt::io_service m_ios;
 	std::atomic<int> m_udp_announces{0};
+	std::atomic<int> m_udp_connects{0};
+	std::atomic<int> m_udp_scrapes{0};
 	udp::socket m_socket{m_ios};
 	int m_port = 0;
 	bool m_abort = false;
@@ -100,6 +102,7 @@ struct udp_tracker
 						, int(bytes_transferred));
 					return;
 				}
+				++m_udp_connects;
 				std::printf("%s: UDP connect from %s\n", time_now_string()
 					, print_endpoint(*from).c_str());
 				ptr = buffer;
@@ -160,10 +163,36 @@ struct udp_tracker
 				else std::printf("%s: UDP sent response to: %s\n"
 					, time_now_string(), print_endpoint(*from).c_str());
 				break;
-			case 2:
-				// ignore scrapes
-				std::printf("%s: UDP scrape (ignored)\n", time_now_string());
+			case 2: // scrape
+			{
+				// one 20 byte info-hash per torrent, we respond with 12 bytes of
+				// stats for each
+				int const num_hashes = int((bytes_transferred - 16) / 20);
+				if (num_hashes == 0 || 8 + num_hashes * 12 > int(size))
+				{
+					std::printf("invalid scrape message: %d Bytes\n"
+						, int(bytes_transferred));
+					return;
+				}
+
+				++m_udp_scrapes;
+				std::printf("%s: UDP scrape [%d] (%d info-hashes)\n", time_now_string()
+					, int(m_udp_scrapes), num_hashes);
+				ptr = buffer;
+				detail::write_uint32(2, ptr); // action = scrape
+				detail::write_uint32(transaction_id, ptr); // transaction_id
+				for (int i = 0; i < num_hashes; ++i)
+				{
+					detail::write_uint32(1, ptr); // complete
+					detail::write_uint32(3, ptr); // downloaded
+					detail::write_uint32(2, ptr); // incomplete
+				}
+				m_socket.send_to(boost::asio::buffer(buffer
+					, static_cast<std::size_t>(ptr - buffer)), *from, 0, e);
+				if (e) std::printf("%s: UDP send_to failed. ERROR: %s\n"
+					, time_now_string(), e.message().c_str());
 				break;
+			}
 			default:
 				std::printf("%s: UDP unknown message: %d\n", time_now_string()
 					, action);
@@ -224,6 +253,8 @@ struct udp_tracker
 	int port() const { return m_port; }
 
 	int num_hits() const { return m_udp_announces; }
+	int num_connects() const { return m_udp_connects; }
+	int num_scrapes() const { return m_udp_scrapes; }
 
 	void thread_fun()
 	{
@@ -265,6 +296,21 @@ int num_udp_announces()
 	return 0;
 }
 
+// the number of UDP tracker connect requests received
+int num_udp_connects()
+{
+	if (g_udp_tracker) return g_udp_tracker->num_connects();
+	return 0;
+}
+
+// the number of UDP tracker scrape requests received. A single request may
+// scrape many torrents
+int num_udp_scrapes()
+{
+	if (g_udp_tracker) return g_udp_tracker->num_scrapes();
+	return 0;
+}
+
 void stop_udp_tracker()
 {
 	g_udp_tracker.reset();
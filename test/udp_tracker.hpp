@@ -40,5 +40,11 @@ int EXPORT start_udp_tracker(lt::address iface
 // the number of udp tracker announces received
 int EXPORT num_udp_announces();
 
+// the number of udp tracker connect requests received
+int EXPORT num_udp_connects();
+
+// the number of udp tracker scrape requests received
+int EXPORT num_udp_scrapes();
+
 void EXPORT stop_udp_tracker();
 
@@ -2,6 +2,7 @@
 
 import BaseHTTPServer
 import SimpleHTTPServer
+import SocketServer
 import sys
 import os
 import ssl
@@ -20,8 +21,11 @@ try:
 except:
 	pass
 
-class http_server_with_timeout(BaseHTTPServer.HTTPServer):
+# serve each connection on its own thread, since web seed clients may open
+# several connections to the same server
+class http_server_with_timeout(SocketServer.ThreadingMixIn, BaseHTTPServer.HTTPServer):
 	allow_reuse_address = True
+	daemon_threads = True
 	timeout = 190
 
 	def handle_timeout(self):
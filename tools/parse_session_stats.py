@@ -312,7 +312,7 @@ reports = [
 	('peers_max', 'num', '', 'num connected peers', ['peer.num_peers_connected', 'peer.num_peers_half_open']),
 	('peer_churn', 'num', '', 'connecting and disconnecting peers', ['peer.num_peers_half_open', 'peer.connection_attempts']),
 	('new_peers', 'num', '', '', ['peer.incoming_connections', 'peer.connection_attempts']),
-	('connection_attempts', 'num', '', '', ['peer.connection_attempt_loops', 'peer.connection_attempts']),
+	('connection_attempts', 'num', '', '', ['peer.connection_attempt_loops', 'peer.connection_attempt_loops_saved', 'peer.connection_attempts']),
 	('pieces', 'num', '', 'number completed pieces', ['ses.num_total_pieces_added', 'ses.num_piece_passed', 'ses.num_piece_failed']),
 	('disk_write_queue', 'Bytes', 'B', 'bytes queued up by peers, to be written to disk', ['disk.queued_write_bytes']),
 